@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <vector>
+
+#pragma once
+
+/* Helpers shared by the bench_*.cpp programs */
+
+/* Calls to operator new, in benches linked with bench_alloc.o */
+extern std::atomic<size_t> bench_allocations;
+
+static inline uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* One result line, what failed is kept going so every check is printed */
+static inline bool check(bool ok, const char *what)
+{
+	printf("%-48s%s\n", what, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+/* The stream in a memfd at offset 0, for read(2) & mmap alike */
+static inline int stream_fd(const std::vector<uint8_t> &stream)
+{
+	int fd = memfd_create("bench", MFD_CLOEXEC);
+	if(fd < 0)
+	{
+		perror("memfd_create()");
+		return -1;
+	}
+	size_t done = 0;
+	while(done < stream.size())
+	{
+		ssize_t len = write(fd, stream.data() + done, stream.size() - done);
+		if(len <= 0)
+		{
+			perror("write()");
+			close(fd);
+			return -1;
+		}
+		done += len;
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
@@ -0,0 +1,32 @@
+/* ===================================== *
+ * bench_alloc.cpp - counting operator new	 *
+ * ===================================== */
+
+#include "bench.hpp"
+#include <stdlib.h>
+#include <new>
+
+/* Every operator new in the process, linked into the benches that check
+ * a path doesn't allocate */
+std::atomic<size_t> bench_allocations(0);
+
+void *operator new(size_t size)
+{
+	bench_allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(size > 0 ? size : 1);
+	if(p == NULL)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,530 @@
+/* ===================================== *
+ * bench_caster.cpp - NTRIP rover load	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_rtcm.hpp"
+#include "ubx_caster.hpp"
+#include "ubx_gen.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+
+using namespace UBX;
+
+/* B5 62 in front of each frame on the wire */
+constexpr size_t UBX_SYNC_SIZE = 2;
+/* Filler NAV frames per epoch, after the RAWX */
+constexpr size_t NAV_PER_EPOCH = 19;
+constexpr size_t NAV_LENGTH = 92;
+constexpr size_t RAWX_MEAS = 16;
+
+/* NAV frame carrying a sequence number, then a pattern */
+static void make_nav(vector<uint8_t> &frame, uint32_t seq)
+{
+	uint8_t payload[NAV_LENGTH];
+	memcpy(payload, &seq, sizeof(seq));
+	for(size_t i = sizeof(seq); i < NAV_LENGTH; i++)
+	{
+		payload[i] = seq + i;
+	}
+	frame.clear();
+	ubx_gen_frame(frame, UBX_CLASS_NAV, UBX_NAV_PVT, payload, NAV_LENGTH, false);
+}
+
+/* RAWX of 16 GPS L1 satellites, whole seconds so it goes through -TADJ untouched */
+static void make_rawx(vector<uint8_t> &frame, uint32_t epoch)
+{
+	uint8_t p[UBX_RXM_RAWX_HEADER_SIZE + RAWX_MEAS * UBX_RXM_RAWX_MEAS_SIZE] = {};
+	double tow = 100000.0 + epoch;
+	uint16_t week = 2300;
+	memcpy(p, &tow, sizeof(tow));
+	memcpy(p + 8, &week, sizeof(week));
+	p[10] = 18;
+	p[11] = RAWX_MEAS;
+	p[12] = 0x01;
+	p[13] = 0x01;
+	for(size_t i = 0; i < RAWX_MEAS; i++)
+	{
+		uint8_t *m = p + UBX_RXM_RAWX_HEADER_SIZE + i * UBX_RXM_RAWX_MEAS_SIZE;
+		double pr = 2.2e7 + i * 1e5 + epoch * 100.0;
+		double cp = pr / 0.19029367279836487;
+		float dop = -525.0f;
+		uint16_t lock = 5000 + epoch * 1000;
+		memcpy(m, &pr, sizeof(pr));
+		memcpy(m + 8, &cp, sizeof(cp));
+		memcpy(m + 16, &dop, sizeof(dop));
+		m[20] = 0;	/* GPS */
+		m[21] = i + 1;
+		m[24] = lock & 0xff;
+		m[25] = lock >> 8;
+		m[26] = 40 + i;
+		m[30] = 0x07;
+	}
+	frame.clear();
+	ubx_gen_frame(frame, UBX_CLASS_RXM, UBX_RXM_RAWX, p, sizeof(p), false);
+}
+
+enum rover_kind
+{
+	ROVER_RAW,	/* all of UBX */
+	ROVER_NAV,	/* UBX NAV only */
+	ROVER_RTCM,
+	ROVER_STALLED,	/* never reads */
+};
+
+struct rover
+{
+	int fd;
+	rover_kind kind;
+	bool v2;
+	bool header_done;
+	string raw;	/* as received */
+	string data;	/* de-chunked */
+	size_t chunk_left;
+	bool chunk_crlf;	/* CRLF after a chunk's data still expected */
+	uint32_t next_seq;
+	size_t frames;
+	size_t errors;
+	bool closed;
+};
+
+static int connect_local(uint16_t port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static string request(const char *mount, bool v2, const char *auth)
+{
+	string req = string("GET /") + mount + (v2 ? " HTTP/1.1\r\nHost: localhost\r\nNtrip-Version: Ntrip/2.0\r\n" : " HTTP/1.0\r\n");
+	req += "User-Agent: NTRIP bench_caster\r\n";
+	if(auth != NULL)
+	{
+		req += string("Authorization: Basic ") + auth + "\r\n";
+	}
+	return req + "\r\n";
+}
+
+/* Whole response of a request the caster answers & closes */
+static string fetch(uint16_t port, const string &req)
+{
+	int fd = connect_local(port);
+	if(fd < 0 || write(fd, req.data(), req.size()) != (ssize_t)req.size())
+	{
+		perror("fetch");
+		exit(1);
+	}
+	string response;
+	char buf[4096];
+	ssize_t len;
+	while((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		response.append(buf, len);
+	}
+	close(fd);
+	return response;
+}
+
+/* Chunked transfer coding off, 2.0 only */
+static void dechunk(rover &r)
+{
+	while(!r.raw.empty())
+	{
+		if(r.chunk_crlf)
+		{
+			if(r.raw.size() < 2)
+			{
+				return;
+			}
+			if(r.raw.compare(0, 2, "\r\n") != 0)
+			{
+				r.errors++;
+			}
+			r.raw.erase(0, 2);
+			r.chunk_crlf = false;
+		}
+		if(r.chunk_left == 0)
+		{
+			size_t eol = r.raw.find("\r\n");
+			if(eol == string::npos)
+			{
+				return;
+			}
+			r.chunk_left = strtoul(r.raw.c_str(), NULL, 16);
+			r.raw.erase(0, eol + 2);
+			if(r.chunk_left == 0)
+			{
+				r.errors++;
+				return;
+			}
+		}
+		size_t n = std::min(r.chunk_left, r.raw.size());
+		r.data.append(r.raw, 0, n);
+		r.raw.erase(0, n);
+		r.chunk_left -= n;
+		r.chunk_crlf = r.chunk_left == 0;
+	}
+}
+
+static void parse_ubx(rover &r)
+{
+	size_t pos = 0;
+	const uint8_t *d = (const uint8_t *)r.data.data();
+	while(r.data.size() - pos >= UBX_SYNC_SIZE + UBX_HEADER_SIZE)
+	{
+		const uint8_t *p = d + pos;
+		if(p[0] != UBX_SYNC1 || p[1] != UBX_SYNC2)
+		{
+			r.errors++;
+			pos = r.data.size();
+			break;
+		}
+		size_t size = UBX_HEADER_SIZE + (p[UBX_SYNC_SIZE + UBX_LENGTH_OFFSET] | p[UBX_SYNC_SIZE + UBX_LENGTH_OFFSET + 1] << 8) + UBX_CKSUM_SIZE;
+		if(r.data.size() - pos < UBX_SYNC_SIZE + size)
+		{
+			break;
+		}
+		const uint8_t *frame = p + UBX_SYNC_SIZE;
+		if(ubx_cksum(frame, size - UBX_CKSUM_SIZE) != (frame[size - 2] << 8 | frame[size - 1]))
+		{
+			r.errors++;
+		}
+		else if(frame[UBX_CLASS_OFFSET] == UBX_CLASS_NAV)
+		{
+			uint32_t seq;
+			memcpy(&seq, frame + UBX_HEADER_SIZE, sizeof(seq));
+			r.errors += seq != r.next_seq;
+			r.next_seq = seq + 1;
+		}
+		else if(r.kind == ROVER_NAV)
+		{
+			r.errors++;
+		}
+		r.frames++;
+		pos += UBX_SYNC_SIZE + size;
+	}
+	r.data.erase(0, pos);
+}
+
+static void parse_rtcm(rover &r)
+{
+	size_t pos = 0;
+	const uint8_t *d = (const uint8_t *)r.data.data();
+	while(r.data.size() - pos >= RTCM3_HEADER_SIZE)
+	{
+		const uint8_t *p = d + pos;
+		if(p[0] != RTCM3_PREAMBLE)
+		{
+			r.errors++;
+			pos = r.data.size();
+			break;
+		}
+		size_t size = RTCM3_HEADER_SIZE + ((p[1] & 0x03) << 8 | p[2]) + RTCM3_CRC_SIZE;
+		if(r.data.size() - pos < size)
+		{
+			break;
+		}
+		uint32_t crc = p[size - 3] << 16 | p[size - 2] << 8 | p[size - 1];
+		r.errors += rtcm_crc24q(p, size - RTCM3_CRC_SIZE) != crc;
+		r.frames++;
+		pos += size;
+	}
+	r.data.erase(0, pos);
+}
+
+static void received(rover &r, std::atomic<size_t> &started)
+{
+	if(!r.header_done)
+	{
+		size_t end = r.raw.find("\r\n\r\n");
+		if(end == string::npos)
+		{
+			return;
+		}
+		const char *ok = r.v2 ? "HTTP/1.1 200 OK\r\n" : "ICY 200 OK\r\n";
+		if(r.raw.compare(0, strlen(ok), ok) != 0 || (r.v2 && r.raw.find("Transfer-Encoding: chunked") > end))
+		{
+			r.errors++;
+		}
+		r.raw.erase(0, end + 4);
+		r.header_done = true;
+		started++;
+	}
+	if(r.v2)
+	{
+		dechunk(r);
+	}
+	else
+	{
+		r.data += r.raw;
+		r.raw.clear();
+	}
+	if(r.kind == ROVER_RTCM)
+	{
+		parse_rtcm(r);
+	}
+	else
+	{
+		parse_ubx(r);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_rovers = 300;
+	size_t num_stalled = 5;
+	size_t epochs = 100;
+	unsigned rate = 20;
+	int opt;
+
+	while((opt = getopt(argc, argv, "c:s:e:r:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'c':
+			num_rovers = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			num_stalled = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			epochs = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c rovers] [-s stalled_rovers] [-e epochs] [-r epochs_per_s]\n"
+				"\tRovers are spread over a UBX, a UBX NAV only & an RTCM3 mountpoint, NTRIP 1.0 & 2.0\n", argv[0]);
+			return 1;
+		}
+	}
+	if(num_stalled > num_rovers || rate == 0)
+	{
+		fputs("Bad arguments\n", stderr);
+		return 1;
+	}
+
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	/* Small buffers, so the stalled rovers get lapped during the run */
+	ubx_caster caster(64 * 1024);
+	if(!caster.parse("127.0.0.1:0") || !caster.add_mount("RAW:ubx") || !caster.add_mount("NAV:ubx/NAV") ||
+		!caster.add_mount("RTCM:rtcm@rover:secret") || caster.listen() != 0)
+	{
+		perror("caster");
+		return 1;
+	}
+	caster.start();
+	uint16_t port = caster.port();
+
+	/* Protocol first */
+	bool ok = true;
+	string table = fetch(port, request("", false, NULL));
+	ok &= check(table.compare(0, 20, "SOURCETABLE 200 OK\r\n") == 0 && table.find("STR;RAW;") != string::npos &&
+		table.find("STR;RTCM;RTCM;RTCM 3.3;") != string::npos && table.find(";B;N;") != string::npos &&
+		table.size() >= 16 && table.compare(table.size() - 16, 16, "ENDSOURCETABLE\r\n") == 0, "sourcetable, NTRIP 1.0");
+	table = fetch(port, request("", true, NULL));
+	ok &= check(table.compare(0, 17, "HTTP/1.1 200 OK\r\n") == 0 && table.find("gnss/sourcetable") != string::npos &&
+		table.find("STR;NAV;NAV;RAW;UBX NAV;") != string::npos, "sourcetable, NTRIP 2.0");
+	ok &= check(fetch(port, request("NOPE", false, NULL)).compare(0, 18, "SOURCETABLE 200 OK") == 0, "unknown mountpoint, NTRIP 1.0");
+	ok &= check(fetch(port, request("NOPE", true, NULL)).compare(0, 12, "HTTP/1.1 404") == 0, "unknown mountpoint, NTRIP 2.0");
+	ok &= check(fetch(port, request("RTCM", false, NULL)).compare(0, 12, "HTTP/1.0 401") == 0, "no password, NTRIP 1.0");
+	/* rover:wrong */
+	ok &= check(fetch(port, request("RTCM", true, "cm92ZXI6d3Jvbmc=")).compare(0, 12, "HTTP/1.1 401") == 0, "bad password, NTRIP 2.0");
+	ok &= check(fetch(port, "POST /RAW HTTP/1.1\r\nNtrip-Version: Ntrip/2.0\r\n\r\n").compare(0, 12, "HTTP/1.1 405") == 0, "not a GET");
+
+	/* Then the rovers, connected before anything is sent so they all get everything */
+	vector<rover> rovers(num_rovers);
+	for(size_t i = 0; i < num_rovers; i++)
+	{
+		rover &r = rovers[i];
+		r.kind = i < num_stalled ? ROVER_STALLED : (rover_kind)(i % 3);
+		r.v2 = i % 2;
+		r.header_done = false;
+		r.chunk_left = 0;
+		r.chunk_crlf = false;
+		r.next_seq = 0;
+		r.frames = r.errors = 0;
+		r.closed = false;
+		r.fd = connect_local(port);
+		if(r.fd < 0)
+		{
+			perror("connect");
+			return 1;
+		}
+		if(r.kind == ROVER_STALLED)
+		{
+			int rcvbuf = 4096;
+			setsockopt(r.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		}
+		static const char *names[] = {"RAW", "NAV", "RTCM", "RAW"};
+		/* rover:secret */
+		string req = request(names[r.kind], r.v2, r.kind == ROVER_RTCM ? "cm92ZXI6c2VjcmV0" : NULL);
+		if(write(r.fd, req.data(), req.size()) != (ssize_t)req.size())
+		{
+			perror("request");
+			return 1;
+		}
+	}
+
+	std::atomic<size_t> started(0);
+	std::thread reader([&]()
+	{
+		int epfd = epoll_create1(EPOLL_CLOEXEC);
+		size_t open = 0;
+		for(rover &r : rovers)
+		{
+			if(r.kind == ROVER_STALLED)
+			{
+				started++;
+				continue;
+			}
+			struct epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.ptr = &r;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, r.fd, &ev);
+			open++;
+		}
+		char chunk[65536];
+		struct epoll_event events[64];
+		while(open > 0)
+		{
+			int n = epoll_wait(epfd, events, 64, 20000);
+			if(n <= 0)
+			{
+				fputs("Rovers timed out\n", stderr);
+				break;
+			}
+			for(int i = 0; i < n; i++)
+			{
+				rover &r = *(rover *)events[i].data.ptr;
+				ssize_t len = read(r.fd, chunk, sizeof(chunk));
+				if(len <= 0)
+				{
+					epoll_ctl(epfd, EPOLL_CTL_DEL, r.fd, NULL);
+					r.closed = true;
+					open--;
+					continue;
+				}
+				r.raw.append(chunk, len);
+				received(r, started);
+			}
+		}
+		close(epfd);
+	});
+	uint64_t start = now_ns();
+	while(started.load() < num_rovers)
+	{
+		if(now_ns() - start > 5000000000ULL)
+		{
+			fprintf(stderr, "Only %zd of %zd rovers started\n", started.load(), num_rovers);
+			return 1;
+		}
+		usleep(1000);
+	}
+
+	/* The logger's side */
+	vector<uint8_t> frame;
+	uint64_t push_total = 0, push_max = 0;
+	size_t pushes = 0;
+	uint32_t seq = 0;
+	uint64_t period = 1000000000ULL / rate;
+	start = now_ns();
+	for(size_t e = 0; e < epochs; e++)
+	{
+		for(size_t f = 0; f <= NAV_PER_EPOCH; f++)
+		{
+			if(f == 0)
+			{
+				make_rawx(frame, e);
+			}
+			else
+			{
+				make_nav(frame, seq++);
+			}
+			uint64_t t0 = now_ns();
+			caster.push(ubx_frame_view(frame.data(), frame.size(), true));
+			uint64_t t = now_ns() - t0;
+			push_total += t;
+			push_max = std::max(push_max, t);
+			pushes++;
+		}
+		caster.push_epoch_end();
+		uint64_t next = start + (e + 1) * period;
+		uint64_t now = now_ns();
+		if(next > now)
+		{
+			usleep((next - now) / 1000);
+		}
+	}
+	uint64_t elapsed = now_ns() - start;
+	/* Let the rovers catch up, stopping closes them */
+	usleep(500000);
+	caster.stop();
+	reader.join();
+	caster.dump_stats(stderr);
+
+	size_t frames[3] = {SIZE_MAX, SIZE_MAX, SIZE_MAX}, errors = 0, differ = 0, closed = 0;
+	for(const rover &r : rovers)
+	{
+		if(r.kind == ROVER_STALLED)
+		{
+			continue;
+		}
+		errors += r.errors;
+		closed += r.closed;
+		if(frames[r.kind] == SIZE_MAX)
+		{
+			frames[r.kind] = r.frames;
+		}
+		differ += frames[r.kind] != r.frames;
+	}
+	for(rover &r : rovers)
+	{
+		close(r.fd);
+	}
+	double s = elapsed / 1e9;
+	printf("%zd rovers (%zd stalled), %zd epochs of %zd frames, %.1f s\n", num_rovers, num_stalled, epochs, NAV_PER_EPOCH + 1, s);
+	printf("push: %.0f ns mean, %.1f us max\n", (double)push_total / pushes, push_max / 1e3);
+	printf("frames per rover: RAW %zd, NAV %zd, RTCM %zd\n", frames[ROVER_RAW], frames[ROVER_NAV], frames[ROVER_RTCM]);
+	ok &= check(frames[ROVER_RAW] == epochs * (NAV_PER_EPOCH + 1), "UBX rovers got every frame");
+	ok &= check(frames[ROVER_NAV] == epochs * NAV_PER_EPOCH, "NAV rovers got every NAV frame, nothing else");
+	ok &= check(frames[ROVER_RTCM] >= epochs, "RTCM rovers got MSM for every epoch");
+	ok &= check(errors == 0 && differ == 0, "all streams intact & identical, 1.0 & 2.0");
+	ok &= check(closed == num_rovers - num_stalled, "rovers closed when the caster stopped");
+	ok &= check(caster.kicked.load() == num_stalled, "stalled rovers lapped & disconnected");
+	puts(ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
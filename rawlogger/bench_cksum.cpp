@@ -0,0 +1,82 @@
+/* ===================================== *
+ * bench_cksum.cpp - UBX checksum bench	 *
+ * ===================================== */
+
+#include "ubx_cksum.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+using namespace UBX;
+
+// Check every implementation bit-exact against the scalar one,
+// with all lengths up to a few blocks and every alignment
+static bool check(const ubx_cksum_impl *impls, const std::vector<uint8_t> &data)
+{
+	bool ok = true;
+	for(size_t off = 0; off < 64; off++)
+	{
+		for(size_t len = 0; off + len <= data.size(); len += (len < 1024 ? 1 : 997))
+		{
+			uint16_t ref = ubx_cksum_scalar(data.data() + off, len);
+			for(const ubx_cksum_impl *impl = impls; impl->func != NULL; impl++)
+			{
+				uint16_t ck = impl->func(data.data() + off, len);
+				if(ck != ref)
+				{
+					fprintf(stderr, "%s: offset %zd, length %zd: %04x != %04x\n",
+						impl->name, off, len, ck, ref);
+					ok = false;
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+int main(void)
+{
+	const ubx_cksum_impl *impls = ubx_cksum_impls();
+	std::vector<uint8_t> data(65536 + 64);
+	srand(1);
+	for(auto &c : data)
+	{
+		c = rand();
+	}
+
+	if(!check(impls, data))
+	{
+		return 1;
+	}
+	printf("All implementations match scalar, using \"%s\"\n", ubx_cksum_name());
+
+	static const size_t sizes[] = {100, 256, 512, 1024, 2048, 4096, 8192};
+	printf("%-8s", "size");
+	for(const ubx_cksum_impl *impl = impls; impl->func != NULL; impl++)
+	{
+		printf("%12s", impl->name);
+	}
+	printf("    (MB/s)\n");
+	for(size_t size : sizes)
+	{
+		printf("%-8zd", size);
+		// roughly 256 MiB worth of data per measurement
+		size_t iterations = (256 << 20) / size;
+		for(const ubx_cksum_impl *impl = impls; impl->func != NULL; impl++)
+		{
+			volatile uint16_t sink = 0;
+			uint64_t start = now_ns();
+			for(size_t i = 0; i < iterations; i++)
+			{
+				sink = sink + impl->func(data.data() + (i & 63), size);
+			}
+			uint64_t elapsed = now_ns() - start;
+			printf("%12.1f", (double)size * iterations / (elapsed / 1e9) / 1e6);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,275 @@
+/* ===================================== *
+ * bench_epoch.cpp - epoch assembler bench	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_gen.hpp"
+#include "ubx_parser.hpp"
+#include "ubx_epoch.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+using namespace UBX;
+
+static bool is_eoe(const ubx_frame_view &frame)
+{
+	return frame.class_id == UBX_CLASS_NAV && frame.msg_id == UBX_NAV_EOE;
+}
+
+static bool intact(const ubx_epoch &epoch)
+{
+	size_t frames = 0, bytes = 0;
+	for(const ubx_epoch_frame *f = epoch.first(); f != NULL; f = f->next)
+	{
+		const uint8_t *data = f->data();
+		if(ubx_cksum(data, f->size - UBX_CKSUM_SIZE) != (data[f->size - 2] << 8 | data[f->size - 1]))
+		{
+			return false;
+		}
+		frames++;
+		bytes += f->size;
+	}
+	return frames == epoch.frames && bytes == epoch.bytes;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t seconds = 600;
+	size_t rounds = 20;
+	ubx_gen_config config;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:n:S:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s seconds] [-n rounds] [-S seed]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(seconds < 10)
+	{
+		fprintf(stderr, "At least 10 s\n");
+		return 1;
+	}
+
+	bool ok = true;
+	ubx_generator gen(config);
+	vector<uint8_t> stream;
+	gen.generate(stream, seconds * config.rate);
+	vector<ubx_frame_view> frames;
+	ubx_parser parser(stream.data(), stream.size());
+	parser.finish();
+	ubx_frame_view frame;
+	while(parser.next(frame))
+	{
+		frames.push_back(frame);
+	}
+	struct timespec arrival;
+	memset(&arrival, 0, sizeof(arrival));
+
+	/* Whole epochs, nothing flagged */
+	{
+		ubx_epoch_assembler assembler;
+		size_t epochs = 0, flagged = 0, total = 0, first_pvt = 0;
+		bool good = true;
+		assembler.subscribe([&](const ubx_epoch_ref &epoch)
+		{
+			epochs++;
+			flagged += epoch->flags != 0;
+			total += epoch->frames;
+			first_pvt += epoch->first()->class_id == UBX_CLASS_NAV && epoch->first()->msg_id == UBX_NAV_PVT;
+			good &= epoch->seq == epochs - 1 && epoch->has_iTOW && epoch->find(UBX_CLASS_RXM, UBX_RXM_RAWX) != NULL && intact(*epoch);
+		});
+		for(const ubx_frame_view &f : frames)
+		{
+			assembler.add(f, arrival, 0);
+		}
+		assembler.flush();
+		ok &= check(good && epochs == gen.epochs && flagged == 0 && total == frames.size() && first_pvt == epochs,
+			"every epoch whole & unflagged");
+		ok &= check(assembler.allocated == 2, "two epochs in turn, when they're not kept");
+	}
+
+	/* NAV-HPPOSLLH after each NAV-PVT, its iTOW after version & reserved Bytes,
+	 * & a NAV message without a known iTOW, Bytes that would be another one */
+	{
+		vector<uint8_t> more;
+		for(const ubx_frame_view &f : frames)
+		{
+			ubx_gen_frame(more, f.class_id, f.msg_id, f.payload(), f.length);
+			if(f.class_id == UBX_CLASS_NAV && f.msg_id == UBX_NAV_PVT)
+			{
+				uint8_t hp[36] = {};
+				memcpy(hp + 4, f.payload(), 4);
+				hp[8] = 0x5a;
+				ubx_gen_frame(more, UBX_CLASS_NAV, UBX_NAV_HPPOSLLH, hp, sizeof(hp));
+				uint8_t unknown[16];
+				memset(unknown, 0xa5, sizeof(unknown));
+				ubx_gen_frame(more, UBX_CLASS_NAV, 0x62, unknown, sizeof(unknown));
+			}
+		}
+		ubx_epoch_assembler assembler;
+		size_t epochs = 0, flagged = 0, total = 0;
+		bool good = true;
+		assembler.subscribe([&](const ubx_epoch_ref &epoch)
+		{
+			epochs++;
+			flagged += epoch->flags != 0;
+			total += epoch->frames;
+			good &= epoch->find(UBX_CLASS_NAV, UBX_NAV_HPPOSLLH) != NULL && epoch->find(UBX_CLASS_NAV, 0x62) != NULL;
+		});
+		ubx_parser more_parser(more.data(), more.size());
+		more_parser.finish();
+		while(more_parser.next(frame))
+		{
+			assembler.add(frame, arrival, 0);
+		}
+		assembler.flush();
+		ok &= check(good && epochs == gen.epochs && flagged == 0 && total == frames.size() + 2 * gen.epochs,
+			"iTOW after the version, or none, splits nothing");
+	}
+
+	/* Every 7th NAV-EOE lost, a NAV-SIG of every 11th epoch late */
+	{
+		ubx_epoch_assembler assembler;
+		size_t epochs = 0, no_eoe = 0, overlap = 0, other = 0, total = 0;
+		assembler.subscribe([&](const ubx_epoch_ref &epoch)
+		{
+			epochs++;
+			no_eoe += epoch->flags == UBX_EPOCH_NO_EOE;
+			overlap += epoch->flags == UBX_EPOCH_OVERLAP;
+			other += epoch->flags != 0 && epoch->flags != UBX_EPOCH_NO_EOE && epoch->flags != UBX_EPOCH_OVERLAP;
+			total += epoch->frames;
+		});
+		size_t epoch = 0, dropped = 0, late = 0;
+		bool held = false;
+		ubx_frame_view sig;
+		for(const ubx_frame_view &f : frames)
+		{
+			/* Not next to a lost NAV-EOE, that would be both, & not after the last one */
+			if(epoch % 11 == 5 && epoch % 7 != 3 && (epoch + 1) % 7 != 3 && epoch + 1 < gen.epochs && !held && f.class_id == UBX_CLASS_NAV && f.msg_id == UBX_NAV_SIG)
+			{
+				sig = f;
+				held = true;
+				continue;
+			}
+			if(is_eoe(f) && epoch++ % 7 == 3)
+			{
+				dropped++;
+				continue;
+			}
+			assembler.add(f, arrival, 0);
+			if(is_eoe(f) && held)
+			{
+				assembler.add(sig, arrival, 0);
+				held = false;
+				late++;
+			}
+		}
+		assembler.flush();
+		ok &= check(epochs == gen.epochs && no_eoe == dropped && overlap == late && other == 0 &&
+			total == frames.size() - dropped, "lost NAV-EOE & late frames flagged");
+		printf("%zd epochs, %zd without NAV-EOE, %zd with a late NAV-SIG\n", epochs, no_eoe, overlap);
+	}
+
+	/* Epochs kept by another thread a while, the assembler never waits for it */
+	{
+		ubx_epoch_assembler assembler;
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<ubx_epoch_ref> queue;
+		bool done = false;
+		size_t consumed = 0, kept_most = 0;
+		bool good = true;
+		assembler.subscribe([&](const ubx_epoch_ref &epoch)
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			queue.push_back(epoch);
+			ready.notify_one();
+		});
+		std::thread consumer([&]()
+		{
+			std::unique_lock<std::mutex> lk(lock);
+			while(1)
+			{
+				ready.wait(lk, [&] { return done || queue.size() >= 8; });
+				if(queue.empty())
+				{
+					return;
+				}
+				kept_most = queue.size() > kept_most ? queue.size() : kept_most;
+				ubx_epoch_ref epoch = std::move(queue.front());
+				queue.pop_front();
+				lk.unlock();
+				good &= intact(*epoch);
+				consumed++;
+				epoch.reset();
+				lk.lock();
+			}
+		});
+		for(const ubx_frame_view &f : frames)
+		{
+			assembler.add(f, arrival, 0);
+		}
+		assembler.flush();
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			done = true;
+			ready.notify_one();
+		}
+		consumer.join();
+		ok &= check(good && consumed == gen.epochs, "epochs intact in another thread");
+		printf("%zd epochs, up to %zd queued, %zu epochs made\n", consumed, kept_most, assembler.allocated.load());
+	}
+
+	/* Time per frame, & allocations once every epoch & arena is there */
+	ubx_epoch_assembler assembler;
+	size_t sink = 0;
+	assembler.subscribe([&](const ubx_epoch_ref &epoch)
+	{
+		sink += epoch->frames;
+	});
+	for(const ubx_frame_view &f : frames)
+	{
+		assembler.add(f, arrival, 0);
+	}
+	size_t before = bench_allocations.load();
+	/* Arena blocks come from malloc(), operator new doesn't see them */
+	size_t arena_before = assembler.arena_bytes.load();
+	uint64_t start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(const ubx_frame_view &f : frames)
+		{
+			assembler.add(f, arrival, 0);
+		}
+	}
+	uint64_t ns = now_ns() - start;
+	size_t after = bench_allocations.load();
+	ok &= check(after == before, "no allocations in steady state");
+	ok &= check(assembler.arena_bytes.load() == arena_before, "no arena growth in steady state");
+	printf("%zd frames, %zd epochs in %zd rounds, %.1f ns/frame, %zd epochs made, %zd arena Bytes, %zd allocations\n",
+		frames.size() * rounds, gen.epochs * rounds, rounds, (double)ns / (frames.size() * rounds),
+		assembler.allocated.load(), assembler.arena_bytes.load(), after - before);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/* ===================================== *
+ * bench_hist.cpp - latency histograms	 *
+ * ===================================== */
+
+#include "ubx_histogram.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+using namespace UBX;
+
+int main(int argc, char *argv[])
+{
+	size_t count = 10000000;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n values]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	/* Log-uniform from 1 ns to ~1 s, like gaps & latencies */
+	std::vector<uint64_t> values(count);
+	uint64_t lcg = 1;
+	for(auto &v : values)
+	{
+		lcg = lcg * 6364136223846793005ULL + 1442695040888963407ULL;
+		v = (uint64_t)exp((lcg >> 11) * 0x1p-53 * log(1e9));
+	}
+
+	bool ok = true;
+	bool bounds = true;
+	for(size_t i = 0; i < UBX_HISTOGRAM_BUCKETS; i++)
+	{
+		bounds &= ubx_histogram::bucket(ubx_histogram::bucket_low(i)) == i;
+		bounds &= ubx_histogram::bucket(ubx_histogram::bucket_high(i)) == i;
+		if(i > 0)
+		{
+			bounds &= ubx_histogram::bucket_low(i) == ubx_histogram::bucket_high(i - 1) + 1;
+		}
+	}
+	bounds &= ubx_histogram::bucket(UINT64_MAX) == UBX_HISTOGRAM_BUCKETS - 1;
+	ok &= check(bounds, "buckets are contiguous");
+
+	ubx_histogram hist("bench");
+	uint64_t start = now_ns();
+	for(uint64_t v : values)
+	{
+		hist.record(v);
+	}
+	uint64_t elapsed = now_ns() - start;
+	printf("record(): %.2f ns\n", (double)elapsed / count);
+
+	/* What rawlogger does per frame: stamp to ns, the gap, record() */
+	ubx_histogram gaps("gaps");
+	std::vector<struct timespec> stamps(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		stamps[i].tv_sec = i / 100;
+		stamps[i].tv_nsec = (i % 100) * 10000000 + values[i] % 1000;
+	}
+	int64_t last = 0;
+	start = now_ns();
+	for(const auto &ts : stamps)
+	{
+		int64_t ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+		if(last != 0)
+		{
+			gaps.record(ns - last);
+		}
+		last = ns;
+	}
+	elapsed = now_ns() - start;
+	printf("per frame (gap): %.2f ns\n", (double)elapsed / count);
+
+	/* Per read & per epoch */
+	size_t calls = std::min(count, (size_t)1000000);
+	struct timespec ts;
+	start = now_ns();
+	for(size_t i = 0; i < calls; i++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+	}
+	elapsed = now_ns() - start;
+	printf("clock_gettime(CLOCK_MONOTONIC): %.2f ns\n", (double)elapsed / calls);
+
+	std::sort(values.begin(), values.end());
+	bool accurate = hist.count() == count;
+	for(double p : {1.0, 10.0, 50.0, 90.0, 99.0, 99.9, 100.0})
+	{
+		uint64_t exact = values[std::max((size_t)(p / 100 * count), (size_t)1) - 1];
+		uint64_t got = hist.percentile(p);
+		printf("p%-5g exact %10lu ns, histogram %10lu ns\n", p, (unsigned long)exact, (unsigned long)got);
+		/* Upper end of the right bucket, within one sub-bucket */
+		accurate &= got >= exact && got - exact <= exact / UBX_HISTOGRAM_SUB;
+	}
+	ok &= check(accurate, "percentiles within 1/16");
+	hist.dump(stdout);
+	return ok ? 0 : 1;
+}
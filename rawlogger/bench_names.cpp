@@ -0,0 +1,256 @@
+/* ===================================== *
+ * bench_names.cpp - name lookup bench	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "bench.hpp"
+#include <time.h>
+#include <string>
+#include <map>
+
+using namespace UBX;
+using std::string;
+using std::map;
+
+// The previous std::map based implementation, for comparison
+namespace old_names
+{
+typedef map<uint8_t, string> ubx_name_map_t;
+
+// UBX Class/Message IDs
+static ubx_name_map_t ubx_class_names =
+{
+	{0x01, "NAV"},
+	{0x02, "RXM"},
+	{0x04, "INF"},
+	{0x05, "ACK"},
+	{0x06, "CFG"},
+	{0x09, "UPD"},
+	{0x0A, "MON"},
+	{0x0D, "TIM"},
+	{0x13, "MGA"},
+	{0x21, "LOG"},
+	{0x27, "SEC"}
+};
+
+static ubx_name_map_t ubx_mon_names =
+{
+	{0x36, "COMMS"},
+	{0x28, "GNSS"},
+	{0x0B, "HW2"},
+	{0x37, "HW3"},
+	{0x09, "HW"},
+	{0x02, "IO"},
+	{0x06, "MSGPP"},
+	{0x27, "PATCH"},
+	{0x38, "RF"},
+	{0x07, "RXBUF"},
+	{0x21, "RXR"},
+	{0x08, "TXBUF"},
+	{0x31, "SPAN"},
+	{0x04, "VER"},
+	{0x39, "SYS"} // not in u-blox documentation, but u-center has support for it
+};
+
+static ubx_name_map_t ubx_nav_names =
+{
+	{0x22, "CLOCK"},
+	{0x04, "DOP"},
+	{0x36, "COV"},
+	{0x61, "EOE"},
+	{0x39, "GEOFENCE"},
+	{0x13, "HPPOSECEF"},
+	{0x14, "HPPOSLLH"},
+	{0x09, "ODO"},
+	{0x34, "ORB"},
+	{0x01, "POSECEF"},
+	{0x02, "POSLLH"},
+	{0x07, "PVT"},
+	{0x3C, "RELPOSNED"},
+	{0x35, "SAT"},
+	{0x43, "SIG"},
+	{0x42, "SLAS"},
+	{0x03, "STATUS"},
+	{0x3B, "SVIN"},
+	{0x24, "TIMEBDS"},
+	{0x25, "TIMEGAL"},
+	{0x23, "TIMEGLO"},
+	{0x20, "TIMEGPS"},
+	{0x27, "TIMEQZSS"},
+	{0x26, "TIMELS"},
+	{0x21, "TIMEUTC"},
+	{0x11, "VELECEF"},
+	{0x12, "VELNED"},
+	{0x32, "SBAS"}
+};
+
+static ubx_name_map_t ubx_rxm_names =
+{
+	{0x14, "MEASX"},
+	{0x15, "RAWX"},
+	{0x32, "RTCM"},
+	{0x13, "SRFBX"}
+};
+
+static ubx_name_map_t ubx_tim_names =
+{
+	{0x01, "TP"},
+	{0x03, "TM2"},
+	{0x06, "VRFY"}
+};
+
+static ubx_name_map_t ubx_sec_names =
+{
+	{0x03, "UNIQID"},
+	{0x09, "SIG"}, // not in u-blox documentation, but u-center has support for it
+	{0x10, "SIGLOG"} // same as above
+};
+
+static map<string, ubx_name_map_t> ubx_names =
+{
+	{"MON", ubx_mon_names},
+	{"NAV", ubx_nav_names},
+	{"RXM", ubx_rxm_names},
+	{"TIM", ubx_tim_names},
+	{"SEC", ubx_sec_names}
+};
+
+static string ubx_msg_name(uint8_t class_id, uint8_t msg_id)
+{
+	string class_name;
+	string msg_name;
+	char buf[32];
+	if(ubx_class_names.count(class_id) == 0) // unknown class
+	{
+		snprintf(buf, sizeof(buf), "%#02x-%#02x", class_id, msg_id);
+		return string(buf);
+	}
+	else
+	{
+		class_name = ubx_class_names[class_id];
+	}
+
+	if(ubx_names[class_name].count(msg_id) == 0) // known class, unknown msg
+	{
+		snprintf(buf, sizeof(buf), "%#02x", msg_id);
+		msg_name = buf;
+	}
+	else // known class, known msg
+	{
+		msg_name = ubx_names[class_name][msg_id];
+	}
+	return class_name + "-" + msg_name;
+}
+
+// u-blox GNSS id
+static ubx_name_map_t ubx_gnssid_names =
+{
+	{0, "GPS"},
+	{1, "SBAS"},
+	{2, "GAL"},
+	{3, "BDS"},
+	{4, "IMES"},
+	{5, "QZSS"},
+	{6, "GLO"},
+	{7, "NavIC"}
+};
+
+static ubx_name_map_t ubx_gnssid_abbr_names =
+{
+	{0, "G"},
+	{1, "S"},
+	{2, "E"},
+	{3, "B"},
+	{4, "I"},
+	{5, "Q"},
+	{6, "R"},
+	{7, "N"}
+};
+
+static string ubx_gnssid_name(uint8_t gnssid)
+{
+	if(ubx_gnssid_names.count(gnssid) == 0)
+	{
+		return "?";
+	}
+	return ubx_gnssid_names[gnssid];
+}
+
+static string ubx_gnssid_abbr_name(uint8_t gnssid)
+{
+	if(ubx_gnssid_abbr_names.count(gnssid) == 0)
+	{
+		return "?";
+	}
+	return ubx_gnssid_abbr_names[gnssid];
+}
+} // namespace old_names
+
+// Message mix roughly like a RAWX + SFRBX + NAV logging session
+static const uint8_t ids[][2] =
+{
+	{0x02, 0x15}, {0x02, 0x13}, {0x02, 0x13}, {0x02, 0x13}, {0x01, 0x07},
+	{0x01, 0x43}, {0x01, 0x35}, {0x01, 0x61}, {0x0A, 0x09}, {0x0D, 0x01},
+	{0x01, 0x99}, {0x42, 0x42}
+};
+constexpr size_t NIDS = sizeof(ids) / sizeof(ids[0]);
+
+int main(void)
+{
+	const size_t iterations = 2000000;
+	volatile size_t sink = 0;
+	char buf[UBX_MSG_NAME_MAX];
+
+	// Both must give the same names
+	for(int c = 0; c < 256; c++)
+	{
+		for(int m = 0; m < 256; m++)
+		{
+			string o = old_names::ubx_msg_name(c, m);
+			if(o != ubx_msg_name(c, m, buf, sizeof(buf)))
+			{
+				fprintf(stderr, "Mismatch at %02x-%02x: %s != %s\n", c, m, o.c_str(), buf);
+				return 1;
+			}
+		}
+		if(old_names::ubx_gnssid_name(c) != ubx_gnssid_name(c) ||
+			old_names::ubx_gnssid_abbr_name(c) != ubx_gnssid_abbr_name(c))
+		{
+			fprintf(stderr, "Mismatch at gnssId %d\n", c);
+			return 1;
+		}
+	}
+
+	uint64_t start = now_ns();
+	for(size_t i = 0; i < iterations; i++)
+	{
+		sink = sink + old_names::ubx_msg_name(ids[i % NIDS][0], ids[i % NIDS][1]).size();
+	}
+	uint64_t old_msg = now_ns() - start;
+
+	start = now_ns();
+	for(size_t i = 0; i < iterations; i++)
+	{
+		sink = sink + strlen(ubx_msg_name(ids[i % NIDS][0], ids[i % NIDS][1], buf, sizeof(buf)));
+	}
+	uint64_t new_msg = now_ns() - start;
+
+	start = now_ns();
+	for(size_t i = 0; i < iterations; i++)
+	{
+		sink = sink + old_names::ubx_gnssid_name(i & 7).size();
+	}
+	uint64_t old_gnss = now_ns() - start;
+
+	start = now_ns();
+	for(size_t i = 0; i < iterations; i++)
+	{
+		sink = sink + strlen(ubx_gnssid_name(i & 7));
+	}
+	uint64_t new_gnss = now_ns() - start;
+
+	printf("%-16s%12s%12s   (ns/lookup)\n", "", "std::map", "table");
+	printf("%-16s%12.1f%12.1f\n", "ubx_msg_name", (double)old_msg / iterations, (double)new_msg / iterations);
+	printf("%-16s%12.1f%12.1f\n", "ubx_gnssid_name", (double)old_gnss / iterations, (double)new_gnss / iterations);
+	return 0;
+}
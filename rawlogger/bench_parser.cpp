@@ -0,0 +1,434 @@
+/* ===================================== *
+ * bench_parser.cpp - UBX parser fuzzing	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_gen.hpp"
+#include "ubx_parser.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+using namespace UBX;
+
+static uint64_t rng_state;
+
+static uint64_t rng()
+{
+	uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static uint32_t below(uint32_t n)
+{
+	return rng() % n;
+}
+
+/* A frame that came out, at the offset of its sync chars, size without them */
+struct found_frame
+{
+	uint64_t offset;
+	size_t size;
+
+	bool operator==(const found_frame &other) const
+	{
+		return this->offset == other.offset && this->size == other.size;
+	}
+};
+
+struct parse_result
+{
+	vector<found_frame> frames;
+	uint64_t wasted;
+	size_t bad_checksums;
+	size_t too_long;
+
+	bool operator==(const parse_result &other) const
+	{
+		return this->frames == other.frames && this->wasted == other.wasted &&
+			this->bad_checksums == other.bad_checksums && this->too_long == other.too_long;
+	}
+};
+
+/* What the parser must give, the slow way: from where the last frame ended,
+ * the first sync chars followed by a whole frame with a good checksum */
+static void oracle(const vector<uint8_t> &data, size_t max_length, parse_result &r)
+{
+	r.frames.clear();
+	r.wasted = 0;
+	size_t pos = 0;
+	for(size_t s = 0; s + 2 + UBX_HEADER_SIZE + UBX_CKSUM_SIZE <= data.size(); s++)
+	{
+		if(data[s] != UBX_SYNC1 || data[s + 1] != UBX_SYNC2)
+		{
+			continue;
+		}
+		size_t length = data[s + 2 + UBX_LENGTH_OFFSET] | (data[s + 2 + UBX_LENGTH_OFFSET + 1] << 8);
+		size_t size = UBX_HEADER_SIZE + length + UBX_CKSUM_SIZE;
+		if(length > max_length || s + 2 + size > data.size())
+		{
+			continue;
+		}
+		const uint8_t *frame = data.data() + s + 2;
+		if(ubx_cksum(frame, size - UBX_CKSUM_SIZE) != (frame[size - 2] << 8 | frame[size - 1]))
+		{
+			continue;
+		}
+		r.frames.push_back({s, size});
+		r.wasted += s - pos;
+		pos = s + 2 + size;
+		s = pos - 1;
+	}
+	r.wasted += data.size() - pos;
+}
+
+/* The view's size, 0 if it isn't the one in the frame's header */
+static size_t frame_size(const vector<uint8_t> &data, uint64_t offset, const ubx_frame_view &frame)
+{
+	size_t length = data[offset + 2 + UBX_LENGTH_OFFSET] | (data[offset + 2 + UBX_LENGTH_OFFSET + 1] << 8);
+	size_t size = UBX_HEADER_SIZE + length + UBX_CKSUM_SIZE;
+	return frame.size == size ? size : 0;
+}
+
+static void stats(const ubx_parser &parser, parse_result &r)
+{
+	r.wasted = parser.wasted_bytes;
+	r.bad_checksums = parser.bad_checksums;
+	r.too_long = parser.too_long;
+}
+
+/* Fed in chunks of 1 .. max_chunk Bytes, 0 for space()/commit() with random lengths */
+static void parse_chunked(const vector<uint8_t> &data, size_t max_length, size_t max_chunk, parse_result &r)
+{
+	ubx_parser parser(max_length);
+	r.frames.clear();
+	size_t done = 0;
+	if(max_chunk > 0)
+	{
+		while(done < data.size())
+		{
+			size_t len = 1 + below(max_chunk);
+			len = len < data.size() - done ? len : data.size() - done;
+			parser.feed(data.data() + done, len, [&](const ubx_frame_view &frame)
+			{
+				r.frames.push_back({parser.frame_offset, frame_size(data, parser.frame_offset, frame)});
+			});
+			done += len;
+		}
+	}
+	else
+	{
+		while(done < data.size())
+		{
+			size_t room;
+			uint8_t *p = parser.space(room);
+			size_t len = 1 + below(room < 1000 ? room : 1000);
+			len = len < data.size() - done ? len : data.size() - done;
+			memcpy(p, data.data() + done, len);
+			parser.commit(len);
+			done += len;
+			const uint8_t *start;
+			size_t size;
+			while(parser.next(&start, &size))
+			{
+				r.frames.push_back({parser.frame_offset, size});
+			}
+		}
+	}
+	parser.finish();
+	ubx_frame_view frame;
+	while(parser.next(frame))
+	{
+		r.frames.push_back({parser.frame_offset, frame_size(data, parser.frame_offset, frame)});
+	}
+	stats(parser, r);
+}
+
+static void parse_in_place(const vector<uint8_t> &data, size_t max_length, parse_result &r)
+{
+	ubx_parser parser(data.data(), data.size(), 0, max_length);
+	r.frames.clear();
+	parser.finish();
+	const uint8_t *start;
+	size_t size;
+	while(parser.next(&start, &size))
+	{
+		if(start != data.data() + parser.frame_offset + 2)
+		{
+			r.frames.push_back({UINT64_MAX, 0});
+		}
+		r.frames.push_back({parser.frame_offset, size});
+	}
+	stats(parser, r);
+}
+
+static void append_frame(vector<uint8_t> &out, uint8_t class_id, uint8_t msg_id, size_t length)
+{
+	vector<uint8_t> payload(length);
+	for(size_t i = 0; i < length; i++)
+	{
+		/* Sync chars inside payloads now & then */
+		payload[i] = below(8) == 0 ? (i & 1 ? UBX_SYNC2 : UBX_SYNC1) : rng();
+	}
+	ubx_gen_frame(out, class_id, msg_id, payload.data(), length);
+}
+
+/* Short frames, pieces of them, sync floods, frames claiming long lengths,
+ * & a few Bytes changed afterwards */
+static void fuzz_input(vector<uint8_t> &out, const vector<uint8_t> &real)
+{
+	out.clear();
+	size_t pieces = 1 + below(40);
+	for(size_t i = 0; i < pieces; i++)
+	{
+		switch(below(7))
+		{
+		case 0:
+		case 1:
+			append_frame(out, below(4) ? 0x01 : rng(), rng(), below(4) ? below(24) : below(300));
+			break;
+		case 2:
+		{
+			/* A piece of a real stream, frames & fragments */
+			size_t len = 1 + below(200);
+			size_t at = below(real.size() - len);
+			out.insert(out.end(), real.begin() + at, real.begin() + at + len);
+			break;
+		}
+		case 3:
+		{
+			vector<uint8_t> frame;
+			append_frame(frame, rng(), rng(), below(40));
+			out.insert(out.end(), frame.begin(), frame.begin() + below(frame.size()));
+			break;
+		}
+		case 4:
+			for(size_t n = below(20); n > 0; n--)
+			{
+				out.push_back(UBX_SYNC1);
+				if(below(8) != 0)
+				{
+					out.push_back(UBX_SYNC2);
+				}
+			}
+			break;
+		case 5:
+		{
+			/* False sync with a length running over what follows */
+			uint8_t header[2 + UBX_HEADER_SIZE] = {UBX_SYNC1, UBX_SYNC2, (uint8_t)rng(), (uint8_t)rng(), (uint8_t)below(200), (uint8_t)(below(4) ? 0 : rng())};
+			out.insert(out.end(), header, header + below(sizeof(header)) + 1);
+			break;
+		}
+		default:
+			for(size_t n = below(16); n > 0; n--)
+			{
+				out.push_back(rng());
+			}
+			break;
+		}
+	}
+	for(size_t n = below(4); n > 0 && !out.empty(); n--)
+	{
+		size_t at = below(out.size());
+		switch(below(3))
+		{
+		case 0:
+			out[at] ^= 1 << below(8);
+			break;
+		case 1:
+			out.insert(out.begin() + at, below(2) ? UBX_SYNC1 : rng());
+			break;
+		default:
+			out.erase(out.begin() + at);
+			break;
+		}
+	}
+}
+
+/* ns/Byte of feeding data in chunk Byte pieces, best of 3 */
+static double time_per_byte(const vector<uint8_t> &data, size_t chunk, size_t &frames)
+{
+	double best = 0;
+	for(int run = 0; run < 3; run++)
+	{
+		ubx_parser parser;
+		uint64_t start = now_ns();
+		for(size_t done = 0; done < data.size(); done += chunk)
+		{
+			size_t len = chunk < data.size() - done ? chunk : data.size() - done;
+			parser.feed(data.data() + done, len, [](const ubx_frame_view &) {});
+		}
+		parser.finish();
+		ubx_frame_view frame;
+		while(parser.next(frame))
+		{
+		}
+		double ns = (double)(now_ns() - start) / data.size();
+		best = run == 0 || ns < best ? ns : best;
+		frames = parser.frames;
+	}
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t cases = 20000;
+	size_t mib = 16;
+	uint64_t seed = 1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:M:S:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			cases = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			mib = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n fuzz_cases] [-M MiB_per_pattern] [-S seed]\n", argv[0]);
+			return 1;
+		}
+	}
+	rng_state = seed;
+	bool ok = true;
+
+	/* A clean generated stream: pieces for the fuzzer, & the baseline */
+	ubx_gen_config config;
+	config.seed = seed;
+	ubx_generator clean_gen(config);
+	vector<uint8_t> clean;
+	clean_gen.generate(clean, 60);
+
+	parse_result expected, got;
+	parse_chunked(clean, UBX_PARSER_MAX_LENGTH, 4096, got);
+	bool all = got.frames.size() == clean_gen.intact.size() && got.wasted == 0;
+	for(size_t i = 0; all && i < got.frames.size(); i++)
+	{
+		all &= got.frames[i].offset == clean_gen.intact[i];
+	}
+	ok &= check(all, "every frame of a clean stream");
+
+	/* Random inputs, the oracle against each way of feeding the parser */
+	const size_t max_lengths[] = {UBX_PARSER_MAX_LENGTH, UBX_PARSER_MAX_LENGTH, 100, 8};
+	const size_t chunks[] = {1, 3, 64, 100000, 0};
+	size_t mismatches = 0, frames = 0;
+	vector<uint8_t> input;
+	for(size_t i = 0; i < cases; i++)
+	{
+		fuzz_input(input, clean);
+		size_t max_length = max_lengths[below(4)];
+		oracle(input, max_length, expected);
+		parse_in_place(input, max_length, got);
+		bool same = got.frames == expected.frames && got.wasted == expected.wasted;
+		parse_result in_place = got;
+		for(size_t chunk : chunks)
+		{
+			parse_chunked(input, max_length, chunk, got);
+			same &= got == in_place;
+		}
+		if(!same && mismatches++ == 0)
+		{
+			fprintf(stderr, "Case %zd differs, %zd Bytes, max_length %zd, %zd frames expected:", i, input.size(), max_length, expected.frames.size());
+			for(uint8_t c : input)
+			{
+				fprintf(stderr, " %02x", c);
+			}
+			fprintf(stderr, "\n");
+		}
+		frames += expected.frames.size();
+	}
+	printf("%zd fuzz cases, %zd frames, %zd mismatches\n", cases, frames, mismatches);
+	ok &= check(mismatches == 0, "chunked & in place parsing match the oracle");
+
+	/* Damaged stream: what a damaged frame doesn't take with it is found */
+	ubx_gen_config damaged_config = config;
+	damaged_config.bit_flips = damaged_config.truncations = damaged_config.false_syncs = 0.01;
+	ubx_generator damaged_gen(damaged_config);
+	vector<uint8_t> damaged;
+	damaged_gen.generate(damaged, 600);
+	parse_chunked(damaged, UBX_PARSER_MAX_LENGTH, 4096, got);
+	size_t hits = 0, hidden = 0, made_up = 0;
+	size_t f = 0;
+	for(uint64_t offset : damaged_gen.intact)
+	{
+		while(f < got.frames.size() && got.frames[f].offset + 2 + got.frames[f].size <= offset)
+		{
+			f++;
+		}
+		if(f < got.frames.size() && got.frames[f].offset == offset)
+		{
+			hits++;
+		}
+		else if(f < got.frames.size() && got.frames[f].offset < offset)
+		{
+			/* Under a frame made up from damage that passed the checksum */
+			hidden++;
+		}
+	}
+	made_up = got.frames.size() - hits;
+	printf("%zd of %zd undamaged frames, %zd under %zd frames made up from damage, %zd bad checksums\n",
+		hits, damaged_gen.intact.size(), hidden, made_up, got.bad_checksums);
+	ok &= check(hits + hidden == damaged_gen.intact.size(), "every undamaged frame of a damaged stream");
+
+	/* Time per Byte on input made to hurt, against the clean stream */
+	size_t size = mib << 20;
+	struct
+	{
+		const char *name;
+		vector<uint8_t> data;
+	} patterns[5];
+	patterns[0].name = "clean stream";
+	while(patterns[0].data.size() < size)
+	{
+		patterns[0].data.insert(patterns[0].data.end(), clean.begin(), clean.end());
+	}
+	patterns[1].name = "sync flood";
+	patterns[2].name = "sync, length 65535";
+	patterns[3].name = "sync, length 0";
+	patterns[4].name = "random";
+	for(size_t i = 0; i < size; i += 2)
+	{
+		patterns[1].data.push_back(UBX_SYNC1);
+		patterns[1].data.push_back(UBX_SYNC2);
+	}
+	for(size_t i = 0; i < size; i += 6)
+	{
+		const uint8_t far[] = {UBX_SYNC1, UBX_SYNC2, (uint8_t)rng(), (uint8_t)rng(), 0xff, 0xff};
+		patterns[2].data.insert(patterns[2].data.end(), far, far + sizeof(far));
+		const uint8_t empty[] = {UBX_SYNC1, UBX_SYNC2, (uint8_t)rng(), (uint8_t)rng(), 0, 0};
+		patterns[3].data.insert(patterns[3].data.end(), empty, empty + sizeof(empty));
+	}
+	for(size_t i = 0; i < size; i++)
+	{
+		patterns[4].data.push_back(rng());
+	}
+	double clean_ns = 0, worst_ns = 0;
+	for(const auto &p : patterns)
+	{
+		for(size_t chunk : {(size_t)4096, (size_t)1})
+		{
+			vector<uint8_t> data(p.data.begin(), p.data.begin() + (chunk == 1 ? p.data.size() / 16 : p.data.size()));
+			double ns = time_per_byte(data, chunk, frames);
+			if(chunk == 4096)
+			{
+				clean_ns = clean_ns == 0 ? ns : clean_ns;
+				worst_ns = ns > worst_ns ? ns : worst_ns;
+			}
+			printf("%-24s%6zd Byte chunks%10.2f ns/Byte%10.1f MB/s%10zd frames\n", p.name, chunk, ns, 1e3 / ns, frames);
+		}
+	}
+	printf("worst case %.2f ns/Byte, %.1fx the clean stream\n", worst_ns, worst_ns / clean_ns);
+	return ok ? 0 : 1;
+}
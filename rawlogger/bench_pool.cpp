@@ -0,0 +1,208 @@
+/* ===================================== *
+ * bench_pool.cpp - frame buffer pool	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_gen.hpp"
+#include "ubx_pool.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_dispatch.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <thread>
+
+using namespace UBX;
+
+typedef ubx_dispatcher<ubx_nav_pvt, ubx_nav_eoe, ubx_nav_sig, ubx_rxm_rawx, ubx_tim_tp> bench_dispatcher;
+
+/* Sizes to classes & back, & reuse within a class */
+static bool check_classes()
+{
+	ubx_frame_pool pool(4);
+	bool good = true;
+	size_t cap;
+	static const size_t sizes[][2] = {{1, 64}, {64, 64}, {65, 128}, {100, 128}, {4096, 4096}, {4097, 8192},
+		{0x10000, 0x10000}, {UBX_MAX_FRAME_SIZE, UBX_POOL_MAX_SIZE}};
+	for(const size_t *s : sizes)
+	{
+		uint8_t *buf = pool.get(s[0], cap);
+		memset(buf, 0xa5, cap);
+		good &= cap == s[1];
+		pool.put(buf, cap);
+		uint8_t *again = pool.get(s[0], cap);
+		good &= again == buf;
+		pool.put(again, cap);
+	}
+	size_t n = sizeof(sizes) / sizeof(sizes[0]);
+	/* 1 & 64, 65 & 100 are the same class */
+	good &= pool.hits == n + 2 && pool.misses == n - 2 && pool.in_use == 0;
+
+	/* Past the pool, malloc()ed every time */
+	uint8_t *big = pool.get(UBX_POOL_MAX_SIZE + 1, cap);
+	good &= cap == UBX_POOL_MAX_SIZE + 1;
+	pool.put(big, cap);
+	good &= pool.misses == n - 1;
+
+	/* Only max_free are kept */
+	uint8_t *bufs[6];
+	for(uint8_t *&buf : bufs)
+	{
+		buf = pool.get(200, cap);
+	}
+	size_t bytes = pool.pooled_bytes;
+	for(uint8_t *buf : bufs)
+	{
+		pool.put(buf, cap);
+	}
+	good &= pool.in_use == 0 && pool.pooled_bytes == bytes - 2 * 256;
+	return check(good, "size classes, reuse & free list limit");
+}
+
+/* Copies & moves of pooled buffers */
+static bool check_bufs()
+{
+	ubx_frame_pool pool;
+	bool good = true;
+	uint8_t data[300];
+	for(size_t i = 0; i < sizeof(data); i++)
+	{
+		data[i] = i;
+	}
+	{
+		ubx_pool_buf a(pool);
+		good &= a.empty() && a.data() == NULL;
+		a.assign(data, 100);
+		const uint8_t *first = a.data();
+		/* Smaller, or the same class: the buffer stays */
+		a.assign(data + 1, 128);
+		good &= a.data() == first && a.size() == 128 && a[0] == 1;
+		a.clear();
+		good &= a.empty() && a.data() == first && pool.in_use == 1;
+		a.assign(data, 300);
+		good &= a.size() == 300 && memcmp(a.data(), data, 300) == 0 && pool.in_use == 1;
+
+		ubx_pool_buf b(a);
+		good &= b.data() != a.data() && b.size() == 300 && memcmp(b.data(), data, 300) == 0 && pool.in_use == 2;
+		ubx_pool_buf c(std::move(b));
+		good &= b.data() == NULL && c.size() == 300 && pool.in_use == 2;
+		b = c;
+		good &= b.size() == 300 && pool.in_use == 3;
+		c = std::move(a);
+		good &= a.empty() && c.size() == 300 && pool.in_use == 2;
+		b.release();
+		good &= b.empty() && pool.in_use == 1;
+	}
+	good &= pool.in_use == 0;
+
+	/* Given back from another thread */
+	{
+		vector<ubx_pool_buf> bufs(100, ubx_pool_buf(pool));
+		for(ubx_pool_buf &buf : bufs)
+		{
+			buf.assign(data, sizeof(data));
+		}
+		std::thread other([&]()
+		{
+			bufs.clear();
+		});
+		other.join();
+	}
+	good &= pool.in_use == 0;
+	return check(good, "copies, moves & release from another thread");
+}
+
+int main(int argc, char *argv[])
+{
+	size_t seconds = 600;
+	ubx_gen_config config;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:S:")) != -1)
+	{
+		switch(opt)
+		{
+		case 's':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s seconds] [-S seed]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(seconds < 10)
+	{
+		fprintf(stderr, "At least 10 s\n");
+		return 1;
+	}
+
+	bool ok = true;
+	ok &= check_classes();
+	ok &= check_bufs();
+
+	ubx_generator gen(config);
+	vector<uint8_t> stream;
+	gen.generate(stream, seconds * config.rate);
+	/* Twice over, the first time round every size class is seen */
+	size_t once = stream.size();
+	stream.resize(2 * once);
+	memcpy(stream.data() + once, stream.data(), once);
+	int fd = stream_fd(stream);
+	if(fd < 0)
+	{
+		return 1;
+	}
+
+	/* The main loop, as rawlogger's with an owning copy & a plain message of each frame */
+	ubx_frame_pool &pool = ubx_frame_pool::global();
+	size_t hits = pool.hits, misses = pool.misses;
+	bench_dispatcher dispatcher;
+	ubx_reader reader(fd);
+	ubx_frame last;
+	size_t frames = 0, registered = 0, decoded = 0, same = 0;
+	size_t before = 0, warm_misses = 0;
+	uint64_t start = 0;
+	size_t warm = gen.frames;
+	while(1)
+	{
+		ubx_frame_view view;
+		if(reader.read_frame(view) == EOF)
+		{
+			break;
+		}
+		if(frames == warm)
+		{
+			before = bench_allocations.load();
+			warm_misses = pool.misses;
+			start = now_ns();
+		}
+		registered += bench_dispatcher::is_registered(view.class_id, view.msg_id);
+		decoded += dispatcher.dispatch(view);
+		ubx_frame frame(view);
+		ubx_any_msg msg(view);
+		same += frame.buf.size() == view.size && memcmp(frame.buf.data(), view.data, view.size) == 0 &&
+			msg.payload.size() == view.length && memcmp(msg.payload.data(), view.payload(), view.length) == 0;
+		last = std::move(frame);
+		frames++;
+	}
+	uint64_t ns = now_ns() - start;
+	size_t after = bench_allocations.load() + pool.misses - warm_misses;
+	close(fd);
+	ok &= check(frames == 2 * gen.frames && same == frames && decoded == registered, "every frame read, copied & decoded");
+	ok &= check(after == before, "no allocations per frame in steady state");
+	printf("%zd frames, %zd after warming up, %.1f ns/frame, %zd allocations\n",
+		frames, frames - warm, (double)ns / (frames - warm), after - before);
+	hits = pool.hits - hits;
+	misses = pool.misses - misses;
+	printf("Pool: %zd hits, %zd misses, %zd buffers out, %zd Bytes\n",
+		hits, misses, pool.in_use.load(), pool.pooled_bytes.load());
+	return ok ? 0 : 1;
+}
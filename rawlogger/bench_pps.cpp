@@ -0,0 +1,358 @@
+/* ===================================== *
+ * bench_pps.cpp - PPS & TIM-TP matching *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_tim.hpp"
+#include "ubx_pps.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_gen.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+
+using namespace UBX;
+
+/* The system clock is this far ahead of GNSS time, seconds included */
+constexpr int64_t CLOCK_OFFSET_NS = 1234003712345LL;
+constexpr uint16_t WEEK = 2300;
+constexpr uint32_t START_TOW_MS = 100000000;
+/* TIM-TP at the navigation rate, read this long after each epoch */
+constexpr int64_t NAV_PERIOD_NS = 100000000;
+constexpr int64_t SERIAL_DELAY_NS = 25000000;
+/* The PPS thread's fetch timeout */
+constexpr int64_t TICK_NS = 50000000;
+/* Reader stalls, one within the latency budget & one past it */
+constexpr int64_t LAG_NS = 120000000;
+constexpr int64_t STALL_NS = 300000000;
+/* F9P's sawtooth is within +-4 ns, this much per second drift */
+constexpr int32_t QERR_STEP_PS = 2713;
+
+static struct timespec to_timespec(int64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	return ts;
+}
+
+static void make_tim_tp(vector<uint8_t> &frame, uint32_t tow_ms, int32_t qerr_ps, uint8_t flags)
+{
+	struct _ubx_tim_tp tp;
+	memset(&tp, 0, sizeof(tp));
+	tp.towMS = htole32(tow_ms);
+	tp.qErr = htole32(qerr_ps);
+	tp.week = htole16(WEEK);
+	tp.flags = flags | UBX_TIM_TP_UTC | UBX_TIM_TP_UTC_AVAIL;
+	frame.clear();
+	ubx_gen_frame(frame, UBX_CLASS_TIM, UBX_TIM_TP, (const uint8_t *)&tp, UBX_TIM_TP_SIZE, false);
+}
+
+/* qErr & flags of each pulse from a recording, one TIM-TP per pulse */
+static int load_recording(const char *path, vector<int32_t> &qerrs, vector<uint8_t> &flags)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	ubx_reader reader(fd);
+	ubx_frame_view frame;
+	ubx_tim_tp tp;
+	uint32_t last_tow = 0xffffffff;
+	while(reader.read_frame(frame) != EOF)
+	{
+		if(!tp.parse(frame) || tp.data.towMS == last_tow)
+		{
+			continue;
+		}
+		last_tow = tp.data.towMS;
+		qerrs.push_back(tp.data.qErr);
+		flags.push_back(tp.data.flags & UBX_TIM_TP_QERR_INVALID);
+	}
+	close(fd);
+	return 0;
+}
+
+enum event_kind
+{
+	EVENT_TP,
+	EVENT_EDGE,
+	EVENT_TICK
+};
+
+struct event
+{
+	int64_t when;	/* system time it's handled at */
+	size_t order;
+	event_kind kind;
+	int64_t stamp;	/* arrival or edge */
+	uint32_t pulse;
+};
+
+int main(int argc, char *argv[])
+{
+	size_t seconds = 600;
+	int64_t jitter_ns = 0;
+	const char *recording = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:j:f:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			jitter_ns = strtol(optarg, NULL, 10);
+			break;
+		case 'f':
+			recording = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n seconds] [-j edge_jitter_ns] [-f tim_tp_recording.ubx]\n"
+				"\tFeeds simulated PPS edges & TIM-TP frames to the correlator, with stalls, gaps & missed edges,\n"
+				"\tthen checks every edge got its own qErr and the corrected offsets are the clock's\n", argv[0]);
+			return 1;
+		}
+	}
+
+	/* Pulse k's qErr, a sawtooth unless recorded */
+	vector<int32_t> qerrs;
+	vector<uint8_t> qerr_flags;
+	if(recording != NULL)
+	{
+		if(load_recording(recording, qerrs, qerr_flags) != 0)
+		{
+			perror(recording);
+			return 1;
+		}
+		if(qerrs.size() < 2)
+		{
+			fprintf(stderr, "%s: no TIM-TP\n", recording);
+			return 1;
+		}
+		seconds = std::min(seconds, qerrs.size() - 1);
+	}
+	else
+	{
+		for(size_t k = 0; k <= seconds; k++)
+		{
+			qerrs.push_back((int32_t)((k * QERR_STEP_PS) % 8000) - 4000);
+			/* Now and then the receiver says it's not valid */
+			qerr_flags.push_back(k % 23 == 0 ? UBX_TIM_TP_QERR_INVALID : 0);
+		}
+	}
+
+	/* Each second k ends with pulse k. What goes wrong in it, first match wins:
+	 * %11 no TIM-TP, %17 edge missed, %19 reader stalled past the budget,
+	 * %13 reader stalled within it */
+	auto stall_of = [](size_t k) -> int64_t
+	{
+		if(k % 11 == 0 || k % 17 == 0)
+		{
+			return 0;
+		}
+		return k % 19 == 0 ? STALL_NS : k % 13 == 0 ? LAG_NS : 0;
+	};
+	size_t want_edges = 0, want_matched = 0, want_uncorrected = 0, want_unmatched = 0, want_late = 0;
+	vector<event> events;
+	uint64_t lcg = 1;
+	for(size_t k = 1; k <= seconds; k++)
+	{
+		int64_t pulse_true = ((int64_t)WEEK * 604800000 + START_TOW_MS) * 1000000 + (int64_t)k * 1000000000;
+		int64_t prev_true = pulse_true - 1000000000;
+		lcg = lcg * 6364136223846793005ULL + 1442695040888963407ULL;
+		int64_t jitter = jitter_ns > 0 ? (int64_t)((lcg >> 33) % (2 * jitter_ns + 1)) - jitter_ns : 0;
+		/* Whole ns, the true edge is qErr ps late */
+		int64_t edge = pulse_true + CLOCK_OFFSET_NS + (int64_t)llround(qerrs[k] / 1000.0) + jitter;
+		bool drop = k % 11 == 0;
+		bool missed = !drop && k % 17 == 0;
+		int64_t stall = stall_of(k);
+		if(!drop)
+		{
+			for(int64_t t = prev_true; t < pulse_true; t += NAV_PERIOD_NS)
+			{
+				event ev;
+				ev.stamp = t + SERIAL_DELAY_NS + CLOCK_OFFSET_NS;
+				ev.when = stall ? std::max(ev.stamp, edge + stall) : ev.stamp;
+				ev.kind = EVENT_TP;
+				ev.pulse = k;
+				events.push_back(ev);
+			}
+		}
+		if(!missed)
+		{
+			event ev;
+			ev.stamp = edge;
+			/* IRQ to the PPS thread */
+			ev.when = edge + 20000;
+			ev.kind = EVENT_EDGE;
+			ev.pulse = k;
+			events.push_back(ev);
+			want_edges++;
+			/* Known to have no TIM-TP when the next one is read, unless that's stalled */
+			if(drop && stall_of(k + 1) == 0)
+			{
+				want_unmatched++;
+			}
+			else if(drop)
+			{
+				want_late++;
+			}
+			else if(stall == STALL_NS)
+			{
+				want_late++;
+			}
+			else
+			{
+				want_matched++;
+				want_uncorrected += qerr_flags[k] != 0;
+			}
+		}
+		for(int64_t t = prev_true; t < pulse_true; t += TICK_NS)
+		{
+			event ev;
+			ev.stamp = ev.when = t + CLOCK_OFFSET_NS + TICK_NS / 2;
+			ev.kind = EVENT_TICK;
+			ev.pulse = k;
+			events.push_back(ev);
+		}
+	}
+	/* The reader keeps its order through stalls, what came in during one waits too */
+	int64_t reader_time = 0;
+	for(size_t i = 0; i < events.size(); i++)
+	{
+		events[i].order = i;
+		if(events[i].kind == EVENT_TP)
+		{
+			reader_time = std::max(reader_time, events[i].when);
+			events[i].when = reader_time;
+		}
+	}
+	std::sort(events.begin(), events.end(), [](const event &a, const event &b)
+	{
+		return a.when != b.when ? a.when < b.when : a.order < b.order;
+	});
+
+	/* Samples go through chrony's datagram too */
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/bench_pps.%d.sock", (int)getpid());
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	unlink(path);
+	if(sock < 0 || bind(sock, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+	ubx_chrony chrony(path);
+	if(chrony.open() != 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	ubx_pps_correlator correlator;
+	ubx_offset_stats offsets, raw_offsets, corrected_offsets, latency;
+	size_t wrong_qerr = 0, off_clock = 0, bad_datagrams = 0, tps = 0;
+	double tolerance = (jitter_ns + 1) / 1e9;
+	vector<uint8_t> frame;
+	ubx_tim_tp tp;
+	uint64_t busy = 0;
+	auto drain = [&](int64_t when)
+	{
+		ubx_pps_sample sample;
+		while(correlator.pop(to_timespec(when), sample))
+		{
+			uint32_t k = sample.sequence;
+			wrong_qerr += sample.qerr_ps != qerrs[k];
+			if(sample.corrected)
+			{
+				corrected_offsets.update(sample.offset);
+				off_clock += fabs(sample.offset + (CLOCK_OFFSET_NS % 1000000000) / 1e9) > tolerance;
+			}
+			offsets.update(sample.offset);
+			raw_offsets.update(sample.raw_offset);
+			latency.update(sample.latency_ns / 1e9);
+
+			chrony.send_pulse(sample.edge, sample.offset);
+			struct chrony_sock_sample got;
+			double sent_true = sample.edge.tv_nsec / 1e9 + sample.offset;
+			if(recv(sock, &got, sizeof(got), MSG_DONTWAIT) != sizeof(got) || got.magic != CHRONY_SOCK_MAGIC ||
+				got.pulse != 1 || got.tv.tv_sec != sample.edge.tv_sec ||
+				fabs(got.tv.tv_usec / 1e6 + got.offset - sent_true) > 1e-10)
+			{
+				bad_datagrams++;
+			}
+		}
+	};
+	for(const event &ev : events)
+	{
+		uint64_t t0 = now_ns();
+		switch(ev.kind)
+		{
+		case EVENT_TP:
+		{
+			/* Predicts pulse ev.pulse, sent after the one before */
+			make_tim_tp(frame, START_TOW_MS + ev.pulse * 1000, qerrs[ev.pulse], qerr_flags[ev.pulse]);
+			tp.parse(ubx_frame_view(frame.data(), frame.size()));
+			correlator.add_tp(tp, to_timespec(ev.stamp));
+			tps++;
+			break;
+		}
+		case EVENT_EDGE:
+			correlator.add_edge(to_timespec(ev.stamp), ev.pulse);
+			break;
+		case EVENT_TICK:
+			break;
+		}
+		drain(ev.when);
+		busy += now_ns() - t0;
+	}
+	drain(events.back().when + 10000000000LL);
+	close(sock);
+	unlink(path);
+
+	printf("%zd s, %zd TIM-TP, %zd edges: %zd matched (%zd without qErr), %zd without TIM-TP, %zd late\n",
+		seconds, tps, correlator.edges, correlator.matched, correlator.uncorrected, correlator.unmatched, correlator.late);
+	printf("%.0f ns per event, decoding & sending included\n", (double)busy / events.size());
+	if(offsets.count > 1)
+	{
+		printf("offset mean %+.9f s, stddev %.3f ns, jitter %.3f ns, %.3f ns when qErr was valid\n",
+			offsets.mean, offsets.stddev() * 1e9, offsets.jitter() * 1e9, corrected_offsets.stddev() * 1e9);
+		printf("without qErr: stddev %.3f ns, jitter %.3f ns\n", raw_offsets.stddev() * 1e9, raw_offsets.jitter() * 1e9);
+		printf("latency mean %.3f ms, max %.3f ms\n", latency.mean * 1e3, latency.max * 1e3);
+	}
+
+	bool ok = true;
+	ok &= check(correlator.edges == want_edges, "every edge seen");
+	ok &= check(correlator.matched == want_matched && correlator.uncorrected == want_uncorrected, "edges with a TIM-TP matched");
+	ok &= check(correlator.unmatched == want_unmatched, "edges without one given up");
+	ok &= check(correlator.late == want_late, "edges past the latency budget given up");
+	ok &= check(wrong_qerr == 0, "each edge got its own qErr");
+	ok &= check(off_clock == 0, "corrected offsets are the clock's");
+	ok &= check(latency.max * 1e9 <= UBX_PPS_LATENCY_BUDGET_NS, "within the latency budget");
+	ok &= check(bad_datagrams == 0, "chrony pulse datagrams");
+	if(recording == NULL && jitter_ns == 0)
+	{
+		/* The sawtooth's own stddev is 8 ns / sqrt(12), what's left is the edges' rounding to ns */
+		ok &= check(corrected_offsets.stddev() < 0.5e-9 && raw_offsets.stddev() > 2e-9, "sawtooth removed");
+	}
+	return ok ? 0 : 1;
+}
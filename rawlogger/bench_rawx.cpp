@@ -0,0 +1,297 @@
+/* ===================================== *
+ * bench_rawx.cpp - RAWX decode bench	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_compress.hpp"
+#include "ubx_gen.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <memory>
+
+using namespace UBX;
+
+/* The array of structs layout, decoded into a vector per epoch, for comparison */
+struct rawx_meas
+{
+	double prMes;
+	double cpMes;
+	float doMes;
+	uint8_t gnssId;
+	uint8_t svId;
+	uint8_t sigId;
+	uint8_t freqId;
+	uint16_t locktime;
+	uint8_t cno;
+	uint8_t prStdev;
+	uint8_t cpStdev;
+	uint8_t doStdev;
+	uint8_t trkStat;
+};
+
+static bool parse_aos(const ubx_frame_view &frame, vector<rawx_meas> &meas)
+{
+	const uint8_t *payload = frame.payload();
+	uint8_t num = getu1(payload, 11);
+	if(frame.length != UBX_RXM_RAWX_HEADER_SIZE + num * UBX_RXM_RAWX_MEAS_SIZE)
+	{
+		return false;
+	}
+	meas.clear();
+	const uint8_t *p = payload + UBX_RXM_RAWX_HEADER_SIZE;
+	for(size_t i = 0; i < num; i++, p += UBX_RXM_RAWX_MEAS_SIZE)
+	{
+		rawx_meas m;
+		m.prMes = getr8(p, 0);
+		m.cpMes = getr8(p, 8);
+		m.doMes = getr4(p, 16);
+		m.gnssId = p[20];
+		m.svId = p[21];
+		m.sigId = p[22];
+		m.freqId = p[23];
+		m.locktime = getu2(p, 24);
+		m.cno = p[26];
+		m.prStdev = p[27] & 0x0f;
+		m.cpStdev = p[28] & 0x0f;
+		m.doStdev = p[29] & 0x0f;
+		m.trkStat = p[30];
+		meas.push_back(m);
+	}
+	return true;
+}
+
+/* Frames (without sync chars) one after the other */
+struct frame_set
+{
+	vector<uint8_t> data;
+	vector<size_t> offsets;
+	size_t meas;
+};
+
+static void add_frame(frame_set &set, const uint8_t *frame, size_t size)
+{
+	set.offsets.push_back(set.data.size());
+	set.data.insert(set.data.end(), frame, frame + size);
+	set.meas += frame[UBX_HEADER_SIZE + 11];
+}
+
+static int load_file(frame_set &set, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	ubx_decompressor decompressor(fd, ubx_compression_from_name(path));
+	ubx_reader reader(&decompressor);
+	reader.quiet = true;
+	const uint8_t *frame;
+	size_t size;
+	while(reader.next_frame(&frame, &size) != EOF)
+	{
+		ubx_frame_view view(frame, size);
+		if(view.valid && view.class_id == UBX_CLASS_RXM && view.msg_id == UBX_RXM_RAWX)
+		{
+			add_frame(set, frame, size);
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+/* Without recorded data: 32 measurements per epoch, like a multi-band receiver */
+static void synthesize(frame_set &set, size_t epochs)
+{
+	srand(1);
+	const size_t num = 32;
+	vector<uint8_t> payload(UBX_RXM_RAWX_HEADER_SIZE + num * UBX_RXM_RAWX_MEAS_SIZE);
+	vector<uint8_t> frame;
+	for(size_t e = 0; e < epochs; e++)
+	{
+		for(auto &c : payload)
+		{
+			c = rand();
+		}
+		payload[11] = num;
+		frame.clear();
+		ubx_gen_frame(frame, UBX_CLASS_RXM, UBX_RXM_RAWX, payload.data(), payload.size(), false);
+		add_frame(set, frame.data(), frame.size());
+	}
+}
+
+static ubx_frame_view view(const frame_set &set, size_t i)
+{
+	size_t end = i + 1 < set.offsets.size() ? set.offsets[i + 1] : set.data.size();
+	return ubx_frame_view(set.data.data() + set.offsets[i], end - set.offsets[i], true);
+}
+
+/* Both layouts must give the same values */
+static bool check(const frame_set &set, ubx_rxm_rawx &rawx)
+{
+	vector<rawx_meas> meas;
+	for(size_t i = 0; i < set.offsets.size(); i++)
+	{
+		ubx_frame_view frame = view(set, i);
+		if(!rawx.parse(frame) || !parse_aos(frame, meas) || meas.size() != rawx.numMeas)
+		{
+			fprintf(stderr, "frame %zd: decode failed\n", i);
+			return false;
+		}
+		for(size_t j = 0; j < meas.size(); j++)
+		{
+			const rawx_meas &m = meas[j];
+			if(memcmp(&m.prMes, &rawx.prMes[j], sizeof(double)) != 0 ||
+				memcmp(&m.cpMes, &rawx.cpMes[j], sizeof(double)) != 0 ||
+				memcmp(&m.doMes, &rawx.doMes[j], sizeof(float)) != 0 ||
+				m.gnssId != rawx.gnssId[j] || m.svId != rawx.svId[j] || m.sigId != rawx.sigId[j] ||
+				m.freqId != rawx.freqId[j] || m.locktime != rawx.locktime[j] || m.cno != rawx.cno[j] ||
+				m.prStdev != rawx.prStdev[j] || m.cpStdev != rawx.cpStdev[j] ||
+				m.doStdev != rawx.doStdev[j] || m.trkStat != rawx.trkStat[j])
+			{
+				fprintf(stderr, "frame %zd, measurement %zd differs\n", i, j);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static void report(const char *name, const frame_set &set, size_t rounds, uint64_t elapsed)
+{
+	double s = elapsed / 1e9;
+	printf("%-24s%10.1f ns/frame%10.2f Mmeas/s%10.1f MB/s\n", name,
+		(double)elapsed / (set.offsets.size() * rounds),
+		set.meas * rounds / s / 1e6, set.data.size() * rounds / s / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	frame_set set;
+	set.meas = 0;
+	for(int i = 1; i < argc; i++)
+	{
+		if(load_file(set, argv[i]) != 0)
+		{
+			return 1;
+		}
+	}
+	if(argc < 2)
+	{
+		synthesize(set, 4096);
+	}
+	if(set.offsets.empty())
+	{
+		fputs("No RXM-RAWX frames\n", stderr);
+		return 1;
+	}
+	printf("%zd RXM-RAWX frames, %zd measurements, %zd Bytes%s\n", set.offsets.size(), set.meas,
+		set.data.size(), argc < 2 ? " (synthetic)" : "");
+
+	// ~8 KiB, not on the stack
+	std::unique_ptr<ubx_rxm_rawx> rawx(new ubx_rxm_rawx());
+	if(!check(set, *rawx))
+	{
+		return 1;
+	}
+
+	// roughly 256 MiB worth of frames per measurement
+	size_t rounds = (256 << 20) / set.data.size() + 1;
+	size_t frames = set.offsets.size();
+	vector<rawx_meas> meas;
+	uint64_t start, elapsed;
+	volatile double sink = 0;
+
+	// Decoding
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < frames; i++)
+		{
+			rawx->parse(view(set, i));
+		}
+		sink = sink + rawx->prMes[0];
+	}
+	report("decode SoA", set, rounds, now_ns() - start);
+
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < frames; i++)
+		{
+			parse_aos(view(set, i), meas);
+		}
+		sink = sink + meas[0].prMes;
+	}
+	report("decode AoS (vector)", set, rounds, now_ns() - start);
+
+	// Decoding and a pass over one field, mean C/N0 of each epoch
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < frames; i++)
+		{
+			rawx->parse(view(set, i));
+			unsigned sum = 0;
+			for(size_t j = 0; j < rawx->numMeas; j++)
+			{
+				sum += rawx->cno[j];
+			}
+			sink = sink + sum;
+		}
+	}
+	report("decode + cno SoA", set, rounds, now_ns() - start);
+
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(size_t i = 0; i < frames; i++)
+		{
+			parse_aos(view(set, i), meas);
+			unsigned sum = 0;
+			for(const rawx_meas &m : meas)
+			{
+				sum += m.cno;
+			}
+			sink = sink + sum;
+		}
+	}
+	report("decode + cno AoS", set, rounds, now_ns() - start);
+
+	// The field pass alone, on the last decoded epoch
+	size_t passes = (64 << 20) / (rawx->numMeas + 1);
+	start = now_ns();
+	for(size_t r = 0; r < passes; r++)
+	{
+		unsigned sum = 0;
+		for(size_t j = 0; j < rawx->numMeas; j++)
+		{
+			sum += rawx->cno[j];
+		}
+		sink = sink + sum;
+	}
+	elapsed = now_ns() - start;
+	printf("%-24s%10.2f ns/meas\n", "cno pass SoA", (double)elapsed / (passes * rawx->numMeas));
+
+	start = now_ns();
+	for(size_t r = 0; r < passes; r++)
+	{
+		unsigned sum = 0;
+		for(const rawx_meas &m : meas)
+		{
+			sum += m.cno;
+		}
+		sink = sink + sum;
+	}
+	elapsed = now_ns() - start;
+	printf("%-24s%10.2f ns/meas\n", "cno pass AoS", (double)elapsed / (passes * meas.size()));
+	return 0;
+}
@@ -0,0 +1,572 @@
+/* ===================================== *
+ * bench_rtcm.cpp - RTCM3 from RXM-RAWX	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_rtcm.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <memory>
+
+using namespace UBX;
+
+constexpr double CLIGHT = 299792458.0;
+constexpr double RANGE_MS = CLIGHT * 0.001;
+constexpr int64_t WEEK_MS = 7 * 24 * 3600 * 1000LL;
+constexpr int64_t DAY_MS = 24 * 3600 * 1000LL;
+constexpr uint16_t WEEK = 2300;
+constexpr int8_t LEAP_S = 18;
+constexpr uint16_t STATION_ID = 1234;
+constexpr uint32_t STATION_INTERVAL_MS = 10000;
+/* Saturday 21:00:18 GPS time is midnight in Moscow, GLONASS' day of week goes back to 0 */
+constexpr int64_t MOSCOW_WEEK_END_MS = WEEK_MS - 3 * 3600 * 1000LL + LEAP_S * 1000LL;
+/* A slip every this many epochs on three signals in four, at a different one for each,
+ * the fourth keeps its lock for the whole run */
+constexpr size_t SLIP_EPOCHS = 97;
+
+/* Half a step of DF405 (fine pseudorange, 2^-29 ms), DF406 (fine phase range, 2^-31 ms)
+ * & DF404 (fine phase range rate, 0.0001 m/s), a little more for the rounding of doubles */
+static const double HALF_DF405 = RANGE_MS / (1 << 30) + 1e-9;
+static const double HALF_DF406 = RANGE_MS / 2 / (1u << 31) + 1e-9;
+constexpr double HALF_DF404 = 0.00005 + 1e-9;
+
+/* Two signals of each system, u-blox sigId & MSM signal ID, GLONASS FDMA steps the frequency */
+struct bench_signal
+{
+	uint8_t sigId;
+	uint8_t msm;
+	double freq;
+	double fcn_step;
+};
+
+struct bench_system
+{
+	uint8_t gnssId;
+	uint16_t type;
+	unsigned sats;
+	bench_signal sigs[2];
+};
+
+/* More than 32 GPS satellites with two signals, more than 64 cells & two 1077 */
+static const bench_system systems[RTCM_MSM_SYSTEMS] =
+{
+	{0, 1077, 34, {{0, 2, 1575.42e6, 0}, {3, 16, 1227.60e6, 0}}},
+	{6, 1087, 14, {{0, 2, 1602.0e6, 0.5625e6}, {2, 8, 1246.0e6, 0.4375e6}}},
+	{2, 1097, 10, {{0, 2, 1575.42e6, 0}, {5, 14, 1207.14e6, 0}}},
+	{3, 1127, 10, {{0, 2, 1561.098e6, 0}, {2, 14, 1207.14e6, 0}}}
+};
+
+/* One signal of one satellite, the truth the output is decoded against */
+struct bench_meas
+{
+	size_t system;
+	uint8_t sat;	/* PRN - 1 */
+	uint8_t msm;	/* MSM signal ID */
+	int fcn;
+	double lambda;	/* m */
+	double range;	/* m at the first epoch */
+	double rate;	/* m/s */
+	double bias;	/* m, code less range */
+	double ambiguity;	/* cycles */
+	int64_t lock_start;	/* ms, of the last slip */
+	/* Whole cycles taken out of the phase range, the same until the next slip */
+	int64_t cycles;
+	int64_t cycles_since;
+	size_t seen;	/* cells in this epoch */
+};
+
+struct bench_counts
+{
+	size_t epochs;
+	size_t messages;
+	size_t bytes;
+	size_t bad_frames;
+	size_t bad_crc;
+	size_t bad_headers;
+	size_t bad_epochs;
+	size_t bad_mmb;
+	size_t bad_cells;
+	size_t unsplit;
+	size_t bad_pr;
+	size_t bad_phase;
+	size_t phase_jumps;
+	size_t bad_rate;
+	size_t bad_lock;
+	size_t bad_info;
+	size_t bad_station;
+	size_t station_msgs;
+	size_t lock_max;	/* highest DF407 seen */
+	uint64_t ns;	/* in encode() */
+};
+
+/* CRC-24Q a bit at a time, not the encoder's table */
+static uint32_t crc24q(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		crc ^= (uint32_t)data[i] << 16;
+		for(int b = 0; b < 8; b++)
+		{
+			crc <<= 1;
+			if(crc & 0x1000000)
+			{
+				crc ^= 0x1864CFB;
+			}
+		}
+	}
+	return crc & 0xFFFFFF;
+}
+
+static uint32_t getbitu(const uint8_t *buf, size_t pos, unsigned len)
+{
+	uint32_t bits = 0;
+	for(unsigned i = 0; i < len; i++, pos++)
+	{
+		bits = bits << 1 | ((buf[pos / 8] >> (7 - pos % 8)) & 1);
+	}
+	return bits;
+}
+
+static int32_t getbits(const uint8_t *buf, size_t pos, unsigned len)
+{
+	uint32_t bits = getbitu(buf, pos, len);
+	if(len < 32 && (bits & (1u << (len - 1))))
+	{
+		bits |= ~((1u << len) - 1);
+	}
+	return (int32_t)bits;
+}
+
+static double get38bits(const uint8_t *buf, size_t pos)
+{
+	return getbits(buf, pos, 32) * 64.0 + getbitu(buf, pos + 32, 6);
+}
+
+/* Shortest lock time of a DF407 indicator, from the table in RTCM 10403.3 */
+static int64_t df407_min_lock(uint32_t ind)
+{
+	if(ind < 64)
+	{
+		return ind;
+	}
+	int64_t n = (ind - 64) / 32;
+	return ((int64_t)ind << (n + 1)) - (64 * (n + 1) << n);
+}
+
+/* The DF407 range the lock time has to be in */
+static bool df407_ok(uint32_t ind, int64_t lock)
+{
+	if(ind > 704)
+	{
+		return false;
+	}
+	return lock >= df407_min_lock(ind) && (ind == 704 || lock < df407_min_lock(ind + 1));
+}
+
+/* DF004 & the like, what an MSM epoch time should be */
+static uint32_t msm_epoch(size_t system, int64_t gps_ms)
+{
+	int64_t tow_ms = gps_ms % WEEK_MS;
+	switch(system)
+	{
+	case 1:
+	{
+		/* Day of week & time of day, Moscow time is UTC + 3 h */
+		int64_t moscow = gps_ms - LEAP_S * 1000LL + 3 * 3600 * 1000LL;
+		return (uint32_t)((moscow / DAY_MS) % 7) << 27 | (uint32_t)(moscow % DAY_MS);
+	}
+	case 3:
+		return (tow_ms - 14000 + WEEK_MS) % WEEK_MS;
+	default:
+		return tow_ms;
+	}
+}
+
+class bench_rtcm
+{
+public:
+	bench_counts counts;
+
+	bench_rtcm()
+	{
+		memset(&this->counts, 0, sizeof(this->counts));
+		this->first_ms = 0;
+		this->rawx.reset(new ubx_rxm_rawx());
+		this->encoder.station_id = STATION_ID;
+		this->encoder.station_interval = STATION_INTERVAL_MS;
+		this->encoder.arp_valid = true;
+		this->encoder.arp[0] = 4027893.8765;
+		this->encoder.arp[1] = -307045.6011;
+		this->encoder.arp[2] = 4919474.9103;
+		this->encoder.glo_cp_bias[0] = -1.24;
+		this->encoder.glo_cp_bias[1] = 2.5;
+		this->encoder.glo_cp_bias[3] = -0.02;
+
+		for(size_t s = 0; s < RTCM_MSM_SYSTEMS; s++)
+		{
+			const bench_system &sys = systems[s];
+			for(unsigned k = 0; k < sys.sats; k++)
+			{
+				for(const bench_signal &sig : sys.sigs)
+				{
+					bench_meas m;
+					memset(&m, 0, sizeof(m));
+					m.system = s;
+					m.sat = k;
+					m.msm = sig.msm;
+					m.fcn = s == 1 ? (int)(k % 14) - 7 : 0;
+					m.lambda = CLIGHT / (sig.freq + m.fcn * sig.fcn_step);
+					m.range = 20e6 + 1e5 * (k * 7 % 31) + 0.123 * s;
+					m.rate = -700.0 + 43.7 * ((k * 5 + s) % 33);
+					m.bias = sig.msm == 2 ? 0 : 1.5 + 0.25 * k;
+					m.ambiguity = 1000.0 * (k + 1) + 0.25;
+					this->meas.push_back(m);
+				}
+			}
+		}
+	}
+
+	/* One epoch into the encoder, its output checked */
+	void epoch(int64_t gps_ms, size_t e)
+	{
+		this->make_rawx(gps_ms, e);
+		this->out.clear();
+		uint64_t start = now_ns();
+		this->encoder.encode(*this->rawx, this->out);
+		this->counts.ns += now_ns() - start;
+		this->counts.epochs++;
+		this->check_epoch(gps_ms);
+	}
+private:
+	ubx_rtcm_encoder encoder;
+	/* ~8 KiB, not on the stack */
+	std::unique_ptr<ubx_rxm_rawx> rawx;
+	vector<bench_meas> meas;
+	vector<uint8_t> out;
+
+	void make_rawx(int64_t gps_ms, size_t e)
+	{
+		ubx_rxm_rawx &r = *this->rawx;
+		r.clear();
+		r.rcvTow = (gps_ms % WEEK_MS) / 1e3;
+		r.week = gps_ms / WEEK_MS;
+		r.leapS = LEAP_S;
+		r.recStat = 0x01;
+		r.valid = true;
+		/* The other way round from MSM's order, so the encoder has to sort */
+		for(size_t j = this->meas.size(); j-- > 0; )
+		{
+			bench_meas &m = this->meas[j];
+			size_t i = r.numMeas++;
+			double t = e;
+			double range = m.range + m.rate * t;
+			const bench_system &sys = systems[m.system];
+			const bench_signal &sig = sys.sigs[m.msm == 2 ? 0 : 1];
+			r.gnssId[i] = sys.gnssId;
+			r.svId[i] = m.sat + 1;
+			r.sigId[i] = sig.sigId;
+			r.freqId[i] = m.fcn + 7;
+			r.prMes[i] = range + m.bias;
+			r.cpMes[i] = range / m.lambda + m.ambiguity;
+			r.doMes[i] = -m.rate / m.lambda;
+			r.cno[i] = 30 + (m.sat + e) % 20;
+			r.prStdev[i] = 3;
+			r.cpStdev[i] = 2;
+			r.doStdev[i] = 4;
+			r.trkStat[i] = 0x07;
+			if(e == 0 || (j % 4 != 0 && (e + 7 * j) % SLIP_EPOCHS == 0))
+			{
+				m.lock_start = gps_ms;
+			}
+			int64_t lock = gps_ms - m.lock_start;
+			r.locktime[i] = lock > 64500 ? 64500 : lock;
+			m.seen = 0;
+		}
+	}
+
+	bench_meas *find(size_t system, size_t sat, size_t msm)
+	{
+		for(bench_meas &m : this->meas)
+		{
+			if(m.system == system && m.sat == sat && m.msm == msm)
+			{
+				return &m;
+			}
+		}
+		return NULL;
+	}
+
+	/* 1005 & 1230 back to what the encoder was given */
+	bool check_station(uint16_t type, const uint8_t *msg, size_t len)
+	{
+		if(type == 1005)
+		{
+			if(len != 19 || getbitu(msg, 24, 6) != 0 || getbitu(msg, 30, 4) != 0x0c)
+			{
+				return false;
+			}
+			double x = get38bits(msg, 34) * 0.0001;
+			double y = get38bits(msg, 74) * 0.0001;
+			double z = get38bits(msg, 114) * 0.0001;
+			/* Truncated like RTKLIB, within a step rather than half of one */
+			return fabs(x - this->encoder.arp[0]) < 0.0001 && fabs(y - this->encoder.arp[1]) < 0.0001 &&
+				fabs(z - this->encoder.arp[2]) < 0.0001;
+		}
+		if(len != 12 || getbitu(msg, 24, 1) != 0 || getbitu(msg, 28, 4) != 0x0f)
+		{
+			return false;
+		}
+		for(size_t b = 0; b < 4; b++)
+		{
+			if(fabs(getbits(msg, 32 + 16 * b, 16) * 0.02 - this->encoder.glo_cp_bias[b]) > 0.01 + 1e-9)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/* One MSM7 against the measurements, returns its multiple message bit */
+	bool check_msm(size_t system, const uint8_t *msg, size_t len, int64_t gps_ms)
+	{
+		bench_counts &c = this->counts;
+		c.bad_epochs += getbitu(msg, 24, 30) != msm_epoch(system, gps_ms);
+		bool mmb = getbitu(msg, 54, 1);
+		size_t i = 55 + 3 + 7 + 2 + 2 + 1 + 3;
+		uint8_t sats[RTCM_MSM_MAX_SATS], sigs[RTCM_MSM_MAX_SIGS];
+		size_t nsat = 0, nsig = 0;
+		for(size_t j = 0; j < RTCM_MSM_MAX_SATS; j++, i++)
+		{
+			if(getbitu(msg, i, 1))
+			{
+				sats[nsat++] = j;
+			}
+		}
+		for(size_t j = 0; j < RTCM_MSM_MAX_SIGS; j++, i++)
+		{
+			if(getbitu(msg, i, 1))
+			{
+				sigs[nsig++] = j + 1;
+			}
+		}
+		if(nsat * nsig > RTCM_MSM_MAX_CELLS)
+		{
+			c.unsplit++;
+			return mmb;
+		}
+		bench_meas *cells[RTCM_MSM_MAX_CELLS];
+		size_t ncell = 0;
+		for(size_t k = 0; k < nsat; k++)
+		{
+			for(size_t j = 0; j < nsig; j++, i++)
+			{
+				if(getbitu(msg, i, 1))
+				{
+					cells[ncell] = find(system, sats[k], sigs[j]);
+					if(cells[ncell] == NULL)
+					{
+						c.bad_cells++;
+						return mmb;
+					}
+					cells[ncell++]->seen++;
+				}
+			}
+		}
+		if((i + nsat * 36 + ncell * 80 + 7) / 8 != len)
+		{
+			c.bad_headers++;
+			return mmb;
+		}
+
+		/* Satellite data: rough range in whole & 1/1024 ms, extended info, rough rate */
+		double rough[RTCM_MSM_MAX_SATS], rough_rate[RTCM_MSM_MAX_SATS];
+		for(size_t k = 0; k < nsat; k++)
+		{
+			rough[k] = getbitu(msg, i + 8 * k, 8) + getbitu(msg, i + 12 * nsat + 10 * k, 10) / 1024.0;
+			rough_rate[k] = getbits(msg, i + 22 * nsat + 14 * k, 14);
+			int fcn = (int)getbitu(msg, i + 8 * nsat + 4 * k, 4) - 7;
+			c.bad_info += system == 1 && fcn != find(system, sats[k], sigs[0])->fcn;
+		}
+		i += 36 * nsat;
+
+		/* Signal data, each cell's satellite is the k with the cell in its row */
+		size_t cell = 0;
+		size_t mask = 55 + 3 + 7 + 2 + 2 + 1 + 3 + RTCM_MSM_MAX_SATS + RTCM_MSM_MAX_SIGS;
+		const ubx_rxm_rawx &r = *this->rawx;
+		for(size_t k = 0; k < nsat; k++)
+		{
+			for(size_t j = 0; j < nsig; j++)
+			{
+				if(!getbitu(msg, mask + k * nsig + j, 1))
+				{
+					continue;
+				}
+				bench_meas &m = *cells[cell];
+				size_t at = this->meas.size() - 1 - (&m - this->meas.data());
+				int32_t pr = getbits(msg, i + 20 * cell, 20);
+				int32_t ph = getbits(msg, i + 20 * ncell + 24 * cell, 24);
+				uint32_t lock = getbitu(msg, i + 44 * ncell + 10 * cell, 10);
+				int32_t rate = getbits(msg, i + 65 * ncell + 15 * cell, 15);
+
+				double P = (rough[k] + pr / 536870912.0) * RANGE_MS;
+				c.bad_pr += pr == -524288 || fabs(P - r.prMes[at]) > HALF_DF405;
+
+				/* Less whole cycles, which only change on a slip */
+				double L = (rough[k] + ph / 2147483648.0) * RANGE_MS;
+				double cycles = (r.cpMes[at] * m.lambda - L) / m.lambda;
+				int64_t n = llround(cycles);
+				c.bad_phase += ph == -8388608 || fabs((cycles - n) * m.lambda) > HALF_DF406;
+				if(m.cycles_since == m.lock_start && n != m.cycles)
+				{
+					c.phase_jumps++;
+				}
+				m.cycles = n;
+				m.cycles_since = m.lock_start;
+
+				double R = rough_rate[k] + rate * 0.0001;
+				c.bad_rate += rate == -16384 || fabs(R + r.doMes[at] * m.lambda) > HALF_DF404;
+
+				c.bad_lock += !df407_ok(lock, gps_ms - m.lock_start);
+				c.lock_max = lock > c.lock_max ? lock : c.lock_max;
+				cell++;
+			}
+		}
+		return mmb;
+	}
+
+	void check_epoch(int64_t gps_ms)
+	{
+		bench_counts &c = this->counts;
+		if(c.epochs == 1)
+		{
+			this->first_ms = gps_ms;
+		}
+		vector<bool> mmbs;
+		size_t gps_msgs = 0, station = 0, last_system = 0;
+		for(size_t pos = 0; pos < this->out.size(); )
+		{
+			const uint8_t *frame = this->out.data() + pos;
+			size_t left = this->out.size() - pos;
+			if(left < RTCM3_HEADER_SIZE + 2 + RTCM3_CRC_SIZE || frame[0] != RTCM3_PREAMBLE || (frame[1] & 0xfc) != 0)
+			{
+				c.bad_frames++;
+				break;
+			}
+			size_t len = (frame[1] & 0x03) << 8 | frame[2];
+			size_t size = RTCM3_HEADER_SIZE + len + RTCM3_CRC_SIZE;
+			if(size > left)
+			{
+				c.bad_frames++;
+				break;
+			}
+			uint32_t crc = frame[size - 3] << 16 | frame[size - 2] << 8 | frame[size - 1];
+			c.bad_crc += crc24q(frame, size - RTCM3_CRC_SIZE) != crc;
+			c.messages++;
+			c.bytes += size;
+			pos += size;
+
+			const uint8_t *msg = frame + RTCM3_HEADER_SIZE;
+			uint16_t type = getbitu(msg, 0, 12);
+			c.bad_headers += getbitu(msg, 12, 12) != STATION_ID;
+			if(type == 1005 || type == 1230)
+			{
+				c.station_msgs++;
+				station++;
+				c.bad_station += !check_station(type, msg, len);
+				continue;
+			}
+			/* MSM in system order, before 1005 & 1230 */
+			size_t s = 0;
+			while(s < RTCM_MSM_SYSTEMS && systems[s].type != type)
+			{
+				s++;
+			}
+			if(s == RTCM_MSM_SYSTEMS || s < last_system || station != 0)
+			{
+				c.bad_headers++;
+				continue;
+			}
+			last_system = s;
+			gps_msgs += s == 0;
+			mmbs.push_back(check_msm(s, msg, len, gps_ms));
+		}
+		/* Set on all but the epoch's last MSM */
+		for(size_t k = 0; k < mmbs.size(); k++)
+		{
+			c.bad_mmb += mmbs[k] != (k + 1 < mmbs.size());
+		}
+		c.bad_mmb += mmbs.size() != RTCM_MSM_SYSTEMS + 1;
+		c.unsplit += gps_msgs != 2;
+		bool due = (gps_ms - this->first_ms) % STATION_INTERVAL_MS == 0;
+		c.bad_station += station != (due ? 2u : 0u);
+		for(const bench_meas &m : this->meas)
+		{
+			c.bad_cells += m.seen != 1;
+		}
+	}
+
+	int64_t first_ms;
+};
+
+int main(int argc, char *argv[])
+{
+	size_t epochs = 600;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			epochs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n epochs]\n"
+				"\tEncodes 1 Hz RXM-RAWX of GPS, GLONASS, Galileo & BeiDou into MSM7, 1005 & 1230,\n"
+				"\tthen decodes every message & checks it against the measurements\n", argv[0]);
+			return 1;
+		}
+	}
+	if(epochs < 2 * SLIP_EPOCHS)
+	{
+		fprintf(stderr, "At least %zd epochs\n", 2 * SLIP_EPOCHS);
+		return 1;
+	}
+
+	/* Across GLONASS' end of the week half way through, then a short one across GPS' & BeiDou's */
+	bench_rtcm moscow, week;
+	int64_t start = (int64_t)WEEK * WEEK_MS + MOSCOW_WEEK_END_MS - epochs / 2 * 1000;
+	for(size_t e = 0; e < epochs; e++)
+	{
+		moscow.epoch(start + e * 1000, e);
+	}
+	start = (int64_t)(WEEK + 1) * WEEK_MS - 15000;
+	for(size_t e = 0; e < 30; e++)
+	{
+		week.epoch(start + e * 1000, e);
+	}
+
+	bench_counts c = moscow.counts;
+	const bench_counts &w = week.counts;
+	printf("%zd epochs, %zd messages, %zd Bytes, %.0f ns per epoch encoded, DF407 up to %zd\n",
+		c.epochs, c.messages, c.bytes, (double)c.ns / c.epochs, c.lock_max);
+
+	bool ok = true;
+	ok &= check(c.bad_frames + w.bad_frames == 0 && c.bad_crc + w.bad_crc == 0, "frames & CRC-24Q");
+	ok &= check(c.bad_headers + w.bad_headers == 0 && c.bad_mmb + w.bad_mmb == 0, "message order, station & multiple message bit");
+	ok &= check(c.bad_epochs + w.bad_epochs == 0, "epoch times, GLONASS Moscow day & BeiDou -14 s");
+	ok &= check(c.bad_cells + w.bad_cells == 0 && c.bad_info + w.bad_info == 0, "every measurement in exactly one cell");
+	ok &= check(c.unsplit + w.unsplit == 0, "more than 64 cells split over two messages");
+	ok &= check(c.bad_pr + w.bad_pr == 0, "DF405 pseudorange within half a step");
+	ok &= check(c.bad_phase + w.bad_phase == 0 && c.phase_jumps + w.phase_jumps == 0, "DF406 phase range within half a step");
+	ok &= check(c.bad_rate + w.bad_rate == 0, "DF404 phase range rate within half a step");
+	ok &= check(c.bad_lock + w.bad_lock == 0 && df407_ok(c.lock_max, (epochs - 1) * 1000), "DF407 lock time since the last slip");
+	ok &= check(c.bad_station + w.bad_station == 0 && c.station_msgs == 2 * ((epochs + 9) / 10), "1005 & 1230 round trip, every 10 s");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+/* ===================================== *
+ * bench_server.cpp - TCP fan-out load	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_server.hpp"
+#include "ubx_gen.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+using namespace UBX;
+
+/* B5 62 in front of each frame on the wire */
+constexpr size_t UBX_SYNC_SIZE = 2;
+
+/* Sequence number of the last frame, clients stop when they see it */
+constexpr uint32_t LAST_SEQ = 0xffffffff;
+
+/* RXM-RAWX sized frame, the payload is the sequence number then a pattern */
+static void make_frame(vector<uint8_t> &frame, uint32_t seq, size_t length)
+{
+	vector<uint8_t> payload(length);
+	memcpy(payload.data(), &seq, sizeof(seq));
+	for(size_t i = sizeof(seq); i < length; i++)
+	{
+		payload[i] = seq + i;
+	}
+	frame.clear();
+	ubx_gen_frame(frame, UBX_CLASS_RXM, UBX_RXM_RAWX, payload.data(), length, false);
+}
+
+struct bench_client
+{
+	int fd;
+	vector<uint8_t> buf;
+	uint32_t next_seq;
+	size_t frames;
+	size_t gaps;	// frames missing, the server's input ring dropped them
+	size_t corrupt;
+	bool done;
+};
+
+/* Whole frames out of what's been received so far */
+static void parse_client(bench_client &c)
+{
+	size_t pos = 0;
+	while(c.buf.size() - pos >= UBX_SYNC_SIZE + UBX_HEADER_SIZE)
+	{
+		const uint8_t *p = c.buf.data() + pos;
+		if(p[0] != UBX_SYNC1 || p[1] != UBX_SYNC2)
+		{
+			c.corrupt++;
+			pos = c.buf.size();
+			break;
+		}
+		size_t length = p[UBX_SYNC_SIZE + UBX_LENGTH_OFFSET] | p[UBX_SYNC_SIZE + UBX_LENGTH_OFFSET + 1] << 8;
+		size_t size = UBX_HEADER_SIZE + length + UBX_CKSUM_SIZE;
+		if(c.buf.size() - pos < UBX_SYNC_SIZE + size)
+		{
+			break;
+		}
+		const uint8_t *frame = p + UBX_SYNC_SIZE;
+		uint16_t cksum = ubx_cksum(frame, size - UBX_CKSUM_SIZE);
+		uint32_t seq;
+		memcpy(&seq, frame + UBX_HEADER_SIZE, sizeof(seq));
+		if(cksum != (frame[size - 2] << 8 | frame[size - 1]))
+		{
+			c.corrupt++;
+		}
+		else if(seq == LAST_SEQ)
+		{
+			c.done = true;
+		}
+		else
+		{
+			if(seq < c.next_seq)
+			{
+				c.corrupt++;
+			}
+			c.gaps += seq - std::min(seq, c.next_seq);
+			c.next_seq = seq + 1;
+			c.frames++;
+		}
+		pos += UBX_SYNC_SIZE + size;
+	}
+	c.buf.erase(c.buf.begin(), c.buf.begin() + pos);
+}
+
+static int connect_client(uint16_t port, int rcvbuf)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+	{
+		return -1;
+	}
+	if(rcvbuf > 0)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t num_clients = 500;
+	size_t num_slow = 10;
+	size_t epochs = 100;
+	size_t frames_per_epoch = 20;
+	size_t frame_length = 16 + 32 * 32;
+	unsigned rate = 20;
+	uint32_t max_lag_ms = 1000;
+	int opt;
+
+	while((opt = getopt(argc, argv, "c:s:e:f:r:l:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'c':
+			num_clients = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			num_slow = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			epochs = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			frames_per_epoch = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			max_lag_ms = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c clients] [-s slow_clients] [-e epochs] [-f frames_per_epoch] [-r epochs_per_s] [-l max_lag_ms]\n"
+				"\tSlow clients never read, they should be dropped then disconnected\n", argv[0]);
+			return 1;
+		}
+	}
+	if(num_slow > num_clients || rate == 0)
+	{
+		fputs("Bad arguments\n", stderr);
+		return 1;
+	}
+
+	/* A couple of fds per client, both ends are in this process */
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	ubx_server server(64 * 1024, max_lag_ms);
+	if(!server.parse("127.0.0.1:0") || server.listen() != 0)
+	{
+		perror("listen");
+		return 1;
+	}
+	server.start();
+
+	vector<bench_client> clients(num_clients);
+	for(size_t i = 0; i < num_clients; i++)
+	{
+		bench_client &c = clients[i];
+		/* Slow ones with a small socket buffer, the server's buffer fills up sooner */
+		c.fd = connect_client(server.port(), i < num_slow ? 4096 : 0);
+		if(c.fd < 0)
+		{
+			perror("connect");
+			return 1;
+		}
+		c.next_seq = 0;
+		c.frames = c.gaps = c.corrupt = 0;
+		c.done = false;
+	}
+	uint64_t start = now_ns();
+	while(server.clients.load() < num_clients)
+	{
+		if(now_ns() - start > 5000000000ULL)
+		{
+			fprintf(stderr, "Only %zd of %zd clients accepted\n", server.clients.load(), num_clients);
+			return 1;
+		}
+		usleep(1000);
+	}
+
+	/* The fast clients are all read by one thread */
+	std::thread reader([&]()
+	{
+		int epfd = epoll_create1(EPOLL_CLOEXEC);
+		for(size_t i = num_slow; i < num_clients; i++)
+		{
+			struct epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.ptr = &clients[i];
+			epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+		}
+		size_t remaining = num_clients - num_slow;
+		uint8_t chunk[65536];
+		struct epoll_event events[64];
+		while(remaining > 0)
+		{
+			int n = epoll_wait(epfd, events, 64, 10000);
+			if(n <= 0)
+			{
+				fputs("Reader timed out\n", stderr);
+				break;
+			}
+			for(int i = 0; i < n; i++)
+			{
+				bench_client &c = *(bench_client *)events[i].data.ptr;
+				ssize_t len = read(c.fd, chunk, sizeof(chunk));
+				if(len <= 0)
+				{
+					epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+					remaining--;
+					continue;
+				}
+				c.buf.insert(c.buf.end(), chunk, chunk + len);
+				parse_client(c);
+				if(c.done)
+				{
+					epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+					remaining--;
+				}
+			}
+		}
+		close(epfd);
+	});
+
+	/* The logger's side: the time spent in push() is what it would lose */
+	vector<uint8_t> frame;
+	uint64_t push_total = 0, push_max = 0;
+	size_t pushes = 0;
+	uint32_t seq = 0;
+	uint64_t period = 1000000000ULL / rate;
+	start = now_ns();
+	for(size_t e = 0; e < epochs; e++)
+	{
+		for(size_t f = 0; f < frames_per_epoch; f++)
+		{
+			make_frame(frame, seq++, frame_length);
+			ubx_frame_view view(frame.data(), frame.size(), true);
+			uint64_t t0 = now_ns();
+			server.push(view);
+			uint64_t t = now_ns() - t0;
+			push_total += t;
+			push_max = std::max(push_max, t);
+			pushes++;
+		}
+		server.push_epoch_end();
+		uint64_t next = start + (e + 1) * period;
+		uint64_t now = now_ns();
+		if(next > now)
+		{
+			usleep((next - now) / 1000);
+		}
+	}
+	uint64_t elapsed = now_ns() - start;
+	make_frame(frame, LAST_SEQ, frame_length);
+	server.push(ubx_frame_view(frame.data(), frame.size(), true));
+	server.push_epoch_end();
+	reader.join();
+
+	/* Per client lines of the server go to stderr */
+	server.stop();
+	server.dump_stats(stderr);
+
+	size_t complete = 0, corrupt = 0, min_frames = SIZE_MAX, max_frames = 0, gaps = 0;
+	for(size_t i = num_slow; i < num_clients; i++)
+	{
+		const bench_client &c = clients[i];
+		complete += c.done;
+		corrupt += c.corrupt;
+		gaps = std::max(gaps, c.gaps);
+		min_frames = std::min(min_frames, c.frames);
+		max_frames = std::max(max_frames, c.frames);
+	}
+	for(bench_client &c : clients)
+	{
+		close(c.fd);
+	}
+	double s = elapsed / 1e9;
+	printf("%zd clients (%zd never reading), %zd frames of %zd Bytes in %zd epochs, %.1f s\n",
+		num_clients, num_slow, pushes, frame.size() + UBX_SYNC_SIZE, epochs, s);
+	printf("push: %.0f ns mean, %.1f us max\n", (double)push_total / pushes, push_max / 1e3);
+	printf("sent: %zd frames, %.1f MB/s\n", server.frames_sent.load(), server.bytes_sent.load() / s / 1e6);
+	printf("fast clients: %zd of %zd complete, %zd..%zd frames, %zd missing (input ring), %zd corrupt\n",
+		complete, num_clients - num_slow, min_frames, max_frames, gaps, corrupt);
+	printf("slow clients: %zd frames dropped, %zd disconnected for lagging\n",
+		server.frames_dropped.load(), server.kicked.load());
+	bool ok = complete == num_clients - num_slow && corrupt == 0 && min_frames == max_frames &&
+		server.kicked.load() == num_slow;
+	puts(ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
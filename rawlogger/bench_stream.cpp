@@ -0,0 +1,595 @@
+/* ===================================== *
+ * bench_stream.cpp - UBX stream bench	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_gen.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_scan.hpp"
+#include "ubx_writer.hpp"
+#include "ubx_index.hpp"
+#include "ubx_dispatch.hpp"
+#include "bench.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+using namespace UBX;
+
+typedef ubx_dispatcher<ubx_nav_pvt, ubx_nav_eoe, ubx_nav_sig, ubx_rxm_rawx> bench_dispatcher;
+
+/* A frame the reader found, without sync chars */
+struct found_frame
+{
+	uint64_t offset;	/* of the sync chars */
+	uint32_t size;
+	bool valid;
+};
+
+struct result
+{
+	const char *name;
+	size_t frames;
+	size_t bytes;
+	uint64_t ns;
+};
+
+static int read_frames(int fd, vector<found_frame> &frames, size_t &wasted)
+{
+	if(lseek(fd, 0, SEEK_SET) != 0)
+	{
+		return -1;
+	}
+	ubx_reader reader(fd);
+	reader.quiet = true;
+	const uint8_t *start;
+	size_t size;
+	frames.clear();
+	while(reader.next_frame(&start, &size) != EOF)
+	{
+		bool valid = ubx_cksum(start, size - UBX_CKSUM_SIZE) == (start[size - 2] << 8 | start[size - 1]);
+		frames.push_back({reader.frame_offset, (uint32_t)size, valid});
+	}
+	wasted = reader.wasted_bytes;
+	return 0;
+}
+
+static ubx_frame_view view(const vector<uint8_t> &stream, const found_frame &f)
+{
+	return ubx_frame_view(stream.data() + f.offset + 2, f.size, f.valid);
+}
+
+/* Valid frames found at the sync chars of undamaged frames, & elsewhere */
+static void match(const vector<found_frame> &frames, const vector<uint64_t> &intact, size_t &hits, size_t &made_up)
+{
+	hits = 0;
+	made_up = 0;
+	size_t i = 0;
+	for(const found_frame &f : frames)
+	{
+		if(!f.valid)
+		{
+			continue;
+		}
+		while(i < intact.size() && intact[i] < f.offset)
+		{
+			i++;
+		}
+		if(i < intact.size() && intact[i] == f.offset)
+		{
+			hits++;
+		}
+		else
+		{
+			made_up++;
+		}
+	}
+}
+
+/* Frames held back by a false sync for many reads keep the time of the read
+ * that got their sync chars: one frame per read through a packet pipe, behind
+ * sync chars claiming more than all of them */
+static bool check_stamps()
+{
+	const size_t count = 4 * UBX_READER_STAMP_BLOCK;
+	int fds[2];
+	if(pipe2(fds, O_CLOEXEC | O_DIRECT) != 0)
+	{
+		perror("pipe2()");
+		return false;
+	}
+	vector<vector<uint8_t>> packets(count + 1);
+	const uint8_t false_sync[] = {UBX_SYNC1, UBX_SYNC2, UBX_CLASS_NAV, UBX_NAV_PVT, 0x00, 0xf0};
+	packets[0].assign(false_sync, false_sync + sizeof(false_sync));
+	for(size_t i = 1; i <= count; i++)
+	{
+		uint8_t itow[4] = {(uint8_t)i, (uint8_t)(i >> 8), 0, 0};
+		ubx_gen_frame(packets[i], UBX_CLASS_NAV, UBX_NAV_EOE, itow, sizeof(itow));
+	}
+	vector<uint64_t> written(count + 1);
+	std::thread writer([&]()
+	{
+		for(size_t i = 0; i <= count; i++)
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			written[i] = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			if(write(fds[1], packets[i].data(), packets[i].size()) != (ssize_t)packets[i].size())
+			{
+				break;
+			}
+			usleep(2000);
+		}
+		close(fds[1]);
+	});
+
+	ubx_reader reader(fds[0]);
+	reader.quiet = true;
+	ubx_frame_view frame;
+	size_t frames = 0, wrong = 0;
+	while(reader.read_frame(frame) != EOF)
+	{
+		size_t k = ++frames;
+		uint64_t mono = reader.frame_mono.tv_sec * 1000000000ULL + reader.frame_mono.tv_nsec;
+		/* Not before its read, nor as late as a few reads after */
+		wrong += k > count || mono < written[k] || (k + 4 <= count && mono >= written[k + 4]);
+	}
+	writer.join();
+	close(fds[0]);
+	return frames == count && wrong == 0;
+}
+
+/* An index across the GPS week rollover, searched against a scan of the
+ * records: UTC missing at the start & in every 7th epoch, or everywhere */
+static bool check_index(const string &dir, bool with_utc)
+{
+	const uint32_t week = 2300;
+	const size_t count = 1200;
+	const int64_t start = week * UBX_INDEX_WEEK_MS + UBX_INDEX_WEEK_MS - count / 2 * 1000;
+	string path = dir + "/bench_stream.ubx" + UBX_INDEX_SUFFIX;
+	ubx_index_writer writer;
+	if(writer.open(path.c_str(), UBX_COMPRESS_NONE) != 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	vector<int64_t> gps_ms(count), utc_ms(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		gps_ms[i] = start + i * 1000;
+		ubx_index_record rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.iTOW = gps_ms[i] % UBX_INDEX_WEEK_MS;
+		bool utc = with_utc && i >= 3 && i % 7 != 0;
+		rec.utc_ms = utc ? UBX_INDEX_GPS_EPOCH_MS + gps_ms[i] - 18000 : UBX_INDEX_NO_UTC;
+		utc_ms[i] = utc ? rec.utc_ms : i > 0 ? utc_ms[i - 1] : UBX_INDEX_NO_UTC;
+		rec.raw_offset = rec.file_offset = i * 1000;
+		writer.add_epoch(rec);
+	}
+	ubx_index index;
+	bool good = writer.close() == 0 && index.load(path.c_str()) == 0 && index.epochs.size() == count;
+	unlink(path.c_str());
+	if(!good)
+	{
+		return false;
+	}
+	/* Weeks are counted from 0 without UTC */
+	int64_t offset = with_utc ? 0 : week * UBX_INDEX_WEEK_MS;
+	good &= index.weeks_known == with_utc;
+	for(size_t i = 0; i < count; i++)
+	{
+		good &= index.week(i) == (gps_ms[i] - offset) / UBX_INDEX_WEEK_MS;
+	}
+	for(int64_t q = start - 1500; q < start + (int64_t)count * 1000 + 1500; q += 250)
+	{
+		size_t want = std::lower_bound(gps_ms.begin(), gps_ms.end(), q) - gps_ms.begin();
+		good &= index.find_itow((q - offset) / UBX_INDEX_WEEK_MS, q % UBX_INDEX_WEEK_MS) == want;
+		/* Without the week, the first time that iTOW comes after the start */
+		uint32_t itow = q % UBX_INDEX_WEEK_MS;
+		int64_t next = start - start % UBX_INDEX_WEEK_MS + itow;
+		next += next < start ? UBX_INDEX_WEEK_MS : 0;
+		good &= index.find_itow(itow) == (size_t)(std::lower_bound(gps_ms.begin(), gps_ms.end(), next) - gps_ms.begin());
+		if(with_utc)
+		{
+			int64_t utc = UBX_INDEX_GPS_EPOCH_MS + q - 18000;
+			good &= index.find_utc(utc) == (size_t)(std::lower_bound(utc_ms.begin(), utc_ms.end(), utc) - utc_ms.begin());
+		}
+	}
+	return good;
+}
+
+/* Chunks cut through damaged frames too, the scanner's merge has to get the
+ * reader's frames. Damaged like -x says, or one frame in a hundred each way
+ * if the benches run on a clean stream. */
+static bool check_damaged(ubx_gen_config config)
+{
+	if(config.bit_flips + config.truncations + config.false_syncs == 0)
+	{
+		config.bit_flips = config.truncations = config.false_syncs = 0.01;
+	}
+	ubx_generator gen(config);
+	vector<uint8_t> stream;
+	gen.generate(stream, 60 * config.rate);
+	int fd = stream_fd(stream);
+	vector<found_frame> frames;
+	size_t wasted;
+	if(fd < 0 || read_frames(fd, frames, wasted) != 0)
+	{
+		return false;
+	}
+	ubx_scanner scanner(fd, 4);
+	scanner.quiet = true;
+	size_t scanned = 0;
+	bool same = scanner.map() == 0 && scanner.run([&](const ubx_frame_view &frame)
+	{
+		same &= scanned < frames.size() && frame.size == frames[scanned].size
+			&& memcmp(frame.data, stream.data() + frames[scanned].offset + 2, frame.size) == 0;
+		scanned++;
+		return 0;
+	}) == 0;
+	close(fd);
+	return same && scanned == frames.size() && scanner.wasted_bytes == wasted
+		&& gen.flipped + gen.truncated + gen.false_syncs != 0;
+}
+
+static void report(const result &r)
+{
+	double s = r.ns / 1e9;
+	printf("%-24s%12.0f frames/s%10.1f MB/s%10.1f ns/frame\n", r.name,
+		r.frames / s, r.bytes / s / 1e6, (double)r.ns / r.frames);
+}
+
+/* One JSON object per line, appended, so runs of different builds can be compared */
+static int write_results(const char *path, const char *label, const ubx_gen_config &config,
+	const vector<result> &results)
+{
+	FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "a");
+	if(fp == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	for(const result &r : results)
+	{
+		double s = r.ns / 1e9;
+		fprintf(fp, "{\"label\":\"%s\",\"bench\":\"%s\",\"seed\":%llu,\"rate\":%u,\"sats\":[%u,%u],"
+			"\"messages\":%u,\"corruption\":[%g,%g,%g],\"cksum\":\"%s\",\"frames\":%zu,\"bytes\":%zu,"
+			"\"seconds\":%.6f,\"frames_per_s\":%.1f,\"mb_per_s\":%.3f,\"ns_per_frame\":%.2f}\n",
+			label, r.name, (unsigned long long)config.seed, config.rate, config.min_sats, config.max_sats,
+			config.messages, config.bit_flips, config.truncations, config.false_syncs, ubx_cksum_name(),
+			r.frames, r.bytes, s, r.frames / s, r.bytes / s / 1e6, (double)r.ns / r.frames);
+	}
+	if(fp != stdout)
+	{
+		fclose(fp);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	ubx_gen_config config;
+	size_t seconds = 600;
+	size_t mib = 256;
+	const char *results_path = NULL;
+	const char *label = "";
+	const char *dump_path = NULL;
+	string dir = "/tmp";
+	int opt;
+
+	while((opt = getopt(argc, argv, "r:n:m:x:s:S:M:o:l:w:d:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'r':
+			config.rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			if(sscanf(optarg, "%u,%u", &config.min_sats, &config.max_sats) != 2)
+			{
+				fprintf(stderr, "Bad satellite counts %s (min,max)\n", optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			if(!config.parse_messages(optarg))
+			{
+				fprintf(stderr, "Bad message mix %s (rawx,sfrbx,sig or all)\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			if(!config.parse_corruption(optarg))
+			{
+				fprintf(stderr, "Bad corruption %s (flips[,truncations[,false_syncs]], per frame)\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			config.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'M':
+			mib = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			results_path = optarg;
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		case 'w':
+			dump_path = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r epochs_per_s] [-n min_sats,max_sats] [-m rawx,sfrbx,sig]\n"
+				"\t[-x flips,truncations,false_syncs] [-s seconds] [-S seed] [-M MiB_per_bench]\n"
+				"\t[-o results.jsonl|-] [-l label] [-w stream.ubx] [-d dir]\n"
+				"\t-x damages that fraction of frames, 0.001,0.001,0.001 is one in a thousand each\n"
+				"\t-o appends one JSON object per bench, -l tags them (git revision, host...)\n"
+				"\t-w saves the generated stream, -d is where the write benches write\n", argv[0]);
+			return 1;
+		}
+	}
+	if(config.rate < 1 || config.rate > UBX_GEN_MAX_RATE || config.min_sats > config.max_sats ||
+		config.max_sats > UBX_GEN_MAX_SATS || seconds < 1)
+	{
+		fprintf(stderr, "Rate is 1 .. %u epochs/s, satellites 0 .. %u\n", UBX_GEN_MAX_RATE, UBX_GEN_MAX_SATS);
+		return 1;
+	}
+
+	bool ok = true;
+
+	/* Correctness first, on a clean stream of the same mix */
+	ubx_gen_config clean_config = config;
+	clean_config.bit_flips = clean_config.truncations = clean_config.false_syncs = 0;
+	ubx_generator clean_gen(clean_config);
+	vector<uint8_t> clean;
+	clean_gen.generate(clean, 60 * config.rate);
+	int clean_fd = stream_fd(clean);
+	vector<found_frame> frames;
+	size_t wasted;
+	if(clean_fd < 0 || read_frames(clean_fd, frames, wasted) != 0)
+	{
+		return 1;
+	}
+	bool all = frames.size() == clean_gen.intact.size() && wasted == 0;
+	for(size_t i = 0; all && i < frames.size(); i++)
+	{
+		all &= frames[i].valid && frames[i].offset == clean_gen.intact[i];
+	}
+	ok &= check(all, "reader finds every frame of a clean stream");
+	ok &= check(check_stamps(), "frames held back keep their read's time");
+	ok &= check(check_index(dir, true) && check_index(dir, false), "index search across the week rollover");
+
+	std::unique_ptr<bench_dispatcher> dispatcher(new bench_dispatcher());
+	size_t epochs = 0;
+	dispatcher->subscribe<ubx_nav_eoe>([&](const ubx_nav_eoe &) { epochs++; });
+	bool decodes = true;
+	for(const found_frame &f : frames)
+	{
+		ubx_frame_view frame = view(clean, f);
+		if(bench_dispatcher::is_registered(frame.class_id, frame.msg_id))
+		{
+			decodes &= dispatcher->dispatch(frame);
+		}
+	}
+	ok &= check(decodes && epochs == clean_gen.epochs, "decoders take every generated frame");
+
+	ubx_scanner clean_scanner(clean_fd, 1);
+	clean_scanner.quiet = true;
+	size_t scanned = 0;
+	bool same = clean_scanner.map() == 0 && clean_scanner.run([&](const ubx_frame_view &frame)
+	{
+		same &= scanned < frames.size() && frame.valid && frame.size == frames[scanned].size;
+		scanned++;
+		return 0;
+	}) == 0;
+	ok &= check(same && scanned == frames.size(), "scanner agrees with the reader");
+	close(clean_fd);
+	ok &= check(check_damaged(config), "scanner agrees with the reader when damaged");
+
+	/* The stream the benches run on */
+	ubx_generator gen(config);
+	vector<uint8_t> stream;
+	gen.generate(stream, seconds * config.rate);
+	if(dump_path != NULL)
+	{
+		FILE *fp = fopen(dump_path, "w");
+		if(fp == NULL || fwrite(stream.data(), 1, stream.size(), fp) != stream.size() || fclose(fp) != 0)
+		{
+			perror(dump_path);
+			return 1;
+		}
+	}
+	int fd = stream_fd(stream);
+	if(fd < 0 || read_frames(fd, frames, wasted) != 0)
+	{
+		return 1;
+	}
+	size_t hits, made_up;
+	match(frames, gen.intact, hits, made_up);
+	size_t valid = 0;
+	for(const found_frame &f : frames)
+	{
+		valid += f.valid;
+	}
+	printf("%zd epochs at %u Hz, %zd frames, %zd Bytes, %zd bit flips, %zd truncated, %zd false syncs\n",
+		gen.epochs, config.rate, gen.frames, stream.size(), gen.flipped, gen.truncated, gen.false_syncs);
+	printf("reader: %zd of %zd undamaged frames, %zd frames from damage that passed the checksum, %zd wasted Bytes\n",
+		hits, gen.intact.size(), made_up, wasted);
+	if(gen.flipped + gen.truncated + gen.false_syncs == 0)
+	{
+		ok &= check(hits == gen.intact.size() && made_up == 0, "reader finds every frame");
+	}
+
+	size_t rounds = ((mib << 20) + stream.size() - 1) / stream.size();
+	vector<result> results;
+	uint64_t start;
+	volatile size_t sink = 0;
+
+	/* Framing: sync search, header & length, as rawlogger's reader does it */
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		lseek(fd, 0, SEEK_SET);
+		ubx_reader reader(fd);
+		reader.quiet = true;
+		const uint8_t *frame;
+		size_t size;
+		while(reader.next_frame(&frame, &size) != EOF)
+		{
+			sink = sink + size;
+		}
+	}
+	results.push_back({"scan reader", frames.size() * rounds, stream.size() * rounds, now_ns() - start});
+
+	/* The same with the checksum, through the mmap()ed scanner */
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		ubx_scanner scanner(fd, 1);
+		scanner.quiet = true;
+		if(scanner.map() != 0)
+		{
+			perror("ubx_scanner::map()");
+			return 1;
+		}
+		scanner.run([&](const ubx_frame_view &frame)
+		{
+			sink = sink + frame.valid;
+			return 0;
+		});
+	}
+	results.push_back({"scan mmap + cksum", frames.size() * rounds, stream.size() * rounds, now_ns() - start});
+
+	/* Checksum of every frame, already framed */
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(const found_frame &f : frames)
+		{
+			const uint8_t *frame = stream.data() + f.offset + 2;
+			sink = sink + (ubx_cksum(frame, f.size - UBX_CKSUM_SIZE) == (frame[f.size - 2] << 8 | frame[f.size - 1]));
+		}
+	}
+	results.push_back({"cksum", frames.size() * rounds, stream.size() * rounds, now_ns() - start});
+
+	/* Decoding of the valid frames, through the dispatcher rawlogger uses */
+	start = now_ns();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		for(const found_frame &f : frames)
+		{
+			if(f.valid)
+			{
+				sink = sink + dispatcher->dispatch(view(stream, f));
+			}
+		}
+	}
+	results.push_back({"decode", valid * rounds, stream.size() * rounds, now_ns() - start});
+
+	/* Buffered writing, committed at each NAV-EOE, uncompressed & zstd */
+	string path = dir + "/bench_stream.ubx";
+	const struct
+	{
+		const char *name;
+		ubx_compression type;
+		size_t divide;
+	} writes[] = {
+		{"write", UBX_COMPRESS_NONE, 1},
+#ifdef HAVE_ZSTD
+		{"write zstd", UBX_COMPRESS_ZSTD, 4},
+#endif
+	};
+	for(const auto &w : writes)
+	{
+		ubx_writer writer;
+		writer.set_compression(w.type, w.type == UBX_COMPRESS_ZSTD ? 3 : UBX_COMPRESS_DEFAULT_LEVEL, UBX_COMPRESS_DEFAULT_EPOCHS);
+		size_t write_rounds = (rounds + w.divide - 1) / w.divide;
+		start = now_ns();
+		for(size_t r = 0; r < write_rounds; r++)
+		{
+			if(writer.open(path.c_str()) != 0)
+			{
+				perror(path.c_str());
+				return 1;
+			}
+			for(const found_frame &f : frames)
+			{
+				if(!f.valid)
+				{
+					continue;
+				}
+				ubx_frame_view frame = view(stream, f);
+				writer.write(frame);
+				if(frame.class_id == UBX_CLASS_NAV && frame.msg_id == UBX_NAV_EOE)
+				{
+					writer.commit();
+				}
+			}
+			writer.close();
+		}
+		results.push_back({w.name, valid * write_rounds, stream.size() * write_rounds, now_ns() - start});
+	}
+
+	/* All of it one after the other, like rawlogger without its threads */
+	{
+		ubx_writer writer;
+		start = now_ns();
+		for(size_t r = 0; r < rounds; r++)
+		{
+			lseek(fd, 0, SEEK_SET);
+			ubx_reader reader(fd);
+			reader.quiet = true;
+			if(writer.open(path.c_str()) != 0)
+			{
+				perror(path.c_str());
+				return 1;
+			}
+			ubx_frame_view frame;
+			while(reader.read_frame(frame) != EOF)
+			{
+				if(!frame.valid)
+				{
+					continue;
+				}
+				dispatcher->dispatch(frame);
+				writer.write(frame);
+				if(frame.class_id == UBX_CLASS_NAV && frame.msg_id == UBX_NAV_EOE)
+				{
+					writer.commit();
+				}
+			}
+			writer.close();
+		}
+		results.push_back({"pipeline", frames.size() * rounds, stream.size() * rounds, now_ns() - start});
+	}
+	unlink(path.c_str());
+	close(fd);
+
+	for(const result &r : results)
+	{
+		report(r);
+	}
+	if(results_path != NULL && write_results(results_path, label, config, results) != 0)
+	{
+		return 1;
+	}
+	return ok ? 0 : 1;
+}
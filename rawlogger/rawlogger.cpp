@@ -5,6 +5,20 @@
 
 #include "ubx.hpp"
 #include "ubx_nav.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_epoch.hpp"
+#include "ubx_writer.hpp"
+#include "ubx_dispatch.hpp"
+#include "ubx_serial.hpp"
+#include "ubx_scan.hpp"
+#include "ubx_sigstats.hpp"
+#include "ubx_rtcm.hpp"
+#include "ubx_server.hpp"
+#include "ubx_caster.hpp"
+#include "ubx_chrony.hpp"
+#include "ubx_pps.hpp"
+#include "ubx_histogram.hpp"
+#include "ubx_metrics.hpp"
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -18,85 +32,31 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <memory>
 
 #define RETURN_ERR \
 	return 1
 
 using namespace UBX;
 
-#define CHAR_CHECK(wasted)				\
-	if(c == EOF)					\
-	{						\
-		return c;				\
-	}						\
-	if(c == UBX_SYNC1)				\
-	{						\
-		if(fgetc(fp) == UBX_SYNC2)		\
-		{					\
-			ungetc(UBX_SYNC2, fp);		\
-			wasted_bytes += (wasted);	\
-			goto resync_sync2;		\
-		}					\
-	}						\
-
-
-int ubx_read_frame(FILE *fp, ubx_buf_t &buf)
+/* SIGUSR1: print the latency histograms */
+static volatile sig_atomic_t dump_requested = 0;
+
+static void on_sigusr1(int)
 {
-	int c = 0;
-	size_t length = 0;
-	size_t wasted_bytes = 0;
-	// Read until we get a sync char
-resync:
-	while (1)
-	{
-		c = fgetc(fp);
-		if (c == EOF)
-		{
-			return c;
-		}
-		if (c == 0xb5)
-		{
-			break;
-		}
-		wasted_bytes++;
-	}
-	// Get SYNC2
-resync_sync2:
-	if(fgetc(fp) != 0x62)
-	{
-		goto resync;
-	}
-	buf.clear();
-	if(wasted_bytes > 0)
-	{
-		fprintf(stderr, "ubx_read_frame(): WASTED %zd Bytes\n", wasted_bytes);
-	}
-	// Get class_id & msg_id
-	buf.push_back(c = fgetc(fp));
-	CHAR_CHECK(1);
-	buf.push_back(c = fgetc(fp));
-	CHAR_CHECK(2);
-	// Get length
-	buf.push_back(c = fgetc(fp));
-	CHAR_CHECK(3);
-	length = c & 0xff; // LSB
-	buf.push_back(c = fgetc(fp));
-	CHAR_CHECK(4);
-	length |= (c << 8) & 0xff00; // MSB
+	dump_requested = 1;
+}
 
-	// Now we know the length, read the payload & checksum
-	for(size_t i = 0; i < length + 2; i++)
-	{
-		buf.push_back(c = fgetc(fp));
-		if(c == EOF)
-		{
-			return c;
-		}
-	}
-	return c;
+static inline int64_t timespec_ns(const struct timespec &ts)
+{
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-void print_status_line(ubx_nav_pvt &pvt)
+void print_status_line(const ubx_nav_pvt &pvt)
 {
 	char buf[128];
 	fputc('\r', stderr);
@@ -115,25 +75,177 @@ int main(int argc, char *argv[])
 {
 	bool debug = false;
 	bool no_write = false;
-	FILE *readin = stdin;
-	FILE *writeout = NULL;
+	int readin = STDIN_FILENO;
+	const char *serial_port = NULL;
+	unsigned int baud = UBX_SERIAL_DEFAULT_BAUD;
+	ubx_serial serial;
+	size_t ring_size = UBX_RING_DEFAULT_SIZE;
+	ubx_ring_policy policy = UBX_RING_DROP_LOW_PRIORITY;
+	ubx_compression compression = UBX_COMPRESS_NONE;
+	int compress_level = UBX_COMPRESS_DEFAULT_LEVEL;
+	const char *level_str = NULL;
+	size_t compress_epochs = UBX_COMPRESS_DEFAULT_EPOCHS;
+	bool scan = false;
+	unsigned scan_threads = 0;
+	vector<uint32_t> sig_windows;
+	const char *rtcm_path = NULL;
+	ubx_rtcm_encoder rtcm;
+	/* Same time tag adjustment as str2str -opt -TADJ=1 in rtkserv.sh */
+	rtcm.tadj = 1.0;
+	vector<std::unique_ptr<ubx_server>> servers;
+	std::unique_ptr<ubx_caster> caster;
+	std::unique_ptr<ubx_chrony> chrony;
+	std::unique_ptr<ubx_pps> pps;
+	const char *metrics_address = NULL;
+	const char *stats_file = NULL;
+	bool quiet = false;
 
 	setvbuf(stderr, NULL, _IONBF, 0);
 
 	int opt;
 
-	while((opt = getopt(argc, argv, "f:dn")) != -1)
+	while((opt = getopt(argc, argv, "f:s:b:r:p:z:l:E:j:w:o:I:A:T:C:M:K:P:m:S:qdn")) != -1)
 	{
 		switch(opt)
 		{
 		case 'f':
-			readin = fopen(optarg, "rb");
-			if(readin == NULL)
+			readin = open(optarg, O_RDONLY);
+			if(readin < 0)
 			{
 				perror(optarg);
 				RETURN_ERR;
 			}
 			break;
+		case 's':
+			serial_port = optarg;
+			break;
+		case 'b':
+			baud = strtoul(optarg, NULL, 10);
+			if(ubx_serial_speed(baud) == B0)
+			{
+				fprintf(stderr, "Unsupported baud rate %s\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'r':
+			ring_size = strtoul(optarg, NULL, 10) * 1024;
+			break;
+		case 'p':
+			if(strcmp(optarg, "block") == 0)
+				policy = UBX_RING_BLOCK;
+			else if(strcmp(optarg, "epoch") == 0)
+				policy = UBX_RING_DROP_EPOCH;
+			else if(strcmp(optarg, "priority") == 0)
+				policy = UBX_RING_DROP_LOW_PRIORITY;
+			else
+			{
+				fprintf(stderr, "Unknown ring policy %s (block, epoch or priority)\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'z':
+			if(!ubx_compression_parse(optarg, compression))
+			{
+				fprintf(stderr, "Unsupported compression %s\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'l':
+			level_str = optarg;
+			break;
+		case 'E':
+			compress_epochs = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			scan = true;
+			scan_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			/* Comma separated window lengths in seconds */
+			for(char *tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ","))
+			{
+				double secs = atof(tok);
+				if(secs <= 0)
+				{
+					fprintf(stderr, "Bad window %s\n", tok);
+					RETURN_ERR;
+				}
+				sig_windows.push_back(secs * 1000);
+			}
+			break;
+		case 'o':
+			rtcm_path = optarg;
+			break;
+		case 'I':
+			rtcm.station_id = strtoul(optarg, NULL, 10);
+			break;
+		case 'A':
+			if(sscanf(optarg, "%lf,%lf,%lf", &rtcm.arp[0], &rtcm.arp[1], &rtcm.arp[2]) != 3)
+			{
+				fprintf(stderr, "Bad ARP %s (x,y,z in m)\n", optarg);
+				RETURN_ERR;
+			}
+			rtcm.arp_valid = true;
+			break;
+		case 'T':
+			servers.emplace_back(new ubx_server());
+			if(!servers.back()->parse(optarg))
+			{
+				fprintf(stderr, "Bad server %s ([host:]port[/CLASS,...])\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'C':
+			caster.reset(new ubx_caster());
+			if(!caster->parse(optarg))
+			{
+				fprintf(stderr, "Bad caster address %s ([host:]port)\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'M':
+			if(!caster)
+			{
+				fputs("-M needs -C first\n", stderr);
+				RETURN_ERR;
+			}
+			if(!caster->add_mount(optarg))
+			{
+				fprintf(stderr, "Bad mountpoint %s (NAME:ubx[/CLASS,...][@user:password] or NAME:rtcm[@user:password])\n", optarg);
+				RETURN_ERR;
+			}
+			break;
+		case 'K':
+			chrony.reset(new ubx_chrony(optarg));
+			break;
+		case 'P':
+		{
+			/* Same socket name as gpsd's, /var/run/chrony.pps0.sock for /dev/pps0 */
+			string device = optarg;
+			string socket_path;
+			size_t comma = device.find(',');
+			if(comma != string::npos)
+			{
+				socket_path = device.substr(comma + 1);
+				device.resize(comma);
+			}
+			else
+			{
+				string copy = device;
+				socket_path = string("/var/run/chrony.") + basename(&copy[0]) + ".sock";
+			}
+			pps.reset(new ubx_pps(device.c_str(), socket_path.c_str()));
+			break;
+		}
+		case 'm':
+			metrics_address = optarg;
+			break;
+		case 'S':
+			stats_file = optarg;
+			break;
+		case 'q':
+			quiet = true;
+			break;
 		case 'd':
 			debug = true;
 			break;
@@ -141,92 +253,616 @@ int main(int argc, char *argv[])
 			no_write = true;
 			break;
 		default:
-			fprintf(stderr, "Usage: %s [-f input_file] [-n] [-d]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-f input_file [-j threads] | -s serial_port [-b baud]] [-r ring_KiB] [-p block|epoch|priority]\n"
+				"\t[-z none|xz|zstd] [-l level] [-E epochs_per_frame] [-w secs[,secs...]]\n"
+				"\t[-o rtcm_output [-I station_id] [-A arp_x,y,z]] [-T [host:]port[/CLASS,...]]...\n"
+				"\t[-C [host:]port -M NAME:ubx[/CLASS,...]|rtcm[@user:password]...] [-K chrony_socket]\n"
+				"\t[-P pps_device[,chrony_socket]] [-m [host:]port] [-S stats_file[,secs]] [-q] [-n] [-d]\n"
+				"\t-j scans input_file with that many threads, 0 for one per CPU\n"
+				"\t-w prints per signal NAV-SIG statistics over windows of that many seconds\n"
+				"\t-o writes RTCM3 MSM7, 1005 & 1230 made from RXM-RAWX to a file or FIFO\n"
+				"\t-T serves the UBX stream, or only these classes, to TCP clients\n"
+				"\t-C is an NTRIP caster for local rovers, with -M mountpoints of UBX or RTCM3\n"
+				"\t-K sends NAV-PVT time to a chrony SOCK refclock, stamped when each epoch starts coming in\n"
+				"\t-P sends PPS edges corrected by TIM-TP qErr to a chrony SOCK refclock, needs TIM-TP enabled\n"
+				"\t-m serves Prometheus metrics on http://host:port/metrics, host is localhost if not given\n"
+				"\t-S rewrites stats_file with the same metrics every secs (default %u)\n"
+				"\t-q prints nothing per frame or epoch, see the metrics instead\n", argv[0], UBX_METRICS_DEFAULT_INTERVAL);
 			RETURN_ERR;
 		}
 	}
 
-	ubx_nav_pvt current_pvt, last_pvt;
+	/* Checked once -z is known, a bad level would only fail at the first write.
+	 * Without compression there's nothing to check, & it's not used. */
+	int level_min, level_max;
+	if(level_str != NULL && ubx_compression_levels(compression, level_min, level_max))
+	{
+		char *end;
+		long level = strtol(level_str, &end, 10);
+		if(end == level_str || *end != '\0' || level < level_min || level > level_max)
+		{
+			fprintf(stderr, "Bad compression level %s (%d .. %d)\n", level_str, level_min, level_max);
+			RETURN_ERR;
+		}
+		compress_level = level;
+	}
+
+	/* Only the main thread takes SIGUSR1, threads started from here on have it blocked */
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = on_sigusr1;
+	act.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &act, NULL);
+	/* A FIFO's reader going away is a write error, not the end of the logger */
+	act.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &act, NULL);
+	sigset_t usr1;
+	sigemptyset(&usr1);
+	sigaddset(&usr1, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &usr1, NULL);
 
-	while(1)
+	if(serial_port != NULL)
 	{
-		ubx_buf_t buf;
-		if(ubx_read_frame(readin, buf) == EOF)
+		if(serial.open(serial_port, baud) != 0)
 		{
-			break;
+			perror(serial_port);
+			RETURN_ERR;
 		}
+		readin = serial.fd;
+	}
 
-		ubx_frame frame(buf);
-		if(!frame.valid)
+	/* Non-blocking, a slow reader loses corrections rather than stalling the logger.
+	 * A FIFO without a reader (ENXIO) is opened again on a later epoch. */
+	int rtcm_fd = -1;
+	size_t rtcm_dropped = 0;
+	size_t rtcm_errors = 0;
+	vector<uint8_t> rtcm_buf;
+	if(rtcm_path != NULL)
+	{
+		rtcm_fd = open(rtcm_path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+		if(rtcm_fd < 0 && errno != ENXIO)
+		{
+			perror(rtcm_path);
+			RETURN_ERR;
+		}
+	}
+
+	/* Listen before reading anything, a port in use is an error at startup */
+	for(auto &server : servers)
+	{
+		if(server->listen() != 0)
 		{
-			fprintf(stderr, "Invalid frame!\n");
-			frame.dump(stderr);
-			continue;
+			perror("Can't listen");
+			RETURN_ERR;
+		}
+		if(debug)
+		{
+			fprintf(stderr, "Serving on port %u\n", server->port());
+		}
+		server->start();
+	}
+	if(caster && caster->mountpoints() == 0)
+	{
+		fputs("-C needs at least one -M mountpoint\n", stderr);
+		RETURN_ERR;
+	}
+	if(caster)
+	{
+		/* Same station as -o */
+		caster->rtcm = rtcm;
+		if(caster->listen() != 0)
+		{
+			perror("Can't listen");
+			RETURN_ERR;
 		}
-		/* Passthrough */
-		if(writeout != NULL)
-			frame.write(writeout);
 		if(debug)
 		{
-			ubx_any_msg msg(frame);
-			msg.dump(stderr);
+			fputs(caster->sourcetable().c_str(), stderr);
+		}
+		caster->start();
+	}
+
+	if(scan && serial_port != NULL)
+	{
+		fputs("-j only works on files\n", stderr);
+		RETURN_ERR;
+	}
+	if(chrony && scan)
+	{
+		fputs("-K needs the input read as it comes, not -j\n", stderr);
+		RETURN_ERR;
+	}
+	/* chronyd may come up later, samples are sent once it's there */
+	if(chrony && chrony->open() != 0)
+	{
+		perror("chrony socket");
+	}
+	if(pps && scan)
+	{
+		fputs("-P needs the input read as it comes, not -j\n", stderr);
+		RETURN_ERR;
+	}
+	if(pps)
+	{
+		if(pps->open() != 0)
+		{
+			perror("PPS device");
+			RETURN_ERR;
+		}
+		if(pps->open_chrony() != 0)
+		{
+			perror("chrony PPS socket");
+		}
+		pps->start();
+	}
+
+	ubx_nav_pvt current_pvt, last_pvt;
+	ubx_reader reader(readin);
+	/* Offline mode: frames come from the parallel scanner instead of the reader */
+	ubx_scanner scanner(readin, scan_threads, debug ? stderr : NULL);
+	if(scan && scanner.map() != 0)
+	{
+		perror("Can't map input");
+		RETURN_ERR;
+	}
+	ubx_writer_thread writer(ring_size, policy);
+	bool writing = false;
+	writer.set_compression(compression, compress_level, compress_epochs);
+	writer.start();
+	ubx_dispatcher<ubx_nav_pvt, ubx_nav_eoe, ubx_nav_sig, ubx_rxm_rawx, ubx_tim_tp> dispatcher;
+	ubx_sig_stats sig_stats(sig_windows);
+	/* Every frame between NAV-EOEs, for whoever needs whole epochs */
+	ubx_epoch_assembler assembler;
+	int err = 0;
+	/* When the first Byte of the current epoch was read, for chrony */
+	bool epoch_start = true;
+	struct timespec epoch_arrival;
+	memset(&epoch_arrival, 0, sizeof(epoch_arrival));
+	/* Receive path latency, CLOCK_MONOTONIC of when each frame's first Byte was read */
+	ubx_histogram frame_gap("frame gap"), epoch_assembly("epoch assembly"), epoch_processing("processing");
+	int64_t frame_ns = 0, last_frame_ns = 0, epoch_start_ns = 0, eoe_ns = 0;
+	bool epoch_done = false;
+	auto dump_latency = [&](FILE *fp)
+	{
+		fputs("\nLatency: first Byte read to first Byte read, epoch's first Byte to NAV-EOE,\n"
+			"\tNAV-EOE to handled, NAV-EOE to written\n", fp);
+		frame_gap.dump(fp);
+		epoch_assembly.dump(fp);
+		epoch_processing.dump(fp);
+		writer.write_latency.dump(fp);
+	};
+
+	/* Registered before the exporter starts, the registry never changes after that */
+	ubx_metrics metrics;
+	std::atomic<size_t> &bad_frames = metrics.counter("ubx_checksum_failures_total", "Sync chars followed by a bad checksum");
+	std::atomic<size_t> &malformed_frames = metrics.counter("ubx_malformed_frames_total", "Frames with a good checksum the decoder refused");
+	std::atomic<size_t> &itow_mismatches = metrics.counter("ubx_itow_mismatches_total", "NAV-EOE without its epoch's NAV-PVT");
+	std::atomic<size_t> &epochs = metrics.counter("ubx_epochs_total", "Epochs read, by NAV-EOE");
+	std::atomic<size_t> &bytes_in = metrics.counter("ubx_read_bytes_total", "Bytes read from the receiver or file");
+	std::atomic<size_t> &wasted_bytes = metrics.counter("ubx_wasted_bytes_total", "Bytes read that were not in a frame");
+	metrics.add("ubx_epochs_incomplete_total", "Epochs without their NAV-EOE or NAV-PVT", UBX_METRIC_COUNTER, assembler.incomplete);
+	metrics.add("ubx_epochs_overlapping_total", "Epochs with NAV messages of the one before", UBX_METRIC_COUNTER, assembler.overlapping);
+	metrics.add("ubx_epoch_arena_bytes", "Memory held for assembling epochs", UBX_METRIC_GAUGE, assembler.arena_bytes);
+	metrics.add("ubx_written_bytes_total", "Bytes written to log files, after compression", UBX_METRIC_COUNTER, writer.bytes_written);
+	metrics.add("ubx_files_opened_total", "Log files opened, at start & each new day", UBX_METRIC_COUNTER, writer.files_opened);
+	/* Queues between the logger & its threads */
+	auto add_queue = [&](const string &labels, std::function<double()> used)
+	{
+		metrics.add("ubx_queue_bytes", "Bytes queued for a thread", UBX_METRIC_GAUGE, used, labels);
+	};
+	add_queue("queue=\"writer\"", [&]() { return writer.ring.used(); });
+	metrics.add("ubx_queue_high_water_bytes", "Most Bytes ever queued for a thread", UBX_METRIC_GAUGE, writer.ring.high_water, "queue=\"writer\"");
+	metrics.add("ubx_queue_full_total", "Pushes that found the queue full", UBX_METRIC_COUNTER, writer.ring.overflows, "queue=\"writer\"");
+	metrics.add("ubx_queue_dropped_frames_total", "Frames dropped from a full queue", UBX_METRIC_COUNTER, writer.ring.dropped_frames, "queue=\"writer\"");
+	metrics.add("ubx_queue_dropped_epochs_total", "Epochs dropped from a full queue", UBX_METRIC_COUNTER, writer.ring.dropped_epochs, "queue=\"writer\"");
+	for(auto &server : servers)
+	{
+		ubx_server *s = server.get();
+		string labels = "port=\"" + std::to_string(s->port()) + "\"";
+		add_queue("queue=\"server\"," + labels, [s]() { return s->queued(); });
+		metrics.add("ubx_server_clients", "TCP clients connected", UBX_METRIC_GAUGE, s->clients, labels);
+		metrics.add("ubx_server_kicked_total", "TCP clients disconnected for lagging", UBX_METRIC_COUNTER, s->kicked, labels);
+		metrics.add("ubx_server_dropped_frames_total", "Frames a lagging TCP client didn't get", UBX_METRIC_COUNTER, s->frames_dropped, labels);
+		metrics.add("ubx_server_sent_bytes_total", "Bytes sent to TCP clients", UBX_METRIC_COUNTER, s->bytes_sent, labels);
+	}
+	if(caster)
+	{
+		ubx_caster *c = caster.get();
+		add_queue("queue=\"caster\"", [c]() { return c->queued(); });
+		metrics.add("ubx_caster_clients", "NTRIP clients connected", UBX_METRIC_GAUGE, c->clients);
+		metrics.add("ubx_caster_refused_total", "NTRIP requests refused", UBX_METRIC_COUNTER, c->refused);
+		metrics.add("ubx_caster_kicked_total", "NTRIP rovers disconnected for lagging", UBX_METRIC_COUNTER, c->kicked);
+	}
+	/* Kernel counters of the serial port, by what went up since the last epoch */
+	std::atomic<size_t> *serial_errors[5] = {};
+	if(serial.fd >= 0)
+	{
+		serial_errors[0] = &metrics.counter("ubx_serial_overruns_total", "Serial input lost to a full buffer", "buffer=\"uart\"");
+		serial_errors[1] = &metrics.counter("ubx_serial_overruns_total", "Serial input lost to a full buffer", "buffer=\"tty\"");
+		serial_errors[2] = &metrics.counter("ubx_serial_line_errors_total", "Serial line errors", "error=\"framing\"");
+		serial_errors[3] = &metrics.counter("ubx_serial_line_errors_total", "Serial line errors", "error=\"parity\"");
+		serial_errors[4] = &metrics.counter("ubx_serial_line_errors_total", "Serial line errors", "error=\"break\"");
+	}
+	metrics.add("ubx_latency_seconds", "Receive path latency", frame_gap, "stage=\"frame_gap\"");
+	metrics.add("ubx_latency_seconds", "Receive path latency", epoch_assembly, "stage=\"epoch_assembly\"");
+	metrics.add("ubx_latency_seconds", "Receive path latency", epoch_processing, "stage=\"processing\"");
+	metrics.add("ubx_latency_seconds", "Receive path latency", writer.write_latency, "stage=\"write\"");
+	ubx_metrics_exporter exporter(metrics);
+	if(metrics_address != NULL && !exporter.set_address(metrics_address))
+	{
+		fprintf(stderr, "Bad metrics address %s ([host:]port)\n", metrics_address);
+		RETURN_ERR;
+	}
+	if(stats_file != NULL && !exporter.set_file(stats_file))
+	{
+		fprintf(stderr, "Bad stats file %s (path[,secs])\n", stats_file);
+		RETURN_ERR;
+	}
+	if(exporter.enabled())
+	{
+		if(exporter.listen() != 0)
+		{
+			perror("Can't listen");
+			RETURN_ERR;
 		}
+		exporter.start();
+	}
+	reader.quiet = quiet;
+	scanner.quiet = quiet;
 
-		ubx_nav_pvt pvt(frame);
-		if(pvt.valid)
+	dispatcher.subscribe<ubx_nav_pvt>([&](const ubx_nav_pvt &pvt)
+	{
+		//pvt.dump(stderr);
+		current_pvt = pvt;
+		if(!quiet)
 		{
-			//pvt.dump(stderr);
-			current_pvt = pvt;
 			print_status_line(pvt);
 		}
+	});
+
+	if(pps)
+	{
+		/* Stamped like the epochs, the correlator needs to know which edge it came before */
+		dispatcher.subscribe<ubx_tim_tp>([&](const ubx_tim_tp &tp)
+		{
+			pps->add_tp(tp, reader.frame_time);
+		});
+	}
 
-		ubx_nav_eoe eoe(frame);
-		if(eoe.valid)
+	dispatcher.subscribe<ubx_nav_eoe>([&](const ubx_nav_eoe &eoe)
+	{
+		//eoe.dump(stderr);
+		ubx_metrics::add(epochs, 1);
+		if(eoe.iTOW != current_pvt.data.iTOW)
 		{
-			//eoe.dump(stderr);
-			if(eoe.iTOW != current_pvt.data.iTOW)
+			ubx_metrics::add(itow_mismatches, 1);
+			if(!quiet)
 			{
 				fprintf(stderr, "\nEOE iTOW mismatch! %u != %u\n", eoe.iTOW, last_pvt.data.iTOW);
 			}
-			
+		}
+
+		if(!quiet)
+		{
 			fputs(" EOE", stderr);
+		}
 
-			/* Open new file if either no file is open, or the PVT day is changed */
-			if((writeout == NULL || current_pvt.data.day != last_pvt.data.day) && !no_write)
+		if(serial.fd >= 0)
+		{
+			struct serial_icounter_struct delta;
+			if(serial.check_errors(quiet ? NULL : stderr, delta))
 			{
-				if(writeout != NULL)
-					fclose(writeout);
-				/* if month changed, make new directory */
-				char dirname[64];
-				if(current_pvt.data.month != last_pvt.data.month)
+				ubx_metrics::add(*serial_errors[0], delta.overrun);
+				ubx_metrics::add(*serial_errors[1], delta.buf_overrun);
+				ubx_metrics::add(*serial_errors[2], delta.frame);
+				ubx_metrics::add(*serial_errors[3], delta.parity);
+				ubx_metrics::add(*serial_errors[4], delta.brk);
+			}
+		}
+
+		if(!scan)
+		{
+			eoe_ns = frame_ns;
+			epoch_assembly.record(eoe_ns - epoch_start_ns);
+			epoch_done = true;
+		}
+
+		if(chrony && eoe.iTOW == current_pvt.data.iTOW)
+		{
+			chrony->send(current_pvt, epoch_arrival);
+		}
+		epoch_start = true;
+
+		for(auto &server : servers)
+		{
+			server->push_epoch_end();
+		}
+		if(caster)
+		{
+			caster->push_epoch_end();
+		}
+
+		/* Whole epoch is queued, let the writer thread write it out */
+		if(writing)
+		{
+			ubx_epoch_info info;
+			info.iTOW = eoe.iTOW;
+			info.reserved = 0;
+			info.arrival_ns = eoe_ns;
+			/* UTC only if this epoch had a PVT */
+			if(eoe.iTOW != current_pvt.data.iTOW || !current_pvt.get_utc_ms(info.utc_ms))
+			{
+				info.utc_ms = UBX_INDEX_NO_UTC;
+			}
+			writer.ring.push_epoch_end(info);
+		}
+
+		/* Open new file if either no file is open, or the PVT day is changed */
+		if((!writing || current_pvt.data.day != last_pvt.data.day) && !no_write)
+		{
+			/* Directory is made by the writer thread if month changed */
+			char filename[128];
+			snprintf(filename, 128, "%04u-%02hhu/%04u%02hhu%02hhuT%02hhu%02hhu%02hhu.ubx%s",
+				current_pvt.data.year, current_pvt.data.month,
+				current_pvt.data.year, current_pvt.data.month, current_pvt.data.day, current_pvt.data.hour, current_pvt.data.min, current_pvt.data.sec,
+				ubx_compression_suffix(compression));
+			writer.ring.push_open(filename);
+			writing = true;
+		}
+
+		last_pvt = current_pvt;
+	});
+
+	if(debug)
+	{
+		assembler.subscribe([&](const ubx_epoch_ref &epoch)
+		{
+			fputc('\n', stderr);
+			epoch->dump(stderr);
+		});
+	}
+
+	if(!sig_windows.empty())
+	{
+		dispatcher.subscribe<ubx_nav_sig>([&](const ubx_nav_sig &sig)
+		{
+			sig_stats.update(sig);
+			for(size_t w = 0; w < sig_stats.windows(); w++)
+			{
+				if(sig_stats.rolled(w))
+				{
+					fputc('\n', stderr);
+					sig_stats.dump(stderr, w);
+				}
+			}
+		});
+	}
+
+	if(rtcm_path != NULL)
+	{
+		/* Encoded as soon as RAWX is in, not at the end of the epoch.
+		 * Nothing here stops the logger, what can't be written is dropped. */
+		dispatcher.subscribe<ubx_rxm_rawx>([&](const ubx_rxm_rawx &rawx)
+		{
+			rtcm_buf.clear();
+			rtcm.encode(rawx, rtcm_buf);
+			if(rtcm_fd < 0)
+			{
+				/* Not O_CREAT, only a FIFO gets here */
+				rtcm_fd = open(rtcm_path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+				if(rtcm_fd >= 0 && debug)
 				{
-					snprintf(dirname, 64, "%04u-%02hhu", current_pvt.data.year, current_pvt.data.month);
-					if(mkdir(dirname, 0755) != 0)
+					fprintf(stderr, "RTCM output %s opened\n", rtcm_path);
+				}
+			}
+			/* A frame at a time, pipe writes up to PIPE_BUF are all or nothing */
+			for(size_t pos = 0; pos < rtcm_buf.size(); )
+			{
+				size_t len = RTCM3_HEADER_SIZE + ((rtcm_buf[pos + 1] & 0x03) << 8 | rtcm_buf[pos + 2]) + RTCM3_CRC_SIZE;
+				pos += len;
+				if(rtcm_fd < 0)
+				{
+					rtcm_dropped++;
+					continue;
+				}
+				ssize_t ret = write(rtcm_fd, rtcm_buf.data() + pos - len, len);
+				if(ret < 0 && (errno == EPIPE || errno == ENXIO))
+				{
+					/* The reader went away, open again on a later epoch */
+					if(debug)
 					{
-						if(errno != EEXIST)
-						{
-							perror(dirname);
-							RETURN_ERR;
-						}
+						fprintf(stderr, "RTCM output %s closed by the reader\n", rtcm_path);
 					}
-					fprintf(stderr, "\nCreated directory %s\n", dirname);
+					close(rtcm_fd);
+					rtcm_fd = -1;
 				}
-				char filename[128];
-				snprintf(filename, 128, "%s/%04u%02hhu%02hhuT%02hhu%02hhu%02hhu.ubx",
-					dirname,
-					current_pvt.data.year, current_pvt.data.month, current_pvt.data.day, current_pvt.data.hour, current_pvt.data.min, current_pvt.data.sec);
-				writeout = fopen(filename, "wb");
-				if(writeout == NULL)
+				else if(ret < 0 && errno != EAGAIN && rtcm_errors++ == 0)
 				{
-					fprintf(stderr, "Unable to open file %s!\n", filename);
-					RETURN_ERR;
+					perror("RTCM output");
+				}
+				if(ret < (ssize_t)len)
+				{
+					rtcm_dropped++;
 				}
-				fprintf(stderr, "\nOpened file %s\n", filename);
 			}
+		});
+	}
 
-			last_pvt = current_pvt;
+	/* Returns non-zero to stop */
+	auto handle_frame = [&](const ubx_frame_view &frame) -> int
+	{
+		/* Only frames the parser passed get here, too short for a view */
+		if(!frame.valid)
+		{
+			ubx_metrics::add(malformed_frames, 1);
+			if(!quiet)
+			{
+				fprintf(stderr, "Invalid frame!\n");
+				frame.dump(stderr);
+			}
+			return 0;
+		}
+		metrics.count_frame(frame.class_id, frame.msg_id, frame.size);
+		if(!scan)
+		{
+			/* Frames read at once have the same stamp, their gap is 0 */
+			frame_ns = timespec_ns(reader.frame_mono);
+			if(last_frame_ns != 0)
+			{
+				frame_gap.record(frame_ns - last_frame_ns);
+			}
+			last_frame_ns = frame_ns;
+			bytes_in.store(reader.bytes_read, std::memory_order_relaxed);
+			wasted_bytes.store(reader.wasted_bytes, std::memory_order_relaxed);
+			bad_frames.store(reader.bad_checksums, std::memory_order_relaxed);
+		}
+		else
+		{
+			bad_frames.store(scanner.bad_checksums, std::memory_order_relaxed);
+		}
+		if(epoch_start && !scan)
+		{
+			epoch_arrival = reader.frame_time;
+			epoch_start_ns = frame_ns;
+			epoch_start = false;
+		}
+		/* Passthrough */
+		if(writing)
+		{
+			writer.ring.push_frame(frame);
+		}
+		if(writer.error() != 0)
+		{
+			return 1;
+		}
+		for(auto &server : servers)
+		{
+			server->push(frame);
+		}
+		if(caster)
+		{
+			caster->push(frame);
+		}
+		/* The scanner dumps frames itself */
+		if(debug && !scan)
+		{
+			frame.dump_msg(stderr);
+		}
+
+		/* Registered but not decoded: the length doesn't match the contents */
+		if(!dispatcher.dispatch(frame) && dispatcher.is_registered(frame.class_id, frame.msg_id))
+		{
+			ubx_metrics::add(malformed_frames, 1);
+		}
+		assembler.add(frame, reader.frame_time, frame_ns);
+		if(epoch_done)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			epoch_processing.record(timespec_ns(now) - eoe_ns);
+			epoch_done = false;
+		}
+		return err;
+	};
+
+	if(scan)
+	{
+		if(scanner.run(handle_frame) != 0)
+		{
+			RETURN_ERR;
+		}
+	}
+	else
+	{
+		/* Everything else is started by now */
+		pthread_sigmask(SIG_UNBLOCK, &usr1, NULL);
+		while(1)
+		{
+			ubx_frame_view frame;
+			if(reader.read_frame(frame) == EOF)
+			{
+				break;
+			}
+			if(handle_frame(frame) != 0)
+			{
+				RETURN_ERR;
+			}
+			if(dump_requested)
+			{
+				dump_requested = 0;
+				dump_latency(stderr);
+			}
 		}
 	}
 	fputs("\nEOF!?\n", stderr);
+	assembler.flush();
+	writer.stop();
+	if(scan)
+	{
+		bad_frames.store(scanner.bad_checksums, std::memory_order_relaxed);
+		scanner.dump_stats(stderr);
+	}
+	else
+	{
+		bytes_in.store(reader.bytes_read, std::memory_order_relaxed);
+		wasted_bytes.store(reader.wasted_bytes, std::memory_order_relaxed);
+		bad_frames.store(reader.bad_checksums, std::memory_order_relaxed);
+		reader.dump_stats(stderr);
+	}
+	/* The decoders don't say, they'd print on every frame even with -q */
+	if(malformed_frames.load() != 0)
+	{
+		fprintf(stderr, "%zd frames the decoders refused\n", malformed_frames.load());
+	}
+	if(serial.fd >= 0)
+	{
+		serial.dump_stats(stderr);
+	}
+	if(rtcm_path != NULL)
+	{
+		rtcm.dump_stats(stderr);
+		if(rtcm_dropped != 0)
+		{
+			fprintf(stderr, "RTCM: %zd messages dropped, output full or without a reader, %zd write errors\n",
+				rtcm_dropped, rtcm_errors);
+		}
+		if(rtcm_fd >= 0)
+		{
+			close(rtcm_fd);
+		}
+	}
+	for(auto &server : servers)
+	{
+		server->stop();
+		server->dump_stats(stderr);
+	}
+	if(caster)
+	{
+		caster->stop();
+		caster->dump_stats(stderr);
+	}
+	if(chrony)
+	{
+		chrony->dump_stats(stderr);
+	}
+	if(pps)
+	{
+		pps->stop();
+		pps->dump_stats(stderr);
+	}
+	if(writer.error() != 0)
+	{
+		RETURN_ERR;
+	}
+	writer.dump_stats(stderr);
+	if(!scan)
+	{
+		dump_latency(stderr);
+	}
+	if(exporter.enabled())
+	{
+		exporter.stop();
+		exporter.dump_stats(stderr);
+	}
 	return 0;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <cstdint>
 #include <stdio.h>
 #include "ubx.hpp"
+#include "ubx_cksum.hpp"
 #include <endian.h>
 
 namespace UBX
@@ -62,68 +63,135 @@ uint8_t getch(ubx_buf_t &buf, size_t offset)
 	return getu1(buf, offset);
 }
 
-void ubx_frame::clear()
+uint8_t getu1(const uint8_t *buf, size_t offset)
+{
+	return buf[offset];
+}
+
+uint16_t getu2(const uint8_t *buf, size_t offset)
+{
+	return buf[offset] | (buf[offset + 1] << 8);
+}
+
+uint32_t getu4(const uint8_t *buf, size_t offset)
+{
+	return
+		 (uint32_t)buf[offset] |
+		((uint32_t)buf[offset + 1] << 8) |
+		((uint32_t)buf[offset + 2] << 16) |
+		((uint32_t)buf[offset + 3] << 24);
+}
+
+int8_t geti1(const uint8_t *buf, size_t offset)
+{
+	return buf[offset];
+}
+
+int16_t geti2(const uint8_t *buf, size_t offset)
+{
+	return getu2(buf, offset);
+}
+
+int32_t geti4(const uint8_t *buf, size_t offset)
+{
+	return getu4(buf, offset);
+}
+
+float getr4(const uint8_t *buf, size_t offset)
+{
+	uint32_t tmp = getu4(buf, offset);
+	float ret;
+	memcpy(&ret, &tmp, sizeof(ret));
+	return ret;
+}
+
+double getr8(const uint8_t *buf, size_t offset)
+{
+	uint64_t tmp = getu4(buf, offset) | ((uint64_t)getu4(buf, offset + 4) << 32);
+	double ret;
+	memcpy(&ret, &tmp, sizeof(ret));
+	return ret;
+}
+
+uint8_t getch(const uint8_t *buf, size_t offset)
+{
+	return getu1(buf, offset);
+}
+
+void ubx_frame_view::clear()
 {
+	this->data = NULL;
+	this->size = 0;
 	this->valid = false;
 	this->class_id = 0;
 	this->msg_id = 0;
 	this->length = 0;
-	this->payload.clear();
 	this->cksum = 0;
 }
 
-ubx_frame::ubx_frame()
+ubx_frame_view::ubx_frame_view()
 {
 	clear();
 }
 
-ubx_frame::ubx_frame(ubx_buf_t &buf)
+ubx_frame_view::ubx_frame_view(const uint8_t *data, size_t size)
 {
 	clear();
-	if (buf.size() < 8)
+	if(size < UBX_HEADER_SIZE + UBX_CKSUM_SIZE)
 	{
 		return;
 	}
-	this->class_id = buf[UBX_CLASS_OFFSET];
-	this->msg_id = buf[UBX_MSG_OFFSET];
-	this->length = buf[UBX_LENGTH_OFFSET] | (buf[UBX_LENGTH_OFFSET + 1] << 8);
-	this->cksum = (buf[buf.size() - 2]<<8) | buf[buf.size() - 1];
-	if(validate(buf))
+	this->data = data;
+	this->size = size;
+	this->class_id = data[UBX_CLASS_OFFSET];
+	this->msg_id = data[UBX_MSG_OFFSET];
+	this->length = data[UBX_LENGTH_OFFSET] | (data[UBX_LENGTH_OFFSET + 1] << 8);
+	this->cksum = (data[size - 2] << 8) | data[size - 1];
+	if(validate())
 	{
 		this->valid = true;
 	}
-	this->payload = ubx_buf_t(buf.begin() + UBX_HEADER_SIZE, buf.end() - UBX_CKSUM_SIZE);
 }
 
-bool ubx_frame::validate(ubx_buf_t &buf)
+ubx_frame_view::ubx_frame_view(const uint8_t *data, size_t size, bool valid)
 {
-	if(buf.size() < 8)
+	clear();
+	if(size < UBX_HEADER_SIZE + UBX_CKSUM_SIZE)
 	{
-		fputs("ubx_frame::validate(): buf.size() < 8\n", stderr);
-		return false;
+		return;
 	}
-	if(buf.size() != (size_t)this->length + UBX_HEADER_SIZE + UBX_CKSUM_SIZE)
+	this->data = data;
+	this->size = size;
+	this->class_id = data[UBX_CLASS_OFFSET];
+	this->msg_id = data[UBX_MSG_OFFSET];
+	this->length = data[UBX_LENGTH_OFFSET] | (data[UBX_LENGTH_OFFSET + 1] << 8);
+	this->cksum = (data[size - 2] << 8) | data[size - 1];
+	this->valid = valid;
+}
+
+bool ubx_frame_view::validate()
+{
+	if(this->size < UBX_HEADER_SIZE + UBX_CKSUM_SIZE)
 	{
-		fprintf(stderr, "ubx_frame::validate(): buf.size() = %zd, length = %d\n", buf.size(), this->length);
+		fprintf(stderr, "ubx_frame_view::validate(): size = %zd, no room for header & checksum\n", this->size);
 		return false;
 	}
-	uint8_t ck_a = 0, ck_b = 0;
-	for (size_t i = 0; i < buf.size() - 2; i++)
+	if(this->size != (size_t)this->length + UBX_HEADER_SIZE + UBX_CKSUM_SIZE)
 	{
-		ck_a += buf[i];
-		ck_b += ck_a;
+		fprintf(stderr, "ubx_frame_view::validate(): size = %zd, length = %d\n", this->size, this->length);
+		return false;
 	}
-	uint16_t buf_cksum = (ck_a << 8) | ck_b;
+	uint16_t buf_cksum = ubx_cksum(this->data, this->size - UBX_CKSUM_SIZE);
 	if(buf_cksum != this->cksum)
 	{
-		fprintf(stderr, "ubx_frame::validate(): buf_cksum = %04x, cksum = %04x\n", buf_cksum, this->cksum);
+		fprintf(stderr, "ubx_frame_view::validate(): buf_cksum = %04x, cksum = %04x\n", buf_cksum, this->cksum);
 		return false;
 	}
 
 	return true;
 }
 
-void ubx_frame::dump(FILE *fp)
+void ubx_frame_view::dump(FILE *fp) const
 {
 	fprintf(fp, "=========\n");
 	fprintf(fp, "class_id: %02x\n", this->class_id);
@@ -131,32 +199,95 @@ void ubx_frame::dump(FILE *fp)
 	fprintf(fp, "length: %d\n", this->length);
 	fprintf(fp, "cksum: %04x\n", this->cksum);
 	fprintf(fp, "buf: ");
-	for (unsigned int i = 0; i < this->payload.size(); i++)
+	for (size_t i = UBX_HEADER_SIZE; i + UBX_CKSUM_SIZE < this->size; i++)
 	{
-		fprintf(fp, "%02x ", this->payload[i]);
+		fprintf(fp, "%02x ", this->data[i]);
 	}
 	fprintf(fp, "\n");
 	fprintf(fp, "valid: %d\n", this->valid);
 }
 
+void ubx_frame_view::dump_msg(FILE *fp) const
+{
+	if(this->valid)
+	{
+		ubx_dump_msg(fp, this->class_id, this->msg_id, payload(), this->length);
+	}
+}
+
 // Returns EOF on error
-// TODO: make it more elegant
-int ubx_frame::write(FILE *fp)
+int ubx_frame_view::write(FILE *fp) const
 {
-	int ret = 0;
-	ret |= fputc(UBX_SYNC1, fp);
-	ret |= fputc(UBX_SYNC2, fp);
-	ret |= fputc(this->class_id, fp);
-	ret |= fputc(this->msg_id, fp);
-	ret |= fputc(this->length & 0xff, fp);
-	ret |= fputc((this->length >> 8) & 0xff, fp);
-	for(size_t i = 0; i < this->payload.size(); i++)
+	static const uint8_t sync[2] = {UBX_SYNC1, UBX_SYNC2};
+	if(fwrite(sync, 1, sizeof(sync), fp) != sizeof(sync) ||
+		fwrite(this->data, 1, this->size, fp) != this->size)
 	{
-		ret |= fputc(this->payload[i], fp);
+		return EOF;
 	}
-	ret |= fputc(this->cksum >> 8, fp);
-	ret |= fputc(this->cksum & 0xff, fp);
-	return ret;
+	return 0;
+}
+
+void ubx_frame::clear()
+{
+	this->valid = false;
+	this->class_id = 0;
+	this->msg_id = 0;
+	this->length = 0;
+	this->buf.clear();
+	this->cksum = 0;
+}
+
+ubx_frame::ubx_frame()
+{
+	clear();
+}
+
+ubx_frame::ubx_frame(ubx_buf_t &buf) : ubx_frame(ubx_frame_view(buf.data(), buf.size()))
+{
+}
+
+ubx_frame::ubx_frame(const ubx_frame_view &view)
+{
+	clear();
+	if(view.data == NULL)
+	{
+		return;
+	}
+	this->class_id = view.class_id;
+	this->msg_id = view.msg_id;
+	this->length = view.length;
+	this->cksum = view.cksum;
+	this->valid = view.valid;
+	this->buf.assign(view.data, view.size);
+}
+
+// The view is only valid as long as this frame isn't modified
+ubx_frame_view ubx_frame::view() const
+{
+	ubx_frame_view view;
+	if(this->buf.empty())
+	{
+		return view;
+	}
+	view.data = this->buf.data();
+	view.size = this->buf.size();
+	view.class_id = this->class_id;
+	view.msg_id = this->msg_id;
+	view.length = this->length;
+	view.cksum = this->cksum;
+	view.valid = this->valid;
+	return view;
+}
+
+void ubx_frame::dump(FILE *fp)
+{
+	view().dump(fp);
+}
+
+// Returns EOF on error
+int ubx_frame::write(FILE *fp)
+{
+	return view().write(fp);
 }
 
 ubx_any_msg::ubx_any_msg()
@@ -164,7 +295,7 @@ ubx_any_msg::ubx_any_msg()
 	clear();
 }
 
-ubx_any_msg::ubx_any_msg(ubx_frame &frame)
+ubx_any_msg::ubx_any_msg(const ubx_frame_view &frame)
 {
 	parse(frame);
 }
@@ -177,7 +308,7 @@ void ubx_any_msg::clear()
 	this->payload.clear();
 }
 
-bool ubx_any_msg::parse(ubx_frame &frame)
+bool ubx_any_msg::parse(const ubx_frame_view &frame)
 {
 	if(frame.valid == false)
 	{
@@ -186,20 +317,26 @@ bool ubx_any_msg::parse(ubx_frame &frame)
 
 	this->class_id = frame.class_id;
 	this->msg_id = frame.msg_id;
-	this->payload = frame.payload;
+	this->payload.assign(frame.payload(), frame.length);
 	return true;
 }
 
 void ubx_any_msg::dump(FILE *fp)
 {
-	fprintf(fp, "%s (%zd)\t> ",
-		("UBX-" + ubx_msg_name(this->class_id, this->msg_id)).c_str(),
-		this->payload.size());
-	for(auto i: this->payload)
+	ubx_dump_msg(fp, this->class_id, this->msg_id, this->payload.data(), this->payload.size());
+}
+
+void ubx_dump_msg(FILE *fp, uint8_t class_id, uint8_t msg_id, const uint8_t *payload, size_t length)
+{
+	char name[UBX_MSG_NAME_MAX];
+	fprintf(fp, "UBX-%s (%zd)\t> ",
+		ubx_msg_name(class_id, msg_id, name, sizeof(name)),
+		length);
+	for(size_t i = 0; i < length; i++)
 	{
-		fprintf(fp, "%02x", i);
+		fprintf(fp, "%02x", payload[i]);
 	}
 	fprintf(fp, "\n");
 }
 
-} // namespace UBX
\ No newline at end of file
+} // namespace UBX
@@ -0,0 +1,68 @@
+#include "ubx.hpp"
+#include "ubx_arena.hpp"
+
+namespace UBX
+{
+
+ubx_arena::ubx_arena(size_t block_size)
+{
+	this->block_size = block_size;
+	this->current = 0;
+	this->offset = 0;
+	this->used_before = 0;
+	this->total = 0;
+	this->blocks_allocated = 0;
+	this->high_water = 0;
+}
+
+ubx_arena::~ubx_arena()
+{
+	for(block &b : this->blocks)
+	{
+		free(b.data);
+	}
+}
+
+void *ubx_arena::alloc(size_t size, size_t align)
+{
+	while(this->current < this->blocks.size())
+	{
+		block &b = this->blocks[this->current];
+		size_t start = (this->offset + align - 1) & ~(align - 1);
+		if(start + size <= b.size)
+		{
+			this->offset = start + size;
+			if(used() > this->high_water)
+			{
+				this->high_water = used();
+			}
+			return b.data + start;
+		}
+		// The rest of this block is wasted until the next reset
+		this->used_before += b.size;
+		this->offset = 0;
+		this->current++;
+	}
+	// Big enough for this one even if it's larger than a block
+	block b;
+	b.size = size + align > this->block_size ? size + align : this->block_size;
+	b.data = (uint8_t *)malloc(b.size);
+	if(b.data == NULL)
+	{
+		perror("ubx_arena::alloc()");
+		abort();
+	}
+	this->blocks.push_back(b);
+	this->total += b.size;
+	this->blocks_allocated++;
+	return alloc(size, align);
+}
+
+void ubx_arena::reset()
+{
+	this->current = 0;
+	this->offset = 0;
+	this->used_before = 0;
+}
+
+} // namespace UBX
@@ -0,0 +1,58 @@
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+constexpr size_t UBX_ARENA_BLOCK = 256 * 1024;
+
+// Bump allocator for data that all goes away at once
+// alloc() moves a pointer along the current block, reset() goes back to the
+// first one. Blocks are kept until the arena is destroyed, so once it has held
+// its largest load, reset() & alloc() never call malloc() again.
+// Not thread safe, & nothing is destroyed: for plain data only.
+class ubx_arena
+{
+public:
+	// Statistics
+	size_t blocks_allocated;	// malloc() calls
+	size_t high_water;	// most Bytes in use between resets
+
+	ubx_arena(size_t block_size = UBX_ARENA_BLOCK);
+	~ubx_arena();
+	// Never NULL, aborts if out of memory
+	void *alloc(size_t size, size_t align = alignof(max_align_t));
+	void reset();
+	// Bytes handed out since the last reset, with padding
+	size_t used() const
+	{
+		return this->used_before + this->offset;
+	}
+	// Bytes in all blocks
+	size_t capacity() const
+	{
+		return this->total;
+	}
+private:
+	struct block
+	{
+		uint8_t *data;
+		size_t size;
+	};
+
+	size_t block_size;
+	vector<block> blocks;
+	size_t current;
+	size_t offset;	// in the current block
+	size_t used_before;	// in the blocks before it
+	size_t total;
+
+	ubx_arena(const ubx_arena &) = delete;
+	ubx_arena &operator=(const ubx_arena &) = delete;
+};
+
+} // namespace UBX
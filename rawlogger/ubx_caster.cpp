@@ -0,0 +1,835 @@
+#include "ubx.hpp"
+#include "ubx_caster.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+
+namespace UBX
+{
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void add(std::atomic<size_t> &counter, size_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static void peak(std::atomic<size_t> &peak, size_t n)
+{
+	if(n > peak.load(std::memory_order_relaxed))
+	{
+		peak.store(n, std::memory_order_relaxed);
+	}
+}
+
+static string base64(const string &in)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string out;
+	for(size_t i = 0; i < in.size(); i += 3)
+	{
+		uint32_t n = (uint8_t)in[i] << 16;
+		if(i + 1 < in.size())
+		{
+			n |= (uint8_t)in[i + 1] << 8;
+		}
+		if(i + 2 < in.size())
+		{
+			n |= (uint8_t)in[i + 2];
+		}
+		out += table[n >> 18 & 0x3f];
+		out += table[n >> 12 & 0x3f];
+		out += i + 1 < in.size() ? table[n >> 6 & 0x3f] : '=';
+		out += i + 2 < in.size() ? table[n & 0x3f] : '=';
+	}
+	return out;
+}
+
+// WGS84 ECEF to latitude & longitude in degrees, for the sourcetable
+static void ecef_to_latlon(const double *xyz, double &lat, double &lon)
+{
+	const double a = 6378137.0, e2 = 6.69437999014e-3;
+	double p = sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1]);
+	double phi = atan2(xyz[2], p * (1 - e2));
+	for(int i = 0; i < 5; i++)
+	{
+		double n = a / sqrt(1 - e2 * sin(phi) * sin(phi));
+		double h = p / cos(phi) - n;
+		phi = atan2(xyz[2], p * (1 - e2 * n / (n + h)));
+	}
+	lat = phi * 180 / M_PI;
+	lon = atan2(xyz[1], xyz[0]) * 180 / M_PI;
+}
+
+// Value of a header in an HTTP request, empty if it's not there
+static string header_value(const string &request, const char *name)
+{
+	size_t len = strlen(name);
+	size_t pos = request.find('\n');
+	while(pos != string::npos && pos + 1 < request.size())
+	{
+		size_t start = pos + 1;
+		size_t end = request.find('\n', start);
+		if(end == string::npos)
+		{
+			end = request.size();
+		}
+		if(end - start > len && strncasecmp(request.c_str() + start, name, len) == 0 && request[start + len] == ':')
+		{
+			size_t first = request.find_first_not_of(" \t", start + len + 1);
+			size_t last = request.find_last_not_of(" \t\r\n", end);
+			if(first == string::npos || first > last)
+			{
+				return "";
+			}
+			return request.substr(first, last - first + 1);
+		}
+		pos = end;
+	}
+	return "";
+}
+
+// HTTP error response, closes the connection
+static string http_error(bool v2, const char *status, const string &extra = "")
+{
+	string response = v2 ? "HTTP/1.1 " : "HTTP/1.0 ";
+	response += status;
+	response += "\r\n";
+	if(v2)
+	{
+		response += "Ntrip-Version: Ntrip/2.0\r\n";
+	}
+	response += "Server: NTRIP rawlogger\r\n" + extra + "Connection: close\r\nContent-Length: 0\r\n\r\n";
+	return response;
+}
+
+ubx_caster::ubx_caster(size_t mount_buf, size_t ring_size)
+	: ring(ring_size, UBX_RING_DROP_EPOCH)
+{
+	this->accepted = 0;
+	this->clients = 0;
+	this->peak_clients = 0;
+	this->refused = 0;
+	this->kicked = 0;
+	size_t size = 1;
+	while(size < mount_buf)
+	{
+		size <<= 1;
+	}
+	this->mount_buf = size;
+	this->bound_port = 0;
+	this->listen_fd = -1;
+	this->epfd = -1;
+	this->want_all = false;
+	this->started = now_ms();
+	this->rawx = new ubx_rxm_rawx();
+}
+
+ubx_caster::~ubx_caster()
+{
+	stop();
+	if(this->listen_fd >= 0)
+	{
+		close(this->listen_fd);
+	}
+	if(this->epfd >= 0)
+	{
+		close(this->epfd);
+	}
+	for(mount *m : this->mounts)
+	{
+		free(m->buf);
+		delete m;
+	}
+	delete this->rawx;
+}
+
+bool ubx_caster::parse(const char *spec)
+{
+	return ubx_parse_address(spec, this->host, this->service);
+}
+
+bool ubx_caster::add_mount(const char *spec)
+{
+	string s = spec;
+	string user_password;
+	size_t at = s.find('@');
+	if(at != string::npos)
+	{
+		user_password = s.substr(at + 1);
+		s.erase(at);
+		if(user_password.find(':') == string::npos)
+		{
+			return false;
+		}
+	}
+	size_t colon = s.find(':');
+	if(colon == string::npos || colon == 0)
+	{
+		return false;
+	}
+	string name = s.substr(0, colon);
+	string format = s.substr(colon + 1);
+	size_t slash = format.find('/');
+	string classes = slash == string::npos ? "" : format.substr(slash + 1);
+	format.erase(std::min(slash, format.size()));
+	if(strcasecmp(format.c_str(), "rtcm") == 0 || strcasecmp(format.c_str(), "rtcm3") == 0)
+	{
+		return slash == string::npos && add_mount(name, UBX_CASTER_RTCM3, user_password);
+	}
+	if(strcasecmp(format.c_str(), "ubx") != 0 || !add_mount(name, UBX_CASTER_UBX, user_password))
+	{
+		return false;
+	}
+	mount *m = this->mounts.back();
+	if(slash != string::npos)
+	{
+		m->all_classes = false;
+		if(!ubx_parse_classes(classes, m->classes))
+		{
+			return false;
+		}
+		this->wanted |= m->classes;
+	}
+	return true;
+}
+
+bool ubx_caster::add_mount(const string &name, ubx_caster_format format, const string &user_password)
+{
+	if(name.find_first_of("/ ;\r\n") != string::npos)
+	{
+		return false;
+	}
+	for(const mount *m : this->mounts)
+	{
+		if(m->name == name)
+		{
+			return false;
+		}
+	}
+	mount *m = new mount();
+	m->name = name;
+	m->format = format;
+	m->all_classes = format == UBX_CASTER_UBX;
+	m->auth = user_password.empty() ? "" : base64(user_password);
+	m->size = this->mount_buf;
+	m->buf = (uint8_t *)malloc(m->size);
+	if(m->buf == NULL)
+	{
+		delete m;
+		return false;
+	}
+	m->head = 0;
+	if(format == UBX_CASTER_RTCM3)
+	{
+		this->wanted.set(UBX_CLASS_RXM);
+	}
+	this->mounts.push_back(m);
+	return true;
+}
+
+int ubx_caster::listen()
+{
+	this->listen_fd = ubx_listen_tcp(this->host, this->service, this->bound_port);
+	if(this->listen_fd < 0)
+	{
+		return -1;
+	}
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(this->epfd < 0)
+	{
+		return -1;
+	}
+	// data.ptr is the client, or one of these two for the listening socket & the ring
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &this->listen_fd;
+	if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->listen_fd, &ev) != 0)
+	{
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &this->ring;
+	if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->ring.pop_event_fd(), &ev) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+void ubx_caster::start()
+{
+	for(mount *m : this->mounts)
+	{
+		if(m->format == UBX_CASTER_UBX && m->all_classes)
+		{
+			this->want_all = true;
+		}
+		if(m->format == UBX_CASTER_RTCM3)
+		{
+			m->encoder = this->rtcm;
+		}
+	}
+	this->started = now_ms();
+	this->thread = std::thread(&ubx_caster::run, this);
+}
+
+void ubx_caster::stop()
+{
+	if(this->thread.joinable())
+	{
+		this->ring.push_stop();
+		this->thread.join();
+	}
+}
+
+void ubx_caster::push(const ubx_frame_view &frame)
+{
+	if(this->want_all || this->wanted.test(frame.class_id))
+	{
+		this->ring.push_frame(frame);
+	}
+}
+
+void ubx_caster::push_epoch_end()
+{
+	ubx_epoch_info info;
+	memset(&info, 0, sizeof(info));
+	this->ring.push_epoch_end(info);
+}
+
+string ubx_caster::sourcetable() const
+{
+	double lat = 0, lon = 0;
+	if(this->rtcm.arp_valid)
+	{
+		ecef_to_latlon(this->rtcm.arp, lat, lon);
+	}
+	double secs = std::max<uint64_t>(now_ms() - this->started, 1000) / 1000.0;
+	string table;
+	char line[512];
+	for(const mount *m : this->mounts)
+	{
+		string details;
+		if(m->format == UBX_CASTER_RTCM3)
+		{
+			unsigned station = std::max(this->rtcm.station_interval / 1000, 1U);
+			snprintf(line, sizeof(line), "1005(%u),1077(1),1087(1),1097(1),1127(1),1230(%u)", station, station);
+			details = line;
+		}
+		else if(m->all_classes)
+		{
+			details = "UBX";
+		}
+		else
+		{
+			for(int i = 0; i < 256; i++)
+			{
+				if(m->classes.test(i))
+				{
+					const char *name = ubx_class_name(i);
+					details += details.empty() ? "UBX " : "+";
+					details += name != NULL ? name : std::to_string(i);
+				}
+			}
+		}
+		// STR;mountpoint;identifier;format;format-details;carrier;nav-system;network;country;
+		// latitude;longitude;nmea;solution;generator;compr-encryp;authentication;fee;bitrate;misc
+		snprintf(line, sizeof(line), "STR;%s;%s;%s;%s;2;GPS+GLO+GAL+BDS;;;%.2f;%.2f;0;0;rawlogger;none;%c;N;%.0f;\r\n",
+			m->name.c_str(), m->name.c_str(), m->format == UBX_CASTER_RTCM3 ? "RTCM 3.3" : "RAW", details.c_str(),
+			lat, lon, m->auth.empty() ? 'N' : 'B', m->bytes_in.load() * 8 / secs);
+		table += line;
+	}
+	table += "ENDSOURCETABLE\r\n";
+	return table;
+}
+
+void ubx_caster::accept_clients()
+{
+	while(1)
+	{
+		struct sockaddr_storage sa;
+		socklen_t len = sizeof(sa);
+		int fd = accept4(this->listen_fd, (struct sockaddr *)&sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			{
+				perror("ubx_caster::accept_clients()");
+			}
+			if(errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			return;
+		}
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		int sndbuf = UBX_CASTER_SNDBUF;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+		client *c = new client();
+		c->fd = fd;
+		c->peer = ubx_peer_name(sa, len);
+		c->state = CLIENT_REQUEST;
+		c->m = NULL;
+		c->chunked = false;
+		c->prefix_sent = 0;
+		c->pos = 0;
+		c->chunk_left = 0;
+		c->trailer_left = 0;
+		c->connected = now_ms();
+		c->bytes_sent = 0;
+		c->writable = true;
+
+		// Edge triggered: EPOLLOUT only comes after write() said EAGAIN
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			perror("ubx_caster::accept_clients()");
+			close(fd);
+			delete c;
+			continue;
+		}
+		this->client_list.push_back(c);
+		add(this->accepted, 1);
+		add(this->clients, 1);
+		peak(this->peak_clients, this->clients.load());
+	}
+}
+
+void ubx_caster::append(mount *m, const uint8_t *data, size_t size)
+{
+	size_t offset = m->head & (m->size - 1);
+	size_t first = std::min(size, m->size - offset);
+	memcpy(m->buf + offset, data, first);
+	memcpy(m->buf, data + first, size - first);
+	m->head += size;
+	add(m->bytes_in, size);
+}
+
+// Each message goes once into each mountpoint's buffer, whatever the number of rovers
+void ubx_caster::fan_out(const uint8_t *frame, size_t size)
+{
+	static const uint8_t sync[2] = {UBX_SYNC1, UBX_SYNC2};
+	ubx_frame_view view(frame, size, true);
+	bool rawx_parsed = false, rawx_valid = false;
+	for(mount *m : this->mounts)
+	{
+		if(m->format == UBX_CASTER_UBX)
+		{
+			if(m->all_classes || m->classes.test(view.class_id))
+			{
+				append(m, sync, sizeof(sync));
+				append(m, frame, size);
+				add(m->messages, 1);
+			}
+			continue;
+		}
+		if(view.class_id != UBX_CLASS_RXM || view.msg_id != UBX_RXM_RAWX)
+		{
+			continue;
+		}
+		if(!rawx_parsed)
+		{
+			rawx_valid = this->rawx->parse(view);
+			rawx_parsed = true;
+		}
+		if(rawx_valid)
+		{
+			m->out.clear();
+			add(m->messages, m->encoder.encode(*this->rawx, m->out));
+			append(m, m->out.data(), m->out.size());
+		}
+	}
+}
+
+void ubx_caster::respond(client *c, const string &response)
+{
+	c->state = CLIENT_RESPONSE;
+	c->prefix = response;
+	c->prefix_sent = 0;
+	flush(c);
+}
+
+void ubx_caster::read_request(client *c)
+{
+	char buf[1024];
+	ssize_t len;
+	while((len = read(c->fd, buf, sizeof(buf))) > 0)
+	{
+		// Rovers may send their position, nothing else is expected after the request
+		if(c->state != CLIENT_REQUEST)
+		{
+			continue;
+		}
+		c->request.append(buf, len);
+		if(c->request.find("\r\n\r\n") != string::npos || c->request.find("\n\n") != string::npos)
+		{
+			handle_request(c);
+		}
+		else if(c->request.size() > UBX_CASTER_MAX_REQUEST)
+		{
+			add(this->refused, 1);
+			respond(c, http_error(false, "400 Bad Request"));
+		}
+		if(c->fd < 0)
+		{
+			return;
+		}
+	}
+	if(len == 0)
+	{
+		drop_client(c, "closed");
+	}
+	else if(errno != EAGAIN && errno != EINTR)
+	{
+		drop_client(c, strerror(errno));
+	}
+}
+
+void ubx_caster::handle_request(client *c)
+{
+	// GET /MOUNT HTTP/1.x, NTRIP 2.0 rovers say so in a header
+	char method[16], path[256], version[16];
+	c->chunked = strcasestr(header_value(c->request, "Ntrip-Version").c_str(), "Ntrip/2.0") != NULL;
+	if(sscanf(c->request.c_str(), "%15s %255s %15s", method, path, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0)
+	{
+		add(this->refused, 1);
+		respond(c, http_error(c->chunked, "400 Bad Request"));
+		return;
+	}
+	if(strcmp(method, "GET") != 0)
+	{
+		add(this->refused, 1);
+		respond(c, http_error(c->chunked, "405 Method Not Allowed", "Allow: GET\r\n"));
+		return;
+	}
+	string name = path[0] == '/' ? path + 1 : path;
+	name.erase(std::min(name.find('?'), name.size()));
+	mount *m = NULL;
+	for(mount *mp : this->mounts)
+	{
+		if(mp->name == name)
+		{
+			m = mp;
+		}
+	}
+
+	// The sourcetable for /, and for unknown mountpoints in NTRIP 1.0
+	if(m == NULL && (name.empty() || !c->chunked))
+	{
+		if(!name.empty())
+		{
+			add(this->refused, 1);
+		}
+		string table = sourcetable();
+		char header[256];
+		if(c->chunked)
+		{
+			snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nNtrip-Version: Ntrip/2.0\r\nServer: NTRIP rawlogger\r\n"
+				"Connection: close\r\nContent-Type: gnss/sourcetable\r\nContent-Length: %zd\r\n\r\n", table.size());
+		}
+		else
+		{
+			snprintf(header, sizeof(header), "SOURCETABLE 200 OK\r\nServer: NTRIP rawlogger\r\n"
+				"Content-Type: text/plain\r\nContent-Length: %zd\r\n\r\n", table.size());
+		}
+		respond(c, header + table);
+		return;
+	}
+	if(m == NULL)
+	{
+		add(this->refused, 1);
+		respond(c, http_error(true, "404 Not Found"));
+		return;
+	}
+	if(!m->auth.empty())
+	{
+		string auth = header_value(c->request, "Authorization");
+		if(auth.size() < 6 || strncasecmp(auth.c_str(), "Basic ", 6) != 0 || auth.substr(6) != m->auth)
+		{
+			add(this->refused, 1);
+			respond(c, http_error(c->chunked, "401 Unauthorized", "WWW-Authenticate: Basic realm=\"/" + m->name + "\"\r\n"));
+			return;
+		}
+	}
+
+	// Rovers start with the next message
+	c->state = CLIENT_STREAM;
+	c->m = m;
+	c->pos = m->head;
+	c->request.clear();
+	c->request.shrink_to_fit();
+	c->prefix = c->chunked ?
+		"HTTP/1.1 200 OK\r\nNtrip-Version: Ntrip/2.0\r\nServer: NTRIP rawlogger\r\n"
+		"Cache-Control: no-store, no-cache, max-age=0\r\nPragma: no-cache\r\nConnection: close\r\n"
+		"Content-Type: gnss/data\r\nTransfer-Encoding: chunked\r\n\r\n" :
+		"ICY 200 OK\r\n\r\n";
+	c->prefix_sent = 0;
+	add(m->rovers, 1);
+	peak(m->peak_rovers, m->rovers.load());
+	flush(c);
+}
+
+// Response or chunk header first, then data straight from the mountpoint's buffer
+void ubx_caster::flush(client *c)
+{
+	static const char crlf[] = "\r\n";
+	mount *m = c->m;
+	// What it hasn't sent yet has been overwritten
+	if(c->state == CLIENT_STREAM && m->head - c->pos > m->size)
+	{
+		add(this->kicked, 1);
+		drop_client(c, "lapped");
+		return;
+	}
+	while(c->writable)
+	{
+		if(c->state == CLIENT_STREAM)
+		{
+			size_t avail = m->head - c->pos;
+			if(c->prefix_sent == c->prefix.size() && c->chunk_left == 0 && c->trailer_left == 0 && avail != 0)
+			{
+				if(c->chunked)
+				{
+					char header[16];
+					c->chunk_left = std::min(avail, UBX_CASTER_MAX_CHUNK);
+					snprintf(header, sizeof(header), "%zx\r\n", c->chunk_left);
+					c->prefix = header;
+					c->prefix_sent = 0;
+					c->trailer_left = 2;
+				}
+				else
+				{
+					c->chunk_left = avail;
+				}
+			}
+		}
+
+		struct iovec iov[4];
+		int iovcnt = 0;
+		size_t prefix_len = c->prefix.size() - c->prefix_sent;
+		if(prefix_len != 0)
+		{
+			iov[iovcnt].iov_base = (void *)(c->prefix.data() + c->prefix_sent);
+			iov[iovcnt++].iov_len = prefix_len;
+		}
+		size_t data_len = 0;
+		if(c->state == CLIENT_STREAM)
+		{
+			data_len = std::min<size_t>(c->chunk_left, m->head - c->pos);
+			size_t offset = c->pos & (m->size - 1);
+			size_t first = std::min(data_len, m->size - offset);
+			if(first != 0)
+			{
+				iov[iovcnt].iov_base = m->buf + offset;
+				iov[iovcnt++].iov_len = first;
+			}
+			if(data_len != first)
+			{
+				iov[iovcnt].iov_base = m->buf;
+				iov[iovcnt++].iov_len = data_len - first;
+			}
+			if(data_len == c->chunk_left && c->trailer_left != 0)
+			{
+				iov[iovcnt].iov_base = (void *)(crlf + 2 - c->trailer_left);
+				iov[iovcnt++].iov_len = c->trailer_left;
+			}
+		}
+		if(iovcnt == 0)
+		{
+			if(c->state == CLIENT_RESPONSE)
+			{
+				drop_client(c, "response sent");
+			}
+			return;
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno == EAGAIN)
+			{
+				c->writable = false;
+				return;
+			}
+			drop_client(c, strerror(errno));
+			return;
+		}
+		c->bytes_sent += n;
+		size_t sent = n;
+		size_t done = std::min(sent, prefix_len);
+		c->prefix_sent += done;
+		sent -= done;
+		done = std::min(sent, data_len);
+		c->pos += done;
+		c->chunk_left -= done;
+		if(done != 0)
+		{
+			add(m->bytes_out, done);
+		}
+		sent -= done;
+		c->trailer_left -= sent;
+	}
+}
+
+void ubx_caster::drop_client(client *c, const char *why)
+{
+	if(c->fd < 0)
+	{
+		return;
+	}
+	// Only rovers are worth a line
+	if(c->state == CLIENT_STREAM)
+	{
+		uint64_t now = now_ms();
+		fprintf(stderr, "Rover %s on %s (NTRIP %s): %zd Bytes in %llu s, %zd Bytes behind (%s)\n",
+			c->peer.c_str(), c->m->name.c_str(), c->chunked ? "2.0" : "1.0", c->bytes_sent,
+			(unsigned long long)(now - c->connected) / 1000, (size_t)(c->m->head - c->pos), why);
+		add(c->m->rovers, -1);
+	}
+	epoll_ctl(this->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	add(this->clients, -1);
+}
+
+void ubx_caster::run()
+{
+	struct epoll_event events[UBX_SERVER_MAX_EVENTS];
+	bool stopping = false;
+	while(!stopping)
+	{
+		const ubx_ring_record *rec = NULL;
+		for(int i = 0; i < 256 && (rec = this->ring.try_pop()) != NULL; i++)
+		{
+			if(rec->type == UBX_RING_FRAME)
+			{
+				fan_out(rec->data(), rec->size);
+			}
+			else if(rec->type == UBX_RING_STOP)
+			{
+				stopping = true;
+			}
+			this->ring.pop_release(rec);
+			if(stopping)
+			{
+				break;
+			}
+		}
+		uint64_t now = now_ms();
+		for(client *c : this->client_list)
+		{
+			if(c->fd >= 0 && c->state == CLIENT_STREAM)
+			{
+				flush(c);
+			}
+			else if(c->fd >= 0 && c->state == CLIENT_REQUEST && now - c->connected > UBX_CASTER_REQUEST_TIMEOUT_MS)
+			{
+				add(this->refused, 1);
+				drop_client(c, "request timeout");
+			}
+		}
+
+		int timeout = 0;
+		if(!stopping && rec == NULL && this->ring.pop_prepare_wait())
+		{
+			timeout = 1000;
+		}
+		int n = epoll_wait(this->epfd, events, UBX_SERVER_MAX_EVENTS, timeout);
+		if(timeout != 0)
+		{
+			this->ring.pop_end_wait();
+		}
+		if(n < 0 && errno != EINTR)
+		{
+			perror("ubx_caster::run()");
+			break;
+		}
+		for(int i = 0; i < n; i++)
+		{
+			void *ptr = events[i].data.ptr;
+			if(ptr == &this->listen_fd)
+			{
+				accept_clients();
+				continue;
+			}
+			if(ptr == &this->ring)
+			{
+				this->ring.pop_event();
+				continue;
+			}
+			client *c = (client *)ptr;
+			if(c->fd >= 0 && (events[i].events & EPOLLIN))
+			{
+				read_request(c);
+			}
+			if(c->fd >= 0 && (events[i].events & (EPOLLERR | EPOLLHUP)))
+			{
+				drop_client(c, "closed");
+			}
+			if(c->fd >= 0 && (events[i].events & EPOLLOUT))
+			{
+				c->writable = true;
+				flush(c);
+			}
+		}
+
+		auto dead = std::remove_if(this->client_list.begin(), this->client_list.end(), [](client *c)
+		{
+			if(c->fd >= 0)
+			{
+				return false;
+			}
+			delete c;
+			return true;
+		});
+		this->client_list.erase(dead, this->client_list.end());
+	}
+
+	for(client *c : this->client_list)
+	{
+		drop_client(c, "caster stopped");
+		delete c;
+	}
+	this->client_list.clear();
+}
+
+void ubx_caster::dump_stats(FILE *fp)
+{
+	double secs = std::max<uint64_t>(now_ms() - this->started, 1) / 1000.0;
+	fprintf(fp, "Caster port %u: %zd connections, %zd now, %zd at most, %zd refused, %zd rovers lapped\n",
+		this->bound_port, this->accepted.load(), this->clients.load(), this->peak_clients.load(),
+		this->refused.load(), this->kicked.load());
+	for(const mount *m : this->mounts)
+	{
+		fprintf(fp, "Mountpoint %s (%s): %zd rovers (max %zd), %zd messages, in %.1f kbit/s, out %.1f kbit/s\n",
+			m->name.c_str(), m->format == UBX_CASTER_RTCM3 ? "RTCM3" : "UBX", m->rovers.load(), m->peak_rovers.load(),
+			m->messages.load(), m->bytes_in.load() * 8 / secs / 1000, m->bytes_out.load() * 8 / secs / 1000);
+	}
+	this->ring.dump_stats(fp);
+}
+
+} // namespace UBX
@@ -0,0 +1,167 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <bitset>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ubx_def.hpp"
+#include "ubx_ring.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_rtcm.hpp"
+#include "ubx_server.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+using std::string;
+
+// Per mountpoint, shared by all its rovers: ~30 s of everything a F9P sends at 1 Hz
+constexpr size_t UBX_CASTER_MOUNT_BUF = 1024 * 1024;
+// Kernel buffer per rover, a stalled one shows up as lapped soon enough
+constexpr int UBX_CASTER_SNDBUF = 64 * 1024;
+// Data per HTTP chunk for NTRIP 2.0
+constexpr size_t UBX_CASTER_MAX_CHUNK = 16 * 1024;
+constexpr size_t UBX_CASTER_MAX_REQUEST = 4096;
+// The whole request has to be in by then
+constexpr uint32_t UBX_CASTER_REQUEST_TIMEOUT_MS = 10000;
+
+enum ubx_caster_format
+{
+	UBX_CASTER_UBX,
+	UBX_CASTER_RTCM3,
+};
+
+// NTRIP 1.0 & 2.0 caster for local rovers, the rtkserv.sh ntrips:// output
+// without an outside caster. Mountpoints carry the raw UBX stream (all or
+// some classes), or RTCM3 encoded from RXM-RAWX.
+// Like ubx_server, push() copies the frame once into a ring that's never
+// waited on. The caster thread appends each message once to every
+// mountpoint's buffer, which all its rovers read from at their own offset;
+// a rover that gets lapped (more than the buffer behind) is disconnected.
+// NTRIP 2.0 rovers get the stream chunked, written straight from the
+// shared buffer with the chunk headers around it.
+class ubx_caster
+{
+public:
+	// Totals
+	std::atomic<size_t> accepted;
+	std::atomic<size_t> clients;	// connected now, rovers & others
+	std::atomic<size_t> peak_clients;
+	std::atomic<size_t> refused;	// bad request, bad password or no such mountpoint
+	std::atomic<size_t> kicked;	// lapped
+	// Encoder settings for the RTCM3 mountpoints, copied by start()
+	ubx_rtcm_encoder rtcm;
+
+	ubx_caster(size_t mount_buf = UBX_CASTER_MOUNT_BUF, size_t ring_size = UBX_SERVER_RING_SIZE);
+	~ubx_caster();
+	// "[host:]port"
+	bool parse(const char *spec);
+	// "NAME:ubx[/CLASS,...][@user:password]" or "NAME:rtcm[@user:password]"
+	bool add_mount(const char *spec);
+	bool add_mount(const string &name, ubx_caster_format format, const string &user_password = "");
+	size_t mountpoints() const
+	{
+		return this->mounts.size();
+	}
+	// Returns -1 with errno set on error
+	int listen();
+	uint16_t port() const
+	{
+		return this->bound_port;
+	}
+	void start();
+	void stop();
+	// Logger side, never blocks on rovers
+	void push(const ubx_frame_view &frame);
+	void push_epoch_end();
+	// Bytes in the ring, not yet taken by the caster thread
+	size_t queued() const
+	{
+		return this->ring.used();
+	}
+	// What would be sent for a request of /
+	string sourcetable() const;
+	void dump_stats(FILE *fp);
+private:
+	struct mount
+	{
+		string name;
+		ubx_caster_format format;
+		std::bitset<256> classes;
+		bool all_classes;
+		string auth;	// Base64 of user:password, empty for none
+		// Shared by the rovers: power of 2 sized byte ring, whole messages
+		uint8_t *buf;
+		size_t size;
+		uint64_t head;	// Bytes appended so far
+		ubx_rtcm_encoder encoder;
+		vector<uint8_t> out;
+		// Statistics
+		std::atomic<size_t> rovers;
+		std::atomic<size_t> peak_rovers;
+		std::atomic<size_t> messages;
+		std::atomic<size_t> bytes_in;	// appended, once
+		std::atomic<size_t> bytes_out;	// sent, to all rovers
+	};
+
+	enum client_state
+	{
+		CLIENT_REQUEST,
+		CLIENT_STREAM,
+		CLIENT_RESPONSE,	// closed once the response is out
+	};
+
+	struct client
+	{
+		int fd;
+		string peer;
+		client_state state;
+		mount *m;
+		bool chunked;	// NTRIP 2.0
+		string request;
+		// Response header, chunk header: goes out before any more data
+		string prefix;
+		size_t prefix_sent;
+		uint64_t pos;	// in the mountpoint's buffer
+		size_t chunk_left;	// data Bytes left in the current chunk
+		uint8_t trailer_left;	// of the CRLF closing it
+		uint64_t connected;	// ms
+		size_t bytes_sent;
+		bool writable;	// until write() says EAGAIN
+	};
+
+	string host;
+	string service;
+	size_t mount_buf;
+	uint16_t bound_port;
+	int listen_fd;
+	int epfd;
+	ubx_ring ring;
+	std::thread thread;
+	vector<mount *> mounts;
+	// Classes any mountpoint needs
+	std::bitset<256> wanted;
+	bool want_all;
+	vector<client *> client_list;
+	uint64_t started;	// ms
+	ubx_rxm_rawx *rawx;
+
+	void run();
+	void accept_clients();
+	void append(mount *m, const uint8_t *data, size_t size);
+	void fan_out(const uint8_t *frame, size_t size);
+	void read_request(client *c);
+	void handle_request(client *c);
+	void respond(client *c, const string &response);
+	void flush(client *c);
+	void drop_client(client *c, const char *why);
+
+	ubx_caster(const ubx_caster &) = delete;
+	ubx_caster &operator=(const ubx_caster &) = delete;
+};
+
+} // namespace UBX
@@ -0,0 +1,160 @@
+#include "ubx.hpp"
+#include "ubx_chrony.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace UBX
+{
+
+ubx_offset_stats::ubx_offset_stats()
+{
+	this->count = 0;
+	this->mean = 0;
+	this->m2 = 0;
+	this->min = 0;
+	this->max = 0;
+	this->last = 0;
+	this->diff_sq = 0;
+}
+
+void ubx_offset_stats::update(double offset)
+{
+	if(this->count == 0)
+	{
+		this->min = this->max = offset;
+	}
+	else
+	{
+		this->min = std::min(this->min, offset);
+		this->max = std::max(this->max, offset);
+		this->diff_sq += (offset - this->last) * (offset - this->last);
+	}
+	this->count++;
+	// Welford
+	double delta = offset - this->mean;
+	this->mean += delta / this->count;
+	this->m2 += delta * (offset - this->mean);
+	this->last = offset;
+}
+
+double ubx_offset_stats::stddev() const
+{
+	return this->count > 1 ? sqrt(this->m2 / (this->count - 1)) : 0;
+}
+
+double ubx_offset_stats::jitter() const
+{
+	return this->count > 1 ? sqrt(this->diff_sq / (this->count - 1)) : 0;
+}
+
+ubx_chrony::ubx_chrony(const char *path)
+{
+	this->path = path;
+	this->fd = -1;
+	this->samples = 0;
+	this->skipped = 0;
+	this->send_errors = 0;
+	this->max_tacc_ns = UBX_CHRONY_MAX_TACC_NS;
+}
+
+ubx_chrony::~ubx_chrony()
+{
+	if(this->fd >= 0)
+	{
+		close(this->fd);
+	}
+}
+
+int ubx_chrony::open()
+{
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if(this->path.size() >= sizeof(sa.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(sa.sun_path, this->path.c_str(), this->path.size());
+	this->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(this->fd < 0)
+	{
+		return -1;
+	}
+	if(connect(this->fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+	{
+		int saved_errno = errno;
+		close(this->fd);
+		this->fd = -1;
+		errno = saved_errno;
+		return -1;
+	}
+	return 0;
+}
+
+bool ubx_chrony::send(const ubx_nav_pvt &pvt, const struct timespec &arrival)
+{
+	// Date, time & fully resolved
+	int64_t utc_ns;
+	if((pvt.data.valid & 0x07) != 0x07 || pvt.data.tAcc > this->max_tacc_ns || !pvt.get_utc_ns(utc_ns))
+	{
+		this->skipped++;
+		return false;
+	}
+	int64_t system_ns = (int64_t)arrival.tv_sec * 1000000000 + arrival.tv_nsec;
+	return send_sample(arrival, (utc_ns - system_ns) / 1e9, 0);
+}
+
+bool ubx_chrony::send_pulse(const struct timespec &edge, double offset)
+{
+	return send_sample(edge, offset, 1);
+}
+
+bool ubx_chrony::send_sample(const struct timespec &system, double offset, int pulse)
+{
+	struct chrony_sock_sample sample;
+	memset(&sample, 0, sizeof(sample));
+	sample.tv.tv_sec = system.tv_sec;
+	sample.tv.tv_usec = system.tv_nsec / 1000;
+	// Against tv as sent, to the us
+	sample.offset = offset + (system.tv_nsec % 1000) / 1e9;
+	sample.pulse = pulse;
+	sample.magic = CHRONY_SOCK_MAGIC;
+	this->offsets.update(sample.offset);
+
+	// chronyd may have been restarted since, connect again
+	if(this->fd < 0 && open() != 0)
+	{
+		this->send_errors++;
+		return false;
+	}
+	if(::send(this->fd, &sample, sizeof(sample), MSG_DONTWAIT) != sizeof(sample))
+	{
+		this->send_errors++;
+		if(errno == ECONNREFUSED || errno == ENOTCONN || errno == ENOENT)
+		{
+			close(this->fd);
+			this->fd = -1;
+		}
+		return false;
+	}
+	this->samples++;
+	return true;
+}
+
+void ubx_chrony::dump_stats(FILE *fp)
+{
+	fprintf(fp, "chrony %s: %zd samples sent, %zd skipped, %zd send errors\n",
+		this->path.c_str(), this->samples, this->skipped, this->send_errors);
+	if(this->offsets.count > 0)
+	{
+		fprintf(fp, "chrony: offset mean %+.6f s, stddev %.6f s, jitter %.6f s, min %+.6f s, max %+.6f s\n",
+			this->offsets.mean, this->offsets.stddev(), this->offsets.jitter(), this->offsets.min, this->offsets.max);
+	}
+}
+
+} // namespace UBX
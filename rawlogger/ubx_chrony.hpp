@@ -0,0 +1,87 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+#include "ubx_nav.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::string;
+
+constexpr int CHRONY_SOCK_MAGIC = 0x534f434b;
+// Samples with a worse time accuracy estimate are not sent
+constexpr uint32_t UBX_CHRONY_MAX_TACC_NS = 1000000;
+
+// Datagram of chrony's SOCK refclock driver (refclock_sock.c)
+struct chrony_sock_sample
+{
+	struct timeval tv;	// system time of the measurement
+	double offset;	// true time - system time, s
+	int pulse;	// non-zero for PPS, seconds come from another source
+	int leap;	// 0 normal, 1 insert, 2 delete
+	int _pad;
+	int magic;	// CHRONY_SOCK_MAGIC
+};
+
+// Streaming mean, deviation & extremes of sample offsets, plus the RMS of
+// the difference between consecutive ones
+struct ubx_offset_stats
+{
+	size_t count;
+	double mean;
+	double m2;
+	double min;
+	double max;
+	double last;
+	double diff_sq;
+
+	ubx_offset_stats();
+	void update(double offset);
+	double stddev() const;
+	double jitter() const;
+};
+
+// chrony SOCK refclock output, instead of going through gpsd.
+// Each epoch gives one sample: the NAV-PVT UTC time (nano included) against
+// the system time when the epoch's first Byte was read. As the receiver is
+// quiet between epochs, that read returns as soon as the first Byte is in,
+// so the offset is the serial latency, constant but for the jitter, to be
+// taken out with the refclock's offset option.
+class ubx_chrony
+{
+public:
+	// Statistics
+	size_t samples;
+	size_t skipped;	// no valid time, or tAcc too large
+	size_t send_errors;
+	ubx_offset_stats offsets;
+	uint32_t max_tacc_ns;
+
+	ubx_chrony(const char *path);
+	~ubx_chrony();
+	// Returns -1 with errno set if chrony's socket isn't there (yet),
+	// send() tries again then
+	int open();
+	// arrival: CLOCK_REALTIME when the epoch's first Byte was read
+	bool send(const ubx_nav_pvt &pvt, const struct timespec &arrival);
+	// A PPS edge's system time & its offset to the true second, same sign as
+	// above. chrony only takes the fraction of a second, the seconds come
+	// from another source.
+	bool send_pulse(const struct timespec &edge, double offset);
+	void dump_stats(FILE *fp);
+private:
+	string path;
+	int fd;
+
+	// offset is against system, to the ns
+	bool send_sample(const struct timespec &system, double offset, int pulse);
+
+	ubx_chrony(const ubx_chrony &) = delete;
+	ubx_chrony &operator=(const ubx_chrony &) = delete;
+};
+
+} // namespace UBX
@@ -0,0 +1,231 @@
+#include "ubx_cksum.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UBX_CKSUM_X86
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define UBX_CKSUM_NEON
+#endif
+
+// Fletcher is linear, for a block of n Bytes b[0..n-1] starting from (A, B):
+//   A' = A + sum(b[i])
+//   B' = B + n * A + sum((n - i) * b[i])
+// so a block only needs a plain sum and a weighted sum, which vectorize well.
+// The checksum is mod 256, and 256 divides 2^16 & 2^32, so the wider
+// accumulators can be left to wrap around freely and truncated at the end.
+
+namespace UBX
+{
+
+static inline uint16_t cksum_finish(uint32_t a, uint32_t b)
+{
+	return ((a & 0xff) << 8) | (b & 0xff);
+}
+
+static inline void cksum_tail(const uint8_t *buf, size_t len, uint32_t &a, uint32_t &b)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		a += buf[i];
+		b += a;
+	}
+}
+
+uint16_t ubx_cksum_scalar(const uint8_t *buf, size_t len)
+{
+	uint8_t ck_a = 0, ck_b = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		ck_a += buf[i];
+		ck_b += ck_a;
+	}
+	return (ck_a << 8) | ck_b;
+}
+
+uint16_t ubx_cksum_blocked(const uint8_t *buf, size_t len)
+{
+	uint32_t a = 0, b = 0;
+	while(len >= 16)
+	{
+		uint32_t s = 0, w = 0;
+		for(int i = 0; i < 16; i++)
+		{
+			s += buf[i];
+			w += (16 - i) * buf[i];
+		}
+		b += 16 * a + w;
+		a += s;
+		buf += 16;
+		len -= 16;
+	}
+	cksum_tail(buf, len, a, b);
+	return cksum_finish(a, b);
+}
+
+#ifdef UBX_CKSUM_X86
+static inline uint32_t hsum_epi32(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+__attribute__((target("sse2")))
+static uint16_t ubx_cksum_sse2(const uint8_t *buf, size_t len)
+{
+	uint32_t a = 0, b = 0;
+	size_t blocks = len / 16;
+	if(blocks > 0)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+		const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+		__m128i vs = zero;	// sum of all Bytes so far
+		__m128i vps = zero;	// sum of vs before each block
+		__m128i vw = zero;	// sum of weighted block sums
+		for(size_t i = 0; i < blocks; i++)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(buf + i * 16));
+			vps = _mm_add_epi32(vps, vs);
+			vs = _mm_add_epi32(vs, _mm_sad_epu8(v, zero));
+			vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), w_lo));
+			vw = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), w_hi));
+		}
+		a = hsum_epi32(vs);
+		b = 16 * hsum_epi32(vps) + hsum_epi32(vw);
+		buf += blocks * 16;
+		len -= blocks * 16;
+	}
+	cksum_tail(buf, len, a, b);
+	return cksum_finish(a, b);
+}
+
+__attribute__((target("avx2")))
+static uint16_t ubx_cksum_avx2(const uint8_t *buf, size_t len)
+{
+	uint32_t a = 0, b = 0;
+	size_t blocks = len / 32;
+	if(blocks > 0)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i ones = _mm256_set1_epi16(1);
+		const __m256i weights = _mm256_setr_epi8(
+			32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+			16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+		__m256i vs = zero;
+		__m256i vps = zero;
+		__m256i vw = zero;
+		for(size_t i = 0; i < blocks; i++)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i * 32));
+			vps = _mm256_add_epi32(vps, vs);
+			vs = _mm256_add_epi32(vs, _mm256_sad_epu8(v, zero));
+			// u8 * s8 pairs fit in s16: 255 * (32 + 31) < 32767
+			vw = _mm256_add_epi32(vw, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+		}
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(vs), _mm256_extracti128_si256(vs, 1));
+		__m128i ps = _mm_add_epi32(_mm256_castsi256_si128(vps), _mm256_extracti128_si256(vps, 1));
+		__m128i w = _mm_add_epi32(_mm256_castsi256_si128(vw), _mm256_extracti128_si256(vw, 1));
+		a = hsum_epi32(s);
+		b = 32 * hsum_epi32(ps) + hsum_epi32(w);
+		buf += blocks * 32;
+		len -= blocks * 32;
+	}
+	cksum_tail(buf, len, a, b);
+	return cksum_finish(a, b);
+}
+#endif
+
+#ifdef UBX_CKSUM_NEON
+static uint16_t ubx_cksum_neon(const uint8_t *buf, size_t len)
+{
+	uint32_t a = 0, b = 0;
+	size_t blocks = len / 16;
+	if(blocks > 0)
+	{
+		static const uint8_t w_lo_tab[8] = {16, 15, 14, 13, 12, 11, 10, 9};
+		static const uint8_t w_hi_tab[8] = {8, 7, 6, 5, 4, 3, 2, 1};
+		const uint8x8_t w_lo = vld1_u8(w_lo_tab);
+		const uint8x8_t w_hi = vld1_u8(w_hi_tab);
+		uint32x4_t vs = vdupq_n_u32(0);
+		uint32x4_t vps = vdupq_n_u32(0);
+		uint32x4_t vw = vdupq_n_u32(0);
+		for(size_t i = 0; i < blocks; i++)
+		{
+			uint8x16_t v = vld1q_u8(buf + i * 16);
+			vps = vaddq_u32(vps, vs);
+			vs = vpadalq_u16(vs, vpaddlq_u8(v));
+			vw = vpadalq_u16(vw, vmull_u8(vget_low_u8(v), w_lo));
+			vw = vpadalq_u16(vw, vmull_u8(vget_high_u8(v), w_hi));
+		}
+		a = vaddvq_u32(vs);
+		b = 16 * vaddvq_u32(vps) + vaddvq_u32(vw);
+		buf += blocks * 16;
+		len -= blocks * 16;
+	}
+	cksum_tail(buf, len, a, b);
+	return cksum_finish(a, b);
+}
+#endif
+
+static const ubx_cksum_impl *ubx_cksum_probe()
+{
+	static ubx_cksum_impl impls[8];
+	int n = 0;
+	impls[n++] = {"scalar", ubx_cksum_scalar};
+	impls[n++] = {"blocked", ubx_cksum_blocked};
+#ifdef UBX_CKSUM_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2"))
+	{
+		impls[n++] = {"sse2", ubx_cksum_sse2};
+	}
+	if(__builtin_cpu_supports("avx2"))
+	{
+		impls[n++] = {"avx2", ubx_cksum_avx2};
+	}
+#endif
+#ifdef UBX_CKSUM_NEON
+	impls[n++] = {"neon", ubx_cksum_neon};
+#endif
+	impls[n] = {NULL, NULL};
+	return impls;
+}
+
+const ubx_cksum_impl *ubx_cksum_impls()
+{
+	// Function local static, so probing happens exactly once even with multiple threads
+	static const ubx_cksum_impl *impls = ubx_cksum_probe();
+	return impls;
+}
+
+// The last usable implementation is the preferred one
+static const ubx_cksum_impl &ubx_cksum_best()
+{
+	static const ubx_cksum_impl &best = []() -> const ubx_cksum_impl &
+	{
+		const ubx_cksum_impl *impls = ubx_cksum_impls();
+		size_t n = 0;
+		while(impls[n + 1].func != NULL)
+		{
+			n++;
+		}
+		return impls[n];
+	}();
+	return best;
+}
+
+uint16_t ubx_cksum(const uint8_t *buf, size_t len)
+{
+	return ubx_cksum_best().func(buf, len);
+}
+
+const char *ubx_cksum_name()
+{
+	return ubx_cksum_best().name;
+}
+
+} // namespace UBX
@@ -0,0 +1,29 @@
+#include <cstddef>
+#include <stdint.h>
+
+#pragma once
+
+namespace UBX
+{
+// UBX checksum (8-Bit Fletcher), CK_A is high byte, CK_B is low byte
+typedef uint16_t (*ubx_cksum_func_t)(const uint8_t *buf, size_t len);
+
+struct ubx_cksum_impl
+{
+	const char *name;
+	ubx_cksum_func_t func;
+};
+
+// Picks the fastest implementation supported by this CPU on first call
+uint16_t ubx_cksum(const uint8_t *buf, size_t len);
+const char *ubx_cksum_name();
+
+// Reference byte-at-a-time implementation
+uint16_t ubx_cksum_scalar(const uint8_t *buf, size_t len);
+// Portable version working on 16 Bytes blocks
+uint16_t ubx_cksum_blocked(const uint8_t *buf, size_t len);
+
+// All implementations usable on this CPU, terminated by {NULL, NULL}
+const ubx_cksum_impl *ubx_cksum_impls();
+
+} // namespace UBX
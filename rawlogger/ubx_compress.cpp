@@ -0,0 +1,498 @@
+#include "ubx_compress.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace UBX
+{
+// Output grows by this much whenever the codec runs out of room
+constexpr size_t UBX_COMPRESS_CHUNK = 64 * 1024;
+
+bool ubx_compression_parse(const char *name, ubx_compression &type)
+{
+	if(strcmp(name, "none") == 0)
+	{
+		type = UBX_COMPRESS_NONE;
+		return true;
+	}
+#ifdef HAVE_LZMA
+	if(strcmp(name, "xz") == 0)
+	{
+		type = UBX_COMPRESS_XZ;
+		return true;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if(strcmp(name, "zstd") == 0)
+	{
+		type = UBX_COMPRESS_ZSTD;
+		return true;
+	}
+#endif
+	return false;
+}
+
+bool ubx_compression_levels(ubx_compression type, int &min, int &max)
+{
+	switch(type)
+	{
+#ifdef HAVE_LZMA
+	case UBX_COMPRESS_XZ:
+		// Presets, without LZMA_PRESET_EXTREME
+		min = 0;
+		max = 9;
+		return true;
+#endif
+#ifdef HAVE_ZSTD
+	case UBX_COMPRESS_ZSTD:
+		min = ZSTD_minCLevel();
+		max = ZSTD_maxCLevel();
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *ubx_compression_suffix(ubx_compression type)
+{
+	switch(type)
+	{
+	case UBX_COMPRESS_XZ:
+		return ".xz";
+	case UBX_COMPRESS_ZSTD:
+		return ".zst";
+	default:
+		return "";
+	}
+}
+
+ubx_compression ubx_compression_from_name(const char *path)
+{
+	size_t len = strlen(path);
+	if(len >= 3 && strcmp(path + len - 3, ".xz") == 0)
+	{
+		return UBX_COMPRESS_XZ;
+	}
+	if(len >= 4 && strcmp(path + len - 4, ".zst") == 0)
+	{
+		return UBX_COMPRESS_ZSTD;
+	}
+	return UBX_COMPRESS_NONE;
+}
+
+ubx_compressor::ubx_compressor(ubx_compression type, int level)
+{
+	this->type = type;
+	this->level = level;
+	this->frame_open = false;
+	this->bytes_in = 0;
+	this->bytes_out = 0;
+	this->frames = 0;
+#ifdef HAVE_LZMA
+	this->lzma = LZMA_STREAM_INIT;
+#endif
+#ifdef HAVE_ZSTD
+	this->zstd = NULL;
+	if(type == UBX_COMPRESS_ZSTD)
+	{
+		this->zstd = ZSTD_createCCtx();
+		if(this->zstd == NULL)
+		{
+			fputs("ubx_compressor::ubx_compressor(): ZSTD_createCCtx() failed\n", stderr);
+			abort();
+		}
+		ZSTD_CCtx_setParameter(this->zstd, ZSTD_c_compressionLevel, level);
+		ZSTD_CCtx_setParameter(this->zstd, ZSTD_c_checksumFlag, 1);
+	}
+#endif
+}
+
+ubx_compressor::~ubx_compressor()
+{
+#ifdef HAVE_LZMA
+	lzma_end(&this->lzma);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(this->zstd);
+#endif
+}
+
+#ifdef HAVE_LZMA
+int ubx_compressor::lzma_run(const uint8_t *in, size_t len, lzma_action action, vector<uint8_t> &out)
+{
+	this->lzma.next_in = in;
+	this->lzma.avail_in = len;
+	while(1)
+	{
+		size_t start = out.size();
+		out.resize(start + UBX_COMPRESS_CHUNK);
+		this->lzma.next_out = out.data() + start;
+		this->lzma.avail_out = UBX_COMPRESS_CHUNK;
+		lzma_ret ret = lzma_code(&this->lzma, action);
+		out.resize(out.size() - this->lzma.avail_out);
+		this->bytes_out += UBX_COMPRESS_CHUNK - this->lzma.avail_out;
+		if(ret == LZMA_STREAM_END)
+		{
+			return 0;
+		}
+		if(ret != LZMA_OK)
+		{
+			fprintf(stderr, "ubx_compressor::lzma_run(): lzma_code() failed: %d\n", ret);
+			errno = ret == LZMA_MEM_ERROR ? ENOMEM : EIO;
+			return -1;
+		}
+		// LZMA_RUN is done once the input is consumed and output wasn't full
+		if(action == LZMA_RUN && this->lzma.avail_in == 0 && this->lzma.avail_out != 0)
+		{
+			return 0;
+		}
+	}
+}
+#endif
+
+#ifdef HAVE_ZSTD
+int ubx_compressor::zstd_run(const uint8_t *in, size_t len, ZSTD_EndDirective mode, vector<uint8_t> &out)
+{
+	ZSTD_inBuffer input = {in, len, 0};
+	while(1)
+	{
+		size_t start = out.size();
+		out.resize(start + UBX_COMPRESS_CHUNK);
+		ZSTD_outBuffer output = {out.data() + start, UBX_COMPRESS_CHUNK, 0};
+		size_t remaining = ZSTD_compressStream2(this->zstd, &output, &input, mode);
+		out.resize(start + output.pos);
+		this->bytes_out += output.pos;
+		if(ZSTD_isError(remaining))
+		{
+			fprintf(stderr, "ubx_compressor::zstd_run(): %s\n", ZSTD_getErrorName(remaining));
+			errno = EIO;
+			return -1;
+		}
+		if(mode == ZSTD_e_continue ? input.pos == input.size : remaining == 0)
+		{
+			return 0;
+		}
+	}
+}
+#endif
+
+int ubx_compressor::begin_frame()
+{
+	switch(this->type)
+	{
+#ifdef HAVE_LZMA
+	case UBX_COMPRESS_XZ:
+	{
+		// Reuses the encoder's memory from the previous frame when possible
+		lzma_ret ret = lzma_easy_encoder(&this->lzma, this->level, LZMA_CHECK_CRC32);
+		if(ret != LZMA_OK)
+		{
+			fprintf(stderr, "ubx_compressor::begin_frame(): lzma_easy_encoder() failed: %d\n", ret);
+			errno = ret == LZMA_MEM_ERROR ? ENOMEM : EINVAL;
+			return -1;
+		}
+		break;
+	}
+#endif
+	default:
+		break;
+	}
+	this->frame_open = true;
+	return 0;
+}
+
+int ubx_compressor::update(const uint8_t *in, size_t len, vector<uint8_t> &out)
+{
+	if(len == 0)
+	{
+		return 0;
+	}
+	if(!this->frame_open && begin_frame() != 0)
+	{
+		return -1;
+	}
+	this->bytes_in += len;
+	switch(this->type)
+	{
+#ifdef HAVE_LZMA
+	case UBX_COMPRESS_XZ:
+		return lzma_run(in, len, LZMA_RUN, out);
+#endif
+#ifdef HAVE_ZSTD
+	case UBX_COMPRESS_ZSTD:
+		return zstd_run(in, len, ZSTD_e_continue, out);
+#endif
+	default:
+		out.insert(out.end(), in, in + len);
+		this->bytes_out += len;
+		return 0;
+	}
+}
+
+int ubx_compressor::end_frame(vector<uint8_t> &out)
+{
+	if(!this->frame_open)
+	{
+		return 0;
+	}
+	this->frame_open = false;
+	this->frames++;
+	switch(this->type)
+	{
+#ifdef HAVE_LZMA
+	case UBX_COMPRESS_XZ:
+		return lzma_run(NULL, 0, LZMA_FINISH, out);
+#endif
+#ifdef HAVE_ZSTD
+	case UBX_COMPRESS_ZSTD:
+		return zstd_run(NULL, 0, ZSTD_e_end, out);
+#endif
+	default:
+		(void)out;
+		return 0;
+	}
+}
+
+void ubx_compressor::dump_stats(FILE *fp)
+{
+	if(this->type == UBX_COMPRESS_NONE)
+	{
+		return;
+	}
+	fprintf(fp, "Compressed %zd Bytes into %zd Bytes (%.1f%%) in %zd frames\n",
+		this->bytes_in, this->bytes_out,
+		this->bytes_in > 0 ? 100.0 * this->bytes_out / this->bytes_in : 0.0,
+		this->frames);
+}
+
+ubx_decompressor::ubx_decompressor(int fd, ubx_compression type)
+{
+	this->type = type;
+	this->fd = fd;
+	this->in_pos = 0;
+	this->in_eof = false;
+	this->done = false;
+	this->bytes_in = 0;
+	this->bytes_out = 0;
+	this->track_frames = false;
+	this->truncated = false;
+	this->error = 0;
+#ifdef HAVE_LZMA
+	// One .xz stream per compressed frame, the decoder is set up at the start of each
+	this->lzma = LZMA_STREAM_INIT;
+	this->lzma_in_stream = false;
+#endif
+#ifdef HAVE_ZSTD
+	this->zstd = NULL;
+	this->zstd_left = 0;
+	if(type == UBX_COMPRESS_ZSTD)
+	{
+		this->zstd = ZSTD_createDCtx();
+		if(this->zstd == NULL)
+		{
+			fputs("ubx_decompressor::ubx_decompressor(): ZSTD_createDCtx() failed\n", stderr);
+			abort();
+		}
+	}
+#endif
+}
+
+ubx_decompressor::~ubx_decompressor()
+{
+#ifdef HAVE_LZMA
+	lzma_end(&this->lzma);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeDCtx(this->zstd);
+#endif
+}
+
+// Read the next chunk of compressed input
+int ubx_decompressor::refill()
+{
+	this->in.resize(UBX_COMPRESS_CHUNK);
+	ssize_t ret;
+	do
+	{
+		ret = ::read(this->fd, this->in.data(), this->in.size());
+	} while(ret < 0 && errno == EINTR);
+	if(ret < 0)
+	{
+		this->in.clear();
+		this->in_pos = 0;
+		return -1;
+	}
+	this->in.resize(ret);
+	this->in_pos = 0;
+	this->in_eof = ret == 0;
+	this->bytes_in += ret;
+	return 0;
+}
+
+// A frame starts at the next input Byte
+void ubx_decompressor::frame_start(uint64_t raw_offset)
+{
+	if(this->track_frames)
+	{
+		ubx_frame_start start;
+		start.raw_offset = raw_offset;
+		start.file_offset = this->bytes_in - (this->in.size() - this->in_pos);
+		this->frame_starts.push_back(start);
+	}
+}
+
+ssize_t ubx_decompressor::read_plain(uint8_t *buf, size_t len)
+{
+	ssize_t ret;
+	do
+	{
+		ret = ::read(this->fd, buf, len);
+	} while(ret < 0 && errno == EINTR);
+	if(ret > 0)
+	{
+		this->bytes_in += ret;
+		this->bytes_out += ret;
+	}
+	return ret;
+}
+
+// A file cut short (by a crash while logging) gives what could be decoded,
+// then the end of data with a warning, & truncated set
+ssize_t ubx_decompressor::read(uint8_t *buf, size_t len)
+{
+	ssize_t ret = decode(buf, len);
+	if(ret < 0 && this->error == 0 && errno != EINTR && errno != EAGAIN)
+	{
+		this->error = errno;
+	}
+	return ret;
+}
+
+ssize_t ubx_decompressor::decode(uint8_t *buf, size_t len)
+{
+	if(this->done || len == 0)
+	{
+		return 0;
+	}
+	switch(this->type)
+	{
+#ifdef HAVE_LZMA
+	case UBX_COMPRESS_XZ:
+	{
+		this->lzma.next_out = buf;
+		this->lzma.avail_out = len;
+		while(this->lzma.avail_out == len)
+		{
+			if(this->in_pos == this->in.size() && !this->in_eof && refill() != 0)
+			{
+				return -1;
+			}
+			if(!this->lzma_in_stream)
+			{
+				// Between streams, skip the stream padding, the end of the file may come here
+				while(this->in_pos < this->in.size() && this->in[this->in_pos] == 0)
+				{
+					this->in_pos++;
+				}
+				if(this->in_pos == this->in.size())
+				{
+					if(this->in_eof)
+					{
+						this->done = true;
+						break;
+					}
+					continue;
+				}
+				lzma_ret ret = lzma_stream_decoder(&this->lzma, UINT64_MAX, 0);
+				if(ret != LZMA_OK)
+				{
+					fprintf(stderr, "ubx_decompressor::read(): lzma_stream_decoder() failed: %d\n", ret);
+					errno = ret == LZMA_MEM_ERROR ? ENOMEM : EIO;
+					return -1;
+				}
+				frame_start(this->bytes_out + len - this->lzma.avail_out);
+				this->lzma_in_stream = true;
+			}
+			this->lzma.next_in = this->in.data() + this->in_pos;
+			this->lzma.avail_in = this->in.size() - this->in_pos;
+			lzma_ret ret = lzma_code(&this->lzma, this->in_eof ? LZMA_FINISH : LZMA_RUN);
+			this->in_pos = this->in.size() - this->lzma.avail_in;
+			if(ret == LZMA_STREAM_END)
+			{
+				this->lzma_in_stream = false;
+				continue;
+			}
+			if(ret == LZMA_BUF_ERROR && this->in_eof)
+			{
+				fputs("ubx_decompressor::read(): truncated .xz file\n", stderr);
+				this->truncated = true;
+				this->done = true;
+				break;
+			}
+			if(ret != LZMA_OK)
+			{
+				fprintf(stderr, "ubx_decompressor::read(): lzma_code() failed: %d\n", ret);
+				errno = ret == LZMA_MEM_ERROR ? ENOMEM : EIO;
+				return -1;
+			}
+		}
+		size_t produced = len - this->lzma.avail_out;
+		this->bytes_out += produced;
+		return produced;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case UBX_COMPRESS_ZSTD:
+	{
+		ZSTD_outBuffer output = {buf, len, 0};
+		while(output.pos == 0)
+		{
+			if(this->in_pos == this->in.size())
+			{
+				if(this->in_eof)
+				{
+					if(this->zstd_left != 0)
+					{
+						fputs("ubx_decompressor::read(): truncated .zst file\n", stderr);
+						this->truncated = true;
+					}
+					this->done = true;
+					break;
+				}
+				if(refill() != 0)
+				{
+					return -1;
+				}
+				continue;
+			}
+			if(this->zstd_left == 0)
+			{
+				frame_start(this->bytes_out + output.pos);
+			}
+			ZSTD_inBuffer input = {this->in.data(), this->in.size(), this->in_pos};
+			size_t ret = ZSTD_decompressStream(this->zstd, &output, &input);
+			this->in_pos = input.pos;
+			if(ZSTD_isError(ret))
+			{
+				fprintf(stderr, "ubx_decompressor::read(): %s\n", ZSTD_getErrorName(ret));
+				errno = EIO;
+				return -1;
+			}
+			this->zstd_left = ret;
+		}
+		this->bytes_out += output.pos;
+		return output.pos;
+	}
+#endif
+	case UBX_COMPRESS_NONE:
+		return read_plain(buf, len);
+	default:
+		// Compressed, but not built with its library
+		errno = ENOTSUP;
+		return -1;
+	}
+}
+
+} // namespace UBX
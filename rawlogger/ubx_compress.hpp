@@ -0,0 +1,134 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <sys/types.h>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+enum ubx_compression
+{
+	UBX_COMPRESS_NONE,
+	UBX_COMPRESS_XZ,
+	UBX_COMPRESS_ZSTD
+};
+
+constexpr int UBX_COMPRESS_DEFAULT_LEVEL = 6;
+// At 1 Hz that's a minute of data per independently decodable frame
+constexpr size_t UBX_COMPRESS_DEFAULT_EPOCHS = 60;
+
+// Parses "none", "xz" or "zstd", returns false if unknown or not built in
+bool ubx_compression_parse(const char *name, ubx_compression &type);
+// Levels the codec takes, false if it has none (UBX_COMPRESS_NONE)
+bool ubx_compression_levels(ubx_compression type, int &min, int &max);
+// File name suffix, "" for none
+const char *ubx_compression_suffix(ubx_compression type);
+// Guess from the file name suffix
+ubx_compression ubx_compression_from_name(const char *path);
+
+// Streaming compressor producing a series of independent frames:
+// one .xz stream or zstd frame per end_frame() call, concatenated.
+// Both formats allow concatenation, so plain xz / zstd tools still work,
+// and a reader can start decoding at any frame boundary.
+// Functions return 0 on success, -1 with errno set on error.
+class ubx_compressor
+{
+public:
+	ubx_compression type;
+	// Statistics
+	size_t bytes_in;
+	size_t bytes_out;
+	size_t frames;
+
+	ubx_compressor(ubx_compression type = UBX_COMPRESS_NONE, int level = UBX_COMPRESS_DEFAULT_LEVEL);
+	~ubx_compressor();
+	// Compress in, append the output to out
+	int update(const uint8_t *in, size_t len, vector<uint8_t> &out);
+	// Finish the current frame, append the rest of its output to out
+	int end_frame(vector<uint8_t> &out);
+	bool in_frame() const
+	{
+		return this->frame_open;
+	}
+	void dump_stats(FILE *fp);
+private:
+	int level;
+	bool frame_open;
+#ifdef HAVE_LZMA
+	lzma_stream lzma;
+	int lzma_run(const uint8_t *in, size_t len, lzma_action action, vector<uint8_t> &out);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd;
+	int zstd_run(const uint8_t *in, size_t len, ZSTD_EndDirective mode, vector<uint8_t> &out);
+#endif
+	int begin_frame();
+
+	ubx_compressor(const ubx_compressor &) = delete;
+	ubx_compressor &operator=(const ubx_compressor &) = delete;
+};
+
+// Where a compressed frame starts, in the decompressed data & in the file
+struct ubx_frame_start
+{
+	uint64_t raw_offset;
+	uint64_t file_offset;
+};
+
+// Streaming decompressor reading from a file descriptor,
+// for all the frames (streams) of a file written by ubx_compressor,
+// or a single one written by the xz / zstd tools
+class ubx_decompressor
+{
+public:
+	ubx_compression type;
+	// Statistics
+	size_t bytes_in;
+	size_t bytes_out;
+	// Set to keep the start of every frame decoded in frame_starts, in order
+	bool track_frames;
+	vector<ubx_frame_start> frame_starts;
+	// The input ended inside a frame, read() gave what could be decoded & then 0
+	bool truncated;
+	// errno of the first read() that failed, e.g. EIO for data that doesn't decode, 0 if none did
+	int error;
+
+	ubx_decompressor(int fd, ubx_compression type);
+	~ubx_decompressor();
+	// Like read(2): returns Bytes decompressed into buf, 0 at the end, -1 with errno set on error
+	ssize_t read(uint8_t *buf, size_t len);
+private:
+	int fd;
+	vector<uint8_t> in;
+	size_t in_pos;
+	bool in_eof;
+	bool done;
+#ifdef HAVE_LZMA
+	lzma_stream lzma;
+	bool lzma_in_stream;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DCtx *zstd;
+	size_t zstd_left; // non-zero while inside a frame
+#endif
+	int refill();
+	void frame_start(uint64_t raw_offset);
+	ssize_t decode(uint8_t *buf, size_t len);
+	ssize_t read_plain(uint8_t *buf, size_t len);
+
+	ubx_decompressor(const ubx_decompressor &) = delete;
+	ubx_decompressor &operator=(const ubx_decompressor &) = delete;
+};
+
+} // namespace UBX
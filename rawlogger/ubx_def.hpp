@@ -3,6 +3,7 @@
 #include <map>
 #include <cstddef>
 #include <stdint.h>
+#include "ubx_pool.hpp"
 
 #pragma once
 
@@ -19,17 +20,23 @@ constexpr uint8_t UBX_MSG_OFFSET	= 1;
 constexpr uint8_t UBX_LENGTH_OFFSET	= 2;
 constexpr uint8_t UBX_HEADER_SIZE	= 4;
 constexpr uint8_t UBX_CKSUM_SIZE	= 2;
+// SYNC1 + SYNC2 + header + 65535 Bytes of payload + checksum
+constexpr size_t UBX_MAX_FRAME_SIZE	= 2 + UBX_HEADER_SIZE + 0xffff + UBX_CKSUM_SIZE;
+static_assert(UBX_MAX_FRAME_SIZE <= UBX_POOL_MAX_SIZE, "frames don't fit the pool");
 
 constexpr uint8_t UBX_CLASS_NAV	= 0x01;
 constexpr uint8_t UBX_CLASS_RXM	= 0x02;
 constexpr uint8_t UBX_CLASS_MON	= 0x0A;
+constexpr uint8_t UBX_CLASS_TIM	= 0x0D;
 constexpr uint8_t UBX_NAV_PVT	= 0x07;
+constexpr uint8_t UBX_NAV_HPPOSLLH	= 0x14;
+constexpr uint8_t UBX_NAV_SIG	= 0x43;
 constexpr uint8_t UBX_NAV_EOE	= 0x61;
 constexpr uint8_t UBX_RXM_RAWX	= 0x15;
 constexpr uint8_t UBX_RXM_SRFBX	= 0x13;
+constexpr uint8_t UBX_TIM_TP	= 0x01;
 
 typedef vector<uint8_t> ubx_buf_t;
-typedef map<uint8_t, string> ubx_name_map_t;
 
 // x1 x2 x4 -> u1 u2 u4
 
@@ -43,13 +50,62 @@ float getr4(ubx_buf_t &buf, size_t offset);
 double getr8(ubx_buf_t &buf, size_t offset);
 uint8_t getch(ubx_buf_t &buf, size_t offset);
 
+// Unchecked versions for frame views, caller makes sure offset is within the payload
+uint8_t getu1(const uint8_t *buf, size_t offset);
+uint16_t getu2(const uint8_t *buf, size_t offset);
+uint32_t getu4(const uint8_t *buf, size_t offset);
+int8_t geti1(const uint8_t *buf, size_t offset);
+int16_t geti2(const uint8_t *buf, size_t offset);
+int32_t geti4(const uint8_t *buf, size_t offset);
+float getr4(const uint8_t *buf, size_t offset);
+double getr8(const uint8_t *buf, size_t offset);
+uint8_t getch(const uint8_t *buf, size_t offset);
+
+// Non-owning view of a frame (without sync chars)
+// Points into someone else's buffer (usually the input buffer of ubx_reader),
+// so it's only valid until that buffer is reused.
+class ubx_frame_view
+{
+public:
+	// class_id, msg_id, length, payload & checksum
+	const uint8_t *data;
+	size_t size;
+
+	uint8_t class_id;
+	uint8_t msg_id;
+	uint16_t length;
+	// CK_A is high byte, CK_B is low byte
+	uint16_t cksum;
+
+	bool valid;
+
+	ubx_frame_view();
+	ubx_frame_view(const uint8_t *data, size_t size);
+	// For frames whose checksum was already checked
+	ubx_frame_view(const uint8_t *data, size_t size, bool valid);
+	const uint8_t *payload() const
+	{
+		return this->data + UBX_HEADER_SIZE;
+	}
+	void clear();
+	void dump(FILE *fp) const;
+	void dump_msg(FILE *fp) const;
+	int write(FILE *fp) const;
+private:
+	bool validate();
+};
+
+// Owning copy of a frame, for callers that need to keep it
+// The copy is in a buffer from ubx_frame_pool::global(), reused by the next
+// frame assigned to it, & recycled when the frame is destroyed.
 class ubx_frame
 {
 public:
 	uint8_t class_id;
 	uint8_t msg_id;
 	uint16_t length;
-	ubx_buf_t payload;
+	// class_id, msg_id, length, payload & checksum
+	ubx_pool_buf buf;
 	// CK_A is high byte, CK_B is low byte
 	uint16_t cksum;
 
@@ -57,11 +113,11 @@ public:
 
 	ubx_frame();
 	ubx_frame(ubx_buf_t &buf);
+	ubx_frame(const ubx_frame_view &view);
+	ubx_frame_view view() const;
 	void clear();
 	void dump(FILE *fp);
 	int write(FILE *fp);
-private:
-	bool validate(ubx_buf_t &buf);
 };
 
 class ubx_any_msg
@@ -70,13 +126,16 @@ public:
 	bool valid;
 	uint8_t class_id;
 	uint8_t msg_id;
-	ubx_buf_t payload;
+	// In a pooled buffer, as ubx_frame
+	ubx_pool_buf payload;
 
 	ubx_any_msg();
-	ubx_any_msg(ubx_frame &frame);
-	bool parse(ubx_frame &frame);
+	ubx_any_msg(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
 	void clear();
 	void dump(FILE *fp);
 };
 
+void ubx_dump_msg(FILE *fp, uint8_t class_id, uint8_t msg_id, const uint8_t *payload, size_t length);
+
 } // namespace UBX
\ No newline at end of file
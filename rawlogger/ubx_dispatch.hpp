@@ -0,0 +1,159 @@
+#include <cstddef>
+#include <stdint.h>
+#include <array>
+#include <tuple>
+#include <vector>
+#include <functional>
+#include <utility>
+#include "ubx_def.hpp"
+#include "ubx_nav.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_tim.hpp"
+
+#pragma once
+
+namespace UBX
+{
+// (class_id, msg_id) of each decoder, specialise this for every new decoder
+template<typename T>
+struct ubx_msg_traits;
+
+template<>
+struct ubx_msg_traits<ubx_nav_pvt>
+{
+	static constexpr uint8_t class_id = UBX_CLASS_NAV;
+	static constexpr uint8_t msg_id = UBX_NAV_PVT;
+};
+
+template<>
+struct ubx_msg_traits<ubx_nav_eoe>
+{
+	static constexpr uint8_t class_id = UBX_CLASS_NAV;
+	static constexpr uint8_t msg_id = UBX_NAV_EOE;
+};
+
+template<>
+struct ubx_msg_traits<ubx_nav_sig>
+{
+	static constexpr uint8_t class_id = UBX_CLASS_NAV;
+	static constexpr uint8_t msg_id = UBX_NAV_SIG;
+};
+
+template<>
+struct ubx_msg_traits<ubx_rxm_rawx>
+{
+	static constexpr uint8_t class_id = UBX_CLASS_RXM;
+	static constexpr uint8_t msg_id = UBX_RXM_RAWX;
+};
+
+template<>
+struct ubx_msg_traits<ubx_tim_tp>
+{
+	static constexpr uint8_t class_id = UBX_CLASS_TIM;
+	static constexpr uint8_t msg_id = UBX_TIM_TP;
+};
+
+constexpr uint16_t ubx_msg_key(uint8_t class_id, uint8_t msg_id)
+{
+	return (class_id << 8) | msg_id;
+}
+
+// Sends each frame to the one decoder registered for its (class_id, msg_id),
+// then to the subscribers of that message type.
+// The key -> decoder table is built at compile time, so the per frame cost is
+// a table lookup and an indirect call no matter how many decoders there are.
+// Decoders are kept as members and reused, nothing is constructed per frame.
+template<typename... Msgs>
+class ubx_dispatcher
+{
+	static_assert(sizeof...(Msgs) < 255, "too many message types");
+public:
+	// Decoded message is only valid during the callback
+	template<typename T>
+	using callback_t = std::function<void(const T &)>;
+
+	template<typename T>
+	void subscribe(callback_t<T> cb)
+	{
+		std::get<index_of<T>()>(this->subscribers).push_back(std::move(cb));
+	}
+
+	// Returns true if the frame was decoded by one of the decoders
+	bool dispatch(const ubx_frame_view &frame)
+	{
+		uint8_t slot = table[ubx_msg_key(frame.class_id, frame.msg_id)];
+		if(slot == 0)
+		{
+			return false;
+		}
+		return handlers[slot - 1](*this, frame);
+	}
+
+	static constexpr bool is_registered(uint8_t class_id, uint8_t msg_id)
+	{
+		return table[ubx_msg_key(class_id, msg_id)] != 0;
+	}
+
+private:
+	typedef bool (*handler_t)(ubx_dispatcher &, const ubx_frame_view &);
+
+	std::tuple<Msgs...> decoders;
+	std::tuple<std::vector<callback_t<Msgs>>...> subscribers;
+
+	template<typename T, size_t I = 0>
+	static constexpr size_t index_of()
+	{
+		static_assert(I < sizeof...(Msgs), "message type not registered");
+		if constexpr(std::is_same<T, typename std::tuple_element<I, std::tuple<Msgs...>>::type>::value)
+		{
+			return I;
+		}
+		else
+		{
+			return index_of<T, I + 1>();
+		}
+	}
+
+	// key -> slot + 1, 0 means no decoder
+	static constexpr std::array<uint8_t, 65536> make_table()
+	{
+		std::array<uint8_t, 65536> t = {};
+		constexpr uint16_t keys[] = {ubx_msg_key(ubx_msg_traits<Msgs>::class_id, ubx_msg_traits<Msgs>::msg_id)...};
+		for(size_t i = 0; i < sizeof...(Msgs); i++)
+		{
+			// two decoders for one message type, not a constant expression
+			if(t[keys[i]] != 0)
+			{
+				throw "duplicate decoder";
+			}
+			t[keys[i]] = i + 1;
+		}
+		return t;
+	}
+
+	template<size_t I>
+	static bool handle(ubx_dispatcher &self, const ubx_frame_view &frame)
+	{
+		auto &decoder = std::get<I>(self.decoders);
+		if(!decoder.parse(frame))
+		{
+			return false;
+		}
+		for(auto &cb : std::get<I>(self.subscribers))
+		{
+			cb(decoder);
+		}
+		return true;
+	}
+
+	template<size_t... I>
+	static constexpr std::array<handler_t, sizeof...(Msgs)> make_handlers(std::index_sequence<I...>)
+	{
+		return {{&handle<I>...}};
+	}
+
+	static constexpr std::array<uint8_t, 65536> table = make_table();
+	static constexpr std::array<handler_t, sizeof...(Msgs)> handlers = make_handlers(std::index_sequence_for<Msgs...>());
+};
+
+} // namespace UBX
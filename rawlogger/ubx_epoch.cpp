@@ -0,0 +1,338 @@
+#include "ubx.hpp"
+#include "ubx_epoch.hpp"
+#include "ubx_names.hpp"
+#include "ubx_metrics.hpp"
+#include <array>
+
+namespace UBX
+{
+
+// Offset of the iTOW in each NAV message's payload + 1, 0 for those without
+// one (or not known), which join the current epoch whatever it is
+static constexpr std::array<uint8_t, 256> make_itow_offsets()
+{
+	std::array<uint8_t, 256> t = {};
+	// Most start with it
+	constexpr uint8_t first[] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,	// POSECEF POSLLH STATUS DOP ATT SOL PVT
+		0x11, 0x12,	// VELECEF VELNED
+		0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,	// TIMEGPS TIMEUTC CLOCK TIMEGLO TIMEBDS TIMEGAL TIMELS TIMEQZSS
+		0x30, 0x31, 0x32, 0x34, 0x35, 0x36, 0x39, 0x3D,	// SVINFO DGPS SBAS ORB SAT COV GEOFENCE EELL
+		0x42, 0x43, 0x60, 0x61	// SLAS SIG AOPSTATUS EOE
+	};
+	// Version & reserved Bytes first
+	constexpr uint8_t after_version[] = {
+		0x09, 0x13, 0x14, 0x3B, 0x3C	// ODO HPPOSECEF HPPOSLLH SVIN RELPOSNED
+	};
+	for(uint8_t id : first)
+	{
+		t[id] = 1;
+	}
+	for(uint8_t id : after_version)
+	{
+		t[id] = 5;
+	}
+	return t;
+}
+
+static constexpr std::array<uint8_t, 256> itow_offsets = make_itow_offsets();
+
+ubx_epoch::ubx_epoch(ubx_epoch_assembler *owner)
+{
+	this->owner = owner;
+	this->refs = 0;
+	clear();
+}
+
+void ubx_epoch::clear()
+{
+	this->arena.reset();
+	this->seq = 0;
+	this->iTOW = 0;
+	this->has_iTOW = false;
+	this->flags = 0;
+	memset(&this->arrival, 0, sizeof(this->arrival));
+	this->arrival_ns = 0;
+	this->frames = 0;
+	this->bytes = 0;
+	this->head = NULL;
+	this->tail = NULL;
+	this->has_pvt = false;
+}
+
+void ubx_epoch::append(const ubx_frame_view &frame)
+{
+	ubx_epoch_frame *f = (ubx_epoch_frame *)this->arena.alloc(sizeof(ubx_epoch_frame) + frame.size, alignof(ubx_epoch_frame));
+	f->next = NULL;
+	f->size = frame.size;
+	f->class_id = frame.class_id;
+	f->msg_id = frame.msg_id;
+	memcpy(f + 1, frame.data, frame.size);
+	if(this->tail != NULL)
+	{
+		this->tail->next = f;
+	}
+	else
+	{
+		this->head = f;
+	}
+	this->tail = f;
+	this->frames++;
+	this->bytes += frame.size;
+}
+
+const ubx_epoch_frame *ubx_epoch::find(uint8_t class_id, uint8_t msg_id) const
+{
+	for(const ubx_epoch_frame *f = this->head; f != NULL; f = f->next)
+	{
+		if(f->class_id == class_id && f->msg_id == msg_id)
+		{
+			return f;
+		}
+	}
+	return NULL;
+}
+
+void ubx_epoch::dump(FILE *fp) const
+{
+	fprintf(fp, "Epoch %llu", (unsigned long long)this->seq);
+	if(this->has_iTOW)
+	{
+		fprintf(fp, " iTOW %u", this->iTOW);
+	}
+	fprintf(fp, ": %zd frames, %zd Bytes%s%s%s%s\n", this->frames, this->bytes,
+		this->flags & UBX_EPOCH_NO_EOE ? ", no EOE" : "",
+		this->flags & UBX_EPOCH_NO_PVT ? ", no PVT" : "",
+		this->flags & UBX_EPOCH_FULL ? ", full" : "",
+		this->flags & UBX_EPOCH_OVERLAP ? ", overlapping" : "");
+	for(const ubx_epoch_frame *f = this->head; f != NULL; f = f->next)
+	{
+		char name[UBX_MSG_NAME_MAX];
+		fprintf(fp, "\t%s %u\n", ubx_msg_name(f->class_id, f->msg_id, name, sizeof(name)), f->size);
+	}
+}
+
+ubx_epoch_ref::ubx_epoch_ref()
+{
+	this->epoch = NULL;
+}
+
+ubx_epoch_ref::ubx_epoch_ref(ubx_epoch *epoch)
+{
+	this->epoch = epoch;
+	if(epoch != NULL)
+	{
+		epoch->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+ubx_epoch_ref::ubx_epoch_ref(const ubx_epoch_ref &other) : ubx_epoch_ref(other.epoch)
+{
+}
+
+ubx_epoch_ref::ubx_epoch_ref(ubx_epoch_ref &&other)
+{
+	this->epoch = other.epoch;
+	other.epoch = NULL;
+}
+
+ubx_epoch_ref::~ubx_epoch_ref()
+{
+	reset();
+}
+
+ubx_epoch_ref &ubx_epoch_ref::operator=(const ubx_epoch_ref &other)
+{
+	if(other.epoch != NULL)
+	{
+		other.epoch->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	reset();
+	this->epoch = other.epoch;
+	return *this;
+}
+
+ubx_epoch_ref &ubx_epoch_ref::operator=(ubx_epoch_ref &&other)
+{
+	if(this != &other)
+	{
+		reset();
+		this->epoch = other.epoch;
+		other.epoch = NULL;
+	}
+	return *this;
+}
+
+void ubx_epoch_ref::reset()
+{
+	// Whoever drops the last one has seen every other holder's reads
+	if(this->epoch != NULL && this->epoch->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		this->epoch->owner->release(this->epoch);
+	}
+	this->epoch = NULL;
+}
+
+ubx_epoch_assembler::ubx_epoch_assembler(size_t max_bytes)
+{
+	this->max_bytes = max_bytes;
+	this->seq = 0;
+	this->last_iTOW = 0;
+	this->has_last = false;
+	this->epochs = 0;
+	this->incomplete = 0;
+	this->overlapping = 0;
+	this->allocated = 0;
+	this->arena_bytes = 0;
+	this->current = take();
+}
+
+ubx_epoch_assembler::~ubx_epoch_assembler()
+{
+	for(ubx_epoch *epoch : this->all)
+	{
+		delete epoch;
+	}
+}
+
+void ubx_epoch_assembler::subscribe(callback_t callback)
+{
+	this->callbacks.push_back(callback);
+}
+
+ubx_epoch *ubx_epoch_assembler::take()
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	ubx_epoch *epoch;
+	if(!this->free_list.empty())
+	{
+		epoch = this->free_list.back();
+		this->free_list.pop_back();
+		epoch->clear();
+	}
+	else
+	{
+		epoch = new ubx_epoch(this);
+		this->all.push_back(epoch);
+		// release() never has to grow it
+		this->free_list.reserve(this->all.size());
+		ubx_metrics::add(this->allocated, 1);
+	}
+	return epoch;
+}
+
+void ubx_epoch_assembler::release(ubx_epoch *epoch)
+{
+	std::lock_guard<std::mutex> lk(this->lock);
+	this->free_list.push_back(epoch);
+}
+
+void ubx_epoch_assembler::close(unsigned flags)
+{
+	ubx_epoch *epoch = this->current;
+	if(epoch->frames == 0)
+	{
+		return;
+	}
+	epoch->flags |= flags;
+	if(!epoch->has_pvt)
+	{
+		epoch->flags |= UBX_EPOCH_NO_PVT;
+	}
+	epoch->seq = this->seq++;
+	// Split by size, what follows is still the same epoch
+	if(epoch->has_iTOW && !(flags & UBX_EPOCH_FULL))
+	{
+		this->last_iTOW = epoch->iTOW;
+		this->has_last = true;
+	}
+	ubx_metrics::add(this->epochs, 1);
+	if(epoch->incomplete())
+	{
+		ubx_metrics::add(this->incomplete, 1);
+	}
+	if(epoch->flags & UBX_EPOCH_OVERLAP)
+	{
+		ubx_metrics::add(this->overlapping, 1);
+	}
+	this->current = take();
+	ubx_epoch_ref ref(epoch);
+	for(callback_t &callback : this->callbacks)
+	{
+		callback(ref);
+	}
+}
+
+void ubx_epoch_assembler::add(const ubx_frame_view &frame, const struct timespec &arrival, int64_t arrival_ns)
+{
+	if(!frame.valid)
+	{
+		return;
+	}
+	// NAV messages with an iTOW mark the epoch, anything else just joins it
+	uint32_t iTOW = 0;
+	bool timed = false;
+	if(frame.class_id == UBX_CLASS_NAV)
+	{
+		size_t at = itow_offsets[frame.msg_id];
+		if(at != 0 && frame.length >= at - 1 + 4)
+		{
+			iTOW = getu4(frame.payload(), at - 1);
+			timed = true;
+		}
+	}
+	bool late = false;
+	if(timed && !(this->current->has_iTOW && iTOW == this->current->iTOW))
+	{
+		if(this->has_last && iTOW == this->last_iTOW)
+		{
+			late = true;
+		}
+		else if(this->current->has_iTOW)
+		{
+			close(UBX_EPOCH_NO_EOE);
+		}
+	}
+	if(this->current->frames > 0 && this->current->bytes + frame.size > this->max_bytes)
+	{
+		close(UBX_EPOCH_FULL);
+	}
+
+	ubx_epoch *epoch = this->current;
+	if(epoch->frames == 0)
+	{
+		epoch->arrival = arrival;
+		epoch->arrival_ns = arrival_ns;
+	}
+	size_t capacity = epoch->arena.capacity();
+	epoch->append(frame);
+	if(epoch->arena.capacity() != capacity)
+	{
+		ubx_metrics::add(this->arena_bytes, epoch->arena.capacity() - capacity);
+	}
+	if(late)
+	{
+		epoch->flags |= UBX_EPOCH_OVERLAP;
+		return;
+	}
+	if(timed && !epoch->has_iTOW)
+	{
+		epoch->iTOW = iTOW;
+		epoch->has_iTOW = true;
+	}
+	if(timed && frame.msg_id == UBX_NAV_PVT)
+	{
+		epoch->has_pvt = true;
+	}
+	if(timed && frame.msg_id == UBX_NAV_EOE)
+	{
+		close(0);
+	}
+}
+
+void ubx_epoch_assembler::flush()
+{
+	close(UBX_EPOCH_NO_EOE);
+}
+
+} // namespace UBX
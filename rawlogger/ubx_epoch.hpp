@@ -0,0 +1,176 @@
+#include <cstddef>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include "ubx_def.hpp"
+#include "ubx_arena.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// Why an epoch is flagged
+constexpr unsigned UBX_EPOCH_NO_EOE = 1 << 0;	// closed by a NAV message of the next epoch, or EOF
+constexpr unsigned UBX_EPOCH_NO_PVT = 1 << 1;	// no NAV-PVT of its iTOW
+constexpr unsigned UBX_EPOCH_FULL = 1 << 2;	// closed at max_bytes, the rest is in the next one
+constexpr unsigned UBX_EPOCH_OVERLAP = 1 << 3;	// has NAV messages of an epoch closed before
+constexpr unsigned UBX_EPOCH_INCOMPLETE = UBX_EPOCH_NO_EOE | UBX_EPOCH_NO_PVT | UBX_EPOCH_FULL;
+
+// A receiver sends far less than this per epoch, even with RAWX & SFRBX of every signal
+constexpr size_t UBX_EPOCH_MAX_BYTES = 1024 * 1024;
+
+class ubx_epoch_assembler;
+
+// One frame of an epoch (without sync chars), in the epoch's arena
+struct ubx_epoch_frame
+{
+	const ubx_epoch_frame *next;
+	uint32_t size;
+	uint8_t class_id;
+	uint8_t msg_id;
+
+	const uint8_t *data() const
+	{
+		return (const uint8_t *)(this + 1);
+	}
+	ubx_frame_view view() const
+	{
+		return ubx_frame_view(data(), this->size, true);
+	}
+};
+
+// Every frame from one NAV-EOE to the next, in order
+// Frames are copied into an arena owned by the epoch, which is reset when the
+// epoch is reused, so a running assembler doesn't allocate.
+// Read only once handed out, so it can be read from any thread.
+class ubx_epoch
+{
+public:
+	uint64_t seq;	// epochs handed out before this one
+	uint32_t iTOW;	// of its first NAV message with one
+	bool has_iTOW;
+	unsigned flags;	// UBX_EPOCH_*
+	// CLOCK_REALTIME & CLOCK_MONOTONIC when its first frame's first Byte was read
+	struct timespec arrival;
+	int64_t arrival_ns;
+	size_t frames;
+	size_t bytes;	// of its frames, without sync chars
+
+	const ubx_epoch_frame *first() const
+	{
+		return this->head;
+	}
+	// First frame of that type, NULL if there's none
+	const ubx_epoch_frame *find(uint8_t class_id, uint8_t msg_id) const;
+	bool incomplete() const
+	{
+		return (this->flags & UBX_EPOCH_INCOMPLETE) != 0;
+	}
+	void dump(FILE *fp) const;
+private:
+	friend class ubx_epoch_assembler;
+	friend class ubx_epoch_ref;
+
+	ubx_epoch_assembler *owner;
+	std::atomic<int> refs;
+	ubx_arena arena;
+	ubx_epoch_frame *head;
+	ubx_epoch_frame *tail;
+	bool has_pvt;
+
+	ubx_epoch(ubx_epoch_assembler *owner);
+	void clear();
+	void append(const ubx_frame_view &frame);
+};
+
+// Counted reference to a finished epoch, copies share it
+// The epoch goes back to its assembler when the last one is gone, in
+// whatever thread that is, so consumers keep them as long as they like.
+class ubx_epoch_ref
+{
+public:
+	ubx_epoch_ref();
+	ubx_epoch_ref(const ubx_epoch_ref &other);
+	ubx_epoch_ref(ubx_epoch_ref &&other);
+	~ubx_epoch_ref();
+	ubx_epoch_ref &operator=(const ubx_epoch_ref &other);
+	ubx_epoch_ref &operator=(ubx_epoch_ref &&other);
+	const ubx_epoch *operator->() const
+	{
+		return this->epoch;
+	}
+	const ubx_epoch &operator*() const
+	{
+		return *this->epoch;
+	}
+	explicit operator bool() const
+	{
+		return this->epoch != NULL;
+	}
+	void reset();
+private:
+	friend class ubx_epoch_assembler;
+
+	ubx_epoch *epoch;
+
+	explicit ubx_epoch_ref(ubx_epoch *epoch);
+};
+
+// Groups frames into epochs
+// NAV-EOE closes an epoch. A NAV message with another iTOW closes it too,
+// flagged UBX_EPOCH_NO_EOE, unless that iTOW is the last epoch's: then it
+// came late, & is kept in the current one, flagged UBX_EPOCH_OVERLAP.
+// Messages without an iTOW (where it is in each NAV message is in a table)
+// are kept in the current epoch & don't move its boundaries.
+// Finished epochs go to every subscriber, in the thread calling add().
+// Epochs come from a free list, & go back to it when their last reference
+// is gone, so once as many are in use as consumers hold on to, nothing
+// is allocated any more. The assembler has to outlive the references.
+class ubx_epoch_assembler
+{
+public:
+	typedef std::function<void(const ubx_epoch_ref &epoch)> callback_t;
+
+	// Statistics, written by the thread calling add() only
+	std::atomic<size_t> epochs;
+	std::atomic<size_t> incomplete;
+	std::atomic<size_t> overlapping;
+	std::atomic<size_t> allocated;	// epochs made, the rest were reused
+	std::atomic<size_t> arena_bytes;	// in the arenas of all epochs
+
+	ubx_epoch_assembler(size_t max_bytes = UBX_EPOCH_MAX_BYTES);
+	~ubx_epoch_assembler();
+	void subscribe(callback_t callback);
+	// A valid frame, read at arrival / arrival_ns (CLOCK_MONOTONIC)
+	void add(const ubx_frame_view &frame, const struct timespec &arrival, int64_t arrival_ns);
+	// End of input, what's there goes out flagged UBX_EPOCH_NO_EOE
+	void flush();
+private:
+	friend class ubx_epoch_ref;
+
+	size_t max_bytes;
+	vector<callback_t> callbacks;
+	ubx_epoch *current;
+	uint64_t seq;
+	// The last epoch closed by NAV-EOE or another iTOW
+	uint32_t last_iTOW;
+	bool has_last;
+	// Epochs not in use, returned from any thread
+	std::mutex lock;
+	vector<ubx_epoch *> free_list;
+	vector<ubx_epoch *> all;
+
+	ubx_epoch *take();
+	void release(ubx_epoch *epoch);
+	void close(unsigned flags);
+
+	ubx_epoch_assembler(const ubx_epoch_assembler &) = delete;
+	ubx_epoch_assembler &operator=(const ubx_epoch_assembler &) = delete;
+};
+
+} // namespace UBX
@@ -0,0 +1,439 @@
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_gen.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+namespace UBX
+{
+
+// GPS time of the first epoch, a Thursday midnight
+constexpr uint16_t UBX_GEN_WEEK = 2300;
+constexpr uint32_t UBX_GEN_TOW = 4 * 86400 * 1000;
+constexpr int UBX_GEN_LEAP_SECONDS = 18;
+// 1980-01-06 in Unix time
+constexpr time_t UBX_GEN_GPS_EPOCH = 315964800;
+constexpr double UBX_GEN_C = 299792458.0;
+constexpr double UBX_GEN_L1 = 1575.42e6;
+
+void ubx_gen_frame(vector<uint8_t> &out, uint8_t class_id, uint8_t msg_id, const uint8_t *payload, size_t length, bool sync)
+{
+	if(sync)
+	{
+		out.push_back(UBX_SYNC1);
+		out.push_back(UBX_SYNC2);
+	}
+	size_t start = out.size();
+	uint8_t header[UBX_HEADER_SIZE] = {class_id, msg_id, (uint8_t)(length & 0xff), (uint8_t)(length >> 8)};
+	out.insert(out.end(), header, header + sizeof(header));
+	out.insert(out.end(), payload, payload + length);
+	uint16_t cksum = ubx_cksum(out.data() + start, UBX_HEADER_SIZE + length);
+	out.push_back(cksum >> 8);
+	out.push_back(cksum & 0xff);
+}
+
+ubx_gen_config::ubx_gen_config()
+{
+	this->seed = 1;
+	this->rate = 10;
+	this->min_sats = 20;
+	this->max_sats = 32;
+	this->messages = UBX_GEN_ALL;
+	this->bit_flips = 0;
+	this->truncations = 0;
+	this->false_syncs = 0;
+}
+
+bool ubx_gen_config::parse_corruption(const char *spec)
+{
+	char *end;
+	double *rates[] = {&this->bit_flips, &this->truncations, &this->false_syncs};
+	for(size_t i = 0; i < 3; i++)
+	{
+		*rates[i] = strtod(spec, &end);
+		if(end == spec || *rates[i] < 0 || *rates[i] > 1)
+		{
+			return false;
+		}
+		if(*end == '\0')
+		{
+			return true;
+		}
+		if(*end != ',' || i == 2)
+		{
+			return false;
+		}
+		spec = end + 1;
+	}
+	return true;
+}
+
+bool ubx_gen_config::parse_messages(const char *spec)
+{
+	string s(spec);
+	unsigned messages = 0;
+	size_t start = 0;
+	while(start <= s.size())
+	{
+		size_t comma = s.find(',', start);
+		string name = s.substr(start, comma == string::npos ? string::npos : comma - start);
+		if(name == "rawx")
+		{
+			messages |= UBX_GEN_RAWX;
+		}
+		else if(name == "sfrbx")
+		{
+			messages |= UBX_GEN_SFRBX;
+		}
+		else if(name == "sig")
+		{
+			messages |= UBX_GEN_NAV_SIG;
+		}
+		else if(name == "all")
+		{
+			messages |= UBX_GEN_ALL;
+		}
+		else if(name != "pvt" && name != "eoe")
+		{
+			return false;
+		}
+		if(comma == string::npos)
+		{
+			break;
+		}
+		start = comma + 1;
+	}
+	this->messages = messages;
+	return true;
+}
+
+ubx_generator::ubx_generator(const ubx_gen_config &config) : config(config)
+{
+	this->config.rate = config.rate < 1 ? 1 : config.rate > UBX_GEN_MAX_RATE ? UBX_GEN_MAX_RATE : config.rate;
+	this->config.max_sats = config.max_sats > UBX_GEN_MAX_SATS ? UBX_GEN_MAX_SATS : config.max_sats;
+	this->config.min_sats = config.min_sats > this->config.max_sats ? this->config.max_sats : config.min_sats;
+	this->state = config.seed;
+	this->itow = UBX_GEN_TOW;
+	this->week = UBX_GEN_WEEK;
+	this->epochs = 0;
+	this->frames = 0;
+	this->flipped = 0;
+	this->truncated = 0;
+	this->false_syncs = 0;
+	this->payload.reserve(0xffff);
+	while(this->sats.size() < (this->config.min_sats + this->config.max_sats) / 2)
+	{
+		walk_sats();
+	}
+}
+
+// splitmix64
+uint64_t ubx_generator::next()
+{
+	uint64_t z = (this->state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+uint32_t ubx_generator::below(uint32_t n)
+{
+	return ((next() >> 32) * n) >> 32;
+}
+
+double ubx_generator::uniform()
+{
+	return (next() >> 11) * 0x1p-53;
+}
+
+// About one satellite rises or sets every 10 s
+void ubx_generator::walk_sats()
+{
+	static const struct
+	{
+		uint8_t gnssId;
+		uint8_t count;
+	} systems[] = {{0, 32}, {2, 36}, {3, 37}, {6, 24}};
+
+	bool grow = this->sats.size() < this->config.min_sats;
+	bool shrink = this->sats.size() > this->config.max_sats;
+	if(!grow && !shrink)
+	{
+		if(below(10 * this->config.rate) != 0)
+		{
+			return;
+		}
+		grow = below(2) == 0 && this->sats.size() < this->config.max_sats;
+		shrink = !grow && this->sats.size() > this->config.min_sats;
+	}
+	if(shrink)
+	{
+		this->sats.erase(this->sats.begin() + below(this->sats.size()));
+		return;
+	}
+	if(!grow)
+	{
+		return;
+	}
+	while(1)
+	{
+		const auto &system = systems[below(4)];
+		sat s;
+		s.gnssId = system.gnssId;
+		s.svId = 1 + below(system.count);
+		bool taken = false;
+		for(const sat &other : this->sats)
+		{
+			taken |= other.gnssId == s.gnssId && other.svId == s.svId;
+		}
+		if(taken)
+		{
+			continue;
+		}
+		s.sigs = 1 + below(2);
+		s.cno = 25 + below(25);
+		s.locktime = 0;
+		s.range = 20e6 + uniform() * 6e6;
+		s.rate = (uniform() - 0.5) * 1600;
+		this->sats.push_back(s);
+		return;
+	}
+}
+
+void ubx_generator::pvt(vector<uint8_t> &out)
+{
+	_ubx_nav_pvt pvt;
+	memset(&pvt, 0, sizeof(pvt));
+	time_t t = UBX_GEN_GPS_EPOCH + this->week * 604800 + this->itow / 1000 - UBX_GEN_LEAP_SECONDS;
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	pvt.iTOW = this->itow;
+	pvt.year = tm.tm_year + 1900;
+	pvt.month = tm.tm_mon + 1;
+	pvt.day = tm.tm_mday;
+	pvt.hour = tm.tm_hour;
+	pvt.min = tm.tm_min;
+	pvt.sec = tm.tm_sec;
+	pvt.valid = 0x37;
+	pvt.tAcc = 20 + below(20);
+	pvt.nano = (this->itow % 1000) * 1000000 + (int32_t)below(200) - 100;
+	pvt.fixType = 3;
+	pvt.flags = 0x01;
+	pvt.numSV = this->sats.size();
+	pvt.lon = 115000000 + below(100);
+	pvt.lat = 480000000 + below(100);
+	pvt.height = 500000 + below(1000);
+	pvt.hMSL = 452000 + below(1000);
+	pvt.hAcc = 500 + below(500);
+	pvt.vAcc = 800 + below(500);
+	pvt.pDOP = 120 + below(40);
+	this->payload.resize(sizeof(pvt));
+	memcpy(this->payload.data(), &pvt, sizeof(pvt));
+	frame(out, UBX_CLASS_NAV, UBX_NAV_PVT);
+}
+
+// Second signal: L2C, E5b, B2I or L2OF
+static uint8_t second_sig(uint8_t gnssId)
+{
+	return gnssId == 0 ? 3 : gnssId == 2 ? 5 : 2;
+}
+
+void ubx_generator::nav_sig(vector<uint8_t> &out)
+{
+	size_t num = 0;
+	for(const sat &s : this->sats)
+	{
+		num += s.sigs;
+	}
+	this->payload.assign(UBX_NAV_SIG_HEADER_SIZE + num * UBX_NAV_SIG_DATA_SIZE, 0);
+	uint8_t *p = this->payload.data();
+	memcpy(p, &this->itow, sizeof(this->itow));
+	p[5] = num;
+	p += UBX_NAV_SIG_HEADER_SIZE;
+	for(const sat &s : this->sats)
+	{
+		for(uint8_t sig = 0; sig < s.sigs; sig++, p += UBX_NAV_SIG_DATA_SIZE)
+		{
+			_ubx_nav_sig_data data;
+			memset(&data, 0, sizeof(data));
+			data.gnssId = s.gnssId;
+			data.svId = s.svId;
+			data.sigId = sig == 0 ? 0 : second_sig(s.gnssId);
+			data.freqId = s.gnssId == 6 ? s.svId % 14 : 0;
+			data.prRes = (int16_t)below(40) - 20;
+			data.cno = s.cno - 3 * sig;
+			data.qualityInd = 7;
+			data.sigFlags = 0x29;
+			memcpy(p, &data, sizeof(data));
+		}
+	}
+	frame(out, UBX_CLASS_NAV, UBX_NAV_SIG);
+}
+
+void ubx_generator::rawx(vector<uint8_t> &out)
+{
+	size_t num = 0;
+	for(const sat &s : this->sats)
+	{
+		num += s.sigs;
+	}
+	this->payload.assign(UBX_RXM_RAWX_HEADER_SIZE + num * UBX_RXM_RAWX_MEAS_SIZE, 0);
+	uint8_t *p = this->payload.data();
+	double tow = this->itow / 1e3;
+	memcpy(p, &tow, sizeof(tow));
+	memcpy(p + 8, &this->week, sizeof(this->week));
+	p[10] = UBX_GEN_LEAP_SECONDS;
+	p[11] = num;
+	p[12] = 0x01;
+	p[13] = 1;
+	p += UBX_RXM_RAWX_HEADER_SIZE;
+	double lambda = UBX_GEN_C / UBX_GEN_L1;
+	for(const sat &s : this->sats)
+	{
+		for(uint8_t sig = 0; sig < s.sigs; sig++, p += UBX_RXM_RAWX_MEAS_SIZE)
+		{
+			double pr = s.range + uniform();
+			double cp = s.range / lambda;
+			float dop = -s.rate / lambda;
+			memcpy(p, &pr, sizeof(pr));
+			memcpy(p + 8, &cp, sizeof(cp));
+			memcpy(p + 16, &dop, sizeof(dop));
+			p[20] = s.gnssId;
+			p[21] = s.svId;
+			p[22] = sig == 0 ? 0 : second_sig(s.gnssId);
+			p[23] = s.gnssId == 6 ? s.svId % 14 : 0;
+			memcpy(p + 24, &s.locktime, sizeof(s.locktime));
+			p[26] = s.cno - 3 * sig;
+			p[27] = 5;
+			p[28] = 2;
+			p[29] = 3;
+			p[30] = 0x07;
+		}
+	}
+	frame(out, UBX_CLASS_RXM, UBX_RXM_RAWX);
+}
+
+// A subframe per satellite every 6 s, spread over the 6 s by svId
+void ubx_generator::sfrbx(vector<uint8_t> &out)
+{
+	uint32_t period = 1000 / this->config.rate;
+	if(this->itow % 1000 >= period)
+	{
+		return;
+	}
+	for(const sat &s : this->sats)
+	{
+		if((this->itow / 1000 + s.svId) % 6 != 0)
+		{
+			continue;
+		}
+		uint8_t words = s.gnssId == 2 ? 8 : s.gnssId == 6 ? 4 : 10;
+		this->payload.resize(UBX_GEN_SFRBX_HEADER_SIZE + 4 * words);
+		uint8_t *p = this->payload.data();
+		p[0] = s.gnssId;
+		p[1] = s.svId;
+		p[2] = 0;
+		p[3] = s.gnssId == 6 ? s.svId % 14 : 0;
+		p[4] = words;
+		p[5] = below(32);
+		p[6] = 2;
+		p[7] = 0;
+		for(size_t i = 0; i < words; i++)
+		{
+			uint32_t word = next();
+			memcpy(p + UBX_GEN_SFRBX_HEADER_SIZE + 4 * i, &word, sizeof(word));
+		}
+		frame(out, UBX_CLASS_RXM, UBX_RXM_SRFBX);
+	}
+}
+
+// Frames this->payload, then damages it as configured
+void ubx_generator::frame(vector<uint8_t> &out, uint8_t class_id, uint8_t msg_id)
+{
+	this->frames++;
+	if(this->config.false_syncs > 0 && uniform() < this->config.false_syncs)
+	{
+		out.push_back(UBX_SYNC1);
+		out.push_back(UBX_SYNC2);
+		for(uint32_t i = below(5); i > 0; i--)
+		{
+			out.push_back(next());
+		}
+		this->false_syncs++;
+	}
+	size_t start = out.size();
+	ubx_gen_frame(out, class_id, msg_id, this->payload.data(), this->payload.size());
+
+	bool damaged = false;
+	size_t size = out.size() - start;
+	if(this->config.truncations > 0 && uniform() < this->config.truncations)
+	{
+		// Anything from the sync chars to all but the last Byte
+		out.resize(start + 1 + below(size - 1));
+		size = out.size() - start;
+		this->truncated++;
+		damaged = true;
+	}
+	if(this->config.bit_flips > 0 && uniform() < this->config.bit_flips)
+	{
+		out[start + below(size)] ^= 1 << below(8);
+		this->flipped++;
+		damaged = true;
+	}
+	if(!damaged)
+	{
+		this->intact.push_back(start);
+	}
+}
+
+void ubx_generator::epoch(vector<uint8_t> &out)
+{
+	walk_sats();
+	double dt = 1.0 / this->config.rate;
+	for(sat &s : this->sats)
+	{
+		s.range += s.rate * dt;
+		s.locktime = s.locktime + 1000 / this->config.rate > 64500 ? 64500 : s.locktime + 1000 / this->config.rate;
+		if(below(8) == 0)
+		{
+			s.cno = s.cno <= 20 ? s.cno + 1 : s.cno >= 52 ? s.cno - 1 : s.cno + below(3) - 1;
+		}
+	}
+	pvt(out);
+	if(this->config.messages & UBX_GEN_NAV_SIG)
+	{
+		nav_sig(out);
+	}
+	if(this->config.messages & UBX_GEN_RAWX)
+	{
+		rawx(out);
+	}
+	if(this->config.messages & UBX_GEN_SFRBX)
+	{
+		sfrbx(out);
+	}
+	this->payload.assign(4, 0);
+	memcpy(this->payload.data(), &this->itow, sizeof(this->itow));
+	frame(out, UBX_CLASS_NAV, UBX_NAV_EOE);
+
+	this->epochs++;
+	this->itow += 1000 / this->config.rate;
+	if(this->itow >= 604800 * 1000)
+	{
+		this->itow -= 604800 * 1000;
+		this->week++;
+	}
+}
+
+void ubx_generator::generate(vector<uint8_t> &out, size_t epochs)
+{
+	for(size_t i = 0; i < epochs; i++)
+	{
+		epoch(out);
+	}
+}
+
+} // namespace UBX
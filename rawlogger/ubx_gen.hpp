@@ -0,0 +1,100 @@
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include "ubx_def.hpp"
+#include "ubx_struct.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+constexpr unsigned UBX_GEN_MAX_RATE = 25;
+// More than a multi-band receiver tracks at once
+constexpr unsigned UBX_GEN_MAX_SATS = 64;
+constexpr size_t UBX_GEN_SFRBX_HEADER_SIZE = 8;
+
+// Message mix, NAV-PVT & NAV-EOE are always there
+constexpr unsigned UBX_GEN_RAWX = 1 << 0;
+constexpr unsigned UBX_GEN_SFRBX = 1 << 1;
+constexpr unsigned UBX_GEN_NAV_SIG = 1 << 2;
+constexpr unsigned UBX_GEN_ALL = UBX_GEN_RAWX | UBX_GEN_SFRBX | UBX_GEN_NAV_SIG;
+
+// Appends a frame with that payload & its checksum to out, with sync chars
+// in front, or as a view would have it (without) for sync = false
+void ubx_gen_frame(vector<uint8_t> &out, uint8_t class_id, uint8_t msg_id, const uint8_t *payload, size_t length, bool sync = true);
+
+struct ubx_gen_config
+{
+	uint64_t seed;
+	unsigned rate;	// epochs/s, 1 .. UBX_GEN_MAX_RATE
+	unsigned min_sats;
+	unsigned max_sats;
+	unsigned messages;	// UBX_GEN_*
+	// Probability per frame of each kind of damage
+	double bit_flips;	// one bit of the frame flipped
+	double truncations;	// frame cut short, the next one follows right away
+	double false_syncs;	// sync chars & a few random Bytes before the frame
+
+	ubx_gen_config();
+	// "flips,truncations,false_syncs"
+	bool parse_corruption(const char *spec);
+	// "rawx,sfrbx,sig" or "all", PVT & EOE are implied
+	bool parse_messages(const char *spec);
+};
+
+// Deterministic generator of receiver-like UBX streams
+// Each epoch is NAV-PVT, NAV-SIG, RXM-RAWX with one measurement per signal
+// (L1 & L2/E5b/B2I for half the satellites), RXM-SFRBX for satellites whose
+// subframe is due (one every 6 s), then NAV-EOE. Satellites come and go in a
+// random walk between min_sats & max_sats. The same seed & config always give
+// the same Bytes, so results of different builds can be compared.
+// Sync char offsets of undamaged frames are kept as the ground truth.
+class ubx_generator
+{
+public:
+	// Ground truth
+	size_t epochs;
+	size_t frames;
+	size_t flipped;
+	size_t truncated;
+	size_t false_syncs;
+	vector<uint64_t> intact;	// offsets of the sync chars of undamaged frames
+
+	ubx_generator(const ubx_gen_config &config);
+	// Appends one epoch to out
+	void epoch(vector<uint8_t> &out);
+	void generate(vector<uint8_t> &out, size_t epochs);
+private:
+	struct sat
+	{
+		uint8_t gnssId;
+		uint8_t svId;
+		uint8_t sigs;
+		uint8_t cno;
+		uint16_t locktime;
+		double range;	// m
+		double rate;	// m/s
+	};
+
+	ubx_gen_config config;
+	uint64_t state;
+	uint32_t itow;	// ms
+	uint16_t week;
+	vector<sat> sats;
+	vector<uint8_t> payload;
+
+	uint64_t next();
+	// Uniform in [0, n)
+	uint32_t below(uint32_t n);
+	double uniform();
+	void walk_sats();
+	void pvt(vector<uint8_t> &out);
+	void nav_sig(vector<uint8_t> &out);
+	void rawx(vector<uint8_t> &out);
+	void sfrbx(vector<uint8_t> &out);
+	void frame(vector<uint8_t> &out, uint8_t class_id, uint8_t msg_id);
+};
+
+} // namespace UBX
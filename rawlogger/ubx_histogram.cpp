@@ -0,0 +1,79 @@
+#include "ubx_histogram.hpp"
+
+namespace UBX
+{
+
+ubx_histogram::ubx_histogram(const char *name)
+{
+	this->name = name;
+	for(auto &count : this->counts)
+	{
+		count.store(0, std::memory_order_relaxed);
+	}
+	this->total.store(0, std::memory_order_relaxed);
+	this->sum_ns.store(0, std::memory_order_relaxed);
+	this->max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t ubx_histogram::bucket_low(size_t index)
+{
+	if(index < UBX_HISTOGRAM_SUB)
+	{
+		return index;
+	}
+	unsigned shift = (index >> UBX_HISTOGRAM_SUB_BITS) - 1;
+	return (uint64_t)(UBX_HISTOGRAM_SUB + (index & (UBX_HISTOGRAM_SUB - 1))) << shift;
+}
+
+uint64_t ubx_histogram::bucket_high(size_t index)
+{
+	if(index < UBX_HISTOGRAM_SUB)
+	{
+		return index;
+	}
+	unsigned shift = (index >> UBX_HISTOGRAM_SUB_BITS) - 1;
+	return bucket_low(index) + ((uint64_t)1 << shift) - 1;
+}
+
+uint64_t ubx_histogram::percentile(double p) const
+{
+	uint64_t n = count();
+	if(n == 0)
+	{
+		return 0;
+	}
+	// Rank of the value, 1 .. n
+	uint64_t rank = p / 100 * n;
+	rank = rank < 1 ? 1 : rank > n ? n : rank;
+	uint64_t seen = 0;
+	for(size_t i = 0; i < UBX_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += this->counts[i].load(std::memory_order_relaxed);
+		if(seen >= rank)
+		{
+			// Not past the largest one seen
+			uint64_t high = bucket_high(i);
+			uint64_t max = this->max.load(std::memory_order_relaxed);
+			return high < max ? high : max;
+		}
+	}
+	return this->max.load(std::memory_order_relaxed);
+}
+
+// One line of percentiles in us, counts are read while recording goes on,
+// so they may be off by the few values recorded meanwhile
+void ubx_histogram::dump(FILE *fp) const
+{
+	uint64_t n = count();
+	if(n == 0)
+	{
+		fprintf(fp, "%-16s no samples\n", this->name.c_str());
+		return;
+	}
+	fprintf(fp, "%-16s %8zu, mean %10.3f us, p50 %10.3f, p90 %10.3f, p99 %10.3f, p99.9 %10.3f, max %10.3f us\n",
+		this->name.c_str(), (size_t)n, sum() / 1e3 / n,
+		percentile(50) / 1e3, percentile(90) / 1e3, percentile(99) / 1e3, percentile(99.9) / 1e3,
+		this->max.load(std::memory_order_relaxed) / 1e3);
+}
+
+} // namespace UBX
@@ -0,0 +1,80 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+
+#pragma once
+
+namespace UBX
+{
+using std::string;
+
+// Sub-buckets per power of two, values are kept to within 1/16 (6.25 %)
+constexpr unsigned UBX_HISTOGRAM_SUB_BITS = 4;
+constexpr size_t UBX_HISTOGRAM_SUB = 1 << UBX_HISTOGRAM_SUB_BITS;
+// 0 .. 15 exactly, then 16 buckets for each of 2^4 .. 2^63
+constexpr size_t UBX_HISTOGRAM_BUCKETS = (64 - UBX_HISTOGRAM_SUB_BITS + 1) << UBX_HISTOGRAM_SUB_BITS;
+
+// HDR style log-linear histogram of ns, fixed size & never allocates.
+// record() is a count leading zeros, two shifts & an increment.
+// One thread records, any other may dump() at the same time: counters are
+// relaxed atomics, which are plain loads & stores on the recording side.
+class ubx_histogram
+{
+public:
+	string name;
+
+	ubx_histogram(const char *name);
+	void record(uint64_t ns)
+	{
+		add(this->counts[bucket(ns)], 1);
+		add(this->total, 1);
+		add(this->sum_ns, ns);
+		if(ns > this->max.load(std::memory_order_relaxed))
+		{
+			this->max.store(ns, std::memory_order_relaxed);
+		}
+	}
+	uint64_t count() const
+	{
+		return this->total.load(std::memory_order_relaxed);
+	}
+	uint64_t sum() const
+	{
+		return this->sum_ns.load(std::memory_order_relaxed);
+	}
+	// Upper end of the bucket the p-th (0 .. 100) percentile is in
+	uint64_t percentile(double p) const;
+	void dump(FILE *fp) const;
+
+	static size_t bucket(uint64_t ns)
+	{
+		if(ns < UBX_HISTOGRAM_SUB)
+		{
+			return ns;
+		}
+		unsigned msb = 63 - __builtin_clzll(ns);
+		unsigned shift = msb - UBX_HISTOGRAM_SUB_BITS;
+		return ((size_t)(shift + 1) << UBX_HISTOGRAM_SUB_BITS) + ((ns >> shift) & (UBX_HISTOGRAM_SUB - 1));
+	}
+	// Smallest & largest value going into a bucket
+	static uint64_t bucket_low(size_t index);
+	static uint64_t bucket_high(size_t index);
+private:
+	std::atomic<uint64_t> counts[UBX_HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sum_ns;
+	std::atomic<uint64_t> max;
+
+	// Only the recording thread writes
+	static void add(std::atomic<uint64_t> &counter, uint64_t n)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	ubx_histogram(const ubx_histogram &) = delete;
+	ubx_histogram &operator=(const ubx_histogram &) = delete;
+};
+
+} // namespace UBX
@@ -0,0 +1,322 @@
+#include "ubx.hpp"
+#include "ubx_index.hpp"
+#include <errno.h>
+#include <endian.h>
+#include <algorithm>
+
+namespace UBX
+{
+
+ubx_index_writer::ubx_index_writer()
+{
+	this->fp = NULL;
+	this->epochs = 0;
+	this->counts.assign(256 * 256, 0);
+}
+
+ubx_index_writer::~ubx_index_writer()
+{
+	close();
+}
+
+// Closes the previous index
+int ubx_index_writer::open(const char *path, uint32_t compression)
+{
+	if(close() != 0)
+	{
+		return -1;
+	}
+	this->fp = fopen(path, "we");
+	if(this->fp == NULL)
+	{
+		return -1;
+	}
+	this->epochs = 0;
+	std::fill(this->counts.begin(), this->counts.end(), 0);
+	this->seen.clear();
+	this->pending.clear();
+
+	struct ubx_index_header header;
+	memcpy(header.magic, UBX_INDEX_MAGIC, sizeof(header.magic));
+	header.version = htole32(UBX_INDEX_VERSION);
+	header.compression = htole32(compression);
+	if(fwrite(&header, sizeof(header), 1, this->fp) != 1 || fflush(this->fp) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+// Writes the counts & footer
+int ubx_index_writer::close()
+{
+	if(this->fp == NULL)
+	{
+		return 0;
+	}
+	int ret = 0;
+	for(uint16_t key : this->seen)
+	{
+		struct ubx_index_count count;
+		memset(&count, 0, sizeof(count));
+		count.class_id = key >> 8;
+		count.msg_id = key & 0xff;
+		count.count = htole64(this->counts[key]);
+		if(fwrite(&count, sizeof(count), 1, this->fp) != 1)
+		{
+			ret = -1;
+			break;
+		}
+	}
+	struct ubx_index_footer footer;
+	footer.epochs = htole64(this->epochs);
+	footer.counts = htole32(this->seen.size());
+	memcpy(footer.magic, UBX_INDEX_FOOTER_MAGIC, sizeof(footer.magic));
+	if(ret == 0 && fwrite(&footer, sizeof(footer), 1, this->fp) != 1)
+	{
+		ret = -1;
+	}
+	int saved_errno = errno;
+	if(fclose(this->fp) != 0 && ret == 0)
+	{
+		ret = -1;
+		saved_errno = errno;
+	}
+	this->fp = NULL;
+	errno = saved_errno;
+	return ret;
+}
+
+// Count a frame of the current epoch, it goes into the totals with add_epoch()
+void ubx_index_writer::count(uint8_t class_id, uint8_t msg_id)
+{
+	this->pending.push_back(class_id << 8 | msg_id);
+}
+
+// Frames of the current epoch were thrown away
+void ubx_index_writer::discard()
+{
+	this->pending.clear();
+}
+
+// Append the record of an epoch that was just written to the data file
+int ubx_index_writer::add_epoch(const ubx_index_record &rec)
+{
+	if(this->fp == NULL)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	for(uint16_t key : this->pending)
+	{
+		if(this->counts[key]++ == 0)
+		{
+			this->seen.push_back(key);
+		}
+	}
+	this->pending.clear();
+	this->epochs++;
+
+	struct ubx_index_record le;
+	le.iTOW = htole32(rec.iTOW);
+	le.skip = htole32(rec.skip);
+	le.utc_ms = htole64(rec.utc_ms);
+	le.raw_offset = htole64(rec.raw_offset);
+	le.file_offset = htole64(rec.file_offset);
+	// Flushed per epoch, so the index keeps up with the data file
+	if(fwrite(&le, sizeof(le), 1, this->fp) != 1 || fflush(this->fp) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+ubx_index::ubx_index()
+{
+	this->compression = 0;
+	this->complete = false;
+	this->weeks_known = false;
+}
+
+int ubx_index::load(const char *path)
+{
+	this->epochs.clear();
+	this->counts.clear();
+	this->complete = false;
+	sort_keys();
+
+	FILE *fp = fopen(path, "re");
+	if(fp == NULL)
+	{
+		return -1;
+	}
+	vector<uint8_t> data;
+	uint8_t chunk[64 * 1024];
+	size_t n;
+	while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	{
+		data.insert(data.end(), chunk, chunk + n);
+	}
+	int saved_errno = errno;
+	bool failed = ferror(fp);
+	fclose(fp);
+	if(failed)
+	{
+		errno = saved_errno;
+		return -1;
+	}
+
+	struct ubx_index_header header;
+	if(data.size() < sizeof(header))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if(memcmp(header.magic, UBX_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+		le32toh(header.version) != UBX_INDEX_VERSION)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	this->compression = le32toh(header.compression);
+
+	// The footer tells where the records end, without it everything
+	// up to the last whole record is taken as records
+	size_t end = data.size();
+	size_t num_epochs = (end - sizeof(header)) / sizeof(ubx_index_record);
+	size_t num_counts = 0;
+	struct ubx_index_footer footer;
+	if(end >= sizeof(header) + sizeof(footer))
+	{
+		memcpy(&footer, data.data() + end - sizeof(footer), sizeof(footer));
+		uint64_t epochs = le64toh(footer.epochs);
+		uint32_t counts = le32toh(footer.counts);
+		if(memcmp(footer.magic, UBX_INDEX_FOOTER_MAGIC, sizeof(footer.magic)) == 0 &&
+			sizeof(header) + epochs * sizeof(ubx_index_record) +
+			counts * sizeof(ubx_index_count) + sizeof(footer) == end)
+		{
+			num_epochs = epochs;
+			num_counts = counts;
+			this->complete = true;
+		}
+	}
+
+	const uint8_t *p = data.data() + sizeof(header);
+	this->epochs.resize(num_epochs);
+	for(size_t i = 0; i < num_epochs; i++, p += sizeof(ubx_index_record))
+	{
+		ubx_index_record &rec = this->epochs[i];
+		memcpy(&rec, p, sizeof(rec));
+		rec.iTOW = le32toh(rec.iTOW);
+		rec.skip = le32toh(rec.skip);
+		rec.utc_ms = le64toh(rec.utc_ms);
+		rec.raw_offset = le64toh(rec.raw_offset);
+		rec.file_offset = le64toh(rec.file_offset);
+	}
+	this->counts.resize(num_counts);
+	for(size_t i = 0; i < num_counts; i++, p += sizeof(ubx_index_count))
+	{
+		memcpy(&this->counts[i], p, sizeof(ubx_index_count));
+		this->counts[i].count = le64toh(this->counts[i].count);
+	}
+	sort_keys();
+	return 0;
+}
+
+// iTOW of the next epoch went back by more than half a week
+static bool rolled_over(uint32_t before, uint32_t after)
+{
+	return (int64_t)before - after > UBX_INDEX_WEEK_MS / 2;
+}
+
+void ubx_index::sort_keys()
+{
+	size_t n = this->epochs.size();
+	this->utc_ms.resize(n);
+	this->gps_ms.resize(n);
+	// Epochs without UTC compare as the last known time before them,
+	// which keeps the sequence sorted for the binary search
+	int64_t utc = UBX_INDEX_NO_UTC;
+	size_t first_utc = n;
+	for(size_t i = 0; i < n; i++)
+	{
+		if(this->epochs[i].utc_ms != UBX_INDEX_NO_UTC)
+		{
+			utc = this->epochs[i].utc_ms;
+			first_utc = std::min(first_utc, i);
+		}
+		this->utc_ms[i] = utc;
+	}
+	if(n == 0)
+	{
+		this->weeks_known = false;
+		return;
+	}
+
+	// GPS time less iTOW is the week & the leap seconds, far less than half a week
+	this->weeks_known = first_utc < n;
+	int64_t week = 0;
+	if(this->weeks_known)
+	{
+		const ubx_index_record &rec = this->epochs[first_utc];
+		int64_t start = rec.utc_ms - UBX_INDEX_GPS_EPOCH_MS - rec.iTOW;
+		week = (start + UBX_INDEX_WEEK_MS / 2) / UBX_INDEX_WEEK_MS;
+		// Back to the first epoch
+		for(size_t i = first_utc; i > 0; i--)
+		{
+			week -= rolled_over(this->epochs[i - 1].iTOW, this->epochs[i].iTOW);
+		}
+	}
+	for(size_t i = 0; i < n; i++)
+	{
+		if(i > 0)
+		{
+			week += rolled_over(this->epochs[i - 1].iTOW, this->epochs[i].iTOW);
+		}
+		this->gps_ms[i] = week * UBX_INDEX_WEEK_MS + this->epochs[i].iTOW;
+	}
+}
+
+size_t ubx_index::find_utc(int64_t utc_ms) const
+{
+	return std::lower_bound(this->utc_ms.begin(), this->utc_ms.end(), utc_ms) - this->utc_ms.begin();
+}
+
+size_t ubx_index::find_itow(uint32_t week, uint32_t iTOW) const
+{
+	int64_t gps_ms = week * UBX_INDEX_WEEK_MS + iTOW;
+	return std::lower_bound(this->gps_ms.begin(), this->gps_ms.end(), gps_ms) - this->gps_ms.begin();
+}
+
+size_t ubx_index::find_itow(uint32_t iTOW) const
+{
+	if(this->epochs.empty())
+	{
+		return 0;
+	}
+	uint32_t first = this->week(0);
+	return find_itow(iTOW < this->epochs[0].iTOW ? first + 1 : first, iTOW);
+}
+
+void ubx_index::dump(FILE *fp)
+{
+	fprintf(fp, "%zd epochs, compression %u%s\n", this->epochs.size(), this->compression,
+		this->complete ? "" : " (incomplete)");
+	if(!this->epochs.empty())
+	{
+		const ubx_index_record &first = this->epochs.front();
+		const ubx_index_record &last = this->epochs.back();
+		fprintf(fp, "week %u iTOW %u - week %u iTOW %u%s, UTC %lld - %lld ms\n", week(0), first.iTOW,
+			week(this->epochs.size() - 1), last.iTOW, this->weeks_known ? "" : " (weeks from 0)",
+			(long long)first.utc_ms, (long long)last.utc_ms);
+	}
+	char name[UBX_MSG_NAME_MAX];
+	for(const ubx_index_count &count : this->counts)
+	{
+		fprintf(fp, "UBX-%s\t%llu\n", ubx_msg_name(count.class_id, count.msg_id, name, sizeof(name)),
+			(unsigned long long)count.count);
+	}
+}
+
+} // namespace UBX
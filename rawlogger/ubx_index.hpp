@@ -0,0 +1,129 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "ubx_def.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// Epoch index sidecar (<file>.idx), all fields little endian:
+//	header:		ubx_index_header
+//	records:	ubx_index_record, one per epoch, in file order
+//	counts:		ubx_index_count, one per message type seen
+//	footer:		ubx_index_footer
+// Records are appended as epochs are written, counts & footer only on close,
+// so an index cut short by a crash still has every record up to that point.
+
+constexpr char UBX_INDEX_MAGIC[8] = {'U', 'B', 'X', 'I', 'D', 'X', '\0', '\0'};
+constexpr char UBX_INDEX_FOOTER_MAGIC[4] = {'U', 'B', 'X', 'E'};
+constexpr uint32_t UBX_INDEX_VERSION = 1;
+constexpr int64_t UBX_INDEX_NO_UTC = INT64_MIN;
+constexpr int64_t UBX_INDEX_WEEK_MS = 7 * 24 * 3600 * 1000LL;
+// 1980-01-06, in ms since 1970
+constexpr int64_t UBX_INDEX_GPS_EPOCH_MS = 315964800000LL;
+constexpr const char *UBX_INDEX_SUFFIX = ".idx";
+
+struct ubx_index_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t compression;	// ubx_compression of the data file
+} __attribute((packed));
+
+struct ubx_index_record
+{
+	uint32_t iTOW;		// from NAV-EOE
+	uint32_t skip;		// Bytes to skip after decompressing from file_offset
+	int64_t utc_ms;		// from NAV-PVT, ms since 1970, UBX_INDEX_NO_UTC if unknown
+	uint64_t raw_offset;	// offset of the epoch's first frame in uncompressed data
+	uint64_t file_offset;	// offset of the compressed frame holding it, == raw_offset if not compressed
+} __attribute((packed));
+
+struct ubx_index_count
+{
+	uint8_t class_id;
+	uint8_t msg_id;
+	uint8_t reserved[6];
+	uint64_t count;
+} __attribute((packed));
+
+struct ubx_index_footer
+{
+	uint64_t epochs;
+	uint32_t counts;
+	char magic[4];
+} __attribute((packed));
+
+// Builds an index while the data file is being written
+// Functions return 0 on success, -1 with errno set on error.
+class ubx_index_writer
+{
+public:
+	ubx_index_writer();
+	~ubx_index_writer();
+	int open(const char *path, uint32_t compression);
+	int close();
+	bool is_open() const
+	{
+		return this->fp != NULL;
+	}
+	void count(uint8_t class_id, uint8_t msg_id);
+	void discard();
+	int add_epoch(const ubx_index_record &rec);
+private:
+	FILE *fp;
+	uint64_t epochs;
+	vector<uint64_t> counts; // indexed by class_id << 8 | msg_id
+	vector<uint16_t> seen;	// keys with non-zero counts, in order of appearance
+	vector<uint16_t> pending; // keys of the current epoch's frames
+
+	ubx_index_writer(const ubx_index_writer &) = delete;
+	ubx_index_writer &operator=(const ubx_index_writer &) = delete;
+};
+
+// Loaded index, with binary search over the epochs
+// Records have no week, it comes from the UTC time where there is one, and
+// from iTOW going back to 0 in between, so a file across the GPS week
+// rollover is still searched in order.
+class ubx_index
+{
+public:
+	uint32_t compression;
+	vector<ubx_index_record> epochs;
+	vector<ubx_index_count> counts;
+	// false if the footer is missing (file wasn't closed), counts are empty then
+	bool complete;
+	// false if no epoch has UTC, weeks are counted from the first epoch's then
+	bool weeks_known;
+
+	ubx_index();
+	// Returns -1 with errno set on error (EINVAL for a malformed index)
+	int load(const char *path);
+	// First epoch at or after utc_ms, epochs.size() if none.
+	// Epochs without UTC are treated as belonging to the previous one.
+	size_t find_utc(int64_t utc_ms) const;
+	// First epoch at or after (week, iTOW), epochs.size() if none
+	size_t find_itow(uint32_t week, uint32_t iTOW) const;
+	// The same in the week the file starts in, or the next one if that
+	// iTOW is before the first epoch
+	size_t find_itow(uint32_t iTOW) const;
+	// GPS week of an epoch
+	uint32_t week(size_t i) const
+	{
+		return this->gps_ms[i] / UBX_INDEX_WEEK_MS;
+	}
+	void dump(FILE *fp);
+private:
+	// Per epoch, sorted: UTC filled forward from the last epoch that had it,
+	// & week * UBX_INDEX_WEEK_MS + iTOW
+	vector<int64_t> utc_ms;
+	vector<int64_t> gps_ms;
+
+	void sort_keys();
+};
+
+} // namespace UBX
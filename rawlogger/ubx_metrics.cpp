@@ -0,0 +1,382 @@
+#include "ubx.hpp"
+#include "ubx_names.hpp"
+#include "ubx_server.hpp"
+#include "ubx_metrics.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+namespace UBX
+{
+
+ubx_metrics::ubx_metrics()
+{
+	for(auto &c : this->classes)
+	{
+		c.store(NULL, std::memory_order_relaxed);
+	}
+}
+
+ubx_metrics::~ubx_metrics()
+{
+	for(auto &c : this->classes)
+	{
+		delete[] c.load(std::memory_order_relaxed);
+	}
+}
+
+void ubx_metrics::add(const char *name, const char *help, ubx_metric_type type, const std::atomic<size_t> &value, const string &labels)
+{
+	this->metrics.push_back({name, help, type, labels, &value, nullptr, NULL});
+}
+
+void ubx_metrics::add(const char *name, const char *help, ubx_metric_type type, std::function<double()> value, const string &labels)
+{
+	this->metrics.push_back({name, help, type, labels, NULL, std::move(value), NULL});
+}
+
+void ubx_metrics::add(const char *name, const char *help, const ubx_histogram &hist, const string &labels)
+{
+	this->metrics.push_back({name, help, UBX_METRIC_SUMMARY, labels, NULL, nullptr, &hist});
+}
+
+std::atomic<size_t> &ubx_metrics::counter(const char *name, const char *help, const string &labels)
+{
+	this->owned.emplace_back(0);
+	add(name, help, UBX_METRIC_COUNTER, this->owned.back(), labels);
+	return this->owned.back();
+}
+
+// Published after it's zeroed, the exporter sees either NULL or the whole table
+ubx_msg_metrics *ubx_metrics::new_class(uint8_t class_id)
+{
+	ubx_msg_metrics *msgs = new ubx_msg_metrics[256];
+	for(size_t i = 0; i < 256; i++)
+	{
+		msgs[i].frames.store(0, std::memory_order_relaxed);
+		msgs[i].bytes.store(0, std::memory_order_relaxed);
+	}
+	this->classes[class_id].store(msgs, std::memory_order_release);
+	return msgs;
+}
+
+static void append_sample(string &out, const string &name, const string &labels, double value)
+{
+	char buf[64];
+	out += name;
+	if(!labels.empty())
+	{
+		out += '{';
+		out += labels;
+		out += '}';
+	}
+	snprintf(buf, sizeof(buf), " %.17g\n", value);
+	out += buf;
+}
+
+void ubx_metrics::format(string &out, const metric &m) const
+{
+	if(m.hist != NULL)
+	{
+		// Quantiles in s, as Prometheus has it
+		string sep = m.labels.empty() ? "" : ",";
+		for(double q : {0.5, 0.9, 0.99, 0.999})
+		{
+			char quantile[32];
+			snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", q);
+			append_sample(out, m.name, m.labels + sep + quantile, m.hist->percentile(q * 100) / 1e9);
+		}
+		append_sample(out, m.name + "_sum", m.labels, m.hist->sum() / 1e9);
+		append_sample(out, m.name + "_count", m.labels, m.hist->count());
+	}
+	else if(m.value != NULL)
+	{
+		append_sample(out, m.name, m.labels, m.value->load(std::memory_order_relaxed));
+	}
+	else
+	{
+		append_sample(out, m.name, m.labels, m.compute());
+	}
+}
+
+string ubx_metrics::prometheus() const
+{
+	static const char *types[] = {"counter", "gauge", "summary"};
+	string out;
+	out.reserve(16384);
+	// Samples of a metric have to be together, under one HELP & TYPE
+	vector<bool> done(this->metrics.size(), false);
+	for(size_t i = 0; i < this->metrics.size(); i++)
+	{
+		if(done[i])
+		{
+			continue;
+		}
+		const metric &first = this->metrics[i];
+		out += "# HELP " + first.name + " " + first.help + "\n";
+		out += "# TYPE " + first.name + " " + types[first.type] + "\n";
+		for(size_t j = i; j < this->metrics.size(); j++)
+		{
+			if(!done[j] && this->metrics[j].name == first.name)
+			{
+				format(out, this->metrics[j]);
+				done[j] = true;
+			}
+		}
+	}
+
+	out += "# HELP ubx_frames_total Frames read, by message type\n# TYPE ubx_frames_total counter\n";
+	string bytes = "# HELP ubx_frame_bytes_total Bytes of frames read, by message type\n# TYPE ubx_frame_bytes_total counter\n";
+	for(size_t c = 0; c < 256; c++)
+	{
+		const ubx_msg_metrics *msgs = this->classes[c].load(std::memory_order_acquire);
+		if(msgs == NULL)
+		{
+			continue;
+		}
+		for(size_t m = 0; m < 256; m++)
+		{
+			size_t frames = msgs[m].frames.load(std::memory_order_relaxed);
+			if(frames == 0)
+			{
+				continue;
+			}
+			char name[UBX_MSG_NAME_MAX];
+			string labels = string("type=\"") + ubx_msg_name(c, m, name, sizeof(name)) + "\"";
+			append_sample(out, "ubx_frames_total", labels, frames);
+			append_sample(bytes, "ubx_frame_bytes_total", labels, msgs[m].bytes.load(std::memory_order_relaxed));
+		}
+	}
+	out += bytes;
+	return out;
+}
+
+ubx_metrics_exporter::ubx_metrics_exporter(const ubx_metrics &metrics) : metrics(metrics)
+{
+	this->scrapes = 0;
+	this->file_writes = 0;
+	this->errors = 0;
+	this->bound_port = 0;
+	this->listen_fd = -1;
+	this->interval = UBX_METRICS_DEFAULT_INTERVAL;
+	this->stop_event = -1;
+}
+
+ubx_metrics_exporter::~ubx_metrics_exporter()
+{
+	stop();
+	if(this->listen_fd >= 0)
+	{
+		close(this->listen_fd);
+	}
+	if(this->stop_event >= 0)
+	{
+		close(this->stop_event);
+	}
+}
+
+bool ubx_metrics_exporter::set_address(const string &address)
+{
+	if(!ubx_parse_address(address, this->host, this->service))
+	{
+		return false;
+	}
+	// Health of the box it runs on, not for the whole network
+	if(this->host.empty())
+	{
+		this->host = "localhost";
+	}
+	return true;
+}
+
+bool ubx_metrics_exporter::set_file(const string &spec)
+{
+	size_t comma = spec.find(',');
+	this->path = spec.substr(0, comma);
+	if(comma != string::npos)
+	{
+		char *end;
+		long secs = strtol(spec.c_str() + comma + 1, &end, 10);
+		if(*end != '\0' || secs < 1)
+		{
+			return false;
+		}
+		this->interval = secs;
+	}
+	return !this->path.empty();
+}
+
+int ubx_metrics_exporter::listen()
+{
+	this->stop_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(this->stop_event < 0)
+	{
+		return -1;
+	}
+	if(this->service.empty())
+	{
+		return 0;
+	}
+	this->listen_fd = ubx_listen_tcp(this->host, this->service, this->bound_port);
+	return this->listen_fd < 0 ? -1 : 0;
+}
+
+void ubx_metrics_exporter::start()
+{
+	this->thread = std::thread(&ubx_metrics_exporter::run, this);
+}
+
+void ubx_metrics_exporter::stop()
+{
+	if(this->thread.joinable())
+	{
+		uint64_t one = 1;
+		if(write(this->stop_event, &one, sizeof(one)) != sizeof(one))
+		{
+			perror("ubx_metrics_exporter::stop()");
+		}
+		this->thread.join();
+		// Last values, as the logger stops
+		if(!this->path.empty())
+		{
+			write_file();
+		}
+	}
+}
+
+void ubx_metrics_exporter::run()
+{
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while(1)
+	{
+		if(!this->path.empty())
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if(now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec))
+			{
+				write_file();
+				next.tv_sec += this->interval;
+			}
+		}
+		struct pollfd fds[2];
+		fds[0].fd = this->stop_event;
+		fds[0].events = POLLIN;
+		fds[1].fd = this->listen_fd;
+		fds[1].events = POLLIN;
+		int timeout = -1;
+		if(!this->path.empty())
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			int64_t ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+			timeout = ms < 0 ? 0 : ms + 1;
+		}
+		int n = poll(fds, this->listen_fd >= 0 ? 2 : 1, timeout);
+		if(n < 0 && errno != EINTR)
+		{
+			perror("ubx_metrics_exporter::run()");
+			return;
+		}
+		if(n <= 0)
+		{
+			continue;
+		}
+		if(fds[0].revents & POLLIN)
+		{
+			return;
+		}
+		if(this->listen_fd >= 0 && (fds[1].revents & POLLIN))
+		{
+			int fd = accept4(this->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if(fd >= 0)
+			{
+				serve(fd);
+				close(fd);
+			}
+		}
+	}
+}
+
+// One HTTP/1.0 exchange, the connection is closed after it
+void ubx_metrics_exporter::serve(int fd)
+{
+	struct timeval tv = {UBX_METRICS_REQUEST_TIMEOUT / 1000, (UBX_METRICS_REQUEST_TIMEOUT % 1000) * 1000};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	string request;
+	char buf[1024];
+	while(request.find("\r\n\r\n") == string::npos && request.find("\n\n") == string::npos)
+	{
+		ssize_t len = recv(fd, buf, sizeof(buf), 0);
+		if(len <= 0 || request.size() + len > UBX_METRICS_MAX_REQUEST)
+		{
+			ubx_metrics::add(this->errors, 1);
+			return;
+		}
+		request.append(buf, len);
+	}
+	string response;
+	if(request.compare(0, 4, "GET ") != 0)
+	{
+		response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+	}
+	else if(request.compare(4, 9, "/metrics ") != 0 && request.compare(4, 2, "/ ") != 0)
+	{
+		response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	}
+	else
+	{
+		string body = this->metrics.prometheus();
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+			std::to_string(body.size()) + "\r\n\r\n" + body;
+		ubx_metrics::add(this->scrapes, 1);
+	}
+	size_t sent = 0;
+	while(sent < response.size())
+	{
+		ssize_t len = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+		if(len <= 0)
+		{
+			ubx_metrics::add(this->errors, 1);
+			return;
+		}
+		sent += len;
+	}
+}
+
+// Written next to it & renamed over it, readers never see half a file
+int ubx_metrics_exporter::write_file()
+{
+	string body = this->metrics.prometheus();
+	string tmp = this->path + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		ubx_metrics::add(this->errors, 1);
+		return -1;
+	}
+	bool ok = write(fd, body.data(), body.size()) == (ssize_t)body.size();
+	ok &= close(fd) == 0;
+	if(!ok || rename(tmp.c_str(), this->path.c_str()) != 0)
+	{
+		unlink(tmp.c_str());
+		ubx_metrics::add(this->errors, 1);
+		return -1;
+	}
+	ubx_metrics::add(this->file_writes, 1);
+	return 0;
+}
+
+void ubx_metrics_exporter::dump_stats(FILE *fp)
+{
+	fprintf(fp, "Metrics: %zd scrapes, %zd stats file writes, %zd errors\n",
+		this->scrapes.load(), this->file_writes.load(), this->errors.load());
+}
+
+} // namespace UBX
@@ -0,0 +1,152 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ubx_def.hpp"
+#include "ubx_histogram.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::string;
+using std::vector;
+
+// Stats file rewrite interval, s
+constexpr unsigned UBX_METRICS_DEFAULT_INTERVAL = 10;
+// Scrapes are small GET requests, anything longer is refused
+constexpr size_t UBX_METRICS_MAX_REQUEST = 4096;
+// A scraper has this long to send its request, ms
+constexpr int UBX_METRICS_REQUEST_TIMEOUT = 1000;
+
+enum ubx_metric_type
+{
+	UBX_METRIC_COUNTER,
+	UBX_METRIC_GAUGE,
+	UBX_METRIC_SUMMARY
+};
+
+// Frames & Bytes of one message type
+struct ubx_msg_metrics
+{
+	std::atomic<size_t> frames;
+	std::atomic<size_t> bytes;
+};
+
+// Lock-free registry of the logger's health metrics, in Prometheus text format.
+// Metrics are atomics that stay where they are (ring & server statistics...),
+// counters made by the registry itself, values computed when exported, and
+// latency histograms as summaries. All of them are registered before any
+// exporting starts & the registry doesn't change after that, so exporting
+// only loads atomics, while the threads owning them go on without waiting.
+// Per message type frame counts are kept by the registry, a 256 entry table
+// per class that's allocated on the class' first frame.
+class ubx_metrics
+{
+public:
+	ubx_metrics();
+	~ubx_metrics();
+	// labels are Prometheus labels without braces, e.g. port="2101"
+	void add(const char *name, const char *help, ubx_metric_type type, const std::atomic<size_t> &value, const string &labels = "");
+	// Computed when exported, has to be safe to call from the exporting thread
+	void add(const char *name, const char *help, ubx_metric_type type, std::function<double()> value, const string &labels = "");
+	void add(const char *name, const char *help, const ubx_histogram &hist, const string &labels = "");
+	// Owned by the registry, for counters nothing else keeps
+	std::atomic<size_t> &counter(const char *name, const char *help, const string &labels = "");
+
+	// Called by the one thread reading frames
+	void count_frame(uint8_t class_id, uint8_t msg_id, size_t size)
+	{
+		ubx_msg_metrics *msgs = this->classes[class_id].load(std::memory_order_acquire);
+		if(msgs == NULL)
+		{
+			msgs = new_class(class_id);
+		}
+		add(msgs[msg_id].frames, 1);
+		add(msgs[msg_id].bytes, size);
+	}
+	// Only the owning thread writes, the exporter reads
+	static void add(std::atomic<size_t> &counter, size_t n)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	string prometheus() const;
+private:
+	struct metric
+	{
+		string name;
+		string help;
+		ubx_metric_type type;
+		string labels;
+		const std::atomic<size_t> *value;
+		std::function<double()> compute;
+		const ubx_histogram *hist;
+	};
+	vector<metric> metrics;
+	std::deque<std::atomic<size_t>> owned;
+	std::atomic<ubx_msg_metrics *> classes[256];
+
+	ubx_msg_metrics *new_class(uint8_t class_id);
+	void format(string &out, const metric &m) const;
+
+	ubx_metrics(const ubx_metrics &) = delete;
+	ubx_metrics &operator=(const ubx_metrics &) = delete;
+};
+
+// Serves the metrics over HTTP (GET /metrics) on a local port and/or rewrites
+// a stats file every interval, from its own thread.
+// Scrapes are answered one at a time, each client gets
+// UBX_METRICS_REQUEST_TIMEOUT to send its request.
+class ubx_metrics_exporter
+{
+public:
+	// Statistics
+	std::atomic<size_t> scrapes;
+	std::atomic<size_t> file_writes;
+	std::atomic<size_t> errors;
+
+	ubx_metrics_exporter(const ubx_metrics &metrics);
+	~ubx_metrics_exporter();
+	// [host:]port, localhost if no host
+	bool set_address(const string &address);
+	// path[,secs]
+	bool set_file(const string &spec);
+	bool enabled() const
+	{
+		return !this->service.empty() || !this->path.empty();
+	}
+	// Returns -1 with errno set if the port can't be listened on
+	int listen();
+	uint16_t port() const
+	{
+		return this->bound_port;
+	}
+	void start();
+	void stop();
+	void dump_stats(FILE *fp);
+private:
+	const ubx_metrics &metrics;
+	string host;
+	string service;
+	uint16_t bound_port;
+	int listen_fd;
+	string path;
+	unsigned interval;
+	int stop_event;
+	std::thread thread;
+
+	void run();
+	void serve(int fd);
+	int write_file();
+
+	ubx_metrics_exporter(const ubx_metrics_exporter &) = delete;
+	ubx_metrics_exporter &operator=(const ubx_metrics_exporter &) = delete;
+};
+
+} // namespace UBX
@@ -1,11 +1,25 @@
 #include "ubx.hpp"
+#include <array>
 
 namespace UBX
 {
-using std::map;
+using std::array;
+
+struct ubx_name_entry
+{
+	uint8_t id;
+	const char *name;
+};
+
+struct ubx_msg_name_entry
+{
+	uint8_t class_id;
+	uint8_t msg_id;
+	const char *name;
+};
 
 // UBX Class/Message IDs
-static ubx_name_map_t ubx_class_names =
+static constexpr ubx_name_entry ubx_class_names[] =
 {
 	{0x01, "NAV"},
 	{0x02, "RXM"},
@@ -20,117 +34,69 @@ static ubx_name_map_t ubx_class_names =
 	{0x27, "SEC"}
 };
 
-static ubx_name_map_t ubx_mon_names =
-{
-	{0x36, "COMMS"},
-	{0x28, "GNSS"},
-	{0x0B, "HW2"},
-	{0x37, "HW3"},
-	{0x09, "HW"},
-	{0x02, "IO"},
-	{0x06, "MSGPP"},
-	{0x27, "PATCH"},
-	{0x38, "RF"},
-	{0x07, "RXBUF"},
-	{0x21, "RXR"},
-	{0x08, "TXBUF"},
-	{0x31, "SPAN"},
-	{0x04, "VER"},
-	{0x39, "SYS"} // not in u-blox documentation, but u-center has support for it
-};
-
-static ubx_name_map_t ubx_nav_names =
-{
-	{0x22, "CLOCK"},
-	{0x04, "DOP"},
-	{0x36, "COV"},
-	{0x61, "EOE"},
-	{0x39, "GEOFENCE"},
-	{0x13, "HPPOSECEF"},
-	{0x14, "HPPOSLLH"},
-	{0x09, "ODO"},
-	{0x34, "ORB"},
-	{0x01, "POSECEF"},
-	{0x02, "POSLLH"},
-	{0x07, "PVT"},
-	{0x3C, "RELPOSNED"},
-	{0x35, "SAT"},
-	{0x43, "SIG"},
-	{0x42, "SLAS"},
-	{0x03, "STATUS"},
-	{0x3B, "SVIN"},
-	{0x24, "TIMEBDS"},
-	{0x25, "TIMEGAL"},
-	{0x23, "TIMEGLO"},
-	{0x20, "TIMEGPS"},
-	{0x27, "TIMEQZSS"},
-	{0x26, "TIMELS"},
-	{0x21, "TIMEUTC"},
-	{0x11, "VELECEF"},
-	{0x12, "VELNED"},
-	{0x32, "SBAS"}
-};
-
-static ubx_name_map_t ubx_rxm_names =
+static constexpr ubx_msg_name_entry ubx_msg_names[] =
 {
-	{0x14, "MEASX"},
-	{0x15, "RAWX"},
-	{0x32, "RTCM"},
-	{0x13, "SRFBX"}
-};
+	{0x0A, 0x36, "MON-COMMS"},
+	{0x0A, 0x28, "MON-GNSS"},
+	{0x0A, 0x0B, "MON-HW2"},
+	{0x0A, 0x37, "MON-HW3"},
+	{0x0A, 0x09, "MON-HW"},
+	{0x0A, 0x02, "MON-IO"},
+	{0x0A, 0x06, "MON-MSGPP"},
+	{0x0A, 0x27, "MON-PATCH"},
+	{0x0A, 0x38, "MON-RF"},
+	{0x0A, 0x07, "MON-RXBUF"},
+	{0x0A, 0x21, "MON-RXR"},
+	{0x0A, 0x08, "MON-TXBUF"},
+	{0x0A, 0x31, "MON-SPAN"},
+	{0x0A, 0x04, "MON-VER"},
+	{0x0A, 0x39, "MON-SYS"}, // not in u-blox documentation, but u-center has support for it
 
-static ubx_name_map_t ubx_tim_names =
-{
-	{0x01, "TP"},
-	{0x03, "TM2"},
-	{0x06, "VRFY"}
-};
+	{0x01, 0x22, "NAV-CLOCK"},
+	{0x01, 0x04, "NAV-DOP"},
+	{0x01, 0x36, "NAV-COV"},
+	{0x01, 0x61, "NAV-EOE"},
+	{0x01, 0x39, "NAV-GEOFENCE"},
+	{0x01, 0x13, "NAV-HPPOSECEF"},
+	{0x01, 0x14, "NAV-HPPOSLLH"},
+	{0x01, 0x09, "NAV-ODO"},
+	{0x01, 0x34, "NAV-ORB"},
+	{0x01, 0x01, "NAV-POSECEF"},
+	{0x01, 0x02, "NAV-POSLLH"},
+	{0x01, 0x07, "NAV-PVT"},
+	{0x01, 0x3C, "NAV-RELPOSNED"},
+	{0x01, 0x35, "NAV-SAT"},
+	{0x01, 0x43, "NAV-SIG"},
+	{0x01, 0x42, "NAV-SLAS"},
+	{0x01, 0x03, "NAV-STATUS"},
+	{0x01, 0x3B, "NAV-SVIN"},
+	{0x01, 0x24, "NAV-TIMEBDS"},
+	{0x01, 0x25, "NAV-TIMEGAL"},
+	{0x01, 0x23, "NAV-TIMEGLO"},
+	{0x01, 0x20, "NAV-TIMEGPS"},
+	{0x01, 0x27, "NAV-TIMEQZSS"},
+	{0x01, 0x26, "NAV-TIMELS"},
+	{0x01, 0x21, "NAV-TIMEUTC"},
+	{0x01, 0x11, "NAV-VELECEF"},
+	{0x01, 0x12, "NAV-VELNED"},
+	{0x01, 0x32, "NAV-SBAS"},
 
-static ubx_name_map_t ubx_sec_names =
-{
-	{0x03, "UNIQID"},
-	{0x09, "SIG"}, // not in u-blox documentation, but u-center has support for it
-	{0x10, "SIGLOG"} // same as above
-};
+	{0x02, 0x14, "RXM-MEASX"},
+	{0x02, 0x15, "RXM-RAWX"},
+	{0x02, 0x32, "RXM-RTCM"},
+	{0x02, 0x13, "RXM-SRFBX"},
 
-static map<string, ubx_name_map_t> ubx_names =
-{
-	{"MON", ubx_mon_names},
-	{"NAV", ubx_nav_names},
-	{"RXM", ubx_rxm_names},
-	{"TIM", ubx_tim_names},
-	{"SEC", ubx_sec_names}
-};
+	{0x0D, 0x01, "TIM-TP"},
+	{0x0D, 0x03, "TIM-TM2"},
+	{0x0D, 0x06, "TIM-VRFY"},
 
-string ubx_msg_name(uint8_t class_id, uint8_t msg_id)
-{
-	string class_name;
-	string msg_name;
-	char buf[32];
-	if(ubx_class_names.count(class_id) == 0) // unknown class
-	{
-		snprintf(buf, sizeof(buf), "%#02x-%#02x", class_id, msg_id);
-		return string(buf);
-	}
-	else
-	{
-		class_name = ubx_class_names[class_id];
-	}
-
-	if(ubx_names[class_name].count(msg_id) == 0) // known class, unknown msg
-	{
-		snprintf(buf, sizeof(buf), "%#02x", msg_id);
-		msg_name = buf;
-	}
-	else // known class, known msg
-	{
-		msg_name = ubx_names[class_name][msg_id];
-	}
-	return class_name + "-" + msg_name;
-}
+	{0x27, 0x03, "SEC-UNIQID"},
+	{0x27, 0x09, "SEC-SIG"}, // not in u-blox documentation, but u-center has support for it
+	{0x27, 0x10, "SEC-SIGLOG"} // same as above
+};
 
 // u-blox GNSS id
-static ubx_name_map_t ubx_gnssid_names =
+static constexpr ubx_name_entry ubx_gnssid_names[] =
 {
 	{0, "GPS"},
 	{1, "SBAS"},
@@ -142,7 +108,7 @@ static ubx_name_map_t ubx_gnssid_names =
 	{7, "NavIC"}
 };
 
-static ubx_name_map_t ubx_gnssid_abbr_names =
+static constexpr ubx_name_entry ubx_gnssid_abbr_names[] =
 {
 	{0, "G"},
 	{1, "S"},
@@ -154,21 +120,112 @@ static ubx_name_map_t ubx_gnssid_abbr_names =
 	{7, "N"}
 };
 
-string ubx_gnssid_name(uint8_t gnssid)
+// Flat lookup tables indexed directly by ID, built at compile time
+
+template<size_t N>
+static constexpr array<const char *, 256> make_id_table(const ubx_name_entry (&entries)[N])
+{
+	array<const char *, 256> t = {};
+	for(size_t i = 0; i < N; i++)
+	{
+		t[entries[i].id] = entries[i].name;
+	}
+	return t;
+}
+
+// Number of classes that have any message names
+static constexpr size_t count_msg_classes()
 {
-	if(ubx_gnssid_names.count(gnssid) == 0)
+	array<bool, 256> seen = {};
+	size_t n = 0;
+	for(const auto &e : ubx_msg_names)
 	{
-		return "?";
+		if(!seen[e.class_id])
+		{
+			seen[e.class_id] = true;
+			n++;
+		}
 	}
-	return ubx_gnssid_names[gnssid];
+	return n;
 }
 
-string ubx_gnssid_abbr_name(uint8_t gnssid)
+constexpr size_t UBX_MSG_CLASSES = count_msg_classes();
+
+// class_id -> row in ubx_msg_table + 1, 0 means no message names
+static constexpr array<uint8_t, 256> make_class_rows()
+{
+	array<uint8_t, 256> t = {};
+	uint8_t n = 0;
+	for(const auto &e : ubx_msg_names)
+	{
+		if(t[e.class_id] == 0)
+		{
+			t[e.class_id] = ++n;
+		}
+	}
+	return t;
+}
+
+static constexpr array<uint8_t, 256> ubx_class_rows = make_class_rows();
+
+static constexpr array<array<const char *, 256>, UBX_MSG_CLASSES> make_msg_table()
 {
-	if(ubx_gnssid_abbr_names.count(gnssid) == 0)
+	array<array<const char *, 256>, UBX_MSG_CLASSES> t = {};
+	for(const auto &e : ubx_msg_names)
 	{
-		return "?";
+		t[ubx_class_rows[e.class_id] - 1][e.msg_id] = e.name;
 	}
-	return ubx_gnssid_abbr_names[gnssid];
+	return t;
+}
+
+static constexpr array<const char *, 256> ubx_class_table = make_id_table(ubx_class_names);
+static constexpr array<array<const char *, 256>, UBX_MSG_CLASSES> ubx_msg_table = make_msg_table();
+static constexpr array<const char *, 256> ubx_gnssid_table = make_id_table(ubx_gnssid_names);
+static constexpr array<const char *, 256> ubx_gnssid_abbr_table = make_id_table(ubx_gnssid_abbr_names);
+
+const char *ubx_class_name(uint8_t class_id)
+{
+	return ubx_class_table[class_id];
+}
+
+const char *ubx_msg_name(uint8_t class_id, uint8_t msg_id)
+{
+	uint8_t row = ubx_class_rows[class_id];
+	if(row == 0)
+	{
+		return NULL;
+	}
+	return ubx_msg_table[row - 1][msg_id];
+}
+
+const char *ubx_msg_name(uint8_t class_id, uint8_t msg_id, char *buf, size_t len)
+{
+	const char *name = ubx_msg_name(class_id, msg_id);
+	if(name != NULL) // known class, known msg
+	{
+		return name;
+	}
+	const char *class_name = ubx_class_name(class_id);
+	if(class_name == NULL) // unknown class
+	{
+		snprintf(buf, len, "%#02x-%#02x", class_id, msg_id);
+	}
+	else // known class, unknown msg
+	{
+		snprintf(buf, len, "%s-%#02x", class_name, msg_id);
+	}
+	return buf;
+}
+
+const char *ubx_gnssid_name(uint8_t gnssid)
+{
+	const char *name = ubx_gnssid_table[gnssid];
+	return name != NULL ? name : "?";
+}
+
+const char *ubx_gnssid_abbr_name(uint8_t gnssid)
+{
+	const char *name = ubx_gnssid_abbr_table[gnssid];
+	return name != NULL ? name : "?";
 }
-} // namespace UBX
\ No newline at end of file
+} // namespace UBX
@@ -4,7 +4,19 @@
 
 namespace UBX
 {
-string ubx_msg_name(uint8_t class_id, uint8_t msg_id);
-string ubx_gnssid_name(uint8_t gnssid);
-string ubx_gnssid_abbr_name(uint8_t gnssid);
-} // namespace UBX
\ No newline at end of file
+// Enough for the longest name, or the "0xff-0xff" fallback
+constexpr size_t UBX_MSG_NAME_MAX = 32;
+
+// Name tables are constant, so these are safe to call from any thread
+// and never allocate.
+
+// "NAV", "RXM" ... or NULL if unknown
+const char *ubx_class_name(uint8_t class_id);
+// "NAV-PVT" ... or NULL if unknown
+const char *ubx_msg_name(uint8_t class_id, uint8_t msg_id);
+// Same as above, but falls back to hex IDs formatted into buf
+const char *ubx_msg_name(uint8_t class_id, uint8_t msg_id, char *buf, size_t len);
+// "?" if unknown
+const char *ubx_gnssid_name(uint8_t gnssid);
+const char *ubx_gnssid_abbr_name(uint8_t gnssid);
+} // namespace UBX
@@ -1,6 +1,7 @@
 #include "ubx.hpp"
 #include "ubx_nav.hpp"
 #include <string>
+#include <time.h>
 
 namespace UBX
 {
@@ -10,7 +11,7 @@ ubx_nav_pvt::ubx_nav_pvt()
 	clear();
 }
 
-ubx_nav_pvt::ubx_nav_pvt(ubx_frame &frame)
+ubx_nav_pvt::ubx_nav_pvt(const ubx_frame_view &frame)
 {
 	parse(frame);
 }
@@ -56,7 +57,7 @@ bool ubx_nav_pvt::validate()
 	return true;
 }
 
-bool ubx_nav_pvt::parse(ubx_frame &frame)
+bool ubx_nav_pvt::parse(const ubx_frame_view &frame)
 {
 	this->valid = false;
 	if(frame.valid == false)
@@ -70,10 +71,9 @@ bool ubx_nav_pvt::parse(ubx_frame &frame)
 	assert(sizeof(this->data) == UBX_NAV_PVT_SIZE);
 	if(frame.length != sizeof(this->data))
 	{
-		fprintf(stderr, "ubx_nav_pvt::ubx_nav_pvt(): frame.length = %d, sizeof(this->data) = %zd\n", frame.length, sizeof(this->data));
 		return false;
 	}
-	memcpy(&this->data, frame.payload.data(), sizeof(this->data));
+	memcpy(&this->data, frame.payload(), sizeof(this->data));
 	// Endianness conversion
 	data.iTOW = le32toh(data.iTOW);
 	data.year = le16toh(data.year);
@@ -130,7 +130,7 @@ void ubx_nav_pvt::dump(FILE *fp)
 	fprintf(fp, "headVeh: %d\n", data.headVeh);
 }
 
-string ubx_nav_pvt::get_fix_type()
+string ubx_nav_pvt::get_fix_type() const
 {
 	// fixType & flags
 	string fix_type;
@@ -168,17 +168,48 @@ string ubx_nav_pvt::get_fix_type()
 	return fix_type;
 }
 
+// Milliseconds since 1970, false if date & time aren't valid
+bool ubx_nav_pvt::get_utc_ms(int64_t &utc_ms) const
+{
+	int64_t ns;
+	if(!get_utc_ns(ns))
+	{
+		return false;
+	}
+	// nano is -1e9..1e9, round towards -inf so it stays monotonic
+	utc_ms = ns >= 0 ? ns / 1000000 : -((-ns + 999999) / 1000000);
+	return true;
+}
+
+bool ubx_nav_pvt::get_utc_ns(int64_t &utc_ns) const
+{
+	if(this->valid == false)
+	{
+		return false;
+	}
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = data.year - 1900;
+	tm.tm_mon = data.month - 1;
+	tm.tm_mday = data.day;
+	tm.tm_hour = data.hour;
+	tm.tm_min = data.min;
+	tm.tm_sec = data.sec;
+	utc_ns = (int64_t)timegm(&tm) * 1000000000 + data.nano;
+	return true;
+}
+
 ubx_nav_eoe::ubx_nav_eoe()
 {
 	clear();
 }
 
-ubx_nav_eoe::ubx_nav_eoe(ubx_frame &frame)
+ubx_nav_eoe::ubx_nav_eoe(const ubx_frame_view &frame)
 {
 	parse(frame);
 }
 
-bool ubx_nav_eoe::parse(ubx_frame &frame)
+bool ubx_nav_eoe::parse(const ubx_frame_view &frame)
 {
 	this->valid = false;
 	if(frame.valid == false)
@@ -193,7 +224,7 @@ bool ubx_nav_eoe::parse(ubx_frame &frame)
 	{
 		return false;
 	}
-	this->iTOW = getu4(frame.payload, 0);
+	this->iTOW = getu4(frame.payload(), 0);
 	if(validate())
 	{
 		this->valid = true;
@@ -220,4 +251,89 @@ bool ubx_nav_eoe::validate()
 	return true;
 }
 
+ubx_nav_sig::ubx_nav_sig()
+{
+	clear();
+}
+
+ubx_nav_sig::ubx_nav_sig(const ubx_frame_view &frame)
+{
+	clear();
+	parse(frame);
+}
+
+// Only the header, data is overwritten by parse() up to numSigs
+void ubx_nav_sig::clear()
+{
+	this->valid = false;
+	this->iTOW = 0;
+	this->version = 0;
+	this->numSigs = 0;
+}
+
+bool ubx_nav_sig::parse(const ubx_frame_view &frame)
+{
+	this->valid = false;
+	if(frame.valid == false)
+	{
+		return false;
+	}
+	if(frame.class_id != UBX_CLASS_NAV || frame.msg_id != UBX_NAV_SIG)
+	{
+		return false; // ignore non NAV-SIG frames
+	}
+	static_assert(sizeof(struct _ubx_nav_sig_data) == UBX_NAV_SIG_DATA_SIZE, "NAV-SIG data size");
+	if(frame.length < UBX_NAV_SIG_HEADER_SIZE)
+	{
+		return false;
+	}
+	const uint8_t *payload = frame.payload();
+	uint8_t num = getu1(payload, 5);
+	if(frame.length != UBX_NAV_SIG_HEADER_SIZE + num * UBX_NAV_SIG_DATA_SIZE)
+	{
+		this->numSigs = 0;
+		return false;
+	}
+	this->iTOW = getu4(payload, 0);
+	this->version = getu1(payload, 4);
+	this->numSigs = num;
+	memcpy(this->data, payload + UBX_NAV_SIG_HEADER_SIZE, num * UBX_NAV_SIG_DATA_SIZE);
+	// Endianness conversion
+	for(size_t i = 0; i < num; i++)
+	{
+		this->data[i].prRes = le16toh(this->data[i].prRes);
+		this->data[i].sigFlags = le16toh(this->data[i].sigFlags);
+	}
+	if(validate())
+	{
+		this->valid = true;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+bool ubx_nav_sig::validate()
+{
+	if(this->iTOW > (86400 * 1000 * 7))
+	{
+		return false;
+	}
+	return true;
+}
+
+void ubx_nav_sig::dump(FILE *fp)
+{
+	fputs("=====================\n", fp);
+	fprintf(fp, "iTOW: %u, version: %u, numSigs: %u\n", this->iTOW, this->version, this->numSigs);
+	for(size_t i = 0; i < this->numSigs; i++)
+	{
+		const struct _ubx_nav_sig_data &sig = this->data[i];
+		fprintf(fp, "%2u/%3u/%u: cno %u, prRes %.1f, quality %u, flags %04x\n",
+			sig.gnssId, sig.svId, sig.sigId, sig.cno, sig.prRes * 0.1, sig.qualityInd, sig.sigFlags);
+	}
+}
+
 } // namespace UBX
\ No newline at end of file
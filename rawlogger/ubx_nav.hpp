@@ -12,11 +12,13 @@ public:
 	bool valid;
 
 	ubx_nav_pvt();
-	ubx_nav_pvt(ubx_frame &frame);
-	bool parse(ubx_frame &frame);
+	ubx_nav_pvt(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
 	void clear();
 	void dump(FILE *fp);
-	string get_fix_type();
+	string get_fix_type() const;
+	bool get_utc_ms(int64_t &utc_ms) const;
+	bool get_utc_ns(int64_t &utc_ns) const;
 private:
 	bool validate();
 };
@@ -28,8 +30,8 @@ class ubx_nav_eoe : public ubx_any_msg
 	uint32_t iTOW;
 
 	ubx_nav_eoe();
-	ubx_nav_eoe(ubx_frame &frame);
-	bool parse(ubx_frame &frame);
+	ubx_nav_eoe(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
 	void clear();
 	void dump(FILE *fp);
 private:
@@ -45,13 +47,14 @@ public:
 	uint8_t numSigs;
 	// not used
 	//uint8_t reserved0[2];
-	
-	vector<struct _ubx_nav_sig_data> data;
+
+	// Valid from 0 to numSigs - 1, reused by each parse()
+	struct _ubx_nav_sig_data data[UBX_NAV_SIG_MAX_SIGS];
 	bool valid;
 
 	ubx_nav_sig();
-	ubx_nav_sig(ubx_frame &frame);
-	bool parse(ubx_frame &frame);
+	ubx_nav_sig(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
 	void clear();
 	void dump(FILE *fp);
 private:
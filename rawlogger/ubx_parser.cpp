@@ -0,0 +1,437 @@
+#include "ubx.hpp"
+#include "ubx_cksum.hpp"
+#include "ubx_parser.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace UBX
+{
+
+// No sync chars found & not handled
+constexpr uint64_t UBX_PARSER_NONE = UINT64_MAX;
+// Handled candidates are only dropped from the front of the list in blocks
+// the same for queued payload ends, so neither list allocates once grown
+constexpr size_t UBX_PARSER_CAND_BLOCK = 1024;
+
+void ubx_parser::init(size_t max_length)
+{
+	this->max_length = max_length > UBX_PARSER_MAX_LENGTH ? UBX_PARSER_MAX_LENGTH : max_length;
+	this->bytes = 0;
+	this->frames = 0;
+	this->wasted_bytes = 0;
+	this->bad_checksums = 0;
+	this->too_long = 0;
+	this->frame_offset = 0;
+	this->frame_wasted = 0;
+	this->cand_head = 0;
+	this->seq_base = 0;
+	this->header_seq = 0;
+	this->fifo_head = 0;
+	reset(0);
+}
+
+ubx_parser::ubx_parser(size_t max_length, size_t bufsize)
+{
+	assert(bufsize > UBX_MAX_FRAME_SIZE);
+	this->store = (uint8_t *)malloc(bufsize);
+	if(this->store == NULL)
+	{
+		perror("ubx_parser::ubx_parser()");
+		abort();
+	}
+	this->buf = this->store;
+	this->bufsize = bufsize;
+	init(max_length);
+}
+
+ubx_parser::ubx_parser(const uint8_t *data, size_t size, uint64_t offset, size_t max_length)
+{
+	this->store = NULL;
+	this->buf = data;
+	this->bufsize = size;
+	init(max_length);
+	this->tail = size;
+	reset(offset);
+	this->bytes = size - offset;
+}
+
+ubx_parser::~ubx_parser()
+{
+	free(this->store);
+}
+
+void ubx_parser::reset(uint64_t offset)
+{
+	if(this->store != NULL)
+	{
+		this->base = offset;
+		this->tail = 0;
+	}
+	else
+	{
+		this->base = 0;
+	}
+	this->finishing = false;
+	this->finished = false;
+	this->floor = offset;
+	this->scan_pos = offset;
+	this->sync_pos = UBX_PARSER_NONE;
+	this->sum_pos = offset;
+	this->sum_a = 0;
+	this->sum_b = 0;
+	this->seq_base += this->cands.size();
+	this->cands.clear();
+	this->cand_head = 0;
+	this->header_seq = this->seq_base;
+	this->ends_fifo.clear();
+	this->fifo_head = 0;
+	this->ends.clear();
+}
+
+uint64_t ubx_parser::live_offset() const
+{
+	if(this->cand_head < this->cands.size())
+	{
+		return this->cands[this->cand_head].start;
+	}
+	return std::min(this->sync_pos, this->scan_pos);
+}
+
+uint8_t *ubx_parser::space(size_t &len)
+{
+	if(this->store == NULL)
+	{
+		len = 0;
+		return NULL;
+	}
+	// Bytes still needed
+	uint64_t keep = std::min(live_offset(), input_end());
+	// Moved once a quarter of the buffer is left, or for free when nothing is needed
+	if(keep > this->base && (this->bufsize - this->tail < this->bufsize / 4 || keep == input_end()))
+	{
+		size_t live = input_end() - keep;
+		memmove(this->store, this->store + (keep - this->base), live);
+		this->base = keep;
+		this->tail = live;
+	}
+	len = this->bufsize - this->tail;
+	return this->store + this->tail;
+}
+
+void ubx_parser::commit(size_t len)
+{
+	this->tail += len;
+	this->bytes += len;
+}
+
+void ubx_parser::feed(const uint8_t *data, size_t len, const callback_t &cb)
+{
+	while(len > 0)
+	{
+		size_t room;
+		uint8_t *p = space(room);
+		// Always drained below, so at most one frame is left in the buffer
+		assert(room > 0);
+		size_t n = len < room ? len : room;
+		memcpy(p, data, n);
+		commit(n);
+		data += n;
+		len -= n;
+		ubx_frame_view frame;
+		while(next(frame))
+		{
+			cb(frame);
+		}
+	}
+}
+
+void ubx_parser::finish()
+{
+	this->finishing = true;
+}
+
+// Next pair of sync chars with both Bytes in, each Byte is looked at once
+bool ubx_parser::find_sync()
+{
+	if(this->sync_pos != UBX_PARSER_NONE)
+	{
+		return true;
+	}
+	uint64_t end = input_end();
+	while(this->scan_pos + 1 < end)
+	{
+		const uint8_t *p = this->buf + (this->scan_pos - this->base);
+		// Not the last Byte, its pair isn't in yet
+		const uint8_t *q = (const uint8_t *)memchr(p, UBX_SYNC1, end - 1 - this->scan_pos);
+		if(q == NULL)
+		{
+			this->scan_pos = end - 1;
+			return false;
+		}
+		this->scan_pos += q - p;
+		if(q[1] == UBX_SYNC2)
+		{
+			this->sync_pos = this->scan_pos;
+			this->scan_pos += 2;
+			return true;
+		}
+		this->scan_pos += q[1] == UBX_SYNC1 ? 1 : 2;
+	}
+	return false;
+}
+
+// Sums of the input up to pos, from where they were,
+// with (A, B) + (a, b) over n Bytes = (A + a, B + n * A + b)
+void ubx_parser::advance(uint64_t pos)
+{
+	if(pos <= this->sum_pos)
+	{
+		return;
+	}
+	size_t n = pos - this->sum_pos;
+	if(n < 16)
+	{
+		// Candidates close together, not worth a call
+		const uint8_t *p = this->buf + (this->sum_pos - this->base);
+		for(size_t i = 0; i < n; i++)
+		{
+			this->sum_a += p[i];
+			this->sum_b += this->sum_a;
+		}
+		this->sum_pos = pos;
+		return;
+	}
+	uint16_t cksum = ubx_cksum(this->buf + (this->sum_pos - this->base), n);
+	this->sum_b += (uint8_t)(n * this->sum_a) + (cksum & 0xff);
+	this->sum_a += cksum >> 8;
+	this->sum_pos = pos;
+}
+
+void ubx_parser::push_end(uint64_t pos, uint64_t seq)
+{
+	if(fifo_empty() || this->ends_fifo.back().pos <= pos)
+	{
+		this->ends_fifo.push_back({pos, seq});
+		return;
+	}
+	this->ends.push_back({pos, seq});
+	std::push_heap(this->ends.begin(), this->ends.end(), std::greater<end_event>());
+}
+
+// Takes the first of the two, ties from the queue first
+void ubx_parser::pop_end()
+{
+	if(!fifo_empty() && (this->ends.empty() || this->ends_fifo[this->fifo_head].pos <= this->ends.front().pos))
+	{
+		this->fifo_head++;
+		if(fifo_empty())
+		{
+			this->ends_fifo.clear();
+			this->fifo_head = 0;
+		}
+		else if(this->fifo_head >= UBX_PARSER_CAND_BLOCK && this->fifo_head * 2 >= this->ends_fifo.size())
+		{
+			this->ends_fifo.erase(this->ends_fifo.begin(), this->ends_fifo.begin() + this->fifo_head);
+			this->fifo_head = 0;
+		}
+		return;
+	}
+	std::pop_heap(this->ends.begin(), this->ends.end(), std::greater<end_event>());
+	this->ends.pop_back();
+}
+
+void ubx_parser::add_candidate(uint64_t start)
+{
+	if(this->cand_head == this->cands.size())
+	{
+		// Nothing pending, the sums can start over here
+		this->sum_pos = start + 2;
+		this->sum_a = 0;
+		this->sum_b = 0;
+	}
+	advance(start + 2);
+	candidate c;
+	c.start = start;
+	c.end = 0;
+	c.a0 = this->sum_a;
+	c.b0 = this->sum_b;
+	c.a1 = 0;
+	c.b1 = 0;
+	c.state = UBX_CAND_HEADER;
+	this->cands.push_back(c);
+}
+
+void ubx_parser::pop_candidate()
+{
+	this->cand_head++;
+	if(this->cand_head == this->cands.size())
+	{
+		this->seq_base += this->cands.size();
+		this->cands.clear();
+		this->cand_head = 0;
+		this->header_seq = this->seq_base;
+		this->ends_fifo.clear();
+		this->fifo_head = 0;
+		this->ends.clear();
+	}
+	else if(this->cand_head >= UBX_PARSER_CAND_BLOCK && this->cand_head * 2 >= this->cands.size())
+	{
+		this->cands.erase(this->cands.begin(), this->cands.begin() + this->cand_head);
+		this->seq_base += this->cand_head;
+		this->cand_head = 0;
+	}
+}
+
+// Handles the next sync pair, header or payload end in input order,
+// false if there is none with the input so far
+bool ubx_parser::step()
+{
+	uint64_t first = this->seq_base + this->cand_head;
+	if(this->header_seq < first)
+	{
+		// Inside a frame that came out
+		this->header_seq = first;
+	}
+	uint64_t header = this->header_seq < this->seq_base + this->cands.size() ?
+		this->cands[this->header_seq - this->seq_base].start + 2 + UBX_HEADER_SIZE : UBX_PARSER_NONE;
+	const end_event *next_end = NULL;
+	if(!fifo_empty() && (this->ends.empty() || this->ends_fifo[this->fifo_head].pos <= this->ends.front().pos))
+	{
+		next_end = &this->ends_fifo[this->fifo_head];
+	}
+	else if(!this->ends.empty())
+	{
+		next_end = &this->ends.front();
+	}
+	uint64_t end = next_end != NULL ? next_end->pos : UBX_PARSER_NONE;
+	uint64_t sync = find_sync() ? this->sync_pos + 2 : UBX_PARSER_NONE;
+	if(sync != UBX_PARSER_NONE && sync <= header && sync <= end)
+	{
+		uint64_t start = this->sync_pos;
+		this->sync_pos = UBX_PARSER_NONE;
+		if(start >= this->floor)
+		{
+			add_candidate(start);
+		}
+		return true;
+	}
+	const uint8_t *p = this->buf - this->base;
+	if(header <= end && header <= input_end())
+	{
+		candidate &c = this->cands[this->header_seq - this->seq_base];
+		size_t length = p[c.start + 2 + UBX_LENGTH_OFFSET] | (p[c.start + 2 + UBX_LENGTH_OFFSET + 1] << 8);
+		if(length > this->max_length)
+		{
+			c.state = UBX_CAND_TOO_LONG;
+		}
+		else
+		{
+			c.end = c.start + 2 + UBX_HEADER_SIZE + length;
+			c.state = UBX_CAND_BODY;
+			push_end(c.end, this->header_seq);
+		}
+		this->header_seq++;
+		return true;
+	}
+	if(end > input_end())
+	{
+		return false;
+	}
+	uint64_t seq = next_end->seq;
+	pop_end();
+	if(seq >= first)
+	{
+		candidate &c = this->cands[seq - this->seq_base];
+		advance(c.end);
+		c.a1 = this->sum_a;
+		c.b1 = this->sum_b;
+		c.state = UBX_CAND_CKSUM;
+	}
+	return true;
+}
+
+bool ubx_parser::next(const uint8_t **start, size_t *size)
+{
+	while(1)
+	{
+		if(this->cand_head < this->cands.size())
+		{
+			candidate &c = this->cands[this->cand_head];
+			if(c.state == UBX_CAND_CKSUM && c.end + UBX_CKSUM_SIZE <= input_end())
+			{
+				// Sums over class .. payload from the two snapshots
+				const uint8_t *p = this->buf + (c.end - this->base);
+				size_t n = c.end - c.start - 2;
+				uint8_t a = c.a1 - c.a0;
+				uint8_t b = c.b1 - c.b0 - (uint8_t)(n * c.a0);
+				c.state = p[0] == a && p[1] == b ? UBX_CAND_VALID : UBX_CAND_BAD_CKSUM;
+			}
+			if(c.state == UBX_CAND_VALID)
+			{
+				*start = this->buf + (c.start + 2 - this->base);
+				*size = c.end + UBX_CKSUM_SIZE - c.start - 2;
+				this->frame_offset = c.start;
+				this->frame_wasted = c.start - this->floor;
+				this->wasted_bytes += this->frame_wasted;
+				this->frames++;
+				this->floor = c.end + UBX_CKSUM_SIZE;
+				// Whatever starts inside it is gone
+				if(this->sync_pos != UBX_PARSER_NONE && this->sync_pos < this->floor)
+				{
+					this->sync_pos = UBX_PARSER_NONE;
+				}
+				if(this->scan_pos < this->floor)
+				{
+					this->scan_pos = this->floor;
+				}
+				do
+				{
+					pop_candidate();
+				}
+				while(this->cand_head < this->cands.size() && this->cands[this->cand_head].start < this->floor);
+				return true;
+			}
+			if(c.state == UBX_CAND_BAD_CKSUM || c.state == UBX_CAND_TOO_LONG || c.state == UBX_CAND_CUT)
+			{
+				this->bad_checksums += c.state == UBX_CAND_BAD_CKSUM;
+				this->too_long += c.state == UBX_CAND_TOO_LONG;
+				pop_candidate();
+				continue;
+			}
+		}
+		if(step())
+		{
+			continue;
+		}
+		if(!this->finishing)
+		{
+			return false;
+		}
+		if(this->cand_head < this->cands.size())
+		{
+			this->cands[this->cand_head].state = UBX_CAND_CUT;
+			continue;
+		}
+		if(!this->finished)
+		{
+			this->wasted_bytes += input_end() - this->floor;
+			this->floor = input_end();
+			this->finished = true;
+		}
+		return false;
+	}
+}
+
+bool ubx_parser::next(ubx_frame_view &frame)
+{
+	const uint8_t *start;
+	size_t size;
+	if(!next(&start, &size))
+	{
+		return false;
+	}
+	frame = ubx_frame_view(start, size, true);
+	return true;
+}
+
+} // namespace UBX
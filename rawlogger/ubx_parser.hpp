@@ -0,0 +1,150 @@
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include "ubx_def.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// Default buffer size, must be larger than UBX_MAX_FRAME_SIZE
+constexpr size_t UBX_PARSER_BUFSIZE = 256 * 1024;
+// Largest payload the protocol allows
+constexpr size_t UBX_PARSER_MAX_LENGTH = 0xffff;
+
+// Incremental (push) UBX framer
+// Input comes in chunks of any size, and complete frames (without sync chars)
+// come out in input order, each one the earliest frame with a good checksum that
+// doesn't overlap the one before. Every pair of sync chars is a candidate until
+// its checksum says otherwise, so a false sync (or a damaged length) never costs
+// the frames that follow it, they are only held back until the false one's
+// claimed end has been read (or max_length is exceeded).
+// Each input Byte is looked at once: sync chars are found with memchr(), and
+// checksums come from running Fletcher sums advanced with ubx_cksum() from one
+// candidate's start or end to the next, so checking a candidate is O(1)
+// whatever its length, and resync never goes back over the input.
+// Worst case (sync chars all along, payload ends out of order) is a heap
+// operation per 2 Bytes, see bench_parser.
+// Frames point into the parser's buffer, valid until the next space()/feed().
+class ubx_parser
+{
+public:
+	// Statistics
+	uint64_t bytes;
+	size_t frames;
+	uint64_t wasted_bytes;
+	size_t bad_checksums;	// candidates that got to their checksum, & failed
+	size_t too_long;	// candidates longer than max_length
+	// Input offset of the last frame's sync chars, Bytes skipped before it
+	uint64_t frame_offset;
+	size_t frame_wasted;
+
+	typedef std::function<void(const ubx_frame_view &frame)> callback_t;
+
+	ubx_parser(size_t max_length = UBX_PARSER_MAX_LENGTH, size_t bufsize = UBX_PARSER_BUFSIZE);
+	// Frames data (a mapped file...) in place, from offset on,
+	// offsets are positions in data, feed() & space() can't be used
+	ubx_parser(const uint8_t *data, size_t size, uint64_t offset = 0, size_t max_length = UBX_PARSER_MAX_LENGTH);
+	~ubx_parser();
+	// Where to put the next input Bytes, len is set to the room there,
+	// 0 if frames from the last input were not taken with next()
+	uint8_t *space(size_t &len);
+	// len Bytes were put there
+	void commit(size_t len);
+	// Copies data in, and calls cb for each frame
+	void feed(const uint8_t *data, size_t len, const callback_t &cb);
+	// The next frame of the input so far, false if more input is needed
+	bool next(const uint8_t **start, size_t *size);
+	bool next(ubx_frame_view &frame);
+	// No more input: frames waiting behind a candidate that can't complete
+	// any more come out of next(), the Bytes after the last one are wasted
+	void finish();
+	// Start over at this input offset, as after a frame ending there
+	void reset(uint64_t offset);
+	// Input offset no frame still to come can start before: the first
+	// candidate's sync chars, or what's not been scanned
+	uint64_t live_offset() const;
+private:
+	enum cand_state : uint8_t
+	{
+		UBX_CAND_HEADER,	// waiting for class, id & length
+		UBX_CAND_BODY,	// waiting for the end of its payload
+		UBX_CAND_CKSUM,	// summed, checked at the front once its checksum is in
+		UBX_CAND_VALID,
+		UBX_CAND_BAD_CKSUM,
+		UBX_CAND_TOO_LONG,
+		UBX_CAND_CUT	// input ended before it did
+	};
+	struct candidate
+	{
+		uint64_t start;	// sync chars
+		uint64_t end;	// checksum
+		uint8_t a0, b0;	// sums before the class
+		uint8_t a1, b1;	// sums before the checksum
+		cand_state state;
+	};
+	// A candidate's payload end, candidates are summed there
+	struct end_event
+	{
+		uint64_t pos;
+		uint64_t seq;
+
+		bool operator>(const end_event &other) const
+		{
+			return this->pos > other.pos;
+		}
+	};
+
+	const uint8_t *buf;
+	uint8_t *store;	// NULL for data framed in place
+	size_t bufsize;
+	uint64_t base;	// input offset of buf[0]
+	size_t tail;	// Bytes in buf
+	size_t max_length;
+	bool finishing;
+	bool finished;
+	// Where the last frame ended, candidates before it are gone
+	uint64_t floor;
+	// Next Byte to look for SYNC1 at, & a pair found there not handled yet
+	uint64_t scan_pos;
+	uint64_t sync_pos;
+	// Fletcher sums of the input up to sum_pos
+	uint64_t sum_pos;
+	uint8_t sum_a, sum_b;
+	// Candidates by start, from cand_head on, seq_base is the seq of cands[0],
+	// headers are read in the same order, header_seq is the next one
+	vector<candidate> cands;
+	size_t cand_head;
+	uint64_t seq_base;
+	uint64_t header_seq;
+	// Payload ends pushed in order (the usual case) are queued in order from
+	// fifo_head on, the others go to a min-heap by pos
+	vector<end_event> ends_fifo;
+	size_t fifo_head;
+	vector<end_event> ends;
+
+	void init(size_t max_length);
+	uint64_t input_end() const
+	{
+		return this->base + this->tail;
+	}
+	bool find_sync();
+	void advance(uint64_t pos);
+	bool step();
+	bool fifo_empty() const
+	{
+		return this->fifo_head == this->ends_fifo.size();
+	}
+	void push_end(uint64_t pos, uint64_t seq);
+	void pop_end();
+	void add_candidate(uint64_t start);
+	void pop_candidate();
+
+	ubx_parser(const ubx_parser &) = delete;
+	ubx_parser &operator=(const ubx_parser &) = delete;
+};
+
+} // namespace UBX
@@ -0,0 +1,194 @@
+#include "ubx.hpp"
+#include "ubx_pool.hpp"
+#include "ubx_metrics.hpp"
+
+namespace UBX
+{
+
+// Smallest class that fits, UBX_POOL_CLASSES if none does
+static size_t size_class(size_t size)
+{
+	if(size > UBX_POOL_MAX_SIZE)
+	{
+		return UBX_POOL_CLASSES;
+	}
+	size_t c = 0;
+	while(c < UBX_POOL_CLASSES - 1 && (UBX_POOL_MIN_SIZE << c) < size)
+	{
+		c++;
+	}
+	return c;
+}
+
+static size_t class_size(size_t c)
+{
+	return c < UBX_POOL_CLASSES - 1 ? UBX_POOL_MIN_SIZE << c : UBX_POOL_MAX_SIZE;
+}
+
+ubx_frame_pool::ubx_frame_pool(size_t max_free)
+{
+	this->max_free = max_free;
+	this->hits = 0;
+	this->misses = 0;
+	this->in_use = 0;
+	this->pooled_bytes = 0;
+	// put() never has to grow them
+	for(vector<uint8_t *> &list : this->free_lists)
+	{
+		list.reserve(max_free);
+	}
+}
+
+ubx_frame_pool::~ubx_frame_pool()
+{
+	for(vector<uint8_t *> &list : this->free_lists)
+	{
+		for(uint8_t *buf : list)
+		{
+			free(buf);
+		}
+	}
+}
+
+ubx_frame_pool &ubx_frame_pool::global()
+{
+	static ubx_frame_pool pool;
+	return pool;
+}
+
+uint8_t *ubx_frame_pool::get(size_t size, size_t &capacity)
+{
+	size_t c = size_class(size);
+	capacity = c < UBX_POOL_CLASSES ? class_size(c) : size;
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		ubx_metrics::add(this->in_use, 1);
+		if(c < UBX_POOL_CLASSES && !this->free_lists[c].empty())
+		{
+			uint8_t *buf = this->free_lists[c].back();
+			this->free_lists[c].pop_back();
+			ubx_metrics::add(this->hits, 1);
+			return buf;
+		}
+		ubx_metrics::add(this->misses, 1);
+		if(c < UBX_POOL_CLASSES)
+		{
+			ubx_metrics::add(this->pooled_bytes, capacity);
+		}
+	}
+	uint8_t *buf = (uint8_t *)malloc(capacity);
+	if(buf == NULL)
+	{
+		perror("ubx_frame_pool::get()");
+		abort();
+	}
+	return buf;
+}
+
+void ubx_frame_pool::put(uint8_t *buf, size_t capacity)
+{
+	size_t c = size_class(capacity);
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		ubx_metrics::add(this->in_use, -1);
+		if(c < UBX_POOL_CLASSES && this->free_lists[c].size() < this->max_free)
+		{
+			this->free_lists[c].push_back(buf);
+			return;
+		}
+		if(c < UBX_POOL_CLASSES)
+		{
+			ubx_metrics::add(this->pooled_bytes, -capacity);
+		}
+	}
+	free(buf);
+}
+
+void ubx_frame_pool::dump_stats(FILE *fp)
+{
+	size_t hits = this->hits.load(), misses = this->misses.load();
+	fprintf(fp, "Frame pool: %zd hits, %zd misses (%.2f%% hits), %zd buffers out, %zd Bytes\n",
+		hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0,
+		this->in_use.load(), this->pooled_bytes.load());
+}
+
+ubx_pool_buf::ubx_pool_buf(ubx_frame_pool &pool)
+{
+	this->pool = &pool;
+	this->buf = NULL;
+	this->length = 0;
+	this->capacity = 0;
+}
+
+ubx_pool_buf::ubx_pool_buf(const ubx_pool_buf &other) : ubx_pool_buf(*other.pool)
+{
+	assign(other.buf, other.length);
+}
+
+ubx_pool_buf::ubx_pool_buf(ubx_pool_buf &&other)
+{
+	this->pool = other.pool;
+	this->buf = other.buf;
+	this->length = other.length;
+	this->capacity = other.capacity;
+	other.buf = NULL;
+	other.length = 0;
+	other.capacity = 0;
+}
+
+ubx_pool_buf::~ubx_pool_buf()
+{
+	release();
+}
+
+ubx_pool_buf &ubx_pool_buf::operator=(const ubx_pool_buf &other)
+{
+	if(this != &other)
+	{
+		assign(other.buf, other.length);
+	}
+	return *this;
+}
+
+ubx_pool_buf &ubx_pool_buf::operator=(ubx_pool_buf &&other)
+{
+	if(this != &other)
+	{
+		release();
+		this->pool = other.pool;
+		this->buf = other.buf;
+		this->length = other.length;
+		this->capacity = other.capacity;
+		other.buf = NULL;
+		other.length = 0;
+		other.capacity = 0;
+	}
+	return *this;
+}
+
+void ubx_pool_buf::assign(const uint8_t *data, size_t size)
+{
+	if(size > this->capacity)
+	{
+		release();
+		this->buf = this->pool->get(size, this->capacity);
+	}
+	if(size > 0)
+	{
+		memcpy(this->buf, data, size);
+	}
+	this->length = size;
+}
+
+void ubx_pool_buf::release()
+{
+	if(this->buf != NULL)
+	{
+		this->pool->put(this->buf, this->capacity);
+	}
+	this->buf = NULL;
+	this->length = 0;
+	this->capacity = 0;
+}
+
+} // namespace UBX
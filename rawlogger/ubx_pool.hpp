@@ -0,0 +1,101 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// Size classes are powers of two from UBX_POOL_MIN_SIZE, the last one holds a
+// whole frame with the largest payload (64 KiB + header & checksum)
+constexpr size_t UBX_POOL_MIN_SIZE = 64;
+constexpr size_t UBX_POOL_MAX_SIZE = 0x10000 + 8;
+constexpr size_t UBX_POOL_CLASSES = 12;
+// Free buffers kept per class, the rest go back to malloc()
+constexpr size_t UBX_POOL_MAX_FREE = 256;
+
+// Recycles frame sized buffers
+// get() takes a buffer of the smallest class that fits from that class' free
+// list (a hit), or mallocs one (a miss), put() gives it back. So once as many
+// of each class are out as are ever needed at once, nothing is allocated.
+// Larger buffers are malloc()ed & freed each time, & counted as misses.
+// get() & put() can be called from any thread.
+class ubx_frame_pool
+{
+public:
+	// Statistics, written with the lock held
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	std::atomic<size_t> in_use;	// buffers out
+	std::atomic<size_t> pooled_bytes;	// in buffers made & not freed, out or free
+
+	ubx_frame_pool(size_t max_free = UBX_POOL_MAX_FREE);
+	~ubx_frame_pool();
+	// At least size Bytes, capacity is set to what there is, never NULL
+	uint8_t *get(size_t size, size_t &capacity);
+	// A buffer from get(), with the capacity it had
+	void put(uint8_t *buf, size_t capacity);
+	void dump_stats(FILE *fp);
+	// Shared by every ubx_frame & ubx_any_msg
+	static ubx_frame_pool &global();
+private:
+	size_t max_free;
+	std::mutex lock;
+	vector<uint8_t *> free_lists[UBX_POOL_CLASSES];
+
+	ubx_frame_pool(const ubx_frame_pool &) = delete;
+	ubx_frame_pool &operator=(const ubx_frame_pool &) = delete;
+};
+
+// A buffer from a ubx_frame_pool, given back when it's destroyed
+// Keeps its buffer when it's cleared or gets smaller contents, so a reused
+// one only goes to the pool when it needs a larger class.
+class ubx_pool_buf
+{
+public:
+	ubx_pool_buf(ubx_frame_pool &pool = ubx_frame_pool::global());
+	ubx_pool_buf(const ubx_pool_buf &other);
+	ubx_pool_buf(ubx_pool_buf &&other);
+	~ubx_pool_buf();
+	ubx_pool_buf &operator=(const ubx_pool_buf &other);
+	ubx_pool_buf &operator=(ubx_pool_buf &&other);
+	void assign(const uint8_t *data, size_t size);
+	void clear()
+	{
+		this->length = 0;
+	}
+	// Back to the pool now
+	void release();
+	const uint8_t *data() const
+	{
+		return this->buf;
+	}
+	uint8_t *data()
+	{
+		return this->buf;
+	}
+	size_t size() const
+	{
+		return this->length;
+	}
+	bool empty() const
+	{
+		return this->length == 0;
+	}
+	const uint8_t &operator[](size_t i) const
+	{
+		return this->buf[i];
+	}
+private:
+	ubx_frame_pool *pool;
+	uint8_t *buf;
+	size_t length;
+	size_t capacity;
+};
+
+} // namespace UBX
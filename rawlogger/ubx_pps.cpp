@@ -0,0 +1,284 @@
+#include "ubx.hpp"
+#include "ubx_pps.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/ioctl.h>
+#include <linux/pps.h>
+
+namespace UBX
+{
+
+static int64_t diff_ns(const struct timespec &a, const struct timespec &b)
+{
+	return (int64_t)(a.tv_sec - b.tv_sec) * 1000000000 + (a.tv_nsec - b.tv_nsec);
+}
+
+// Into [-0.5, 0.5) s, chrony does the same with pulses
+static double wrap_second(double offset)
+{
+	return offset - floor(offset + 0.5);
+}
+
+ubx_pps_correlator::ubx_pps_correlator()
+{
+	this->edges = 0;
+	this->matched = 0;
+	this->uncorrected = 0;
+	this->unmatched = 0;
+	this->late = 0;
+	this->latency_budget_ns = UBX_PPS_LATENCY_BUDGET_NS;
+	this->tp_head = 0;
+	this->tp_count = 0;
+	this->edge_head = 0;
+	this->edge_count = 0;
+	memset(&this->last_edge, 0, sizeof(this->last_edge));
+	this->have_last_edge = false;
+}
+
+void ubx_pps_correlator::add_tp(const ubx_tim_tp &tp, const struct timespec &arrival)
+{
+	if(!tp.valid)
+	{
+		return;
+	}
+	tp_entry entry;
+	entry.arrival = arrival;
+	entry.pulse_ns = tp.get_pulse_ns();
+	entry.qerr_ps = tp.data.qErr;
+	entry.qerr_valid = tp.qerr_valid();
+	// Oldest one goes when full
+	if(this->tp_count == UBX_PPS_MAX_TP)
+	{
+		this->tps[this->tp_head] = entry;
+		this->tp_head = (this->tp_head + 1) % UBX_PPS_MAX_TP;
+	}
+	else
+	{
+		this->tps[(this->tp_head + this->tp_count) % UBX_PPS_MAX_TP] = entry;
+		this->tp_count++;
+	}
+}
+
+void ubx_pps_correlator::add_edge(const struct timespec &edge, uint32_t sequence)
+{
+	this->edges++;
+	if(this->edge_count == UBX_PPS_MAX_EDGES)
+	{
+		this->unmatched++;
+		this->edge_head = (this->edge_head + 1) % UBX_PPS_MAX_EDGES;
+		this->edge_count--;
+	}
+	edge_entry &entry = this->pending[(this->edge_head + this->edge_count) % UBX_PPS_MAX_EDGES];
+	entry.edge = edge;
+	entry.sequence = sequence;
+	// No more than a second back, in case edges were missed
+	entry.after = edge;
+	entry.after.tv_sec--;
+	if(this->have_last_edge && diff_ns(this->last_edge, entry.after) > 0)
+	{
+		entry.after = this->last_edge;
+	}
+	this->edge_count++;
+	this->last_edge = edge;
+	this->have_last_edge = true;
+}
+
+bool ubx_pps_correlator::pop(const struct timespec &now, ubx_pps_sample &sample)
+{
+	while(this->edge_count > 0)
+	{
+		const edge_entry &entry = this->pending[this->edge_head];
+		// Last TIM-TP in (after, edge), or a later one to show it's not coming
+		const tp_entry *tp = NULL;
+		bool later = false;
+		for(size_t i = 0; i < this->tp_count; i++)
+		{
+			const tp_entry &t = this->tps[(this->tp_head + i) % UBX_PPS_MAX_TP];
+			if(diff_ns(t.arrival, entry.edge) >= 0)
+			{
+				later = true;
+				break;
+			}
+			if(diff_ns(t.arrival, entry.after) > 0)
+			{
+				tp = &t;
+			}
+		}
+		int64_t latency = diff_ns(now, entry.edge);
+		if(tp == NULL && !later && latency <= this->latency_budget_ns)
+		{
+			return false;
+		}
+		this->edge_head = (this->edge_head + 1) % UBX_PPS_MAX_EDGES;
+		this->edge_count--;
+		if(latency > this->latency_budget_ns)
+		{
+			this->late++;
+			continue;
+		}
+		if(tp == NULL)
+		{
+			this->unmatched++;
+			continue;
+		}
+		// qErr is how late the pulse is, the edge's true time is the
+		// predicted one + qErr
+		double frac_ns = tp->pulse_ns % 1000000000 - entry.edge.tv_nsec;
+		sample.edge = entry.edge;
+		sample.sequence = entry.sequence;
+		sample.raw_offset = wrap_second(frac_ns / 1e9);
+		sample.corrected = tp->qerr_valid;
+		sample.qerr_ps = tp->qerr_ps;
+		sample.offset = tp->qerr_valid ? wrap_second((frac_ns + tp->qerr_ps / 1000.0) / 1e9) : sample.raw_offset;
+		sample.latency_ns = latency;
+		this->matched++;
+		if(!tp->qerr_valid)
+		{
+			this->uncorrected++;
+		}
+		return true;
+	}
+	return false;
+}
+
+ubx_pps::ubx_pps(const char *device, const char *chrony_path) : chrony(chrony_path)
+{
+	this->device = device;
+	this->fd = -1;
+	this->fetch_errors = 0;
+	this->stopping = false;
+}
+
+ubx_pps::~ubx_pps()
+{
+	stop();
+	if(this->fd >= 0)
+	{
+		close(this->fd);
+	}
+}
+
+int ubx_pps::open()
+{
+	this->fd = ::open(this->device.c_str(), O_RDWR | O_CLOEXEC);
+	if(this->fd < 0)
+	{
+		return -1;
+	}
+	int caps;
+	if(ioctl(this->fd, PPS_GETCAP, &caps) != 0)
+	{
+		return -1;
+	}
+	if((caps & PPS_CAPTUREASSERT) == 0)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	// Assert capture is pps-gpio's default, setting it needs root
+	struct pps_kparams params;
+	if(ioctl(this->fd, PPS_GETPARAMS, &params) == 0 && (params.mode & PPS_CAPTUREASSERT) == 0)
+	{
+		params.api_version = PPS_API_VERS;
+		params.mode |= PPS_CAPTUREASSERT | PPS_TSFMT_TSPEC;
+		if(ioctl(this->fd, PPS_SETPARAMS, &params) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int ubx_pps::open_chrony()
+{
+	return this->chrony.open();
+}
+
+void ubx_pps::start()
+{
+	this->thread = std::thread(&ubx_pps::run, this);
+}
+
+void ubx_pps::stop()
+{
+	if(this->thread.joinable())
+	{
+		this->stopping = true;
+		this->thread.join();
+	}
+}
+
+void ubx_pps::add_tp(const ubx_tim_tp &tp, const struct timespec &arrival)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->correlator.add_tp(tp, arrival);
+	flush();
+}
+
+void ubx_pps::run()
+{
+	uint32_t last_sequence = 0;
+	while(!this->stopping.load())
+	{
+		// RFC 2783 time_pps_fetch() with a timeout, so pending edges are
+		// decided on & stop() is seen without an edge
+		struct pps_fdata fdata;
+		memset(&fdata, 0, sizeof(fdata));
+		fdata.timeout.nsec = UBX_PPS_FETCH_TIMEOUT_NS;
+		fdata.timeout.flags = ~PPS_TIME_INVALID;
+		bool edge = false;
+		if(ioctl(this->fd, PPS_FETCH, &fdata) == 0)
+		{
+			edge = fdata.info.assert_sequence != last_sequence;
+			last_sequence = fdata.info.assert_sequence;
+		}
+		else if(errno != ETIMEDOUT && errno != EINTR)
+		{
+			this->fetch_errors++;
+			struct timespec wait = {0, UBX_PPS_FETCH_TIMEOUT_NS};
+			nanosleep(&wait, NULL);
+		}
+		std::lock_guard<std::mutex> guard(this->lock);
+		if(edge)
+		{
+			struct timespec ts;
+			ts.tv_sec = fdata.info.assert_tu.sec;
+			ts.tv_nsec = fdata.info.assert_tu.nsec;
+			this->correlator.add_edge(ts, fdata.info.assert_sequence);
+		}
+		flush();
+	}
+}
+
+void ubx_pps::flush()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	ubx_pps_sample sample;
+	while(this->correlator.pop(now, sample))
+	{
+		this->chrony.send_pulse(sample.edge, sample.offset);
+		this->offsets.update(sample.offset);
+		this->raw_offsets.update(sample.raw_offset);
+		this->latency.update(sample.latency_ns / 1e9);
+	}
+}
+
+void ubx_pps::dump_stats(FILE *fp)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	const ubx_pps_correlator &c = this->correlator;
+	fprintf(fp, "PPS %s: %zd edges, %zd matched (%zd without qErr), %zd without TIM-TP, %zd over the %.0f ms budget, %zd fetch errors\n",
+		this->device.c_str(), c.edges, c.matched, c.uncorrected, c.unmatched, c.late, c.latency_budget_ns / 1e6, this->fetch_errors);
+	if(this->offsets.count > 0)
+	{
+		fprintf(fp, "PPS: offset mean %+.9f s, stddev %.9f s, jitter %.9f s; without qErr stddev %.9f s, jitter %.9f s\n",
+			this->offsets.mean, this->offsets.stddev(), this->offsets.jitter(), this->raw_offsets.stddev(), this->raw_offsets.jitter());
+		fprintf(fp, "PPS: latency mean %.3f ms, max %.3f ms\n", this->latency.mean * 1e3, this->latency.max * 1e3);
+	}
+	this->chrony.dump_stats(fp);
+}
+
+} // namespace UBX
@@ -0,0 +1,131 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "ubx_tim.hpp"
+#include "ubx_chrony.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::string;
+
+// An edge is given up if not sent to chrony within this after its timestamp,
+// which covers the TIM-TP before it still being in the logger's read buffer
+constexpr int64_t UBX_PPS_LATENCY_BUDGET_NS = 200000000;
+// How long the PPS thread waits for an edge before checking the pending ones
+constexpr int64_t UBX_PPS_FETCH_TIMEOUT_NS = 50000000;
+// TIM-TP comes at the navigation rate, this covers more than a second at 10 Hz
+constexpr size_t UBX_PPS_MAX_TP = 16;
+constexpr size_t UBX_PPS_MAX_EDGES = 4;
+
+// One PPS edge with the TIM-TP that predicted it
+struct ubx_pps_sample
+{
+	struct timespec edge;	// system time of the edge (CLOCK_REALTIME)
+	uint32_t sequence;
+	// True time of the edge - edge, in [-0.5, 0.5) s, with & without qErr
+	double offset;
+	double raw_offset;
+	int32_t qerr_ps;
+	bool corrected;	// qErr was valid
+	int64_t latency_ns;	// from the edge to the sample being made
+};
+
+// Matches each PPS edge with the TIM-TP that was about it.
+// TIM-TP gives the time & quantization error of the next pulse, so the one for
+// an edge is the last TIM-TP read after the previous edge and before this one.
+// Both are system times (CLOCK_REALTIME), so matching works however far off
+// the system clock still is. Only the fraction of a second is compared, time
+// base & leap seconds don't matter.
+// An edge waits for its TIM-TP, when the logger is behind, until a later TIM-TP
+// shows none is coming or the latency budget is spent.
+// Not thread safe, ubx_pps serialises the calls.
+class ubx_pps_correlator
+{
+public:
+	// Statistics
+	size_t edges;
+	size_t matched;
+	size_t uncorrected;	// matched, qErr invalid
+	size_t unmatched;	// no TIM-TP between the previous edge and this one
+	size_t late;	// over the latency budget
+	int64_t latency_budget_ns;
+
+	ubx_pps_correlator();
+	void add_tp(const ubx_tim_tp &tp, const struct timespec &arrival);
+	void add_edge(const struct timespec &edge, uint32_t sequence);
+	// Oldest edge that can be decided on by now, false if none
+	bool pop(const struct timespec &now, ubx_pps_sample &sample);
+private:
+	struct tp_entry
+	{
+		struct timespec arrival;
+		int64_t pulse_ns;
+		int32_t qerr_ps;
+		bool qerr_valid;
+	};
+	struct edge_entry
+	{
+		struct timespec edge;
+		// TIM-TP read after this are about this edge
+		struct timespec after;
+		uint32_t sequence;
+	};
+	// Rings, in arrival order
+	tp_entry tps[UBX_PPS_MAX_TP];
+	size_t tp_head;
+	size_t tp_count;
+	edge_entry pending[UBX_PPS_MAX_EDGES];
+	size_t edge_head;
+	size_t edge_count;
+	struct timespec last_edge;
+	bool have_last_edge;
+};
+
+// RFC 2783 PPS source (e.g. pps-gpio's /dev/pps0) disciplined by TIM-TP.
+// A thread waits for assert edges, each one is sent to chrony's SOCK refclock
+// as a pulse with the receiver's qErr taken out, which removes the sawtooth
+// of the pulse being aligned to the receiver's clock.
+class ubx_pps
+{
+public:
+	ubx_pps_correlator correlator;
+	// Offsets as sent, with & without qErr
+	ubx_offset_stats offsets;
+	ubx_offset_stats raw_offsets;
+	ubx_offset_stats latency;	// s
+	size_t fetch_errors;
+
+	ubx_pps(const char *device, const char *chrony_path);
+	~ubx_pps();
+	// The PPS device has to be there, chrony's socket may come later
+	int open();
+	int open_chrony();
+	void start();
+	void stop();
+	// From the reader, arrival is its frame_time
+	void add_tp(const ubx_tim_tp &tp, const struct timespec &arrival);
+	void dump_stats(FILE *fp);
+private:
+	string device;
+	int fd;
+	ubx_chrony chrony;
+	std::mutex lock;
+	std::atomic<bool> stopping;
+	std::thread thread;
+
+	void run();
+	// With lock held
+	void flush();
+
+	ubx_pps(const ubx_pps &) = delete;
+	ubx_pps &operator=(const ubx_pps &) = delete;
+};
+
+} // namespace UBX
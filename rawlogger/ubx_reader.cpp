@@ -0,0 +1,236 @@
+#include "ubx.hpp"
+#include "ubx_reader.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+namespace UBX
+{
+
+ubx_reader::ubx_reader(int fd, size_t bufsize) : parser(UBX_PARSER_MAX_LENGTH, bufsize)
+{
+	this->fd = fd;
+	this->decompressor = NULL;
+	this->quiet = false;
+	this->frame_offset = 0;
+	memset(&this->frame_time, 0, sizeof(this->frame_time));
+	memset(&this->frame_mono, 0, sizeof(this->frame_mono));
+	// Enough unless a false sync holds frames back over more reads than that
+	this->stamps.reserve(2 * UBX_READER_STAMP_BLOCK);
+	this->stamp_head = 0;
+	this->eof = false;
+	this->epfd = -1;
+	this->bytes_read = 0;
+	this->syscalls = 0;
+	this->frames = 0;
+	this->wasted_bytes = 0;
+	this->bad_checksums = 0;
+	clock_gettime(CLOCK_MONOTONIC, &this->start_time);
+}
+
+ubx_reader::ubx_reader(ubx_decompressor *decompressor, size_t bufsize) : ubx_reader(-1, bufsize)
+{
+	this->decompressor = decompressor;
+}
+
+ubx_reader::~ubx_reader()
+{
+	if(this->epfd >= 0)
+	{
+		close(this->epfd);
+	}
+}
+
+// Wait until a non-blocking fd (serial port) is readable
+bool ubx_reader::wait_readable()
+{
+	if(this->epfd < 0)
+	{
+		this->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(this->epfd < 0)
+		{
+			perror("ubx_reader::wait_readable()");
+			return false;
+		}
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = this->fd;
+		if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->fd, &ev) != 0)
+		{
+			perror("ubx_reader::wait_readable()");
+			return false;
+		}
+	}
+	while(1)
+	{
+		struct epoll_event ev;
+		int ret = epoll_wait(this->epfd, &ev, 1, -1);
+		this->syscalls++;
+		if(ret > 0)
+		{
+			return true;
+		}
+		if(ret < 0 && errno != EINTR)
+		{
+			perror("ubx_reader::wait_readable()");
+			return false;
+		}
+	}
+}
+
+ssize_t ubx_reader::input(uint8_t *buf, size_t len)
+{
+	if(this->decompressor != NULL)
+	{
+		return this->decompressor->read(buf, len);
+	}
+	return read(this->fd, buf, len);
+}
+
+// One read into the parser's buffer
+// Returns false on EOF or error
+bool ubx_reader::fill()
+{
+	size_t len;
+	uint8_t *buf = this->parser.space(len);
+	while(1)
+	{
+		ssize_t ret = input(buf, len);
+		this->syscalls++;
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				if(wait_readable())
+				{
+					continue;
+				}
+				this->eof = true;
+				return false;
+			}
+			perror("ubx_reader::fill()");
+			this->eof = true;
+			return false;
+		}
+		if(ret == 0)
+		{
+			this->eof = true;
+			return false;
+		}
+		// Frames to come start at or after the live offset, so only the
+		// last read before it & those after are needed for them
+		uint64_t live = this->parser.live_offset();
+		while(this->stamps.size() - this->stamp_head > 1 && this->stamps[this->stamp_head + 1].offset <= live)
+		{
+			this->stamp_head++;
+		}
+		if(this->stamp_head >= UBX_READER_STAMP_BLOCK && this->stamp_head * 2 >= this->stamps.size())
+		{
+			this->stamps.erase(this->stamps.begin(), this->stamps.begin() + this->stamp_head);
+			this->stamp_head = 0;
+		}
+		this->stamps.emplace_back();
+		read_stamp &stamp = this->stamps.back();
+		stamp.offset = this->parser.bytes;
+		clock_gettime(CLOCK_REALTIME, &stamp.time);
+		clock_gettime(CLOCK_MONOTONIC, &stamp.mono);
+		this->parser.commit(ret);
+		this->bytes_read += ret;
+		return true;
+	}
+}
+
+// Find the next frame (without sync chars) in the input buffer, its checksum
+// is good, those that aren't are counted in bad_checksums & skipped.
+// start & size are only valid until the next call.
+// Returns EOF on end of input or error, 0 on success
+int ubx_reader::next_frame(const uint8_t **start, size_t *size)
+{
+	while(!this->parser.next(start, size))
+	{
+		if(this->eof)
+		{
+			this->wasted_bytes = this->parser.wasted_bytes;
+			this->bad_checksums = this->parser.bad_checksums;
+			return EOF;
+		}
+		if(!fill())
+		{
+			// Frames held back by a false sync that can't complete come out now
+			this->parser.finish();
+		}
+	}
+	this->frames = this->parser.frames;
+	this->wasted_bytes = this->parser.wasted_bytes;
+	this->bad_checksums = this->parser.bad_checksums;
+	if(this->parser.frame_wasted > 0 && !this->quiet)
+	{
+		fprintf(stderr, "ubx_reader::next_frame(): WASTED %zd Bytes\n", this->parser.frame_wasted);
+	}
+	this->frame_offset = this->parser.frame_offset;
+	// Latest read that started at or before the sync chars, the first one
+	// kept always did
+	for(size_t i = this->stamps.size(); i-- > this->stamp_head; )
+	{
+		const read_stamp &stamp = this->stamps[i];
+		if(stamp.offset <= this->frame_offset)
+		{
+			this->frame_time = stamp.time;
+			this->frame_mono = stamp.mono;
+			break;
+		}
+	}
+	return 0;
+}
+
+// Read one frame as a view into the input buffer,
+// it's only valid until the next call.
+// Returns EOF on end of input or error, 0 on success
+int ubx_reader::read_frame(ubx_frame_view &frame)
+{
+	const uint8_t *start;
+	size_t size;
+	if(next_frame(&start, &size) == EOF)
+	{
+		frame.clear();
+		return EOF;
+	}
+	// The parser checked it
+	frame = ubx_frame_view(start, size, true);
+	return 0;
+}
+
+// Read one frame (without sync chars) into buf, for callers that need to keep it
+// Returns EOF on end of input or error, 0 on success
+int ubx_reader::read_frame(ubx_buf_t &buf)
+{
+	const uint8_t *start;
+	size_t size;
+	if(next_frame(&start, &size) == EOF)
+	{
+		return EOF;
+	}
+	buf.assign(start, start + size);
+	return 0;
+}
+
+void ubx_reader::dump_stats(FILE *fp)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - this->start_time.tv_sec) +
+		(now.tv_nsec - this->start_time.tv_nsec) / 1e9;
+	fprintf(fp, "Read %zd Bytes in %.3f s (%.1f Bytes/s), %zd frames, %zd wasted Bytes, %zd bad checksums\n",
+		this->bytes_read, elapsed,
+		elapsed > 0 ? this->bytes_read / elapsed : 0.0,
+		this->frames, this->wasted_bytes, this->bad_checksums);
+	fprintf(fp, "%zd read() calls, %.4f syscalls/frame\n",
+		this->syscalls,
+		this->frames > 0 ? (double)this->syscalls / this->frames : 0.0);
+}
+
+} // namespace UBX
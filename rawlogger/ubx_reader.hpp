@@ -0,0 +1,77 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include "ubx_def.hpp"
+#include "ubx_compress.hpp"
+#include "ubx_parser.hpp"
+
+#pragma once
+
+namespace UBX
+{
+// Default input buffer size, must be larger than UBX_MAX_FRAME_SIZE
+constexpr size_t UBX_READER_BUFSIZE = 256 * 1024;
+// Arrival times no frame can start in any more are dropped from the front
+// in blocks, so the list doesn't allocate once grown
+constexpr size_t UBX_READER_STAMP_BLOCK = 64;
+
+// Block based UBX frame reader
+// Reads large chunks with read(2) into a ubx_parser's buffer, which frames them,
+// so only frames with a good checksum come out, & a false sync doesn't cost
+// the frames after it.
+// Non-blocking fds (serial ports) are waited on with epoll.
+// Compressed files are read through a ubx_decompressor instead of the fd.
+class ubx_reader
+{
+public:
+	// Statistics
+	size_t bytes_read;
+	size_t syscalls;
+	size_t frames;
+	size_t wasted_bytes;
+	size_t bad_checksums;
+	// Input offset of the last frame's sync chars
+	uint64_t frame_offset;
+	// CLOCK_REALTIME & CLOCK_MONOTONIC when the read() that got the last
+	// frame's first Byte returned, frames read at once share them
+	struct timespec frame_time;
+	struct timespec frame_mono;
+	// Don't report wasted Bytes on stderr
+	bool quiet;
+
+	ubx_reader(int fd, size_t bufsize = UBX_READER_BUFSIZE);
+	ubx_reader(ubx_decompressor *decompressor, size_t bufsize = UBX_READER_BUFSIZE);
+	~ubx_reader();
+	int read_frame(ubx_frame_view &frame);
+	int read_frame(ubx_buf_t &buf);
+	int next_frame(const uint8_t **start, size_t *size);
+	void dump_stats(FILE *fp);
+private:
+	int fd;
+	ubx_decompressor *decompressor;
+	ubx_parser parser;
+	bool eof;
+	int epfd;
+	struct timespec start_time;
+	// Input offset of each read's first Byte & when it returned, from
+	// stamp_head on, back to the last read before the parser's live offset
+	struct read_stamp
+	{
+		uint64_t offset;
+		struct timespec time;
+		struct timespec mono;
+	};
+	std::vector<read_stamp> stamps;
+	size_t stamp_head;
+
+	bool fill();
+	bool wait_readable();
+	ssize_t input(uint8_t *buf, size_t len);
+
+	ubx_reader(const ubx_reader &) = delete;
+	ubx_reader &operator=(const ubx_reader &) = delete;
+};
+
+} // namespace UBX
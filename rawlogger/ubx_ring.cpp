@@ -0,0 +1,301 @@
+#include "ubx.hpp"
+#include "ubx_ring.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+namespace UBX
+{
+constexpr size_t UBX_RING_ALIGN = 8;
+
+static inline size_t ring_align(size_t size)
+{
+	return (size + UBX_RING_ALIGN - 1) & ~(UBX_RING_ALIGN - 1);
+}
+
+// Block on an eventfd until the other side signals it
+static void event_wait(int fd)
+{
+	uint64_t val;
+	while(read(fd, &val, sizeof(val)) < 0 && errno == EINTR)
+	{
+	}
+}
+
+static void event_signal(int fd)
+{
+	uint64_t val = 1;
+	while(write(fd, &val, sizeof(val)) < 0 && errno == EINTR)
+	{
+	}
+}
+
+bool ubx_frame_priority(const ubx_frame_view &frame)
+{
+	switch(frame.class_id)
+	{
+	case UBX_CLASS_RXM:
+	case UBX_CLASS_TIM:
+		return true;
+	case UBX_CLASS_NAV:
+		return frame.msg_id == UBX_NAV_PVT || frame.msg_id == UBX_NAV_EOE;
+	default:
+		return false;
+	}
+}
+
+ubx_ring::ubx_ring(size_t size, ubx_ring_policy policy)
+{
+	// Power of 2, with room for a few of the largest possible frames at least
+	size_t min_size = 4 * ring_align(sizeof(ubx_ring_record) + UBX_MAX_FRAME_SIZE);
+	size_t capacity = 1;
+	while(capacity < size || capacity < min_size)
+	{
+		capacity <<= 1;
+	}
+	this->capacity = capacity;
+	this->buf = (uint8_t *)aligned_alloc(64, capacity);
+	this->producer_event = eventfd(0, EFD_CLOEXEC);
+	this->consumer_event = eventfd(0, EFD_CLOEXEC);
+	if(this->buf == NULL || this->producer_event < 0 || this->consumer_event < 0)
+	{
+		perror("ubx_ring::ubx_ring()");
+		abort();
+	}
+	this->policy = policy;
+	this->dropping_epoch = false;
+	this->head = 0;
+	this->tail = 0;
+	this->producer_waiting = false;
+	this->consumer_waiting = false;
+	this->high_water = 0;
+	this->overflows = 0;
+	this->dropped_frames = 0;
+	this->dropped_bytes = 0;
+	this->dropped_epochs = 0;
+}
+
+ubx_ring::~ubx_ring()
+{
+	close(this->producer_event);
+	close(this->consumer_event);
+	free(this->buf);
+}
+
+// Bytes needed for a record of `size` Bytes of data at the current head,
+// including padding up to the end of the buffer if it has to wrap around
+size_t ubx_ring::space_needed(size_t size) const
+{
+	size_t rec_size = ring_align(sizeof(ubx_ring_record) + size);
+	size_t offset = this->head.load(std::memory_order_relaxed) & (this->capacity - 1);
+	if(offset + rec_size > this->capacity)
+	{
+		rec_size += this->capacity - offset;
+	}
+	return rec_size;
+}
+
+bool ubx_ring::try_push(uint8_t type, const void *data, size_t size)
+{
+	size_t head = this->head.load(std::memory_order_relaxed);
+	size_t tail = this->tail.load(std::memory_order_acquire);
+	size_t needed = space_needed(size);
+	if(head - tail + needed > this->capacity)
+	{
+		return false;
+	}
+	size_t offset = head & (this->capacity - 1);
+	ubx_ring_record *rec = (ubx_ring_record *)(this->buf + offset);
+	if(offset + ring_align(sizeof(ubx_ring_record) + size) > this->capacity)
+	{
+		// Pad to the end, record goes to the beginning
+		rec->type = UBX_RING_PAD;
+		rec->size = this->capacity - offset - sizeof(ubx_ring_record);
+		rec = (ubx_ring_record *)this->buf;
+	}
+	rec->type = type;
+	rec->size = size;
+	if(size > 0)
+	{
+		memcpy(rec->data(), data, size);
+	}
+	// seq_cst, pairs with the consumer storing consumer_waiting before checking head
+	this->head.store(head + needed);
+	if(this->consumer_waiting.load())
+	{
+		event_signal(this->consumer_event);
+	}
+
+	size_t used = head + needed - tail;
+	if(used > this->high_water.load(std::memory_order_relaxed))
+	{
+		this->high_water.store(used, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+void ubx_ring::push_blocking(uint8_t type, const void *data, size_t size)
+{
+	while(!try_push(type, data, size))
+	{
+		this->producer_waiting.store(true);
+		// Check again after announcing we're waiting, the consumer may have
+		// released everything in between
+		size_t needed = space_needed(size);
+		if(this->head.load(std::memory_order_relaxed) - this->tail.load() + needed > this->capacity)
+		{
+			event_wait(this->producer_event);
+		}
+		this->producer_waiting.store(false);
+	}
+}
+
+void ubx_ring::drop(size_t size)
+{
+	this->dropped_frames.store(this->dropped_frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	this->dropped_bytes.store(this->dropped_bytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+}
+
+void ubx_ring::push_frame(const ubx_frame_view &frame)
+{
+	if(this->dropping_epoch)
+	{
+		drop(frame.size);
+		return;
+	}
+	if(this->policy == UBX_RING_DROP_LOW_PRIORITY && !ubx_frame_priority(frame) &&
+		used() + space_needed(frame.size) > this->capacity * UBX_RING_LOW_PRIORITY_LIMIT)
+	{
+		this->overflows.store(this->overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		drop(frame.size);
+		return;
+	}
+	if(try_push(UBX_RING_FRAME, frame.data, frame.size))
+	{
+		return;
+	}
+	this->overflows.store(this->overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	switch(this->policy)
+	{
+	case UBX_RING_DROP_EPOCH:
+		this->dropping_epoch = true;
+		drop(frame.size);
+		break;
+	case UBX_RING_BLOCK:
+	case UBX_RING_DROP_LOW_PRIORITY:
+		push_blocking(UBX_RING_FRAME, frame.data, frame.size);
+		break;
+	}
+}
+
+void ubx_ring::push_epoch_end(const ubx_epoch_info &info)
+{
+	if(this->dropping_epoch)
+	{
+		this->dropping_epoch = false;
+		this->dropped_epochs.store(this->dropped_epochs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		push_blocking(UBX_RING_EPOCH_ABORT, NULL, 0);
+		return;
+	}
+	push_blocking(UBX_RING_EPOCH_END, &info, sizeof(info));
+}
+
+void ubx_ring::push_open(const char *path)
+{
+	push_blocking(UBX_RING_OPEN, path, strlen(path) + 1);
+}
+
+void ubx_ring::push_stop()
+{
+	push_blocking(UBX_RING_STOP, NULL, 0);
+}
+
+const ubx_ring_record *ubx_ring::pop_wait()
+{
+	while(1)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		if(this->head.load(std::memory_order_acquire) == tail)
+		{
+			this->consumer_waiting.store(true);
+			if(this->head.load() == tail)
+			{
+				event_wait(this->consumer_event);
+			}
+			this->consumer_waiting.store(false);
+			continue;
+		}
+		const ubx_ring_record *rec = (const ubx_ring_record *)(this->buf + (tail & (this->capacity - 1)));
+		if(rec->type == UBX_RING_PAD)
+		{
+			pop_release(rec);
+			continue;
+		}
+		return rec;
+	}
+}
+
+const ubx_ring_record *ubx_ring::try_pop()
+{
+	while(1)
+	{
+		size_t tail = this->tail.load(std::memory_order_relaxed);
+		if(this->head.load(std::memory_order_acquire) == tail)
+		{
+			return NULL;
+		}
+		const ubx_ring_record *rec = (const ubx_ring_record *)(this->buf + (tail & (this->capacity - 1)));
+		if(rec->type == UBX_RING_PAD)
+		{
+			pop_release(rec);
+			continue;
+		}
+		return rec;
+	}
+}
+
+bool ubx_ring::pop_prepare_wait()
+{
+	this->consumer_waiting.store(true);
+	// seq_cst, the producer either sees consumer_waiting or we see its head
+	if(this->head.load() != this->tail.load(std::memory_order_relaxed))
+	{
+		this->consumer_waiting.store(false);
+		return false;
+	}
+	return true;
+}
+
+void ubx_ring::pop_end_wait()
+{
+	this->consumer_waiting.store(false);
+}
+
+// Only after pop_event_fd() was readable, it blocks otherwise
+void ubx_ring::pop_event()
+{
+	event_wait(this->consumer_event);
+}
+
+void ubx_ring::pop_release(const ubx_ring_record *rec)
+{
+	size_t tail = this->tail.load(std::memory_order_relaxed);
+	// seq_cst, pairs with the producer storing producer_waiting before checking tail
+	this->tail.store(tail + ring_align(sizeof(ubx_ring_record) + rec->size));
+	if(this->producer_waiting.load())
+	{
+		event_signal(this->producer_event);
+	}
+}
+
+void ubx_ring::dump_stats(FILE *fp)
+{
+	static const char *policy_names[] = {"block", "drop epoch", "drop low priority"};
+	fprintf(fp, "Ring: %zd Bytes (%s), high water mark %zd Bytes, %zd overflows\n",
+		this->capacity, policy_names[this->policy],
+		this->high_water.load(), this->overflows.load());
+	fprintf(fp, "Ring: dropped %zd frames (%zd Bytes), %zd epochs\n",
+		this->dropped_frames.load(), this->dropped_bytes.load(), this->dropped_epochs.load());
+}
+
+} // namespace UBX
@@ -0,0 +1,143 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include "ubx_def.hpp"
+
+#pragma once
+
+namespace UBX
+{
+constexpr size_t UBX_RING_DEFAULT_SIZE = 4 * 1024 * 1024;
+
+// What push_frame() does when the ring is full:
+// UBX_RING_BLOCK:
+//	wait for the consumer, nothing is lost, but a long enough stall
+//	backs up the UART and the kernel drops bytes instead.
+// UBX_RING_DROP_EPOCH:
+//	drop the frame and the rest of its epoch, and tell the consumer
+//	to throw away the part it already has, so only whole epochs are kept.
+// UBX_RING_DROP_LOW_PRIORITY:
+//	once the ring is over UBX_RING_LOW_PRIORITY_LIMIT full, drop low
+//	priority frames (see ubx_frame_priority()) to keep the room for
+//	raw measurements, and block only if even those don't fit.
+enum ubx_ring_policy
+{
+	UBX_RING_BLOCK,
+	UBX_RING_DROP_EPOCH,
+	UBX_RING_DROP_LOW_PRIORITY
+};
+
+// Fraction of the ring that low priority frames may fill
+constexpr double UBX_RING_LOW_PRIORITY_LIMIT = 0.75;
+
+enum ubx_ring_type : uint8_t
+{
+	UBX_RING_PAD,		// filler up to the end of the buffer
+	UBX_RING_FRAME,		// data: frame without sync chars
+	UBX_RING_EPOCH_END,	// data: ubx_epoch_info, end of epoch (after NAV-EOE)
+	UBX_RING_EPOCH_ABORT,	// frames of this epoch were dropped
+	UBX_RING_OPEN,		// data: NUL terminated file name
+	UBX_RING_STOP		// no more records
+};
+
+struct ubx_ring_record
+{
+	uint32_t size;	// size of data
+	uint8_t type;
+	uint8_t reserved[3];
+
+	// data follows the header
+	uint8_t *data()
+	{
+		return (uint8_t *)(this + 1);
+	}
+	const uint8_t *data() const
+	{
+		return (const uint8_t *)(this + 1);
+	}
+};
+
+// Sent along with the end of an epoch, for the index
+struct ubx_epoch_info
+{
+	uint32_t iTOW;
+	uint32_t reserved;
+	int64_t utc_ms;	// UBX_INDEX_NO_UTC if unknown
+	int64_t arrival_ns;	// CLOCK_MONOTONIC when NAV-EOE was read, 0 if unknown
+};
+
+// true for messages we always want to keep: raw measurements & navigation solution
+bool ubx_frame_priority(const ubx_frame_view &frame);
+
+// Lock-free single producer, single consumer ring of variable sized records
+// Records are contiguous in memory, so the consumer reads them in place.
+// Either side sleeps on an eventfd only when the ring is full/empty.
+class ubx_ring
+{
+public:
+	// Statistics, written by the producer only
+	std::atomic<size_t> high_water;	// most Bytes ever in use
+	std::atomic<size_t> overflows;	// pushes that found the ring full
+	std::atomic<size_t> dropped_frames;
+	std::atomic<size_t> dropped_bytes;
+	std::atomic<size_t> dropped_epochs;
+
+	ubx_ring(size_t size = UBX_RING_DEFAULT_SIZE, ubx_ring_policy policy = UBX_RING_DROP_LOW_PRIORITY);
+	~ubx_ring();
+
+	// Producer side
+	void push_frame(const ubx_frame_view &frame);
+	void push_epoch_end(const ubx_epoch_info &info);
+	void push_open(const char *path);
+	void push_stop();
+
+	// Consumer side, the record stays valid until pop_release()
+	const ubx_ring_record *pop_wait();
+	void pop_release(const ubx_ring_record *rec);
+	// Non-blocking consumer side, for consumers that sleep in their own epoll:
+	// try_pop() returns NULL if the ring is empty. Before sleeping, call
+	// pop_prepare_wait(), which returns false if something came in after all,
+	// wait for pop_event_fd() to be readable (then call pop_event()),
+	// and call pop_end_wait() once awake.
+	const ubx_ring_record *try_pop();
+	bool pop_prepare_wait();
+	void pop_end_wait();
+	void pop_event();
+	int pop_event_fd() const
+	{
+		return this->consumer_event;
+	}
+
+	size_t size() const
+	{
+		return this->capacity;
+	}
+	size_t used() const
+	{
+		return this->head.load(std::memory_order_acquire) - this->tail.load(std::memory_order_acquire);
+	}
+	void dump_stats(FILE *fp);
+private:
+	uint8_t *buf;
+	size_t capacity; // power of 2
+	ubx_ring_policy policy;
+	bool dropping_epoch;
+
+	alignas(64) std::atomic<size_t> head;	// written by producer
+	alignas(64) std::atomic<size_t> tail;	// written by consumer
+	alignas(64) std::atomic<bool> producer_waiting;
+	std::atomic<bool> consumer_waiting;
+	int producer_event;
+	int consumer_event;
+
+	size_t space_needed(size_t size) const;
+	bool try_push(uint8_t type, const void *data, size_t size);
+	void push_blocking(uint8_t type, const void *data, size_t size);
+	void drop(size_t size);
+
+	ubx_ring(const ubx_ring &) = delete;
+	ubx_ring &operator=(const ubx_ring &) = delete;
+};
+
+} // namespace UBX
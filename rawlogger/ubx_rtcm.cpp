@@ -0,0 +1,614 @@
+#include "ubx.hpp"
+#include "ubx_rtcm.hpp"
+#include <math.h>
+#include <algorithm>
+
+namespace UBX
+{
+
+constexpr double CLIGHT = 299792458.0;
+constexpr double RANGE_MS = CLIGHT * 0.001;
+constexpr double P2_10 = 0.0009765625;
+constexpr double P2_29 = 1.862645149230957e-09;
+constexpr double P2_31 = 4.656612873077393e-10;
+constexpr int64_t WEEK_MS = 7 * 24 * 3600 * 1000LL;
+// cpStdev index above which the phase isn't used, as RTKLIB
+constexpr uint8_t CPSTD_VALID = 5;
+// RAWX trkStat
+constexpr uint8_t TRK_PR_VALID = 0x01;
+constexpr uint8_t TRK_CP_VALID = 0x02;
+constexpr uint8_t TRK_HALF_CYC = 0x04;
+
+// Rounding the way RTKLIB does, the output has to match bit for bit
+static int32_t round_i(double x)
+{
+	return (int32_t)floor(x + 0.5);
+}
+
+static uint32_t round_u(double x)
+{
+	return (uint32_t)floor(x + 0.5);
+}
+
+static const uint32_t crc24q_table[256] =
+{
+	0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC, 0x9F7F17,
+	0xA18139, 0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23, 0xB8B2D5, 0x3EFE2E,
+	0xC54E89, 0x430272, 0x4F9B84, 0xC9D77F, 0x56A868, 0xD0E493, 0xDC7D65, 0x5A319E,
+	0x64CFB0, 0xE2834B, 0xEE1ABD, 0x685646, 0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7,
+	0x0CD1E9, 0x8A9D12, 0x8604E4, 0x00481F, 0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE,
+	0xAD50D0, 0x2B1C2B, 0x2785DD, 0xA1C926, 0x3EB631, 0xB8FACA, 0xB4633C, 0x322FC7,
+	0xC99F60, 0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A, 0xD0AC8C, 0x56E077,
+	0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5, 0xF7614E,
+	0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8, 0x00903E, 0x86DCC5,
+	0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A, 0xAD88F1, 0xA11107, 0x275DFC,
+	0xDCED5B, 0x5AA1A0, 0x563856, 0xD074AD, 0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C,
+	0x7D6C62, 0xFB2099, 0xF7B96F, 0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375,
+	0x15723B, 0x933EC0, 0x9FA736, 0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C,
+	0xB4F302, 0x32BFF9, 0x3E260F, 0xB86AF4, 0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15,
+	0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53, 0xC596A8, 0xC90F5E, 0x4F43A5,
+	0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791, 0x688E67, 0xEEC29C,
+	0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145, 0x26EDBE, 0x2A7448, 0xAC38B3,
+	0x92C69D, 0x148A66, 0x181390, 0x9E5F6B, 0x01207C, 0x876C87, 0x8BF571, 0x0DB98A,
+	0xF6092D, 0x7045D6, 0x7CDC20, 0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A,
+	0x578814, 0xD1C4EF, 0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703,
+	0x3F964D, 0xB9DAB6, 0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A,
+	0x9E1774, 0x185B8F, 0x14C279, 0x928E82, 0x0DF195, 0x8BBD6E, 0x872498, 0x016863,
+	0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132, 0x693E25, 0xEF72DE, 0xE3EB28, 0x65A7D3,
+	0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C, 0x4EF3E7, 0x426A11, 0xC426EA,
+	0x2AE476, 0xACA88D, 0xA0317B, 0x267D80, 0xB90297, 0x3F4E6C, 0x33D79A, 0xB59B61,
+	0x8B654F, 0x0D29B4, 0x01B042, 0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3, 0x141A58,
+	0xEFAAFF, 0x69E604, 0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8,
+	0x4E2BC6, 0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1,
+	0x26359F, 0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673, 0xB94A88,
+	0x87B4A6, 0x01F85D, 0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC, 0x9E874A, 0x18CBB1,
+	0xE37B16, 0x6537ED, 0x69AE1B, 0xEFE2E0, 0x709DF7, 0xF6D10C, 0xFA48FA, 0x7C0401,
+	0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9, 0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538
+};
+
+uint32_t rtcm_crc24q(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table[(crc >> 16) ^ data[i]];
+	}
+	return crc;
+}
+
+uint16_t rtcm_msg_type(const uint8_t *frame, size_t size)
+{
+	if(size < RTCM3_HEADER_SIZE + 2)
+	{
+		return 0;
+	}
+	return (frame[3] << 4) | (frame[4] >> 4);
+}
+
+// Big endian bit fields, MSB first, buf must be zeroed
+static void setbitu(uint8_t *buf, size_t pos, unsigned len, uint32_t data)
+{
+	for(unsigned i = 0; i < len; i++, pos++)
+	{
+		if(data & (1u << (len - i - 1)))
+		{
+			buf[pos / 8] |= 0x80 >> (pos % 8);
+		}
+	}
+}
+
+static void setbits(uint8_t *buf, size_t pos, unsigned len, int32_t data)
+{
+	setbitu(buf, pos, len, (uint32_t)data & (len < 32 ? (1u << len) - 1 : 0xFFFFFFFF));
+}
+
+// 38 bit signed, truncated like RTKLIB does
+static void set38bits(uint8_t *buf, size_t pos, double value)
+{
+	int32_t word_h = (int32_t)floor(value / 64.0);
+	uint32_t word_l = (uint32_t)(value - word_h * 64.0);
+	setbits(buf, pos, 32, word_h);
+	setbitu(buf, pos + 32, 6, word_l);
+}
+
+// Lock time indicator with extended range and resolution (DF407), lock in ms
+// Below 64 ms it's the lock time, then each power of two range has 32 steps
+static uint32_t msm_lock_ex(int64_t lock)
+{
+	if(lock < 64)
+	{
+		return lock < 0 ? 0 : lock;
+	}
+	for(unsigned k = 6; k < 26; k++)
+	{
+		if(lock < (1LL << (k + 1)))
+		{
+			int64_t step = 1LL << (k - 5);
+			return (lock - (1LL << k)) / step + 64 + 32 * (k - 6);
+		}
+	}
+	return 704;
+}
+
+// u-blox gnssId -> system index, -1 if MSM7 isn't sent for it
+static int msm_system(uint8_t gnssId)
+{
+	switch(gnssId)
+	{
+	case 0:
+		return 0;	// GPS
+	case 6:
+		return 1;	// GLONASS
+	case 2:
+		return 2;	// Galileo
+	case 3:
+		return 3;	// BeiDou
+	default:
+		return -1;
+	}
+}
+
+static const uint16_t msm7_types[RTCM_MSM_SYSTEMS] = {1077, 1087, 1097, 1127};
+
+// u-blox sigId -> MSM signal ID & carrier frequency, false if there's no MSM signal for it
+static bool msm_signal(int system, uint8_t sigId, int fcn, uint8_t &sig, double &freq)
+{
+	switch(system)
+	{
+	case 0:
+		switch(sigId)
+		{
+		case 0: sig = 2; freq = 1575.42e6; return true;	// L1C/A 1C
+		case 3: sig = 16; freq = 1227.60e6; return true;	// L2 CL 2L
+		case 4: sig = 15; freq = 1227.60e6; return true;	// L2 CM 2S
+		case 6: sig = 22; freq = 1176.45e6; return true;	// L5 I 5I
+		case 7: sig = 23; freq = 1176.45e6; return true;	// L5 Q 5Q
+		}
+		return false;
+	case 1:
+		if(fcn < -7 || fcn > 6)
+		{
+			return false;
+		}
+		switch(sigId)
+		{
+		case 0: sig = 2; freq = 1602.0e6 + fcn * 0.5625e6; return true;	// L1OF 1C
+		case 2: sig = 8; freq = 1246.0e6 + fcn * 0.4375e6; return true;	// L2OF 2C
+		}
+		return false;
+	case 2:
+		switch(sigId)
+		{
+		case 0: sig = 2; freq = 1575.42e6; return true;	// E1 C 1C
+		case 1: sig = 4; freq = 1575.42e6; return true;	// E1 B 1B
+		case 3: sig = 22; freq = 1176.45e6; return true;	// E5a I 5I
+		case 4: sig = 23; freq = 1176.45e6; return true;	// E5a Q 5Q
+		case 5: sig = 14; freq = 1207.14e6; return true;	// E5b I 7I
+		case 6: sig = 15; freq = 1207.14e6; return true;	// E5b Q 7Q
+		}
+		return false;
+	case 3:
+		switch(sigId)
+		{
+		case 0: case 1: sig = 2; freq = 1561.098e6; return true;	// B1I D1/D2 2I
+		case 2: case 3: sig = 14; freq = 1207.14e6; return true;	// B2I D1/D2 7I
+		case 5: sig = 31; freq = 1575.42e6; return true;	// B1C pilot 1P
+		case 7: sig = 23; freq = 1176.45e6; return true;	// B2a pilot 5P
+		}
+		return false;
+	}
+	return false;
+}
+
+ubx_rtcm_encoder::ubx_rtcm_encoder()
+{
+	this->station_id = 0;
+	this->arp_valid = false;
+	this->arp[0] = this->arp[1] = this->arp[2] = 0;
+	this->tadj = 0;
+	this->station_interval = 0;
+	this->glo_cp_aligned = false;
+	for(double &bias : this->glo_cp_bias)
+	{
+		bias = 0;
+	}
+	this->epochs = 0;
+	this->messages = 0;
+	this->bytes = 0;
+	this->skipped = 0;
+	this->state.assign(RTCM_MSM_SYSTEMS * RTCM_MSM_MAX_SATS * RTCM_MSM_MAX_SIGS, sig_state());
+	for(auto &list : this->meas)
+	{
+		list.reserve(UBX_RXM_RAWX_MAX_MEAS);
+	}
+	this->last_station = -1;
+}
+
+// Frame the message in buf, bits long after the header
+size_t ubx_rtcm_encoder::finish(size_t bits, vector<uint8_t> &out)
+{
+	size_t len = (bits + 7) / 8;
+	this->buf[0] = RTCM3_PREAMBLE;
+	this->buf[1] = len >> 8;
+	this->buf[2] = len & 0xff;
+	uint32_t crc = rtcm_crc24q(this->buf, RTCM3_HEADER_SIZE + len);
+	this->buf[RTCM3_HEADER_SIZE + len] = crc >> 16;
+	this->buf[RTCM3_HEADER_SIZE + len + 1] = crc >> 8;
+	this->buf[RTCM3_HEADER_SIZE + len + 2] = crc;
+	size_t size = RTCM3_HEADER_SIZE + len + RTCM3_CRC_SIZE;
+	out.insert(out.end(), this->buf, this->buf + size);
+	this->messages++;
+	this->bytes += size;
+	return 1;
+}
+
+size_t ubx_rtcm_encoder::encode_1005(vector<uint8_t> &out)
+{
+	if(!this->arp_valid)
+	{
+		return 0;
+	}
+	memset(this->buf, 0, sizeof(this->buf));
+	size_t i = RTCM3_HEADER_SIZE * 8;
+	setbitu(this->buf, i, 12, 1005); i += 12;
+	setbitu(this->buf, i, 12, this->station_id); i += 12;
+	setbitu(this->buf, i, 6, 0); i += 6;	// ITRF realization year
+	setbitu(this->buf, i, 1, 1); i += 1;	// GPS
+	setbitu(this->buf, i, 1, 1); i += 1;	// GLONASS
+	setbitu(this->buf, i, 1, 0); i += 1;	// Galileo, as RTKLIB
+	setbitu(this->buf, i, 1, 0); i += 1;	// reference station, not physical
+	set38bits(this->buf, i, this->arp[0] / 0.0001); i += 38;
+	setbitu(this->buf, i, 1, 1); i += 1;	// single receiver oscillator
+	setbitu(this->buf, i, 1, 0); i += 1;	// reserved
+	set38bits(this->buf, i, this->arp[1] / 0.0001); i += 38;
+	setbitu(this->buf, i, 2, 0); i += 2;	// quarter cycle indicator
+	set38bits(this->buf, i, this->arp[2] / 0.0001); i += 38;
+	return finish(i - RTCM3_HEADER_SIZE * 8, out);
+}
+
+size_t ubx_rtcm_encoder::encode_1230(vector<uint8_t> &out)
+{
+	memset(this->buf, 0, sizeof(this->buf));
+	size_t i = RTCM3_HEADER_SIZE * 8;
+	setbitu(this->buf, i, 12, 1230); i += 12;
+	setbitu(this->buf, i, 12, this->station_id); i += 12;
+	setbitu(this->buf, i, 1, this->glo_cp_aligned); i += 1;
+	setbitu(this->buf, i, 3, 0); i += 3;	// reserved
+	setbitu(this->buf, i, 4, 0x0f); i += 4;	// all four biases follow
+	for(double bias : this->glo_cp_bias)
+	{
+		double b = bias / 0.02;
+		setbits(this->buf, i, 16, fabs(b) > 32767 ? -32768 : round_i(b)); i += 16;
+	}
+	return finish(i - RTCM3_HEADER_SIZE * 8, out);
+}
+
+// One MSM7 of the satellites first_sat..last_sat - 1, list is sorted by (sat, sig)
+size_t ubx_rtcm_encoder::msm7(size_t system, const vector<msm_meas> &list, size_t first_sat, size_t last_sat,
+	uint32_t epoch, int64_t now, bool more, vector<uint8_t> &out)
+{
+	// Masks, index in the mask + 1, 0 if not there
+	uint8_t sat_ind[RTCM_MSM_MAX_SATS] = {0};
+	uint8_t sig_ind[RTCM_MSM_MAX_SIGS] = {0};
+	uint8_t cell_ind[RTCM_MSM_MAX_CELLS] = {0};
+	size_t nsat = 0, nsig = 0, ncell = 0;
+	for(const msm_meas &m : list)
+	{
+		if(m.sat >= first_sat && m.sat < last_sat)
+		{
+			sat_ind[m.sat] = 1;
+			sig_ind[m.sig] = 1;
+		}
+	}
+	for(size_t i = 0; i < RTCM_MSM_MAX_SATS; i++)
+	{
+		if(sat_ind[i])
+		{
+			sat_ind[i] = ++nsat;
+		}
+	}
+	for(size_t i = 0; i < RTCM_MSM_MAX_SIGS; i++)
+	{
+		if(sig_ind[i])
+		{
+			sig_ind[i] = ++nsig;
+		}
+	}
+	if(nsat == 0 || nsat * nsig > RTCM_MSM_MAX_CELLS)
+	{
+		return 0;
+	}
+	const msm_meas *cell_meas[RTCM_MSM_MAX_CELLS];
+	for(const msm_meas &m : list)
+	{
+		if(m.sat >= first_sat && m.sat < last_sat)
+		{
+			cell_ind[(sat_ind[m.sat] - 1) * nsig + sig_ind[m.sig] - 1] = 1;
+		}
+	}
+	for(size_t i = 0; i < nsat * nsig; i++)
+	{
+		if(cell_ind[i])
+		{
+			cell_ind[i] = ++ncell;
+		}
+	}
+
+	// Rough range & range rate of each satellite, from its first signal that has them
+	double rrng[RTCM_MSM_MAX_SATS] = {0};
+	double rrate[RTCM_MSM_MAX_SATS] = {0};
+	uint8_t info[RTCM_MSM_MAX_SATS] = {0};
+	for(const msm_meas &m : list)
+	{
+		if(m.sat < first_sat || m.sat >= last_sat)
+		{
+			continue;
+		}
+		size_t k = sat_ind[m.sat] - 1;
+		if(rrng[k] == 0.0 && m.P != 0.0)
+		{
+			rrng[k] = round_i(m.P / RANGE_MS / P2_10) * RANGE_MS * P2_10;
+		}
+		if(rrate[k] == 0.0 && m.D != 0.0)
+		{
+			rrate[k] = round_i(-m.D * CLIGHT / m.freq);
+		}
+		info[k] = m.info;
+	}
+
+	// Fine values of each cell
+	double psrng[RTCM_MSM_MAX_CELLS], phrng[RTCM_MSM_MAX_CELLS], rate[RTCM_MSM_MAX_CELLS];
+	int64_t lock[RTCM_MSM_MAX_CELLS];
+	for(const msm_meas &m : list)
+	{
+		if(m.sat < first_sat || m.sat >= last_sat)
+		{
+			continue;
+		}
+		size_t k = sat_ind[m.sat] - 1;
+		size_t cell = cell_ind[k * nsig + sig_ind[m.sig] - 1] - 1;
+		cell_meas[cell] = &m;
+		psrng[cell] = m.P == 0.0 ? 0.0 : m.P - rrng[k];
+		phrng[cell] = m.L == 0.0 ? 0.0 : m.L * m.lambda - rrng[k];
+		rate[cell] = m.D == 0.0 ? 0.0 : -m.D * m.lambda - rrate[k];
+		// Phase range less the rough range drifts with the code-carrier divergence,
+		// an integer number of cycles is taken out of it to keep it in range.
+		// The offset only changes on a slip, or when it runs out of range anyway.
+		// No phase resets it too, as RTKLIB, but stays invalid rather than -offset.
+		sig_state &st = this->state[m.state];
+		bool slip = m.slip;
+		if(slip || m.L == 0.0 || fabs(phrng[cell] - st.cp_offset) > 1171.0)
+		{
+			st.cp_offset = round_i(phrng[cell] / m.lambda) * m.lambda;
+			slip = true;
+		}
+		if(m.L != 0.0)
+		{
+			phrng[cell] -= st.cp_offset;
+		}
+		if(slip)
+		{
+			st.lock_start = now;
+		}
+		lock[cell] = now - st.lock_start;
+	}
+
+	memset(this->buf, 0, sizeof(this->buf));
+	size_t i = RTCM3_HEADER_SIZE * 8;
+	setbitu(this->buf, i, 12, msm7_types[system]); i += 12;
+	setbitu(this->buf, i, 12, this->station_id); i += 12;
+	setbitu(this->buf, i, 30, epoch); i += 30;
+	setbitu(this->buf, i, 1, more); i += 1;	// multiple message bit
+	// IODS, reserved, clock steering, external clock, smoothing & its interval are all 0
+	i += 3 + 7 + 2 + 2 + 1 + 3;
+	for(size_t j = 0; j < RTCM_MSM_MAX_SATS; j++, i++)
+	{
+		setbitu(this->buf, i, 1, sat_ind[j] != 0);
+	}
+	for(size_t j = 0; j < RTCM_MSM_MAX_SIGS; j++, i++)
+	{
+		setbitu(this->buf, i, 1, sig_ind[j] != 0);
+	}
+	for(size_t j = 0; j < nsat * nsig; j++, i++)
+	{
+		setbitu(this->buf, i, 1, cell_ind[j] != 0);
+	}
+
+	// Satellite data
+	for(size_t j = 0; j < nsat; j++, i += 8)
+	{
+		bool valid = rrng[j] > 0.0 && rrng[j] <= RANGE_MS * 255.0;
+		setbitu(this->buf, i, 8, valid ? round_u(rrng[j] / RANGE_MS / P2_10) >> 10 : 255);
+	}
+	for(size_t j = 0; j < nsat; j++, i += 4)
+	{
+		setbitu(this->buf, i, 4, info[j]);
+	}
+	for(size_t j = 0; j < nsat; j++, i += 10)
+	{
+		bool valid = rrng[j] > 0.0 && rrng[j] <= RANGE_MS * 255.0;
+		setbitu(this->buf, i, 10, valid ? round_u(rrng[j] / RANGE_MS / P2_10) & 0x3FF : 0);
+	}
+	for(size_t j = 0; j < nsat; j++, i += 14)
+	{
+		setbits(this->buf, i, 14, fabs(rrate[j]) > 8191.0 ? -8192 : round_i(rrate[j]));
+	}
+
+	// Signal data
+	for(size_t j = 0; j < ncell; j++, i += 20)
+	{
+		bool valid = psrng[j] != 0.0 && fabs(psrng[j]) <= 292.7;
+		setbits(this->buf, i, 20, valid ? round_i(psrng[j] / RANGE_MS / P2_29) : -524288);
+	}
+	for(size_t j = 0; j < ncell; j++, i += 24)
+	{
+		bool valid = phrng[j] != 0.0 && fabs(phrng[j]) <= 1171.0;
+		setbits(this->buf, i, 24, valid ? round_i(phrng[j] / RANGE_MS / P2_31) : -8388608);
+	}
+	for(size_t j = 0; j < ncell; j++, i += 10)
+	{
+		setbitu(this->buf, i, 10, msm_lock_ex(lock[j]));
+	}
+	for(size_t j = 0; j < ncell; j++, i += 1)
+	{
+		setbitu(this->buf, i, 1, cell_meas[j]->half);
+	}
+	for(size_t j = 0; j < ncell; j++, i += 10)
+	{
+		setbitu(this->buf, i, 10, round_u(cell_meas[j]->cno / 0.0625));
+	}
+	for(size_t j = 0; j < ncell; j++, i += 15)
+	{
+		setbits(this->buf, i, 15, fabs(rate[j]) > 1.6384 ? -16384 : round_i(rate[j] / 0.0001));
+	}
+	return finish(i - RTCM3_HEADER_SIZE * 8, out);
+}
+
+size_t ubx_rtcm_encoder::encode(const ubx_rxm_rawx &rawx, vector<uint8_t> &out)
+{
+	if(!rawx.valid)
+	{
+		return 0;
+	}
+	// Receiver time adjustment (RTKLIB -TADJ), measurements follow the time tag
+	double tow = rawx.rcvTow;
+	double toff = 0;
+	if(this->tadj > 0)
+	{
+		double tn = tow / this->tadj;
+		toff = (tn - floor(tn + 0.5)) * this->tadj;
+		tow -= toff;
+	}
+	int64_t now = (int64_t)rawx.week * WEEK_MS + round_u(tow * 1e3);
+
+	for(auto &list : this->meas)
+	{
+		list.clear();
+	}
+	for(size_t i = 0; i < rawx.numMeas; i++)
+	{
+		int system = msm_system(rawx.gnssId[i]);
+		int fcn = (int)rawx.freqId[i] - 7;
+		uint8_t sig;
+		double freq;
+		if(system < 0 || rawx.svId[i] < 1 || rawx.svId[i] > RTCM_MSM_MAX_SATS ||
+			!msm_signal(system, rawx.sigId[i], fcn, sig, freq))
+		{
+			this->skipped++;
+			continue;
+		}
+		msm_meas m;
+		m.sat = rawx.svId[i] - 1;
+		m.sig = sig - 1;
+		m.info = system == 1 ? fcn + 7 : 0;
+		m.freq = freq;
+		m.lambda = CLIGHT / freq;
+		m.P = rawx.prMes[i] - toff * CLIGHT;
+		m.L = rawx.cpMes[i] - toff * freq;
+		m.D = rawx.doMes[i];
+		m.cno = rawx.cno[i];
+		uint8_t trk = rawx.trkStat[i];
+		if(!(trk & TRK_PR_VALID))
+		{
+			m.P = 0.0;
+		}
+		if(!(trk & TRK_CP_VALID) || rawx.cpMes[i] == -0.5 || rawx.cpStdev[i] > CPSTD_VALID)
+		{
+			m.L = 0.0;
+		}
+		m.half = m.L != 0.0 && !(trk & TRK_HALF_CYC);
+
+		// A slip is the receiver's lock time going back, or a first sighting
+		m.state = (system * RTCM_MSM_MAX_SATS + m.sat) * RTCM_MSM_MAX_SIGS + m.sig;
+		sig_state &st = this->state[m.state];
+		m.slip = !st.seen || rawx.locktime[i] == 0 || rawx.locktime[i] < st.locktime;
+		st.seen = true;
+		st.locktime = rawx.locktime[i];
+		this->meas[system].push_back(m);
+	}
+
+	size_t frames = 0;
+	// Last non-empty system, its last message clears the multiple message bit
+	int last_system = -1;
+	for(size_t s = 0; s < RTCM_MSM_SYSTEMS; s++)
+	{
+		if(!this->meas[s].empty())
+		{
+			last_system = s;
+		}
+	}
+	for(size_t s = 0; s < RTCM_MSM_SYSTEMS; s++)
+	{
+		vector<msm_meas> &list = this->meas[s];
+		if(list.empty())
+		{
+			continue;
+		}
+		std::sort(list.begin(), list.end(), [](const msm_meas &a, const msm_meas &b)
+		{
+			return a.sat != b.sat ? a.sat < b.sat : a.sig < b.sig;
+		});
+		// Epoch time: GLONASS is day of week & time of day in Moscow time, BeiDou is 14 s behind GPS
+		uint32_t epoch;
+		double t = tow;
+		if(s == 1)
+		{
+			int leap = rawx.recStat & 0x01 ? rawx.leapS : 18;
+			t = fmod(tow - leap + 10800.0 + 604800.0, 604800.0);
+			uint32_t dow = (uint32_t)(t / 86400.0);
+			epoch = (dow << 27) + round_u(fmod(t, 86400.0) * 1e3);
+		}
+		else
+		{
+			if(s == 3)
+			{
+				t = fmod(tow - 14.0 + 604800.0, 604800.0);
+			}
+			epoch = round_u(t * 1e3);
+		}
+		// More than 64 cells, split the satellites over several messages
+		uint32_t sigs = 0;
+		for(const msm_meas &m : list)
+		{
+			sigs |= 1u << m.sig;
+		}
+		size_t nsig = __builtin_popcount(sigs);
+		size_t per_msg = RTCM_MSM_MAX_CELLS / nsig;
+		size_t first = 0;
+		while(first < list.size())
+		{
+			size_t end = first;
+			size_t nsat = 0;
+			while(end < list.size() && nsat < per_msg)
+			{
+				uint8_t sat = list[end].sat;
+				while(end < list.size() && list[end].sat == sat)
+				{
+					end++;
+				}
+				nsat++;
+			}
+			size_t last_sat = end < list.size() ? list[end].sat : RTCM_MSM_MAX_SATS;
+			bool more = (int)s != last_system || end < list.size();
+			frames += msm7(s, list, list[first].sat, last_sat, epoch, now, more, out);
+			first = end;
+		}
+	}
+
+	if(this->last_station < 0 || now - this->last_station >= this->station_interval)
+	{
+		frames += encode_1005(out);
+		frames += encode_1230(out);
+		this->last_station = now;
+	}
+	this->epochs++;
+	return frames;
+}
+
+void ubx_rtcm_encoder::dump_stats(FILE *fp)
+{
+	fprintf(fp, "RTCM: %zd epochs, %zd messages, %zd Bytes, %zd measurements skipped\n",
+		this->epochs, this->messages, this->bytes, this->skipped);
+}
+
+} // namespace UBX
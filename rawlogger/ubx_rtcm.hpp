@@ -0,0 +1,102 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "ubx_rxm.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+constexpr uint8_t RTCM3_PREAMBLE = 0xD3;
+// Preamble, 6 reserved bits & 10 bits of length, then the CRC-24Q
+constexpr size_t RTCM3_HEADER_SIZE = 3;
+constexpr size_t RTCM3_CRC_SIZE = 3;
+constexpr size_t RTCM3_MAX_PAYLOAD = 1023;
+constexpr size_t RTCM3_MAX_FRAME = RTCM3_HEADER_SIZE + RTCM3_MAX_PAYLOAD + RTCM3_CRC_SIZE;
+
+// GPS, GLONASS, Galileo & BeiDou, in the order their MSM7 are sent
+constexpr size_t RTCM_MSM_SYSTEMS = 4;
+constexpr size_t RTCM_MSM_MAX_SATS = 64;
+constexpr size_t RTCM_MSM_MAX_SIGS = 32;
+constexpr size_t RTCM_MSM_MAX_CELLS = 64;
+
+// CRC-24Q over len Bytes, as used by RTCM3 & SBAS
+uint32_t rtcm_crc24q(const uint8_t *data, size_t len);
+// Message number of an RTCM3 frame, 0 if it's too short
+uint16_t rtcm_msg_type(const uint8_t *frame, size_t size);
+
+// RTCM3 encoder fed from decoded RXM-RAWX
+// Each epoch gives MSM7 for GPS (1077), GLONASS (1087), Galileo (1097) & BeiDou (1127),
+// then the station ARP (1005) & GLONASS code-phase biases (1230) when they're due.
+// Measurements go through the same conversions as RTKLIB's u-blox decoder &
+// MSM encoder (validity from trkStat, receiver time adjustment, phase offsets,
+// lock time since the last slip), so the output matches str2str's for the same input.
+class ubx_rtcm_encoder
+{
+public:
+	uint16_t station_id;
+	// Antenna reference point, ECEF in m, 1005 is only sent if set
+	bool arp_valid;
+	double arp[3];
+	// Round the receiver time to multiples of this many s & correct the
+	// measurements to match, like str2str -opt -TADJ=, 0 for none
+	double tadj;
+	// ms between 1005 & 1230, 0 for every epoch
+	uint32_t station_interval;
+	// GLONASS code-phase biases in m: L1 C/A, L1 P, L2 C/A, L2 P
+	bool glo_cp_aligned;
+	double glo_cp_bias[4];
+
+	// Statistics
+	size_t epochs;
+	size_t messages;
+	size_t bytes;
+	size_t skipped;	// measurements of signals MSM can't carry
+
+	ubx_rtcm_encoder();
+	// Appends the frames of one epoch to out, returns the number of frames
+	size_t encode(const ubx_rxm_rawx &rawx, vector<uint8_t> &out);
+	size_t encode_1005(vector<uint8_t> &out);
+	size_t encode_1230(vector<uint8_t> &out);
+	void dump_stats(FILE *fp);
+private:
+	// One measurement, converted
+	struct msm_meas
+	{
+		uint8_t sat;	// PRN - 1
+		uint8_t sig;	// MSM signal ID - 1
+		uint8_t info;	// extended satellite info, GLONASS frequency number + 7
+		bool half;	// half-cycle ambiguity
+		bool slip;
+		double P;	// m, 0 if invalid
+		double L;	// cycles, 0 if invalid
+		double D;	// Hz
+		double freq;	// Hz
+		double lambda;	// m
+		double cno;	// dBHz
+		size_t state;	// index in state
+	};
+
+	// Per (system, satellite, signal) state kept between epochs
+	struct sig_state
+	{
+		bool seen;
+		uint16_t locktime;	// from RAWX, a drop means a slip
+		int64_t lock_start;	// ms
+		double cp_offset;	// m, integer cycles taken out of the phase range
+	};
+
+	vector<sig_state> state;	// [(system * MAX_SATS + sat) * MAX_SIGS + sig]
+	vector<msm_meas> meas[RTCM_MSM_SYSTEMS];
+	int64_t last_station;	// ms, -1 if never
+	uint8_t buf[RTCM3_MAX_FRAME];
+
+	size_t msm7(size_t system, const vector<msm_meas> &list, size_t first_sat, size_t last_sat,
+		uint32_t epoch, int64_t now, bool more, vector<uint8_t> &out);
+	size_t finish(size_t bits, vector<uint8_t> &out);
+};
+
+} // namespace UBX
@@ -0,0 +1,94 @@
+#include "ubx.hpp"
+#include "ubx_rxm.hpp"
+
+namespace UBX
+{
+
+ubx_rxm_rawx::ubx_rxm_rawx()
+{
+	clear();
+}
+
+ubx_rxm_rawx::ubx_rxm_rawx(const ubx_frame_view &frame)
+{
+	clear();
+	parse(frame);
+}
+
+// Only the header, the arrays are overwritten by parse() up to numMeas
+void ubx_rxm_rawx::clear()
+{
+	this->valid = false;
+	this->rcvTow = 0;
+	this->week = 0;
+	this->leapS = 0;
+	this->numMeas = 0;
+	this->recStat = 0;
+	this->version = 0;
+}
+
+bool ubx_rxm_rawx::parse(const ubx_frame_view &frame)
+{
+	this->valid = false;
+	if(frame.valid == false)
+	{
+		return false;
+	}
+	if(frame.class_id != UBX_CLASS_RXM || frame.msg_id != UBX_RXM_RAWX)
+	{
+		return false; // ignore non RXM-RAWX frames
+	}
+	if(frame.length < UBX_RXM_RAWX_HEADER_SIZE)
+	{
+		return false;
+	}
+	const uint8_t *payload = frame.payload();
+	uint8_t num = getu1(payload, 11);
+	if(frame.length != UBX_RXM_RAWX_HEADER_SIZE + num * UBX_RXM_RAWX_MEAS_SIZE)
+	{
+		this->numMeas = 0;
+		return false;
+	}
+	this->rcvTow = getr8(payload, 0);
+	this->week = getu2(payload, 8);
+	this->leapS = geti1(payload, 10);
+	this->numMeas = num;
+	this->recStat = getu1(payload, 12);
+	this->version = getu1(payload, 13);
+
+	// Scatter each 32 Byte record into the arrays
+	const uint8_t *meas = payload + UBX_RXM_RAWX_HEADER_SIZE;
+	for(size_t i = 0; i < num; i++, meas += UBX_RXM_RAWX_MEAS_SIZE)
+	{
+		this->prMes[i] = getr8(meas, 0);
+		this->cpMes[i] = getr8(meas, 8);
+		this->doMes[i] = getr4(meas, 16);
+		this->gnssId[i] = meas[20];
+		this->svId[i] = meas[21];
+		this->sigId[i] = meas[22];
+		this->freqId[i] = meas[23];
+		this->locktime[i] = getu2(meas, 24);
+		this->cno[i] = meas[26];
+		this->prStdev[i] = meas[27] & 0x0f;
+		this->cpStdev[i] = meas[28] & 0x0f;
+		this->doStdev[i] = meas[29] & 0x0f;
+		this->trkStat[i] = meas[30];
+	}
+	this->valid = true;
+	return true;
+}
+
+void ubx_rxm_rawx::dump(FILE *fp)
+{
+	fputs("=====================\n", fp);
+	fprintf(fp, "rcvTow: %.3f, week: %u, leapS: %d\n", this->rcvTow, this->week, this->leapS);
+	fprintf(fp, "numMeas: %u, recStat: %u, version: %u\n", this->numMeas, this->recStat, this->version);
+	for(size_t i = 0; i < this->numMeas; i++)
+	{
+		fprintf(fp, "%2u/%3u/%u: pr %.3f, cp %.3f, do %.3f, cno %u, lock %u, trk %x\n",
+			this->gnssId[i], this->svId[i], this->sigId[i], this->prMes[i], this->cpMes[i],
+			this->doMes[i], this->cno[i], this->locktime[i], this->trkStat[i]);
+	}
+}
+
+} // namespace UBX
@@ -0,0 +1,55 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include "ubx_def.hpp"
+
+#pragma once
+
+namespace UBX
+{
+// numMeas is a U1
+constexpr size_t UBX_RXM_RAWX_MAX_MEAS = 255;
+constexpr size_t UBX_RXM_RAWX_HEADER_SIZE = 16;
+constexpr size_t UBX_RXM_RAWX_MEAS_SIZE = 32;
+
+// UBX-RXM-RAWX, measurements stored as a structure of arrays
+// Each field of the measurements is a contiguous array, so a loop over one
+// field (e.g. all cno) only touches that field and can be vectorised.
+// Storage is fixed & reused by each parse(), decoding never allocates.
+// Arrays are valid from 0 to numMeas - 1.
+class ubx_rxm_rawx : public ubx_any_msg
+{
+public:
+	// Header
+	double rcvTow;
+	uint16_t week;
+	int8_t leapS;
+	uint8_t numMeas;
+	uint8_t recStat;
+	uint8_t version;
+	bool valid;
+
+	// Measurements
+	alignas(32) double prMes[UBX_RXM_RAWX_MAX_MEAS];	// m
+	alignas(32) double cpMes[UBX_RXM_RAWX_MAX_MEAS];	// cycles
+	alignas(32) float doMes[UBX_RXM_RAWX_MAX_MEAS];	// Hz
+	alignas(32) uint16_t locktime[UBX_RXM_RAWX_MAX_MEAS];	// ms
+	alignas(32) uint8_t gnssId[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t svId[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t sigId[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t freqId[UBX_RXM_RAWX_MAX_MEAS];	// GLONASS, -7 for real frequency slot number
+	alignas(32) uint8_t cno[UBX_RXM_RAWX_MAX_MEAS];	// dBHz
+	// Standard deviation indices, only the low 4 bits of the X1 fields
+	alignas(32) uint8_t prStdev[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t cpStdev[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t doStdev[UBX_RXM_RAWX_MAX_MEAS];
+	alignas(32) uint8_t trkStat[UBX_RXM_RAWX_MAX_MEAS];
+
+	ubx_rxm_rawx();
+	ubx_rxm_rawx(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
+	void clear();
+	void dump(FILE *fp);
+};
+
+} // namespace UBX
@@ -0,0 +1,334 @@
+#include "ubx.hpp"
+#include "ubx_scan.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace UBX
+{
+
+ubx_scanner::ubx_scanner(int fd, unsigned threads, FILE *dump_fp)
+{
+	if(threads == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	this->fd = fd;
+	this->threads = threads;
+	this->dump_fp = dump_fp;
+	this->data = NULL;
+	this->size = 0;
+	this->next_chunk = 0;
+	this->merged = 0;
+	this->stopping = false;
+	this->bytes = 0;
+	this->frames = 0;
+	this->wasted_bytes = 0;
+	this->bad_checksums = 0;
+	this->chunks = 0;
+	this->merge_frames = 0;
+	this->quiet = false;
+}
+
+ubx_scanner::~ubx_scanner()
+{
+	for(chunk &c : this->chunk_list)
+	{
+		free(c.dump);
+	}
+	if(this->data != NULL)
+	{
+		munmap((void *)this->data, this->size);
+	}
+}
+
+int ubx_scanner::map()
+{
+	struct stat st;
+	if(fstat(this->fd, &st) != 0)
+	{
+		return -1;
+	}
+	if(!S_ISREG(st.st_mode))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	this->size = st.st_size;
+	this->bytes = this->size;
+	if(this->size == 0)
+	{
+		return 0;
+	}
+	void *ptr = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+	if(ptr == MAP_FAILED)
+	{
+		this->size = 0;
+		return -1;
+	}
+	// Each worker reads its chunk front to back
+	madvise(ptr, this->size, MADV_SEQUENTIAL);
+	this->data = (const uint8_t *)ptr;
+	return 0;
+}
+
+// Next frame of an in place parser over the whole file, as ubx_reader frames it.
+// Returns false at EOF, with what's left in eof.
+bool ubx_scanner::next(ubx_parser &parser, scan_frame &f, scan_eof &eof) const
+{
+	size_t wasted = parser.wasted_bytes;
+	size_t bad = parser.bad_checksums;
+	const uint8_t *frame;
+	size_t frame_size;
+	if(!parser.next(&frame, &frame_size))
+	{
+		eof.tail = parser.wasted_bytes - wasted;
+		eof.bad_checksums = parser.bad_checksums - bad;
+		return false;
+	}
+	f.start = frame - this->data;
+	f.end = f.start + frame_size;
+	f.size = frame_size;
+	f.wasted = parser.frame_wasted;
+	f.bad_checksums = parser.bad_checksums - bad;
+	f.dump_offset = 0;
+	f.dump_len = 0;
+	return true;
+}
+
+// Worker: frame & checksum one chunk
+void ubx_scanner::scan(chunk &c)
+{
+	FILE *dump = NULL;
+	if(this->dump_fp != NULL)
+	{
+		dump = open_memstream(&c.dump, &c.dump_size);
+		if(dump == NULL)
+		{
+			perror("ubx_scanner::scan()");
+			abort();
+		}
+	}
+	// The whole file is there, frames cut by its end come out right away
+	ubx_parser parser(this->data, this->size, c.begin);
+	parser.finish();
+	// The last chunk runs to EOF, the others until they're in the next one
+	bool last = c.limit == this->size;
+	size_t pos = c.begin;
+	while(last || pos < c.limit)
+	{
+		scan_frame f;
+		if(!next(parser, f, c.eof_info))
+		{
+			c.eof = true;
+			break;
+		}
+		pos = f.end;
+		if(dump != NULL)
+		{
+			const uint8_t *frame = this->data + f.start;
+			f.dump_offset = ftell(dump);
+			ubx_dump_msg(dump, frame[UBX_CLASS_OFFSET], frame[UBX_MSG_OFFSET],
+				frame + UBX_HEADER_SIZE, f.size - UBX_HEADER_SIZE - UBX_CKSUM_SIZE);
+			f.dump_len = ftell(dump) - f.dump_offset;
+		}
+		c.frames.push_back(f);
+	}
+	c.end = pos;
+	if(dump != NULL)
+	{
+		fclose(dump);
+	}
+}
+
+void ubx_scanner::worker()
+{
+	size_t ahead = this->threads * UBX_SCAN_AHEAD;
+	std::unique_lock<std::mutex> lk(this->lock);
+	while(1)
+	{
+		this->chunk_free.wait(lk, [&]
+		{
+			return this->stopping || this->next_chunk >= this->chunk_list.size() ||
+				this->next_chunk < this->merged + ahead;
+		});
+		if(this->stopping || this->next_chunk >= this->chunk_list.size())
+		{
+			return;
+		}
+		chunk &c = this->chunk_list[this->next_chunk++];
+		lk.unlock();
+		scan(c);
+		lk.lock();
+		c.done = true;
+		this->chunk_done.notify_all();
+	}
+}
+
+int ubx_scanner::emit(const scan_frame &f, const char *dump, callback_t &callback)
+{
+	if(f.wasted > 0)
+	{
+		// Same message as the reader, so the output doesn't change
+		this->wasted_bytes += f.wasted;
+		if(!this->quiet)
+		{
+			fprintf(stderr, "ubx_reader::next_frame(): WASTED %zd Bytes\n", (size_t)f.wasted);
+		}
+	}
+	this->bad_checksums += f.bad_checksums;
+	// The parser checked it
+	ubx_frame_view view(this->data + f.start, f.size, true);
+	if(this->dump_fp != NULL && view.valid)
+	{
+		if(dump != NULL)
+		{
+			fwrite(dump, 1, f.dump_len, this->dump_fp);
+		}
+		else
+		{
+			view.dump_msg(this->dump_fp);
+		}
+	}
+	this->frames++;
+	return callback(view);
+}
+
+void ubx_scanner::emit_eof(const scan_eof &eof)
+{
+	this->wasted_bytes += eof.tail;
+	this->bad_checksums += eof.bad_checksums;
+}
+
+int ubx_scanner::run(callback_t callback)
+{
+	if(this->size == 0)
+	{
+		return 0;
+	}
+	size_t n = (this->size + UBX_SCAN_CHUNK - 1) / UBX_SCAN_CHUNK;
+	this->chunk_list.resize(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		chunk &c = this->chunk_list[i];
+		c.begin = i * UBX_SCAN_CHUNK;
+		c.limit = i + 1 < n ? c.begin + UBX_SCAN_CHUNK : this->size;
+		c.end = c.begin;
+		c.eof = false;
+		c.eof_info.tail = 0;
+		c.eof_info.bad_checksums = 0;
+		c.dump = NULL;
+		c.dump_size = 0;
+		c.done = false;
+	}
+	this->chunks = n;
+
+	vector<std::thread> workers;
+	for(unsigned i = 0; i < this->threads; i++)
+	{
+		workers.emplace_back(&ubx_scanner::worker, this);
+	}
+
+	// Parser state between frames is just the position, so once the merge
+	// stands where a worker started, or where one of its frames ended,
+	// the rest of that worker's frames are what the reader would find too.
+	// The merge's own parser is moved to where it stands when it has to frame a gap.
+	ubx_parser gap(this->data, this->size);
+	gap.finish();
+	size_t gap_pos = 0;
+	size_t pos = 0;
+	bool finished = false;
+	int ret = 0;
+	for(size_t k = 0; k < n && !finished && ret == 0; k++)
+	{
+		chunk &c = this->chunk_list[k];
+		{
+			std::unique_lock<std::mutex> lk(this->lock);
+			this->chunk_done.wait(lk, [&] { return c.done; });
+		}
+		size_t j = 0;
+		while(ret == 0)
+		{
+			size_t from = SIZE_MAX;
+			if(pos == c.begin)
+			{
+				from = 0;
+			}
+			else
+			{
+				while(j < c.frames.size() && c.frames[j].end < pos)
+				{
+					j++;
+				}
+				if(j < c.frames.size() && c.frames[j].end == pos)
+				{
+					from = j + 1;
+				}
+			}
+			if(from != SIZE_MAX)
+			{
+				for(size_t i = from; i < c.frames.size() && ret == 0; i++)
+				{
+					ret = emit(c.frames[i], c.dump != NULL ? c.dump + c.frames[i].dump_offset : NULL, callback);
+				}
+				pos = c.end;
+				if(c.eof && ret == 0)
+				{
+					emit_eof(c.eof_info);
+					finished = true;
+				}
+				break;
+			}
+			if(k + 1 < n && pos >= c.limit)
+			{
+				break;
+			}
+			// Frame the gap up to where the worker's frames meet it
+			if(gap_pos != pos)
+			{
+				gap.reset(pos);
+				gap.finish();
+			}
+			scan_frame f;
+			scan_eof eof;
+			if(!next(gap, f, eof))
+			{
+				emit_eof(eof);
+				finished = true;
+				break;
+			}
+			pos = gap_pos = f.end;
+			this->merge_frames++;
+			ret = emit(f, NULL, callback);
+		}
+
+		std::lock_guard<std::mutex> lk(this->lock);
+		free(c.dump);
+		c.dump = NULL;
+		vector<scan_frame>().swap(c.frames);
+		this->merged = k + 1;
+		this->chunk_free.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(this->lock);
+		this->stopping = true;
+		this->chunk_free.notify_all();
+	}
+	for(std::thread &t : workers)
+	{
+		t.join();
+	}
+	return ret;
+}
+
+void ubx_scanner::dump_stats(FILE *fp)
+{
+	fprintf(fp, "Scanned %zd Bytes in %zd chunks with %u threads, %zd frames, %zd wasted Bytes, %zd bad checksums\n",
+		this->bytes, this->chunks, this->threads, this->frames, this->wasted_bytes, this->bad_checksums);
+	fprintf(fp, "%zd frames found by the merge between chunks\n", this->merge_frames);
+}
+
+} // namespace UBX
@@ -0,0 +1,111 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "ubx_def.hpp"
+#include "ubx_parser.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// Chunk handed to each worker, large enough that the resync at its start
+// and the overlap at its end are negligible
+constexpr size_t UBX_SCAN_CHUNK = 4 * 1024 * 1024;
+// Chunks scanned ahead of the merge, per thread, bounds the memory used
+constexpr size_t UBX_SCAN_AHEAD = 2;
+
+// Parallel scanner for archived files
+// The file is mmap()ed and cut into chunks. Each worker frames its chunk with
+// a ubx_parser started at the chunk's first Byte, as if a frame ended there,
+// running past the chunk end until it's past the next chunk's start.
+// The calling thread merges the chunks in order: where the previous chunk's
+// frames don't meet the next chunk's, it frames the gap itself, so frames,
+// wasted Bytes & messages come out exactly as ubx_reader would give them.
+class ubx_scanner
+{
+public:
+	// Statistics
+	size_t bytes;
+	size_t frames;
+	size_t wasted_bytes;
+	size_t bad_checksums;
+	size_t chunks;
+	size_t merge_frames;	// frames the merge had to find itself
+	// Don't report wasted Bytes on stderr
+	bool quiet;
+
+	// Returns 0 to go on, anything else stops the scan
+	typedef std::function<int(const ubx_frame_view &frame)> callback_t;
+
+	// threads == 0: one per CPU
+	// With dump_fp, valid frames are dump_msg()ed there (rendered by the workers)
+	// just before they're handed to the callback.
+	ubx_scanner(int fd, unsigned threads = 0, FILE *dump_fp = NULL);
+	~ubx_scanner();
+	// Returns -1 with errno set if fd can't be mapped
+	int map();
+	// Returns the callback's value if it stopped the scan, 0 otherwise
+	int run(callback_t callback);
+	void dump_stats(FILE *fp);
+private:
+	struct scan_frame
+	{
+		uint64_t start;	// frame without sync chars
+		uint64_t end;	// position after it
+		uint32_t size;
+		uint32_t wasted;	// Bytes skipped before it
+		uint32_t bad_checksums;	// candidates that failed before it
+		uint32_t dump_offset;
+		uint32_t dump_len;
+	};
+	struct scan_eof
+	{
+		size_t tail;	// left over at the end
+		size_t bad_checksums;
+	};
+	struct chunk
+	{
+		size_t begin;	// nominal range
+		size_t limit;
+		size_t end;	// position after the last frame
+		bool eof;
+		scan_eof eof_info;
+		vector<scan_frame> frames;
+		char *dump;
+		size_t dump_size;
+		bool done;
+	};
+
+	int fd;
+	unsigned threads;
+	FILE *dump_fp;
+	const uint8_t *data;
+	size_t size;
+	vector<chunk> chunk_list;
+
+	std::mutex lock;
+	std::condition_variable chunk_done;
+	std::condition_variable chunk_free;
+	size_t next_chunk;	// next one for the workers
+	size_t merged;		// chunks the merge is done with
+	bool stopping;
+
+	bool next(ubx_parser &parser, scan_frame &f, scan_eof &eof) const;
+	void scan(chunk &c);
+	void worker();
+	int emit(const scan_frame &f, const char *dump, callback_t &callback);
+	void emit_eof(const scan_eof &eof);
+
+	ubx_scanner(const ubx_scanner &) = delete;
+	ubx_scanner &operator=(const ubx_scanner &) = delete;
+};
+
+} // namespace UBX
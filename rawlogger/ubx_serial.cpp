@@ -0,0 +1,179 @@
+#include "ubx_serial.hpp"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+namespace UBX
+{
+
+speed_t ubx_serial_speed(unsigned int baud)
+{
+	switch(baud)
+	{
+	case 4800:
+		return B4800;
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	default:
+		return B0;
+	}
+}
+
+ubx_serial::ubx_serial()
+{
+	this->fd = -1;
+	memset(&this->saved_termios, 0, sizeof(this->saved_termios));
+	memset(&this->base, 0, sizeof(this->base));
+	memset(&this->last, 0, sizeof(this->last));
+}
+
+ubx_serial::~ubx_serial()
+{
+	close();
+}
+
+// Returns -1 with errno set on error
+int ubx_serial::open(const char *path, unsigned int baud)
+{
+	speed_t speed = ubx_serial_speed(baud);
+	if(speed == B0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	close();
+	this->fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if(this->fd < 0)
+	{
+		return -1;
+	}
+
+	struct termios tio;
+	if(tcgetattr(this->fd, &tio) != 0)
+	{
+		goto error;
+	}
+	this->saved_termios = tio;
+	// 8N1, no flow control, no line discipline processing at all
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+	// Return as soon as anything arrives, epoll does the waiting
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if(cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0)
+	{
+		goto error;
+	}
+	if(tcsetattr(this->fd, TCSANOW, &tio) != 0)
+	{
+		goto error;
+	}
+	tcflush(this->fd, TCIFLUSH);
+
+	// Ask the driver to push received bytes to the tty layer right away,
+	// not every driver supports it (PL011 mostly ignores it), so it's not fatal
+	struct serial_struct ss;
+	if(ioctl(this->fd, TIOCGSERIAL, &ss) == 0)
+	{
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if(ioctl(this->fd, TIOCSSERIAL, &ss) != 0)
+		{
+			fprintf(stderr, "ubx_serial::open(): %s: can't set low latency: %s\n", path, strerror(errno));
+		}
+	}
+
+	if(get_counters(this->base) != 0)
+	{
+		memset(&this->base, 0, sizeof(this->base));
+	}
+	this->last = this->base;
+	return 0;
+error:
+	int saved_errno = errno;
+	::close(this->fd);
+	this->fd = -1;
+	errno = saved_errno;
+	return -1;
+}
+
+void ubx_serial::close()
+{
+	if(this->fd < 0)
+	{
+		return;
+	}
+	tcsetattr(this->fd, TCSANOW, &this->saved_termios);
+	::close(this->fd);
+	this->fd = -1;
+}
+
+int ubx_serial::get_counters(struct serial_icounter_struct &counters)
+{
+	if(this->fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+	return ioctl(this->fd, TIOCGICOUNT, &counters);
+}
+
+bool ubx_serial::check_errors(FILE *fp, struct serial_icounter_struct &delta)
+{
+	memset(&delta, 0, sizeof(delta));
+	struct serial_icounter_struct now;
+	if(get_counters(now) != 0)
+	{
+		return false;
+	}
+	delta.overrun = now.overrun - this->last.overrun;
+	delta.buf_overrun = now.buf_overrun - this->last.buf_overrun;
+	delta.frame = now.frame - this->last.frame;
+	delta.parity = now.parity - this->last.parity;
+	delta.brk = now.brk - this->last.brk;
+	this->last = now;
+	bool overrun = delta.overrun != 0 || delta.buf_overrun != 0;
+	bool line = delta.frame != 0 || delta.parity != 0 || delta.brk != 0;
+	if(fp != NULL && overrun)
+	{
+		fprintf(fp, "\nSerial overrun! UART: +%d, tty buffer: +%d\n", delta.overrun, delta.buf_overrun);
+	}
+	if(fp != NULL && line)
+	{
+		fprintf(fp, "\nSerial line errors! framing: +%d, parity: +%d, break: +%d\n",
+			delta.frame, delta.parity, delta.brk);
+	}
+	return overrun || line;
+}
+
+void ubx_serial::dump_stats(FILE *fp)
+{
+	struct serial_icounter_struct now;
+	if(get_counters(now) != 0)
+	{
+		return;
+	}
+	fprintf(fp, "Serial: %d Bytes received, overruns: UART %d, tty buffer %d, framing errors: %d, parity errors: %d\n",
+		now.rx - this->base.rx,
+		now.overrun - this->base.overrun, now.buf_overrun - this->base.buf_overrun,
+		now.frame - this->base.frame, now.parity - this->base.parity);
+}
+
+} // namespace UBX
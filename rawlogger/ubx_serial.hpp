@@ -0,0 +1,42 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <termios.h>
+#include <linux/serial.h>
+
+#pragma once
+
+namespace UBX
+{
+constexpr unsigned int UBX_SERIAL_DEFAULT_BAUD = 921600;
+
+// Direct serial port input, instead of going through gpspipe / str2str
+// The port is put in raw mode, non-blocking, so ubx_reader waits on it with epoll.
+class ubx_serial
+{
+public:
+	int fd;
+
+	ubx_serial();
+	~ubx_serial();
+	int open(const char *path, unsigned int baud);
+	void close();
+	// Kernel side error counters since open(), returns -1 if the driver doesn't support it
+	int get_counters(struct serial_icounter_struct &counters);
+	// How much the counters went up since the last call into delta, printed
+	// on fp unless it's NULL, returns true if any error counter did
+	bool check_errors(FILE *fp, struct serial_icounter_struct &delta);
+	void dump_stats(FILE *fp);
+private:
+	struct termios saved_termios;
+	struct serial_icounter_struct base;
+	struct serial_icounter_struct last;
+
+	ubx_serial(const ubx_serial &) = delete;
+	ubx_serial &operator=(const ubx_serial &) = delete;
+};
+
+// Returns B0 for unsupported rates
+speed_t ubx_serial_speed(unsigned int baud);
+
+} // namespace UBX
@@ -0,0 +1,566 @@
+#include "ubx.hpp"
+#include "ubx_server.hpp"
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+namespace UBX
+{
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void add(std::atomic<size_t> &counter, size_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// The input ring drops the rest of an epoch rather than ever blocking the logger
+ubx_server::ubx_server(size_t client_buf, uint32_t max_lag_ms, size_t ring_size)
+	: ring(ring_size, UBX_RING_DROP_EPOCH)
+{
+	this->accepted = 0;
+	this->clients = 0;
+	this->kicked = 0;
+	this->frames_sent = 0;
+	this->frames_dropped = 0;
+	this->bytes_sent = 0;
+	size_t size = 1;
+	while(size < client_buf)
+	{
+		size <<= 1;
+	}
+	this->client_buf = size;
+	this->max_lag_ms = max_lag_ms;
+	this->all_classes = true;
+	this->bound_port = 0;
+	this->listen_fd = -1;
+	this->epfd = -1;
+}
+
+ubx_server::~ubx_server()
+{
+	stop();
+	if(this->listen_fd >= 0)
+	{
+		close(this->listen_fd);
+	}
+	if(this->epfd >= 0)
+	{
+		close(this->epfd);
+	}
+}
+
+bool ubx_parse_classes(const string &list, std::bitset<256> &classes)
+{
+	size_t pos = 0;
+	while(pos <= list.size())
+	{
+		size_t comma = list.find(',', pos);
+		string name = list.substr(pos, comma == string::npos ? string::npos : comma - pos);
+		pos = comma == string::npos ? list.size() + 1 : comma + 1;
+		int class_id = -1;
+		for(int i = 0; i < 256 && class_id < 0; i++)
+		{
+			const char *known = ubx_class_name(i);
+			if(known != NULL && strcasecmp(known, name.c_str()) == 0)
+			{
+				class_id = i;
+			}
+		}
+		if(class_id < 0)
+		{
+			char *end;
+			unsigned long n = strtoul(name.c_str(), &end, 0);
+			if(name.empty() || *end != '\0' || n > 255)
+			{
+				return false;
+			}
+			class_id = n;
+		}
+		classes.set(class_id);
+	}
+	return true;
+}
+
+bool ubx_parse_address(const string &addr, string &host, string &service)
+{
+	// [v6 address]:port, host:port or port
+	size_t colon = addr.rfind(':');
+	if(colon == string::npos)
+	{
+		host.clear();
+		service = addr;
+	}
+	else
+	{
+		host = addr.substr(0, colon);
+		service = addr.substr(colon + 1);
+		if(host.size() >= 2 && host.front() == '[' && host.back() == ']')
+		{
+			host = host.substr(1, host.size() - 2);
+		}
+	}
+	return !service.empty();
+}
+
+int ubx_listen_tcp(const string &host, const string &service, uint16_t &port)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int ret = getaddrinfo(host.empty() ? NULL : host.c_str(), service.c_str(), &hints, &res);
+	if(ret != 0)
+	{
+		fprintf(stderr, "%s:%s: %s\n", host.c_str(), service.c_str(), gai_strerror(ret));
+		errno = EINVAL;
+		return -1;
+	}
+	// IPv6 first, it takes IPv4 too
+	int listen_fd = -1;
+	int saved_errno = 0;
+	for(int family : {AF_INET6, AF_INET})
+	{
+		for(struct addrinfo *ai = res; ai != NULL && listen_fd < 0; ai = ai->ai_next)
+		{
+			if(ai->ai_family != family)
+			{
+				continue;
+			}
+			int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+			if(fd < 0)
+			{
+				saved_errno = errno;
+				continue;
+			}
+			int on = 1, off = 0;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if(family == AF_INET6)
+			{
+				setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+			}
+			if(bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0)
+			{
+				saved_errno = errno;
+				close(fd);
+				continue;
+			}
+			listen_fd = fd;
+		}
+	}
+	freeaddrinfo(res);
+	if(listen_fd < 0)
+	{
+		errno = saved_errno;
+		return -1;
+	}
+
+	struct sockaddr_storage sa;
+	socklen_t len = sizeof(sa);
+	port = 0;
+	if(getsockname(listen_fd, (struct sockaddr *)&sa, &len) == 0)
+	{
+		port = ntohs(sa.ss_family == AF_INET6 ?
+			((struct sockaddr_in6 *)&sa)->sin6_port : ((struct sockaddr_in *)&sa)->sin_port);
+	}
+	return listen_fd;
+}
+
+string ubx_peer_name(const struct sockaddr_storage &sa, socklen_t len)
+{
+	char host[INET6_ADDRSTRLEN + 8] = "?";
+	char port[8] = "";
+	getnameinfo((const struct sockaddr *)&sa, len, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+	return string(host) + ":" + port;
+}
+
+bool ubx_server::parse(const char *spec)
+{
+	string s = spec;
+	size_t slash = s.find('/');
+	if(slash != string::npos)
+	{
+		this->all_classes = false;
+		if(!ubx_parse_classes(s.substr(slash + 1), this->classes))
+		{
+			return false;
+		}
+	}
+	return ubx_parse_address(s.substr(0, slash), this->host, this->service);
+}
+
+void ubx_server::select_class(uint8_t class_id)
+{
+	this->all_classes = false;
+	this->classes.set(class_id);
+}
+
+int ubx_server::listen()
+{
+	this->listen_fd = ubx_listen_tcp(this->host, this->service, this->bound_port);
+	if(this->listen_fd < 0)
+	{
+		return -1;
+	}
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(this->epfd < 0)
+	{
+		return -1;
+	}
+	// data.ptr is the client, or one of these two for the listening socket & the ring
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &this->listen_fd;
+	if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->listen_fd, &ev) != 0)
+	{
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &this->ring;
+	if(epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->ring.pop_event_fd(), &ev) != 0)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+void ubx_server::start()
+{
+	this->thread = std::thread(&ubx_server::run, this);
+}
+
+void ubx_server::stop()
+{
+	if(this->thread.joinable())
+	{
+		this->ring.push_stop();
+		this->thread.join();
+	}
+}
+
+void ubx_server::push(const ubx_frame_view &frame)
+{
+	if(this->all_classes || this->classes.test(frame.class_id))
+	{
+		this->ring.push_frame(frame);
+	}
+}
+
+void ubx_server::push_epoch_end()
+{
+	ubx_epoch_info info;
+	memset(&info, 0, sizeof(info));
+	this->ring.push_epoch_end(info);
+}
+
+void ubx_server::accept_clients()
+{
+	while(1)
+	{
+		struct sockaddr_storage sa;
+		socklen_t len = sizeof(sa);
+		int fd = accept4(this->listen_fd, (struct sockaddr *)&sa, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0)
+		{
+			if(errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+			{
+				perror("ubx_server::accept_clients()");
+			}
+			if(errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			return;
+		}
+		// Frames go out as soon as they're in
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		// Or the kernel queues megabytes for a stalled client before its lag shows
+		int sndbuf = this->client_buf;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+		client *c = new client();
+		c->fd = fd;
+		c->peer = ubx_peer_name(sa, len);
+		c->size = this->client_buf;
+		c->buf = (uint8_t *)malloc(c->size);
+		c->head = c->tail = 0;
+		c->caught_up = c->connected = now_ms();
+		c->max_queued = 0;
+		c->max_lag = 0;
+		c->frames_sent = c->frames_dropped = 0;
+		c->writable = true;
+
+		// Edge triggered: EPOLLOUT only comes after write() said EAGAIN
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if(c->buf == NULL || epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			perror("ubx_server::accept_clients()");
+			close(fd);
+			free(c->buf);
+			delete c;
+			continue;
+		}
+		this->client_list.push_back(c);
+		add(this->accepted, 1);
+		add(this->clients, 1);
+	}
+}
+
+void ubx_server::fan_out(const uint8_t *frame, size_t size)
+{
+	static const uint8_t sync[2] = {UBX_SYNC1, UBX_SYNC2};
+	size_t need = sizeof(sync) + size;
+	for(client *c : this->client_list)
+	{
+		if(c->fd < 0)
+		{
+			continue;
+		}
+		size_t queued = c->head - c->tail;
+		if(queued + need > c->size)
+		{
+			c->frames_dropped++;
+			add(this->frames_dropped, 1);
+			continue;
+		}
+		if(queued == 0)
+		{
+			c->caught_up = now_ms();
+		}
+		const uint8_t *parts[2] = {sync, frame};
+		size_t lens[2] = {sizeof(sync), size};
+		for(int i = 0; i < 2; i++)
+		{
+			size_t offset = c->head & (c->size - 1);
+			size_t first = std::min(lens[i], c->size - offset);
+			memcpy(c->buf + offset, parts[i], first);
+			memcpy(c->buf, parts[i] + first, lens[i] - first);
+			c->head += lens[i];
+		}
+		c->frames_sent++;
+		add(this->frames_sent, 1);
+		c->max_queued = std::max(c->max_queued, queued + need);
+	}
+}
+
+bool ubx_server::flush(client *c, uint64_t now)
+{
+	size_t sent = 0;
+	while(c->writable && c->head != c->tail)
+	{
+		size_t queued = c->head - c->tail;
+		size_t offset = c->tail & (c->size - 1);
+		struct iovec iov[2];
+		iov[0].iov_base = c->buf + offset;
+		iov[0].iov_len = std::min(queued, c->size - offset);
+		iov[1].iov_base = c->buf;
+		iov[1].iov_len = queued - iov[0].iov_len;
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov[1].iov_len != 0 ? 2 : 1;
+		ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(errno == EAGAIN)
+			{
+				c->writable = false;
+				break;
+			}
+			drop_client(c, strerror(errno));
+			return false;
+		}
+		c->tail += n;
+		sent += n;
+	}
+	add(this->bytes_sent, sent);
+	if(c->head == c->tail)
+	{
+		c->caught_up = now;
+		return true;
+	}
+	uint32_t lag = now - c->caught_up;
+	c->max_lag = std::max(c->max_lag, lag);
+	if(lag > this->max_lag_ms)
+	{
+		add(this->kicked, 1);
+		drop_client(c, "lagging");
+		return false;
+	}
+	return true;
+}
+
+void ubx_server::print_client(FILE *fp, const client *c, uint64_t now, const char *why)
+{
+	fprintf(fp, "Client %s: %zd frames sent, %zd dropped, %zd Bytes queued (max %zd), lag %llu ms (max %u), %llu s (%s)\n",
+		c->peer.c_str(), c->frames_sent, c->frames_dropped, (size_t)(c->head - c->tail), c->max_queued,
+		(unsigned long long)(c->head == c->tail ? 0 : now - c->caught_up), c->max_lag,
+		(unsigned long long)(now - c->connected) / 1000, why);
+}
+
+// The client is only marked, it's freed at the end of the event loop round
+void ubx_server::drop_client(client *c, const char *why)
+{
+	if(c->fd < 0)
+	{
+		return;
+	}
+	print_client(stderr, c, now_ms(), why);
+	epoll_ctl(this->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	add(this->clients, -1);
+}
+
+void ubx_server::run()
+{
+	struct epoll_event events[UBX_SERVER_MAX_EVENTS];
+	bool stopping = false;
+	while(!stopping)
+	{
+		// Frames in, a batch at a time so the clients' buffers get written out in between
+		const ubx_ring_record *rec = NULL;
+		for(int i = 0; i < 256 && (rec = this->ring.try_pop()) != NULL; i++)
+		{
+			if(rec->type == UBX_RING_FRAME)
+			{
+				fan_out(rec->data(), rec->size);
+			}
+			else if(rec->type == UBX_RING_STOP)
+			{
+				stopping = true;
+			}
+			this->ring.pop_release(rec);
+			if(stopping)
+			{
+				break;
+			}
+		}
+		uint64_t now = now_ms();
+		for(client *c : this->client_list)
+		{
+			if(c->fd >= 0)
+			{
+				flush(c, now);
+			}
+		}
+
+		// Sleep only if the ring is empty, wake up now and then to check lags
+		int timeout = 0;
+		if(!stopping && rec == NULL && this->ring.pop_prepare_wait())
+		{
+			timeout = 1000;
+		}
+		int n = epoll_wait(this->epfd, events, UBX_SERVER_MAX_EVENTS, timeout);
+		if(timeout != 0)
+		{
+			this->ring.pop_end_wait();
+		}
+		if(n < 0 && errno != EINTR)
+		{
+			perror("ubx_server::run()");
+			break;
+		}
+		now = now_ms();
+		for(int i = 0; i < n; i++)
+		{
+			void *ptr = events[i].data.ptr;
+			if(ptr == &this->listen_fd)
+			{
+				accept_clients();
+				continue;
+			}
+			if(ptr == &this->ring)
+			{
+				this->ring.pop_event();
+				continue;
+			}
+			client *c = (client *)ptr;
+			if(c->fd < 0)
+			{
+				continue;
+			}
+			if(events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+			{
+				drop_client(c, "closed");
+				continue;
+			}
+			if(events[i].events & EPOLLIN)
+			{
+				// Nothing is expected from clients, throw it away
+				char junk[512];
+				ssize_t len;
+				while((len = read(c->fd, junk, sizeof(junk))) > 0)
+				{
+				}
+				if(len == 0)
+				{
+					drop_client(c, "closed");
+					continue;
+				}
+			}
+			if(events[i].events & EPOLLOUT)
+			{
+				c->writable = true;
+				flush(c, now);
+			}
+		}
+
+		auto dead = std::remove_if(this->client_list.begin(), this->client_list.end(), [](client *c)
+		{
+			if(c->fd >= 0)
+			{
+				return false;
+			}
+			free(c->buf);
+			delete c;
+			return true;
+		});
+		this->client_list.erase(dead, this->client_list.end());
+	}
+
+	uint64_t now = now_ms();
+	for(client *c : this->client_list)
+	{
+		if(c->fd >= 0)
+		{
+			print_client(stderr, c, now, "server stopped");
+			close(c->fd);
+		}
+		free(c->buf);
+		delete c;
+	}
+	this->client_list.clear();
+	this->clients = 0;
+}
+
+void ubx_server::dump_stats(FILE *fp)
+{
+	fprintf(fp, "Server port %u: %zd clients accepted, %zd connected, %zd disconnected for lagging\n",
+		this->bound_port, this->accepted.load(), this->clients.load(), this->kicked.load());
+	fprintf(fp, "Server port %u: %zd frames sent, %zd dropped for slow clients, %zd Bytes\n",
+		this->bound_port, this->frames_sent.load(), this->frames_dropped.load(), this->bytes_sent.load());
+	this->ring.dump_stats(fp);
+}
+
+} // namespace UBX
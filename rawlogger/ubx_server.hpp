@@ -0,0 +1,130 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <bitset>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include "ubx_def.hpp"
+#include "ubx_ring.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+using std::string;
+
+// Input ring, from the logger to the server thread
+constexpr size_t UBX_SERVER_RING_SIZE = 1024 * 1024;
+// Per client, several epochs of everything a F9P sends at 1 Hz
+constexpr size_t UBX_SERVER_CLIENT_BUF = 256 * 1024;
+// A client that hasn't caught up for this long is disconnected
+constexpr uint32_t UBX_SERVER_MAX_LAG_MS = 10000;
+constexpr int UBX_SERVER_MAX_EVENTS = 64;
+
+// "CLASS,CLASS...", by name (NAV, RXM...) or number, sets them in classes
+bool ubx_parse_classes(const string &list, std::bitset<256> &classes);
+// "[host:]port", host may be a [v6 address]
+bool ubx_parse_address(const string &addr, string &host, string &service);
+// Non-blocking listening socket, dual stack if host is empty, port is the bound one.
+// Returns -1 with errno set on error.
+int ubx_listen_tcp(const string &host, const string &service, uint16_t &port);
+// "address:port" of a peer
+string ubx_peer_name(const struct sockaddr_storage &sa, socklen_t len);
+
+// TCP fan-out server for the UBX stream, like str2str's tcpsvr://
+// push() is called by the logger: frames of the selected classes are copied
+// once into a ring and never wait on the network. The server thread copies
+// each one into every client's own bounded buffer, and writes them out
+// non-blocking from an edge-triggered epoll loop.
+// A frame that doesn't fit in a client's buffer is dropped for that client
+// only, so clients always get whole frames. A client that has not caught up
+// (emptied its buffer) for max_lag_ms is disconnected.
+class ubx_server
+{
+public:
+	// Statistics, totals over all clients
+	std::atomic<size_t> accepted;
+	std::atomic<size_t> clients;	// connected now
+	std::atomic<size_t> kicked;	// disconnected for lagging
+	std::atomic<size_t> frames_sent;
+	std::atomic<size_t> frames_dropped;
+	std::atomic<size_t> bytes_sent;
+
+	// Frames are sent with their sync chars
+	ubx_server(size_t client_buf = UBX_SERVER_CLIENT_BUF, uint32_t max_lag_ms = UBX_SERVER_MAX_LAG_MS,
+		size_t ring_size = UBX_SERVER_RING_SIZE);
+	~ubx_server();
+	// "[host:]port[/CLASS,CLASS...]", classes by name (NAV, RXM...) or number,
+	// all of them if none are given. Returns false if it can't be parsed.
+	bool parse(const char *spec);
+	// Only frames of these classes are sent
+	void select_class(uint8_t class_id);
+	// Returns -1 with errno set on error
+	int listen();
+	// Bound port, after listen()
+	uint16_t port() const
+	{
+		return this->bound_port;
+	}
+	void start();
+	void stop();
+	// Logger side, never blocks on clients
+	void push(const ubx_frame_view &frame);
+	void push_epoch_end();
+	// Bytes in the ring, not yet taken by the server thread
+	size_t queued() const
+	{
+		return this->ring.used();
+	}
+	// Per client lines are printed by the server thread when they leave,
+	// and for the ones still connected by stop()
+	void dump_stats(FILE *fp);
+private:
+	struct client
+	{
+		int fd;
+		string peer;
+		uint8_t *buf;	// power of 2 sized byte ring
+		size_t size;
+		uint64_t head;	// Bytes queued so far
+		uint64_t tail;	// Bytes written so far
+		uint64_t caught_up;	// ms, the last time the buffer was empty
+		size_t max_queued;
+		uint32_t max_lag;	// ms
+		size_t frames_sent;
+		size_t frames_dropped;
+		uint64_t connected;	// ms
+		bool writable;	// until write() says EAGAIN
+	};
+
+	string host;
+	string service;
+	std::bitset<256> classes;
+	bool all_classes;
+	size_t client_buf;
+	uint32_t max_lag_ms;
+	uint16_t bound_port;
+	int listen_fd;
+	int epfd;
+	ubx_ring ring;
+	std::thread thread;
+	vector<client *> client_list;
+
+	void run();
+	void accept_clients();
+	void fan_out(const uint8_t *frame, size_t size);
+	// Returns false if the client is gone
+	bool flush(client *c, uint64_t now);
+	void drop_client(client *c, const char *why);
+	void print_client(FILE *fp, const client *c, uint64_t now, const char *why);
+
+	ubx_server(const ubx_server &) = delete;
+	ubx_server &operator=(const ubx_server &) = delete;
+};
+
+} // namespace UBX
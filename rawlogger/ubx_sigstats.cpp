@@ -0,0 +1,219 @@
+#include "ubx.hpp"
+#include "ubx_sigstats.hpp"
+#include <algorithm>
+
+namespace UBX
+{
+
+constexpr uint64_t WEEK_MS = 7 * 24 * 3600 * 1000ULL;
+
+ubx_sig_stats::ubx_sig_stats(const vector<uint32_t> &windows, size_t capacity)
+{
+	this->dropped = 0;
+	this->window_len = windows;
+	for(uint32_t &len : this->window_len)
+	{
+		if(len == 0)
+		{
+			len = 1;
+		}
+	}
+	// slots are stored + 1 in 16 bits
+	this->capacity = capacity < 65535 ? capacity : 65535;
+	this->slot_of.assign(UBX_SIG_KEYS, 0);
+	this->keys.reserve(this->capacity);
+	this->last_itow = 0;
+	this->weeks = 0;
+	this->current.assign(this->window_len.size(), 0);
+	this->new_window.assign(this->window_len.size(), 0);
+
+	size_t n = this->window_len.size() * 2 * this->capacity;
+	this->stamp.assign(n, 0);
+	this->count.assign(n, 0);
+	this->cno_sum.assign(n, 0);
+	this->cno_min.assign(n, 0);
+	this->cno_max.assign(n, 0);
+	this->pr_count.assign(n, 0);
+	this->pr_sum.assign(n, 0);
+	this->pr_min.assign(n, 0);
+	this->pr_max.assign(n, 0);
+}
+
+// SIZE_MAX if it's out of range or there's no room
+size_t ubx_sig_stats::slot(const struct _ubx_nav_sig_data &sig)
+{
+	if(sig.gnssId >= 8 || sig.sigId >= 16)
+	{
+		return SIZE_MAX;
+	}
+	uint16_t key = sig.gnssId << 12 | sig.svId << 4 | sig.sigId;
+	uint16_t s = this->slot_of[key];
+	if(s != 0)
+	{
+		return s - 1;
+	}
+	if(this->keys.size() >= this->capacity)
+	{
+		this->dropped++;
+		return SIZE_MAX;
+	}
+	this->keys.push_back(key);
+	this->slot_of[key] = this->keys.size();
+	return this->keys.size() - 1;
+}
+
+void ubx_sig_stats::update(const ubx_nav_sig &sig)
+{
+	if(!sig.valid)
+	{
+		return;
+	}
+	// iTOW going back by more than half a week is the week rollover
+	if(sig.iTOW + WEEK_MS / 2 < this->last_itow)
+	{
+		this->weeks++;
+	}
+	this->last_itow = sig.iTOW;
+	uint64_t t = this->weeks * WEEK_MS + sig.iTOW;
+
+	for(size_t w = 0; w < this->window_len.size(); w++)
+	{
+		uint64_t id = t / this->window_len[w];
+		this->new_window[w] = id != this->current[w];
+		this->current[w] = id;
+	}
+
+	for(size_t i = 0; i < sig.numSigs; i++)
+	{
+		const struct _ubx_nav_sig_data &d = sig.data[i];
+		size_t s = slot(d);
+		if(s == SIZE_MAX)
+		{
+			continue;
+		}
+		uint8_t cno = d.cno;
+		int16_t prRes = d.prRes;
+		bool pr_used = d.sigFlags & UBX_NAV_SIG_PR_USED;
+		for(size_t w = 0; w < this->window_len.size(); w++)
+		{
+			uint64_t id = this->current[w];
+			size_t k = (w * 2 + (id & 1)) * this->capacity + s;
+			if(this->stamp[k] != id + 1)
+			{
+				this->stamp[k] = id + 1;
+				this->count[k] = 0;
+				this->cno_sum[k] = 0;
+				this->cno_min[k] = UINT8_MAX;
+				this->cno_max[k] = 0;
+				this->pr_count[k] = 0;
+				this->pr_sum[k] = 0;
+				this->pr_min[k] = INT16_MAX;
+				this->pr_max[k] = INT16_MIN;
+			}
+			this->count[k]++;
+			this->cno_sum[k] += cno;
+			this->cno_min[k] = std::min(this->cno_min[k], cno);
+			this->cno_max[k] = std::max(this->cno_max[k], cno);
+			if(pr_used)
+			{
+				this->pr_count[k]++;
+				this->pr_sum[k] += prRes;
+				this->pr_min[k] = std::min(this->pr_min[k], prRes);
+				this->pr_max[k] = std::max(this->pr_max[k], prRes);
+			}
+		}
+	}
+}
+
+size_t ubx_sig_stats::signals() const
+{
+	return this->keys.size();
+}
+
+void ubx_sig_stats::signal(size_t slot, uint8_t &gnssId, uint8_t &svId, uint8_t &sigId) const
+{
+	uint16_t key = this->keys.at(slot);
+	gnssId = key >> 12;
+	svId = (key >> 4) & 0xff;
+	sigId = key & 0x0f;
+}
+
+size_t ubx_sig_stats::windows() const
+{
+	return this->window_len.size();
+}
+
+uint32_t ubx_sig_stats::window_ms(size_t window) const
+{
+	return this->window_len.at(window);
+}
+
+bool ubx_sig_stats::rolled(size_t window) const
+{
+	return this->new_window.at(window);
+}
+
+bool ubx_sig_stats::summary(size_t window, size_t slot, bool previous, ubx_sig_summary &out) const
+{
+	if(window >= this->window_len.size() || slot >= this->keys.size())
+	{
+		return false;
+	}
+	uint64_t id = this->current[window];
+	if(previous)
+	{
+		if(id == 0)
+		{
+			return false;
+		}
+		id--;
+	}
+	size_t k = (window * 2 + (id & 1)) * this->capacity + slot;
+	if(this->stamp[k] != id + 1)
+	{
+		return false;
+	}
+	out.start_ms = id * this->window_len[window];
+	out.epochs = this->count[k];
+	out.cno_min = this->cno_min[k];
+	out.cno_max = this->cno_max[k];
+	out.cno_mean = (float)this->cno_sum[k] / this->count[k];
+	out.pr_epochs = this->pr_count[k];
+	if(this->pr_count[k] != 0)
+	{
+		out.prRes_min = this->pr_min[k] * 0.1f;
+		out.prRes_max = this->pr_max[k] * 0.1f;
+		out.prRes_mean = this->pr_sum[k] * 0.1f / this->pr_count[k];
+	}
+	else
+	{
+		out.prRes_min = out.prRes_max = out.prRes_mean = 0;
+	}
+	return true;
+}
+
+void ubx_sig_stats::dump(FILE *fp, size_t window) const
+{
+	ubx_sig_summary sum;
+	bool header = false;
+	for(size_t s = 0; s < this->keys.size(); s++)
+	{
+		if(!summary(window, s, true, sum))
+		{
+			continue;
+		}
+		if(!header)
+		{
+			fprintf(fp, "NAV-SIG %u ms window from %llu ms: gnss/sv/sig epochs cno min/mean/max, prUsed prRes min/mean/max\n",
+				this->window_len[window], (unsigned long long)sum.start_ms);
+			header = true;
+		}
+		uint8_t gnssId, svId, sigId;
+		signal(s, gnssId, svId, sigId);
+		fprintf(fp, "%u/%3u/%2u %5u %2u/%4.1f/%2u %5u %6.1f/%6.1f/%6.1f\n", gnssId, svId, sigId,
+			sum.epochs, sum.cno_min, sum.cno_mean, sum.cno_max,
+			sum.pr_epochs, sum.prRes_min, sum.prRes_mean, sum.prRes_max);
+	}
+}
+
+} // namespace UBX
@@ -0,0 +1,83 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "ubx_nav.hpp"
+
+#pragma once
+
+namespace UBX
+{
+using std::vector;
+
+// gnssId < 8, sigId < 16 (anything else is ignored)
+constexpr size_t UBX_SIG_KEYS = 8 * 256 * 16;
+constexpr size_t UBX_SIG_DEFAULT_CAPACITY = 512;
+// NAV-SIG sigFlags: prUsed, prRes only means something if it's set
+constexpr uint16_t UBX_NAV_SIG_PR_USED = 0x0008;
+
+// Result of one signal over one window
+struct ubx_sig_summary
+{
+	uint64_t start_ms;	// window start, ms since the first GPS week seen
+	uint32_t epochs;	// epochs the signal was in
+	uint8_t cno_min;
+	uint8_t cno_max;
+	float cno_mean;
+	uint32_t pr_epochs;	// epochs with prUsed
+	float prRes_min;	// m
+	float prRes_max;
+	float prRes_mean;
+};
+
+// Streaming C/N0 & prRes min/mean/max of each (gnssId, svId, sigId) seen in NAV-SIG
+// Windows are fixed lengths of GPS time, several at once (e.g. 10 s, 1 min, 10 min),
+// aligned on the GPS week so they line up between runs.
+// All state is in flat arrays allocated up front: each window has two banks, the
+// current one and the one before, and a slot is reset when it's first touched in a
+// new window. An epoch is O(numSigs), nothing is swept at window boundaries.
+class ubx_sig_stats
+{
+public:
+	size_t dropped;	// signals ignored because there was no free slot
+
+	// windows in ms, capacity is the number of distinct signals kept
+	ubx_sig_stats(const vector<uint32_t> &windows, size_t capacity = UBX_SIG_DEFAULT_CAPACITY);
+	void update(const ubx_nav_sig &sig);
+	// Number of signals seen, slots are 0..signals() - 1
+	size_t signals() const;
+	void signal(size_t slot, uint8_t &gnssId, uint8_t &svId, uint8_t &sigId) const;
+	size_t windows() const;
+	uint32_t window_ms(size_t window) const;
+	// previous = false: the window in progress, true: the last complete one
+	// False if the signal wasn't in that window
+	bool summary(size_t window, size_t slot, bool previous, ubx_sig_summary &out) const;
+	// True once if the last update() started a new one of that window
+	bool rolled(size_t window) const;
+	// Last complete window, all signals
+	void dump(FILE *fp, size_t window) const;
+private:
+	vector<uint32_t> window_len;
+	size_t capacity;
+	vector<uint16_t> slot_of;	// key -> slot + 1
+	vector<uint16_t> keys;		// slot -> key
+	uint32_t last_itow;
+	uint64_t weeks;
+	vector<uint64_t> current;	// window -> id of the one in progress
+	vector<uint8_t> new_window;
+
+	// [(window * 2 + bank) * capacity + slot], bank = window id & 1
+	vector<uint64_t> stamp;	// window id + 1, 0 = never touched
+	vector<uint32_t> count;
+	vector<uint32_t> cno_sum;
+	vector<uint8_t> cno_min;
+	vector<uint8_t> cno_max;
+	vector<uint32_t> pr_count;
+	vector<int64_t> pr_sum;
+	vector<int16_t> pr_min;
+	vector<int16_t> pr_max;
+
+	size_t slot(const struct _ubx_nav_sig_data &sig);
+};
+
+} // namespace UBX
@@ -11,6 +11,11 @@ namespace UBX
 using std::vector;
 
 constexpr size_t UBX_NAV_PVT_SIZE = 92;
+constexpr size_t UBX_NAV_SIG_HEADER_SIZE = 8;
+constexpr size_t UBX_NAV_SIG_DATA_SIZE = 16;
+// numSigs is a U1, more than any receiver tracks
+constexpr size_t UBX_NAV_SIG_MAX_SIGS = 255;
+constexpr size_t UBX_TIM_TP_SIZE = 16;
 
 // UBX-NAV-PVT
 struct _ubx_nav_pvt
@@ -63,4 +68,15 @@ struct _ubx_nav_sig_data
 	uint8_t reserved1[4];
 } __attribute((packed));
 
+// UBX-TIM-TP, time of the next time pulse
+struct _ubx_tim_tp
+{
+	uint32_t towMS;	// ms
+	uint32_t towSubMS;	// 2^-32 ms
+	int32_t qErr;	// ps, quantization error of that pulse
+	uint16_t week;
+	uint8_t flags;
+	uint8_t refInfo;
+} __attribute((packed));
+
 } // namespace UBX
@@ -0,0 +1,84 @@
+#include "ubx.hpp"
+#include "ubx_tim.hpp"
+
+namespace UBX
+{
+ubx_tim_tp::ubx_tim_tp()
+{
+	clear();
+}
+
+ubx_tim_tp::ubx_tim_tp(const ubx_frame_view &frame)
+{
+	parse(frame);
+}
+
+void ubx_tim_tp::clear()
+{
+	memset(&this->data, 0, sizeof(this->data));
+	this->valid = false;
+}
+
+bool ubx_tim_tp::validate()
+{
+	if(data.towMS >= (86400 * 1000 * 7))
+	{
+		return false;
+	}
+	return true;
+}
+
+bool ubx_tim_tp::parse(const ubx_frame_view &frame)
+{
+	this->valid = false;
+	if(frame.valid == false)
+	{
+		return false;
+	}
+	if(frame.class_id != UBX_CLASS_TIM || frame.msg_id != UBX_TIM_TP)
+	{
+		return false; // ignore non TIM-TP frames
+	}
+	static_assert(sizeof(struct _ubx_tim_tp) == UBX_TIM_TP_SIZE, "TIM-TP size");
+	if(frame.length != sizeof(this->data))
+	{
+		return false;
+	}
+	memcpy(&this->data, frame.payload(), sizeof(this->data));
+	// Endianness conversion
+	data.towMS = le32toh(data.towMS);
+	data.towSubMS = le32toh(data.towSubMS);
+	data.qErr = le32toh(data.qErr);
+	data.week = le16toh(data.week);
+	if(validate())
+	{
+		this->valid = true;
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+void ubx_tim_tp::dump(FILE *fp)
+{
+	fputs("=====================\n", fp);
+	fprintf(fp, "week: %u, towMS: %u, towSubMS: %u\n", data.week, data.towMS, data.towSubMS);
+	fprintf(fp, "qErr: %d ps%s\n", data.qErr, qerr_valid() ? "" : " (invalid)");
+	fprintf(fp, "flags: %02x, refInfo: %02x\n", data.flags, data.refInfo);
+}
+
+int64_t ubx_tim_tp::get_pulse_ns() const
+{
+	// towSubMS is a fraction of a ms in 2^-32 units
+	int64_t sub_ns = ((uint64_t)data.towSubMS * 1000000) >> 32;
+	return ((int64_t)data.week * 604800000 + data.towMS) * 1000000 + sub_ns;
+}
+
+bool ubx_tim_tp::qerr_valid() const
+{
+	return (data.flags & UBX_TIM_TP_QERR_INVALID) == 0;
+}
+
+} // namespace UBX
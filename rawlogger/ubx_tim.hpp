@@ -0,0 +1,30 @@
+#include "ubx_def.hpp"
+#include "ubx_struct.hpp"
+
+#pragma once
+
+namespace UBX
+{
+// flags bitfield of TIM-TP
+constexpr uint8_t UBX_TIM_TP_UTC	= 0x01;	// time base is UTC, GNSS otherwise
+constexpr uint8_t UBX_TIM_TP_UTC_AVAIL	= 0x02;
+constexpr uint8_t UBX_TIM_TP_QERR_INVALID	= 0x10;
+
+class ubx_tim_tp : public ubx_any_msg
+{
+public:
+	struct _ubx_tim_tp data;
+	bool valid;
+
+	ubx_tim_tp();
+	ubx_tim_tp(const ubx_frame_view &frame);
+	bool parse(const ubx_frame_view &frame);
+	void clear();
+	void dump(FILE *fp);
+	// ns since the start of week 0, in the time base of flags
+	int64_t get_pulse_ns() const;
+	bool qerr_valid() const;
+private:
+	bool validate();
+};
+}
@@ -0,0 +1,470 @@
+#include "ubx.hpp"
+#include "ubx_writer.hpp"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+namespace UBX
+{
+
+static const uint8_t ubx_sync[2] = {UBX_SYNC1, UBX_SYNC2};
+
+ubx_writer::ubx_writer(size_t bufsize)
+{
+	void *ptr = NULL;
+	if(posix_memalign(&ptr, UBX_WRITER_ALIGN, bufsize) != 0)
+	{
+		perror("ubx_writer::ubx_writer()");
+		abort();
+	}
+	this->buf = (uint8_t *)ptr;
+	this->bufsize = bufsize;
+	this->used = 0;
+	this->fd = -1;
+	this->raw_pos = 0;
+	this->file_pos = 0;
+	this->epoch_raw_start = 0;
+	this->frame_raw_start = 0;
+	this->frame_file_start = 0;
+	this->compressor = NULL;
+	this->epochs_per_frame = 0;
+	this->epochs_in_frame = 0;
+	this->bytes_written = 0;
+	this->syscalls = 0;
+	this->commits = 0;
+}
+
+ubx_writer::~ubx_writer()
+{
+	if(is_open())
+	{
+		close();
+	}
+	delete this->compressor;
+	free(this->buf);
+}
+
+void ubx_writer::set_compression(ubx_compression type, int level, size_t epochs_per_frame)
+{
+	delete this->compressor;
+	this->compressor = NULL;
+	if(type != UBX_COMPRESS_NONE)
+	{
+		this->compressor = new ubx_compressor(type, level);
+	}
+	this->epochs_per_frame = epochs_per_frame > 0 ? epochs_per_frame : 1;
+	this->epochs_in_frame = 0;
+}
+
+// Closes the previous file (after writing out what's buffered)
+int ubx_writer::open(const char *path)
+{
+	if(is_open() && close() != 0)
+	{
+		return -1;
+	}
+	this->fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(this->fd < 0)
+	{
+		return -1;
+	}
+	this->raw_pos = 0;
+	this->file_pos = 0;
+	this->epoch_raw_start = 0;
+	this->frame_raw_start = 0;
+	this->frame_file_start = 0;
+	return 0;
+}
+
+int ubx_writer::close()
+{
+	if(!is_open())
+	{
+		return 0;
+	}
+	int ret = commit();
+	if(ret == 0 && this->compressor != NULL)
+	{
+		// Finish the last frame, so the whole file can be decoded
+		this->epochs_in_frame = 0;
+		ret = this->compressor->end_frame(this->compressed);
+		if(ret == 0)
+		{
+			ret = write_compressed();
+		}
+	}
+	int saved_errno = errno;
+	if(::close(this->fd) != 0 && ret == 0)
+	{
+		ret = -1;
+		saved_errno = errno;
+	}
+	this->fd = -1;
+	this->used = 0;
+	errno = saved_errno;
+	return ret;
+}
+
+// Write all of iov, retrying on short writes
+int ubx_writer::writev_all(struct iovec *iov, int iovcnt)
+{
+	while(iovcnt > 0)
+	{
+		ssize_t ret = ::writev(this->fd, iov, iovcnt);
+		this->syscalls++;
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		this->bytes_written += ret;
+		this->file_pos += ret;
+		// Skip what's already written
+		while(iovcnt > 0 && (size_t)ret >= iov->iov_len)
+		{
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+int ubx_writer::write(const ubx_frame_view &frame)
+{
+	return write(frame.data, frame.size);
+}
+
+// frame without sync chars
+int ubx_writer::write(const uint8_t *frame, size_t frame_size)
+{
+	if(!is_open())
+	{
+		errno = EBADF;
+		return -1;
+	}
+	size_t size = sizeof(ubx_sync) + frame_size;
+	this->raw_pos += size;
+	if(this->used + size > this->bufsize && this->compressor != NULL)
+	{
+		// Epoch doesn't fit in the buffer, feed it to the compressor already
+		size_t used = this->used;
+		this->used = 0;
+		if(compress(this->buf, used) != 0 ||
+			compress(ubx_sync, sizeof(ubx_sync)) != 0 ||
+			compress(frame, frame_size) != 0)
+		{
+			return -1;
+		}
+		return 0;
+	}
+	if(this->used + size > this->bufsize)
+	{
+		// Epoch doesn't fit in the buffer, write everything out in one go
+		struct iovec iov[3] =
+		{
+			{this->buf, this->used},
+			{(void *)ubx_sync, sizeof(ubx_sync)},
+			{(void *)frame, frame_size}
+		};
+		this->used = 0;
+		return writev_all(iov, 3);
+	}
+	memcpy(this->buf + this->used, ubx_sync, sizeof(ubx_sync));
+	memcpy(this->buf + this->used + sizeof(ubx_sync), frame, frame_size);
+	this->used += size;
+	return 0;
+}
+
+// Write out everything buffered, called at the end of each epoch
+int ubx_writer::commit()
+{
+	if(this->used == 0 && this->compressed.empty())
+	{
+		return 0;
+	}
+	if(!is_open())
+	{
+		errno = EBADF;
+		return -1;
+	}
+	this->commits++;
+	this->epoch_raw_start = this->raw_pos;
+	if(this->compressor != NULL)
+	{
+		size_t used = this->used;
+		this->used = 0;
+		if(compress(this->buf, used) != 0)
+		{
+			return -1;
+		}
+		bool frame_done = false;
+		if(++this->epochs_in_frame >= this->epochs_per_frame)
+		{
+			this->epochs_in_frame = 0;
+			if(this->compressor->end_frame(this->compressed) != 0)
+			{
+				return -1;
+			}
+			frame_done = true;
+		}
+		if(write_compressed() != 0)
+		{
+			return -1;
+		}
+		if(frame_done)
+		{
+			// Next epoch starts a new frame right here
+			this->frame_raw_start = this->raw_pos;
+			this->frame_file_start = this->file_pos;
+		}
+		return 0;
+	}
+	struct iovec iov = {this->buf, this->used};
+	this->used = 0;
+	return writev_all(&iov, 1);
+}
+
+int ubx_writer::compress(const uint8_t *data, size_t size)
+{
+	return this->compressor->update(data, size, this->compressed);
+}
+
+// Write out whatever the compressor produced so far
+int ubx_writer::write_compressed()
+{
+	if(this->compressed.empty())
+	{
+		return 0;
+	}
+	struct iovec iov = {this->compressed.data(), this->compressed.size()};
+	int ret = writev_all(&iov, 1);
+	this->compressed.clear();
+	return ret;
+}
+
+// Throw away the buffered (incomplete) epoch
+void ubx_writer::discard()
+{
+	this->raw_pos -= this->used;
+	this->used = 0;
+	// Whatever was already written through stays, the next epoch starts after it
+	this->epoch_raw_start = this->raw_pos;
+}
+
+void ubx_writer::epoch_position(ubx_index_record &rec) const
+{
+	rec.raw_offset = this->epoch_raw_start;
+	if(this->compressor != NULL)
+	{
+		rec.file_offset = this->frame_file_start;
+		rec.skip = this->epoch_raw_start - this->frame_raw_start;
+	}
+	else
+	{
+		rec.file_offset = this->epoch_raw_start;
+		rec.skip = 0;
+	}
+}
+
+void ubx_writer::dump_stats(FILE *fp)
+{
+	fprintf(fp, "Wrote %zd Bytes in %zd commits, %zd write calls\n",
+		this->bytes_written, this->commits, this->syscalls);
+	if(this->compressor != NULL)
+	{
+		this->compressor->dump_stats(fp);
+	}
+}
+
+ubx_writer_thread::ubx_writer_thread(size_t ring_size, ubx_ring_policy policy) : ring(ring_size, policy), write_latency("write")
+{
+	this->compression = UBX_COMPRESS_NONE;
+	this->err = 0;
+	this->bytes_written = 0;
+	this->files_opened = 0;
+}
+
+ubx_writer_thread::~ubx_writer_thread()
+{
+	stop();
+}
+
+void ubx_writer_thread::set_compression(ubx_compression type, int level, size_t epochs_per_frame)
+{
+	this->writer.set_compression(type, level, epochs_per_frame);
+	this->compression = type;
+}
+
+void ubx_writer_thread::start()
+{
+	this->thread = std::thread(&ubx_writer_thread::run, this);
+}
+
+void ubx_writer_thread::stop()
+{
+	if(!this->thread.joinable())
+	{
+		return;
+	}
+	this->ring.push_stop();
+	this->thread.join();
+}
+
+// Only the first error is kept, the thread keeps draining the ring
+// so the reader never gets stuck on it
+void ubx_writer_thread::fail(const char *what)
+{
+	int e = errno;
+	fprintf(stderr, "\n%s: %s\n", what, strerror(e));
+	int expected = 0;
+	this->err.compare_exchange_strong(expected, e);
+}
+
+// Open a new file, creating its directory if needed
+int ubx_writer_thread::open(const char *path)
+{
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s", path);
+	dirname(dir);
+	if(mkdir(dir, 0755) == 0)
+	{
+		fprintf(stderr, "\nCreated directory %s\n", dir);
+	}
+	else if(errno != EEXIST)
+	{
+		fail(dir);
+		return -1;
+	}
+	if(close() != 0)
+	{
+		fail("Write error");
+		return -1;
+	}
+	if(this->writer.open(path) != 0)
+	{
+		fail(path);
+		return -1;
+	}
+	fprintf(stderr, "\nOpened file %s\n", path);
+	this->files_opened.store(this->files_opened.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	// A missing index only costs seeking, keep logging without it
+	char index_path[PATH_MAX];
+	snprintf(index_path, sizeof(index_path), "%s%s", path, UBX_INDEX_SUFFIX);
+	if(this->index.open(index_path, this->compression) != 0)
+	{
+		perror(index_path);
+		this->index.close();
+	}
+	return 0;
+}
+
+int ubx_writer_thread::close()
+{
+	int ret = this->writer.close();
+	if(this->index.close() != 0)
+	{
+		perror("ubx_writer_thread::close()");
+	}
+	return ret;
+}
+
+// Write out the epoch & add it to the index
+void ubx_writer_thread::end_epoch(const ubx_epoch_info &info)
+{
+	if(!this->writer.is_open())
+	{
+		return;
+	}
+	ubx_index_record rec;
+	this->writer.epoch_position(rec);
+	bool empty = this->writer.empty_epoch();
+	if(this->writer.commit() != 0)
+	{
+		fail("Write error");
+		return;
+	}
+	this->bytes_written.store(this->writer.bytes_written, std::memory_order_relaxed);
+	if(info.arrival_ns != 0)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		this->write_latency.record(now.tv_sec * 1000000000LL + now.tv_nsec - info.arrival_ns);
+	}
+	if(this->index.is_open() && !empty)
+	{
+		rec.iTOW = info.iTOW;
+		rec.utc_ms = info.utc_ms;
+		if(this->index.add_epoch(rec) != 0)
+		{
+			perror("ubx_writer_thread::end_epoch()");
+			this->index.close();
+		}
+	}
+}
+
+void ubx_writer_thread::run()
+{
+	while(1)
+	{
+		const ubx_ring_record *rec = this->ring.pop_wait();
+		switch(rec->type)
+		{
+		case UBX_RING_FRAME:
+			// Frames before the first file is opened are not logged
+			if(!this->writer.is_open())
+			{
+				break;
+			}
+			if(this->writer.write(rec->data(), rec->size) != 0)
+			{
+				fail("Write error");
+			}
+			this->index.count(rec->data()[UBX_CLASS_OFFSET], rec->data()[UBX_MSG_OFFSET]);
+			break;
+		case UBX_RING_EPOCH_END:
+		{
+			ubx_epoch_info info;
+			memcpy(&info, rec->data(), sizeof(info));
+			end_epoch(info);
+			break;
+		}
+		case UBX_RING_EPOCH_ABORT:
+			this->writer.discard();
+			this->index.discard();
+			break;
+		case UBX_RING_OPEN:
+			open((const char *)rec->data());
+			break;
+		case UBX_RING_STOP:
+			if(close() != 0)
+			{
+				fail("Write error");
+			}
+			this->bytes_written.store(this->writer.bytes_written, std::memory_order_relaxed);
+			this->ring.pop_release(rec);
+			return;
+		}
+		this->ring.pop_release(rec);
+	}
+}
+
+void ubx_writer_thread::dump_stats(FILE *fp)
+{
+	this->ring.dump_stats(fp);
+	this->writer.dump_stats(fp);
+}
+
+} // namespace UBX
@@ -0,0 +1,122 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <thread>
+#include "ubx_def.hpp"
+#include "ubx_ring.hpp"
+#include "ubx_compress.hpp"
+#include "ubx_index.hpp"
+#include "ubx_histogram.hpp"
+
+#pragma once
+
+namespace UBX
+{
+// Output buffer size, a few seconds worth of RAWX + SFRBX at 10 Hz
+constexpr size_t UBX_WRITER_BUFSIZE = 1024 * 1024;
+constexpr size_t UBX_WRITER_ALIGN = 4096;
+
+// Buffered frame writer
+// Frames are copied into a large aligned buffer, which only goes to the file
+// on commit() (at epoch boundaries), so the file never ends with half an epoch.
+// An epoch larger than the whole buffer is written through with writev(2).
+// With compression, each commit() is fed to the compressor, and a compressed
+// frame is finished every epochs_per_frame epochs (and on close), so a crash
+// only loses the last, unfinished frame.
+// epoch_position() tells where each epoch lands, for the index sidecar.
+// All functions return 0 on success, -1 with errno set on error.
+class ubx_writer
+{
+public:
+	// Statistics
+	size_t bytes_written;
+	size_t syscalls;
+	size_t commits;
+
+	ubx_writer(size_t bufsize = UBX_WRITER_BUFSIZE);
+	~ubx_writer();
+	void set_compression(ubx_compression type, int level, size_t epochs_per_frame);
+	int open(const char *path);
+	int close();
+	bool is_open() const
+	{
+		return this->fd >= 0;
+	}
+	int write(const ubx_frame_view &frame);
+	int write(const uint8_t *frame, size_t size);
+	int commit();
+	void discard();
+	// Where the current epoch starts, call before commit()
+	void epoch_position(ubx_index_record &rec) const;
+	bool empty_epoch() const
+	{
+		return this->raw_pos == this->epoch_raw_start;
+	}
+	void dump_stats(FILE *fp);
+private:
+	int fd;
+	uint8_t *buf;
+	size_t bufsize;
+	size_t used;
+	// Positions in the current file, uncompressed (raw) and on disk
+	uint64_t raw_pos;
+	uint64_t file_pos;
+	uint64_t epoch_raw_start;
+	uint64_t frame_raw_start;	// where the current compressed frame starts
+	uint64_t frame_file_start;
+	ubx_compressor *compressor;
+	vector<uint8_t> compressed;
+	size_t epochs_per_frame;
+	size_t epochs_in_frame;
+
+	int compress(const uint8_t *data, size_t size);
+	int write_compressed();
+	int writev_all(struct iovec *iov, int iovcnt);
+
+	ubx_writer(const ubx_writer &) = delete;
+	ubx_writer &operator=(const ubx_writer &) = delete;
+};
+
+// Disk writer thread, fed by the reader through a ubx_ring
+// so SD card stalls don't hold up reading the UART.
+// Each file gets an epoch index next to it, see ubx_index.hpp.
+class ubx_writer_thread
+{
+public:
+	ubx_ring ring;
+	// From NAV-EOE being read to its epoch written out, recorded by the thread
+	ubx_histogram write_latency;
+	// Statistics, written by the thread
+	std::atomic<size_t> bytes_written;	// to disk, after compression
+	std::atomic<size_t> files_opened;
+
+	ubx_writer_thread(size_t ring_size = UBX_RING_DEFAULT_SIZE, ubx_ring_policy policy = UBX_RING_DROP_LOW_PRIORITY);
+	~ubx_writer_thread();
+	// Must be called before start()
+	void set_compression(ubx_compression type, int level, size_t epochs_per_frame);
+	void start();
+	// Writes out everything still in the ring, then waits for the thread to exit
+	void stop();
+	// errno of the first failure, 0 if none
+	int error() const
+	{
+		return this->err.load(std::memory_order_relaxed);
+	}
+	void dump_stats(FILE *fp);
+private:
+	ubx_writer writer;
+	ubx_index_writer index;
+	ubx_compression compression;
+	std::thread thread;
+	std::atomic<int> err;
+
+	void run();
+	int open(const char *path);
+	int close();
+	void end_epoch(const ubx_epoch_info &info);
+	void fail(const char *what);
+};
+
+} // namespace UBX
@@ -0,0 +1,397 @@
+/* ===================================== *
+ * ubxbatch.cpp - UBX archive statistics *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_compress.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+using namespace UBX;
+using std::pair;
+
+/* iTOW wraps around at the end of the GPS week */
+constexpr uint32_t WEEK_MS = 7 * 24 * 3600 * 1000;
+
+struct file_stats
+{
+	string path;
+	size_t size;		/* on disk */
+	bool failed;
+	size_t bytes;		/* after decompression */
+	size_t frames;
+	size_t invalid;
+	size_t wasted;
+	size_t epochs;
+	size_t gaps;
+	uint64_t gap_ms;
+	uint32_t interval;	/* usual epoch interval in ms */
+	vector<pair<uint16_t, uint64_t>> types;	/* (class_id << 8 | msg_id, count) */
+};
+
+/* Files to do, one queue per thread, the others steal from its back */
+struct work_queue
+{
+	std::mutex lock;
+	std::deque<size_t> jobs;
+};
+
+static bool is_ubx_name(const char *name)
+{
+	size_t len = strlen(name);
+	for(const char *suffix : {".ubx", ".ubx.xz", ".ubx.zst"})
+	{
+		size_t n = strlen(suffix);
+		if(len > n && strcmp(name + len - n, suffix) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void find_files(const string &path, vector<string> &files)
+{
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0)
+	{
+		perror(path.c_str());
+		return;
+	}
+	if(!S_ISDIR(st.st_mode))
+	{
+		files.push_back(path);
+		return;
+	}
+	DIR *dir = opendir(path.c_str());
+	if(dir == NULL)
+	{
+		perror(path.c_str());
+		return;
+	}
+	struct dirent *ent;
+	while((ent = readdir(dir)) != NULL)
+	{
+		if(ent->d_name[0] == '.')
+		{
+			continue;
+		}
+		string sub = path + "/" + ent->d_name;
+		if(ent->d_type == DT_DIR || (ent->d_type == DT_UNKNOWN && stat(sub.c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+		{
+			find_files(sub, files);
+		}
+		else if(is_ubx_name(ent->d_name))
+		{
+			files.push_back(sub);
+		}
+	}
+	closedir(dir);
+}
+
+/* Epochs further apart than 1.5 intervals are gaps, the interval being the median one */
+static void find_gaps(vector<uint32_t> &itows, file_stats &st)
+{
+	vector<uint32_t> deltas;
+	for(size_t i = 1; i < itows.size(); i++)
+	{
+		uint32_t delta = (itows[i] + WEEK_MS - itows[i - 1]) % WEEK_MS;
+		if(delta != 0)
+		{
+			deltas.push_back(delta);
+		}
+	}
+	if(deltas.empty())
+	{
+		return;
+	}
+	vector<uint32_t> sorted = deltas;
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+	st.interval = sorted[sorted.size() / 2];
+	for(uint32_t delta : deltas)
+	{
+		if(delta > st.interval + st.interval / 2)
+		{
+			st.gaps++;
+			st.gap_ms += delta - st.interval;
+		}
+	}
+}
+
+/* counts is scratch space, 65536 entries */
+static void process_file(file_stats &st, vector<uint64_t> &counts)
+{
+	int fd = open(st.path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		perror(st.path.c_str());
+		st.failed = true;
+		return;
+	}
+	struct stat sb;
+	if(fstat(fd, &sb) == 0)
+	{
+		st.size = sb.st_size;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	std::fill(counts.begin(), counts.end(), 0);
+	vector<uint32_t> itows;
+	{
+		ubx_decompressor decompressor(fd, ubx_compression_from_name(st.path.c_str()));
+		ubx_reader reader(&decompressor);
+		reader.quiet = true;
+		const uint8_t *frame;
+		size_t size;
+		while(reader.next_frame(&frame, &size) != EOF)
+		{
+			uint8_t class_id = frame[UBX_CLASS_OFFSET];
+			uint8_t msg_id = frame[UBX_MSG_OFFSET];
+			counts[class_id << 8 | msg_id]++;
+			if(class_id == UBX_CLASS_NAV && msg_id == UBX_NAV_EOE && size == UBX_HEADER_SIZE + 4 + UBX_CKSUM_SIZE)
+			{
+				itows.push_back(getu4(frame + UBX_HEADER_SIZE, 0));
+			}
+		}
+		st.frames = reader.frames;
+		st.invalid = reader.bad_checksums;
+		st.wasted = reader.wasted_bytes;
+		st.bytes = reader.bytes_read;
+		/* The reader takes both for the end of the file */
+		if(decompressor.truncated || decompressor.error != 0)
+		{
+			fprintf(stderr, "%s: %s\n", st.path.c_str(), decompressor.truncated ? "truncated" : strerror(decompressor.error));
+			st.failed = true;
+		}
+	}
+	close(fd);
+
+	for(size_t key = 0; key < counts.size(); key++)
+	{
+		if(counts[key] != 0)
+		{
+			st.types.emplace_back(key, counts[key]);
+		}
+	}
+	st.epochs = itows.size();
+	find_gaps(itows, st);
+}
+
+static void worker(unsigned id, vector<work_queue> &queues, vector<file_stats> &stats, std::atomic<size_t> &steals)
+{
+	vector<uint64_t> counts(256 * 256);
+	size_t n = queues.size();
+	while(1)
+	{
+		size_t job = SIZE_MAX;
+		{
+			std::lock_guard<std::mutex> lk(queues[id].lock);
+			if(!queues[id].jobs.empty())
+			{
+				job = queues[id].jobs.front();
+				queues[id].jobs.pop_front();
+			}
+		}
+		/* Own queue is done, help the others from the small end of theirs */
+		for(size_t k = 1; k < n && job == SIZE_MAX; k++)
+		{
+			work_queue &victim = queues[(id + k) % n];
+			std::lock_guard<std::mutex> lk(victim.lock);
+			if(!victim.jobs.empty())
+			{
+				job = victim.jobs.back();
+				victim.jobs.pop_back();
+				steals++;
+			}
+		}
+		if(job == SIZE_MAX)
+		{
+			return;
+		}
+		process_file(stats[job], counts);
+	}
+}
+
+static void print_stats(const file_stats &st, const char *name)
+{
+	printf("%s\t%zd\t%zd\t%zd\t%zd\t%zd\t%zd\t%zd\t%llu\t%u\n", name,
+		st.size, st.bytes, st.frames, st.invalid, st.wasted,
+		st.epochs, st.gaps, (unsigned long long)st.gap_ms, st.interval);
+}
+
+static void print_types(const vector<pair<uint16_t, uint64_t>> &types, const char *name)
+{
+	char buf[UBX_MSG_NAME_MAX];
+	for(const auto &type : types)
+	{
+		printf("%s\tUBX-%s\t%llu\n", name, ubx_msg_name(type.first >> 8, type.first & 0xff, buf, sizeof(buf)),
+			(unsigned long long)type.second);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned threads = 0;
+	bool per_file_types = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "j:m")) != -1)
+	{
+		switch(opt)
+		{
+		case 'j':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			per_file_types = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-j threads] [-m] dir|file|'glob' ...\n"
+				"\tStatistics of .ubx, .ubx.xz & .ubx.zst files, directories are searched recursively\n"
+				"\t-m also lists message counts per file\n", argv[0]);
+			return 1;
+		}
+	}
+	if(threads == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	vector<string> files;
+	for(int i = optind; i < argc; i++)
+	{
+		if(strpbrk(argv[i], "*?[") == NULL)
+		{
+			find_files(argv[i], files);
+			continue;
+		}
+		glob_t g;
+		if(glob(argv[i], 0, NULL, &g) == 0)
+		{
+			for(size_t j = 0; j < g.gl_pathc; j++)
+			{
+				find_files(g.gl_pathv[j], files);
+			}
+		}
+		globfree(&g);
+	}
+	std::sort(files.begin(), files.end());
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+	if(files.empty())
+	{
+		fputs("No files\n", stderr);
+		return 1;
+	}
+
+	vector<file_stats> stats(files.size());
+	vector<size_t> order(files.size());
+	for(size_t i = 0; i < files.size(); i++)
+	{
+		file_stats &st = stats[i];
+		st.path = files[i];
+		st.size = 0;
+		st.failed = false;
+		st.bytes = st.frames = st.invalid = st.wasted = st.epochs = st.gaps = 0;
+		st.gap_ms = 0;
+		st.interval = 0;
+		struct stat sb;
+		if(stat(files[i].c_str(), &sb) == 0)
+		{
+			st.size = sb.st_size;
+		}
+		order[i] = i;
+	}
+	/* Biggest files first, so no thread is left with a big one at the end */
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{
+		return stats[a].size > stats[b].size;
+	});
+	if(threads > files.size())
+	{
+		threads = files.size();
+	}
+	vector<work_queue> queues(threads);
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		queues[i % threads].jobs.push_back(order[i]);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	std::atomic<size_t> steals(0);
+	vector<std::thread> pool;
+	for(unsigned i = 0; i < threads; i++)
+	{
+		pool.emplace_back(worker, i, std::ref(queues), std::ref(stats), std::ref(steals));
+	}
+	for(std::thread &t : pool)
+	{
+		t.join();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	/* Per file, in name order, then the totals */
+	file_stats total = file_stats();
+	vector<uint64_t> counts(256 * 256);
+	size_t failed = 0;
+	puts("# file\tsize\tbytes\tframes\tinvalid\twasted\tepochs\tgaps\tgap_ms\tinterval_ms");
+	for(const file_stats &st : stats)
+	{
+		if(st.failed)
+		{
+			failed++;
+			continue;
+		}
+		print_stats(st, st.path.c_str());
+		total.size += st.size;
+		total.bytes += st.bytes;
+		total.frames += st.frames;
+		total.invalid += st.invalid;
+		total.wasted += st.wasted;
+		total.epochs += st.epochs;
+		total.gaps += st.gaps;
+		total.gap_ms += st.gap_ms;
+		for(const auto &type : st.types)
+		{
+			counts[type.first] += type.second;
+		}
+	}
+	print_stats(total, "TOTAL");
+	for(size_t key = 0; key < counts.size(); key++)
+	{
+		if(counts[key] != 0)
+		{
+			total.types.emplace_back(key, counts[key]);
+		}
+	}
+	puts("# file\tmessage\tcount");
+	if(per_file_types)
+	{
+		for(const file_stats &st : stats)
+		{
+			print_types(st.types, st.path.c_str());
+		}
+	}
+	print_types(total.types, "TOTAL");
+
+	fprintf(stderr, "%zd files (%zd failed), %zd Bytes (%zd decompressed) in %.3f s with %u threads, %zd steals, %.1f MB/s\n",
+		stats.size(), failed, total.size, total.bytes, elapsed, threads, steals.load(),
+		elapsed > 0 ? total.bytes / elapsed / 1e6 : 0.0);
+	return failed > 0 ? 1 : 0;
+}
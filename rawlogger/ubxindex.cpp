@@ -0,0 +1,245 @@
+/* ===================================== *
+ * ubxindex.cpp - UBX epoch index tool	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_nav.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_index.hpp"
+#include "ubx_compress.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+
+using namespace UBX;
+
+/* The compressed frame an epoch's first Byte is in, *next is where to look
+ * from for the next one, epochs come in order */
+static int locate_epoch(const ubx_decompressor &decompressor, size_t *next, ubx_index_record &rec)
+{
+	if(decompressor.type == UBX_COMPRESS_NONE)
+	{
+		rec.file_offset = rec.raw_offset;
+		rec.skip = 0;
+		return 0;
+	}
+	const vector<ubx_frame_start> &starts = decompressor.frame_starts;
+	while(*next + 1 < starts.size() && starts[*next + 1].raw_offset <= rec.raw_offset)
+	{
+		(*next)++;
+	}
+	/* A file from xz -e is one frame, the skip has to fit */
+	uint64_t skip = starts.empty() ? rec.raw_offset : rec.raw_offset - starts[*next].raw_offset;
+	if(skip > UINT32_MAX)
+	{
+		errno = EOVERFLOW;
+		return -1;
+	}
+	rec.file_offset = starts.empty() ? 0 : starts[*next].file_offset;
+	rec.skip = skip;
+	return 0;
+}
+
+/* Rebuild the index of a .ubx, .ubx.xz or .ubx.zst file, e.g. one logged before indexing existed */
+static int build_index(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		perror(path);
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	ubx_compression type = ubx_compression_from_name(path);
+	char index_path[4096];
+	snprintf(index_path, sizeof(index_path), "%s%s", path, UBX_INDEX_SUFFIX);
+	ubx_index_writer index;
+	if(index.open(index_path, type) != 0)
+	{
+		perror(index_path);
+		close(fd);
+		return -1;
+	}
+
+	ubx_decompressor decompressor(fd, type);
+	decompressor.track_frames = true;
+	size_t next_start = 0;
+	ubx_reader reader(&decompressor);
+	ubx_nav_pvt pvt;
+	ubx_frame_view frame;
+	bool in_epoch = false;
+	ubx_index_record rec;
+	memset(&rec, 0, sizeof(rec));
+	int ret = 0;
+	while(reader.read_frame(frame) != EOF)
+	{
+		if(!frame.valid)
+		{
+			continue;
+		}
+		if(!in_epoch)
+		{
+			rec.raw_offset = reader.frame_offset;
+			if(locate_epoch(decompressor, &next_start, rec) != 0)
+			{
+				perror(path);
+				ret = -1;
+				break;
+			}
+			in_epoch = true;
+		}
+		index.count(frame.class_id, frame.msg_id);
+		if(frame.class_id != UBX_CLASS_NAV)
+		{
+			continue;
+		}
+		if(frame.msg_id == UBX_NAV_PVT)
+		{
+			pvt.parse(frame);
+		}
+		else if(frame.msg_id == UBX_NAV_EOE)
+		{
+			ubx_nav_eoe eoe(frame);
+			int64_t utc_ms;
+			if(pvt.data.iTOW != eoe.iTOW || !pvt.get_utc_ms(utc_ms))
+			{
+				utc_ms = UBX_INDEX_NO_UTC;
+			}
+			rec.iTOW = eoe.iTOW;
+			rec.utc_ms = utc_ms;
+			if(index.add_epoch(rec) != 0)
+			{
+				perror(index_path);
+				ret = -1;
+				break;
+			}
+			in_epoch = false;
+		}
+	}
+	close(fd);
+	if(index.close() != 0 && ret == 0)
+	{
+		perror(index_path);
+		ret = -1;
+	}
+	return ret;
+}
+
+/* Parse YYYY-MM-DDTHH:MM:SS[.sss] (UTC) into ms since 1970 */
+static bool parse_time(const char *str, int64_t &utc_ms)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	const char *end = strptime(str, "%Y-%m-%dT%H:%M:%S", &tm);
+	if(end == NULL)
+	{
+		return false;
+	}
+	unsigned ms = 0;
+	if(*end == '.')
+	{
+		char frac[4] = "000";
+		for(int i = 0; i < 3 && end[i + 1] >= '0' && end[i + 1] <= '9'; i++)
+		{
+			frac[i] = end[i + 1];
+		}
+		ms = atoi(frac);
+	}
+	utc_ms = (int64_t)timegm(&tm) * 1000 + ms;
+	return true;
+}
+
+static void print_epoch(const ubx_index &index, size_t i)
+{
+	if(i >= index.epochs.size())
+	{
+		puts("not found");
+		return;
+	}
+	const ubx_index_record &rec = index.epochs[i];
+	printf("epoch %zd: week %u iTOW %u, UTC %lld ms, raw offset %llu, file offset %llu + %u\n",
+		i, index.week(i), rec.iTOW, (long long)rec.utc_ms,
+		(unsigned long long)rec.raw_offset, (unsigned long long)rec.file_offset, rec.skip);
+}
+
+int main(int argc, char *argv[])
+{
+	bool dump = false;
+	const char *time_str = NULL;
+	long itow = -1;
+	long week = -1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "dt:i:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'd':
+			dump = true;
+			break;
+		case 't':
+			time_str = optarg;
+			break;
+		case 'i':
+			/* A week, or the first time that iTOW comes in the file */
+			if(sscanf(optarg, "%ld:%ld", &week, &itow) != 2)
+			{
+				week = -1;
+				itow = strtol(optarg, NULL, 10);
+			}
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-d | -t YYYY-MM-DDTHH:MM:SS[.sss] | -i [week:]iTOW_ms] file.ubx[.xz|.zst] ...\n"
+				"\tWithout options, (re)builds file.ubx%s\n", argv[0], UBX_INDEX_SUFFIX);
+			return 1;
+		}
+	}
+
+	int64_t utc_ms = 0;
+	if(time_str != NULL && !parse_time(time_str, utc_ms))
+	{
+		fprintf(stderr, "Bad time %s\n", time_str);
+		return 1;
+	}
+
+	int ret = 0;
+	for(int i = optind; i < argc; i++)
+	{
+		if(!dump && time_str == NULL && itow < 0)
+		{
+			if(build_index(argv[i]) != 0)
+			{
+				ret = 1;
+			}
+			continue;
+		}
+		char index_path[4096];
+		snprintf(index_path, sizeof(index_path), "%s%s", argv[i], UBX_INDEX_SUFFIX);
+		ubx_index index;
+		if(index.load(index_path) != 0)
+		{
+			perror(index_path);
+			ret = 1;
+			continue;
+		}
+		printf("%s: ", argv[i]);
+		if(dump)
+		{
+			index.dump(stdout);
+		}
+		if(time_str != NULL)
+		{
+			print_epoch(index, index.find_utc(utc_ms));
+		}
+		if(itow >= 0)
+		{
+			print_epoch(index, week >= 0 ? index.find_itow(week, itow) : index.find_itow(itow));
+		}
+	}
+	return ret;
+}
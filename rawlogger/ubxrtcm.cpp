@@ -0,0 +1,238 @@
+/* ===================================== *
+ * ubxrtcm.cpp - UBX to RTCM3 converter	 *
+ * ===================================== */
+
+#include "ubx.hpp"
+#include "ubx_rxm.hpp"
+#include "ubx_rtcm.hpp"
+#include "ubx_reader.hpp"
+#include "ubx_compress.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <memory>
+#include <map>
+
+using namespace UBX;
+
+/* RTCM3 frames of a capture, CRC checked */
+static int load_rtcm(const char *path, vector<vector<uint8_t>> &frames)
+{
+	FILE *fp = fopen(path, "re");
+	if(fp == NULL)
+	{
+		perror(path);
+		return -1;
+	}
+	vector<uint8_t> data;
+	uint8_t chunk[65536];
+	size_t n;
+	while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	{
+		data.insert(data.end(), chunk, chunk + n);
+	}
+	fclose(fp);
+	size_t pos = 0, skipped = 0;
+	while(pos + RTCM3_HEADER_SIZE + RTCM3_CRC_SIZE <= data.size())
+	{
+		if(data[pos] != RTCM3_PREAMBLE || (data[pos + 1] & 0xfc) != 0)
+		{
+			pos++;
+			skipped++;
+			continue;
+		}
+		size_t len = (data[pos + 1] & 0x03) << 8 | data[pos + 2];
+		size_t size = RTCM3_HEADER_SIZE + len + RTCM3_CRC_SIZE;
+		if(pos + size > data.size())
+		{
+			break;
+		}
+		const uint8_t *p = data.data() + pos;
+		uint32_t crc = p[size - 3] << 16 | p[size - 2] << 8 | p[size - 1];
+		if(rtcm_crc24q(p, size - RTCM3_CRC_SIZE) != crc)
+		{
+			pos++;
+			skipped++;
+			continue;
+		}
+		frames.emplace_back(p, p + size);
+		pos += size;
+	}
+	if(skipped != 0)
+	{
+		fprintf(stderr, "%s: skipped %zd Bytes\n", path, skipped);
+	}
+	return 0;
+}
+
+/* What a frame is compared against: the type, and the epoch for MSM */
+static uint64_t frame_key(const vector<uint8_t> &frame)
+{
+	uint16_t type = rtcm_msg_type(frame.data(), frame.size());
+	uint64_t key = (uint64_t)type << 32;
+	if(type >= 1071 && type <= 1137 && frame.size() >= 12)
+	{
+		/* 30 bit epoch after type & station ID */
+		const uint8_t *p = frame.data() + RTCM3_HEADER_SIZE;
+		uint32_t epoch = ((p[3] & 0x0f) << 26) | (p[4] << 18) | (p[5] << 10) | (p[6] << 2) | (p[7] >> 6);
+		key |= epoch;
+	}
+	return key;
+}
+
+/* First differing bit of the payload, -1 if the same */
+static long first_diff(const vector<uint8_t> &a, const vector<uint8_t> &b)
+{
+	size_t n = std::min(a.size(), b.size()) - RTCM3_CRC_SIZE;
+	for(size_t i = RTCM3_HEADER_SIZE; i < n; i++)
+	{
+		if(a[i] != b[i])
+		{
+			return (i - RTCM3_HEADER_SIZE) * 8 + __builtin_clz((a[i] ^ b[i]) << 24);
+		}
+	}
+	return a.size() == b.size() ? -1 : (long)(n - RTCM3_HEADER_SIZE) * 8;
+}
+
+/* Match each of ours with the capture's frame of the same type & epoch */
+static int compare(const vector<vector<uint8_t>> &ours, const vector<vector<uint8_t>> &theirs)
+{
+	std::multimap<uint64_t, size_t> index;
+	for(size_t i = 0; i < theirs.size(); i++)
+	{
+		index.emplace(frame_key(theirs[i]), i);
+	}
+	size_t same = 0, differ = 0, missing = 0;
+	std::map<uint16_t, size_t> differ_types;
+	for(const vector<uint8_t> &frame : ours)
+	{
+		auto it = index.find(frame_key(frame));
+		if(it == index.end())
+		{
+			missing++;
+			continue;
+		}
+		const vector<uint8_t> &other = theirs[it->second];
+		index.erase(it);
+		long bit = first_diff(frame, other);
+		if(bit < 0)
+		{
+			same++;
+			continue;
+		}
+		uint16_t type = rtcm_msg_type(frame.data(), frame.size());
+		if(differ_types[type]++ == 0)
+		{
+			fprintf(stderr, "%u: first difference at payload bit %ld (%zd vs %zd Bytes)\n",
+				type, bit, frame.size(), other.size());
+		}
+		differ++;
+	}
+	printf("%zd identical, %zd different, %zd not in capture, %zd only in capture\n",
+		same, differ, missing, index.size());
+	for(const auto &t : differ_types)
+	{
+		printf("%u: %zd different\n", t.first, t.second);
+	}
+	return differ == 0 && missing == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	ubx_rtcm_encoder encoder;
+	const char *capture = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "I:A:t:c:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'I':
+			encoder.station_id = strtoul(optarg, NULL, 10);
+			break;
+		case 'A':
+			if(sscanf(optarg, "%lf,%lf,%lf", &encoder.arp[0], &encoder.arp[1], &encoder.arp[2]) != 3)
+			{
+				fprintf(stderr, "Bad ARP %s\n", optarg);
+				return 1;
+			}
+			encoder.arp_valid = true;
+			break;
+		case 't':
+			encoder.tadj = atof(optarg);
+			break;
+		case 'c':
+			capture = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-I station_id] [-A x,y,z] [-t tadj_s] [-c capture.rtcm] file.ubx\n"
+				"\tWrites RTCM3 MSM7, 1005 & 1230 to stdout, or compares them with a capture,\n"
+				"\te.g. of str2str -opt -TADJ=1 on the same input\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind + 1 != argc)
+	{
+		fputs("One input file\n", stderr);
+		return 1;
+	}
+	const char *path = argv[optind];
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	ubx_decompressor decompressor(fd, ubx_compression_from_name(path));
+	ubx_reader reader(&decompressor);
+	reader.quiet = true;
+	/* ~8 KiB, not on the stack */
+	std::unique_ptr<ubx_rxm_rawx> rawx(new ubx_rxm_rawx());
+	vector<uint8_t> out;
+	vector<vector<uint8_t>> ours;
+	const uint8_t *frame;
+	size_t size;
+	while(reader.next_frame(&frame, &size) != EOF)
+	{
+		ubx_frame_view view(frame, size);
+		if(!rawx->parse(view))
+		{
+			continue;
+		}
+		out.clear();
+		encoder.encode(*rawx, out);
+		if(capture == NULL)
+		{
+			if(fwrite(out.data(), 1, out.size(), stdout) != out.size())
+			{
+				perror("stdout");
+				return 1;
+			}
+			continue;
+		}
+		/* Split into frames, the encoder only writes whole ones */
+		for(size_t pos = 0; pos < out.size(); )
+		{
+			size_t len = RTCM3_HEADER_SIZE + ((out[pos + 1] & 0x03) << 8 | out[pos + 2]) + RTCM3_CRC_SIZE;
+			ours.emplace_back(out.begin() + pos, out.begin() + pos + len);
+			pos += len;
+		}
+	}
+	close(fd);
+	encoder.dump_stats(stderr);
+	if(capture == NULL)
+	{
+		return 0;
+	}
+	vector<vector<uint8_t>> theirs;
+	if(load_rtcm(capture, theirs) != 0)
+	{
+		return 1;
+	}
+	return compare(ours, theirs);
+}
@@ -0,0 +1,128 @@
+/* ================================================= *
+ * ubxsockmon.cpp - chrony SOCK refclock stand-in	 *
+ * ================================================= */
+
+#include "ubx.hpp"
+#include "ubx_chrony.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+
+using namespace UBX;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int)
+{
+	stop = 1;
+}
+
+/* Binds the socket like chronyd does, so rawlogger -K can be measured without it */
+int main(int argc, char *argv[])
+{
+	size_t max_samples = 0;
+	bool quiet = false;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:q")) != -1)
+	{
+		switch(opt)
+		{
+		case 'n':
+			max_samples = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n samples] [-q] socket_path\n"
+				"\tReceives chrony SOCK refclock samples & measures their offset & jitter,\n"
+				"\tuntil -n samples or SIGINT\n", argv[0]);
+			return 1;
+		}
+	}
+	if(optind + 1 != argc)
+	{
+		fputs("One socket path\n", stderr);
+		return 1;
+	}
+	const char *path = argv[optind];
+
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(sa.sun_path))
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(ENAMETOOLONG));
+		return 1;
+	}
+	strcpy(sa.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	unlink(path);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	/* No SA_RESTART, recv() returns on them */
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = on_signal;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	ubx_offset_stats offsets;
+	size_t bad = 0;
+	while(!stop && (max_samples == 0 || offsets.count < max_samples))
+	{
+		struct chrony_sock_sample sample;
+		ssize_t len = recv(fd, &sample, sizeof(sample), 0);
+		if(len < 0)
+		{
+			if(errno != EINTR)
+			{
+				perror("recv");
+				break;
+			}
+			continue;
+		}
+		if(len != sizeof(sample) || sample.magic != CHRONY_SOCK_MAGIC)
+		{
+			bad++;
+			continue;
+		}
+		offsets.update(sample.offset);
+		if(!quiet)
+		{
+			struct tm tm;
+			gmtime_r(&sample.tv.tv_sec, &tm);
+			printf("%02d:%02d:%02d.%06ld offset %+.6f s%s%s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+				(long)sample.tv.tv_usec, sample.offset, sample.pulse ? " pulse" : "",
+				sample.leap == 1 ? " leap+" : sample.leap == 2 ? " leap-" : "");
+			fflush(stdout);
+		}
+	}
+	close(fd);
+	unlink(path);
+
+	printf("%zd samples, %zd bad\n", offsets.count, bad);
+	if(offsets.count == 0)
+	{
+		return 1;
+	}
+	printf("offset mean %+.6f s, stddev %.6f s, jitter %.6f s, min %+.6f s, max %+.6f s\n",
+		offsets.mean, offsets.stddev(), offsets.jitter(), offsets.min, offsets.max);
+	/* The refclock's offset option is added to each sample */
+	printf("refclock SOCK %s refid UBX precision %.0e offset %.4f\n",
+		path, std::max(offsets.stddev(), 1e-6), -offsets.mean);
+	return 0;
+}